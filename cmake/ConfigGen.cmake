@@ -56,6 +56,12 @@ function(caffe_generate_export_configs)
     list(APPEND Caffe_DEFINITIONS -DUSE_MKL)
   endif()
 
+  if(PARALLEL STREQUAL "OpenMP" OR PARALLEL STREQUAL "openmp")
+    list(APPEND Caffe_DEFINITIONS -DUSE_OPENMP)
+  elseif(PARALLEL STREQUAL "ThreadPool" OR PARALLEL STREQUAL "threadpool")
+    list(APPEND Caffe_DEFINITIONS -DUSE_THREAD_POOL)
+  endif()
+
   configure_file("cmake/Templates/CaffeConfig.cmake.in" "${PROJECT_BINARY_DIR}/CaffeConfig.cmake" @ONLY)
 
   # Add targets to the build-tree export set
@@ -91,6 +91,20 @@ elseif(APPLE)
   list(APPEND Caffe_LINKER_LIBS ${vecLib_LINKER_LIBS})
 endif()
 
+# ---[ Threading backend of caffe::parallel_for
+set(PARALLEL "ThreadPool" CACHE STRING "Selected threading backend")
+set_property(CACHE PARALLEL PROPERTY STRINGS "ThreadPool;OpenMP;Serial")
+
+if(PARALLEL STREQUAL "OpenMP" OR PARALLEL STREQUAL "openmp")
+  find_package(OpenMP REQUIRED)
+  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${OpenMP_CXX_FLAGS}")
+  add_definitions(-DUSE_OPENMP)
+elseif(PARALLEL STREQUAL "ThreadPool" OR PARALLEL STREQUAL "threadpool")
+  add_definitions(-DUSE_THREAD_POOL)
+elseif(NOT PARALLEL STREQUAL "Serial" AND NOT PARALLEL STREQUAL "serial")
+  message(FATAL_ERROR "PARALLEL must be one of ThreadPool, OpenMP or Serial")
+endif()
+
 # ---[ Python
 if(BUILD_python)
   if(NOT "${python_version}" VERSION_LESS "3.0.0")
@@ -25,7 +25,7 @@ template <typename Dtype>
 class Blob {
  public:
   Blob()
-       : data_(), diff_(), count_(0), capacity_(0) {}
+       : data_(), diff_(), count_(0), capacity_(0), layout_(NCHW) {}
 
   /// @brief Deprecated; use <code>Blob(const vector<int>& shape)</code>.
   explicit Blob(const int num, const int channels, const int height,
@@ -180,6 +180,19 @@ class Blob {
     }
     return offset;
   }
+
+  /**
+   * @brief Returns the memory layout of the data (and diff).
+   *
+   * The shape and the offset() helpers always describe the logical NCHW
+   * blob; with a blocked layout (see BlobLayout) the channels of each image
+   * are stored in interleaved groups instead. Layers that produce a top set
+   * its layout in Reshape; ShareData and Reshape leave it untouched.
+   */
+  inline BlobLayout layout() const { return layout_; }
+  /// @brief Sets the layout; blocked layouts need 4 axes and a multiple of
+  ///        the block size in channels.
+  void set_layout(const BlobLayout layout);
   /**
    * @brief Copy from a source Blob.
    *
@@ -274,6 +287,7 @@ class Blob {
   vector<int> shape_;
   int count_;
   int capacity_;
+  BlobLayout layout_;
 
   DISABLE_COPY_AND_ASSIGN(Blob);
 };  // class Blob
@@ -90,6 +90,9 @@ using std::string;
 using std::stringstream;
 using std::vector;
 
+class HostAllocator;
+class ThreadPool;
+
 // A global initialization function that you should call in your main function.
 // Currently it initializes google flags and google logging.
 void GlobalInit(int* pargc, char*** pargv);
@@ -151,6 +154,37 @@ class Caffe {
   // Prints the current GPU status.
   static void DeviceQuery();
 
+  // The pool CPU work is spread over (see util/parallel.hpp). It is started
+  // on first use with the settings below; changing them restarts it, so they
+  // must not be changed while parallel work is running.
+  static ThreadPool& thread_pool();
+  // Sets the number of threads, counting the calling one; 0 restores the
+  // default.
+  static void set_num_threads(const int num_threads);
+  inline static int requested_num_threads() { return Get().num_threads_; }
+  // Binds each pool thread to one core of the given NUMA nodes (all nodes if
+  // numa_nodes is empty), splitting the threads evenly between the nodes.
+  static void set_thread_affinity(const bool pin_threads,
+      const vector<int>& numa_nodes);
+  // The allocator of host memory for blobs (see util/host_allocator.hpp),
+  // shared by all threads and never destroyed. Its settings and statistics
+  // are set and read through it.
+  static HostAllocator& host_allocator();
+  // The number of workers of data-parallel training (see
+  // Solver::set_transport) and the rank of this process among them. The Data
+  // and ImageData layers of TRAIN nets load batch_size / solver_count()
+  // images per batch, reading every solver_count()-th record, starting at
+  // record solver_rank(). HDF5Data, WindowData and MemoryData do not shard
+  // their data and refuse to run in TRAIN nets with several workers.
+  inline static int solver_count() { return Get().solver_count_; }
+  inline static int solver_rank() { return Get().solver_rank_; }
+  inline static void set_solver_count(const int count) {
+    Get().solver_count_ = count;
+  }
+  inline static void set_solver_rank(const int rank) {
+    Get().solver_rank_ = rank;
+  }
+
  protected:
 #ifndef CPU_ONLY
   cublasHandle_t cublas_handle_;
@@ -159,6 +193,12 @@ class Caffe {
   shared_ptr<RNG> random_generator_;
 
   Brew mode_;
+  int num_threads_;
+  bool pin_threads_;
+  vector<int> numa_nodes_;
+  shared_ptr<ThreadPool> thread_pool_;
+  int solver_count_;
+  int solver_rank_;
   static shared_ptr<Caffe> singleton_;
 
  private:
@@ -203,6 +203,10 @@ class FlattenLayer : public Layer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
+  virtual inline int ForwardSharedBottom(const int top_index) const {
+    return 0;
+  }
+
  protected:
   /**
    * @param bottom input Blob vector (length 2+)
@@ -262,6 +266,9 @@ class InnerProductLayer : public Layer<Dtype> {
   int K_;
   int N_;
   bool bias_term_;
+  // Whether a ReLU is fused into the forward pass (InnerProductParameter
+  // fuse_relu).
+  bool fuse_relu_;
   Blob<Dtype> bias_multiplier_;
 };
 
@@ -298,6 +305,40 @@ class MVNLayer : public Layer<Dtype> {
   Blob<Dtype> sum_multiplier_;
 };
 
+/**
+ * @brief Converts a Blob stored in a channel-blocked layout (see BlobLayout)
+ *        to plain NCHW, for layers that cannot consume the blocked form.
+ *
+ * Net inserts these automatically when NetParameter.layout asks for a blocked
+ * layout (see InsertReorders). An NCHW bottom is passed through by sharing
+ * its data, as SplitLayer does.
+ */
+template <typename Dtype>
+class ReorderLayer : public Layer<Dtype> {
+ public:
+  explicit ReorderLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "Reorder"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+  virtual inline int ForwardSharedBottom(const int top_index) const {
+    return passthrough_ ? 0 : -1;
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  /// Whether the bottom is NCHW, so that Forward shares its data.
+  bool passthrough_;
+};
+
 /**
  * @brief Ignores bottom blobs while producing no top blobs. (This is useful
  *        to suppress outputs during testing.)
@@ -357,8 +398,6 @@ class SoftmaxLayer : public Layer<Dtype> {
   int outer_num_;
   int inner_num_;
   int softmax_axis_;
-  /// sum_multiplier is used to carry out sum using BLAS
-  Blob<Dtype> sum_multiplier_;
   /// scale is an intermediate Blob to hold temporary results.
   Blob<Dtype> scale_;
 };
@@ -410,6 +449,10 @@ class SplitLayer : public Layer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
 
+  virtual inline int ForwardSharedBottom(const int top_index) const {
+    return 0;
+  }
+
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
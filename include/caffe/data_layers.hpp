@@ -17,7 +17,9 @@
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/worker_group.hpp"
 
 namespace caffe {
 
@@ -48,17 +50,44 @@ class BaseDataLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
 
  protected:
+  // The items this process loads per batch of batch_size: in data-parallel
+  // training, each worker loads its shard of the batch of a TRAIN net, so
+  // that the workers together train on batch_size items per iteration, as a
+  // single process would. The layers doing so read every
+  // Caffe::solver_count()-th record, starting at record
+  // Caffe::solver_rank().
+  int WorkerBatchSize(const int batch_size) const;
+
   TransformationParameter transform_param_;
   shared_ptr<DataTransformer<Dtype> > data_transformer_;
   bool output_labels_;
 };
 
+/**
+ * @brief A batch of data and labels, filled by the prefetching thread of a
+ *        BasePrefetchingDataLayer.
+ */
+template <typename Dtype>
+class Batch {
+ public:
+  Blob<Dtype> data_, label_;
+};
+
+/**
+ * @brief Provides base for data layers that assemble their batches in a
+ *        background thread.
+ *
+ * The thread fills a ring of DataParameter.prefetch batches ahead of the
+ * net. Forward points the tops at the next ready batch instead of copying
+ * it, and hands the batch it replaces back to the thread, so the tops stay
+ * valid until the next Forward. Layers may spread the items of a batch over
+ * DataParameter.transform_threads workers, each with its own transformer.
+ */
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
  public:
-  explicit BasePrefetchingDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param) {}
+  explicit BasePrefetchingDataLayer(const LayerParameter& param);
   virtual ~BasePrefetchingDataLayer() {}
   // LayerSetUp: implements common data layer setup functionality, and calls
   // DataLayerSetUp to do special data layer setup for individual layer types.
@@ -71,15 +100,24 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
-  virtual void CreatePrefetchThread();
-  virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
-
  protected:
-  Blob<Dtype> prefetch_data_;
-  Blob<Dtype> prefetch_label_;
+  // The thread's function: fills free batches until it is stopped.
+  virtual void InternalThreadEntry();
+  // Fills batch->data_ and batch->label_, reshaping them if needed. Called
+  // on the prefetching thread.
+  virtual void load_batch(Batch<Dtype>* batch) = 0;
+
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
+  BlockingQueue<Batch<Dtype>*> prefetch_free_;
+  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  // The batch the tops point at, if any.
+  Batch<Dtype>* prefetch_current_;
+
   Blob<Dtype> transformed_data_;
+  // One transformer per transform worker; transformers_[0] is
+  // data_transformer_. Each has its own random generator, seeded in order.
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
+  shared_ptr<WorkerGroup> transform_workers_;
 };
 
 template <typename Dtype>
@@ -97,10 +135,28 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MaxTopBlobs() const { return 2; }
 
  protected:
-  virtual void InternalThreadEntry();
+  virtual void load_batch(Batch<Dtype>* batch);
+  // Decodes and transforms item item_id of the batch on transform worker
+  // thread_id.
+  void load_item(const int thread_id, const int item_id, Dtype* top_data,
+      Dtype* top_label);
+  // Moves the cursor to the next record, in the order of the database or,
+  // with shuffle, of order_, starting over at the end of the epoch.
+  void Next();
+  void ShuffleRecords();
 
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
+  // With shuffle, the order of the records in the current epoch, and the
+  // position of the cursor in it.
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  vector<size_t> order_;
+  size_t order_id_;
+  // The serialized datums of the batch being loaded. They point into the
+  // database when the cursor keeps its values valid, and into values_ when
+  // they have to be copied out of it.
+  vector<std::pair<const char*, size_t> > value_refs_;
+  vector<string> values_;
 };
 
 /**
@@ -239,10 +295,18 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  // Moves to the next line, reshuffling after the last one if asked to.
+  void NextLine();
+  virtual void load_batch(Batch<Dtype>* batch);
+  // Reads and transforms item item_id of the batch on transform worker
+  // thread_id.
+  void load_item(const int thread_id, const int item_id, Dtype* prefetch_data,
+      Dtype* prefetch_label);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  // The images of the batch being loaded.
+  vector<std::pair<std::string, int> > batch_lines_;
 };
 
 /**
@@ -311,7 +375,7 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual unsigned int PrefetchRand();
-  virtual void InternalThreadEntry();
+  virtual void load_batch(Batch<Dtype>* batch);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
@@ -2,6 +2,8 @@
 #ifndef CAFFE_DATA_TRANSFORMER_HPP
 #define CAFFE_DATA_TRANSFORMER_HPP
 
+#include <stdint.h>
+
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -38,6 +40,20 @@ class DataTransformer {
    */
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Applies the transformation defined in the data layer's
+   * transform_param block to raw pixels.
+   *
+   * @param data
+   *    uint8 pixels in channel, height, width order, such as the data of a
+   *    DatumView (see util/io.hpp) pointing into a database.
+   * @param transformed_blob
+   *    This is destination blob. It can be part of top blob's data if
+   *    set_cpu_data() is used. See data_layer.cpp for an example.
+   */
+  void Transform(const uint8_t* data, const int channels, const int height,
+      const int width, Blob<Dtype>* transformed_blob);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
@@ -100,6 +116,14 @@ class DataTransformer {
   virtual int Rand(int n);
 
   void Transform(const Datum& datum, Dtype* transformed_data);
+  // Transforms uint8 pixels or float values of the given shape.
+  template <typename T>
+  void Transform(const T* data, const int datum_channels,
+      const int datum_height, const int datum_width, Dtype* transformed_data);
+  // Checks that transformed_blob can hold the transformation of data of the
+  // given shape.
+  void CheckShape(const int datum_channels, const int datum_height,
+      const int datum_width, const Blob<Dtype>* transformed_blob);
   // Tranformation parameters
   TransformationParameter param_;
 
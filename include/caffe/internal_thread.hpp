@@ -28,6 +28,13 @@ class InternalThread {
   /** Will not return until the internal thread has exited. */
   bool WaitForInternalThreadToExit();
 
+  /**
+   * Asks the internal thread to stop, by interrupting it at its next
+   * boost::thread interruption point or must_stop() check, and waits for it
+   * to exit. For threads that loop until they are told to stop.
+   */
+  bool StopInternalThread();
+
   bool is_started() const;
 
  protected:
@@ -35,6 +42,10 @@ class InternalThread {
       with the code you want your thread to run. */
   virtual void InternalThreadEntry() {}
 
+  /* Should be tested by InternalThreadEntry implementations that loop,
+     which return once it is true. */
+  bool must_stop();
+
   shared_ptr<boost::thread> thread_;
 };
 
@@ -265,6 +265,18 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Return the index of the bottom blob whose data Forward shares with
+   *        the top blob at top_index (see Blob::ShareData), or -1 if Forward
+   *        writes the top blob itself.
+   *
+   * The memory planner of Net (NetParameter.plan_memory) keeps the shared
+   * data alive for as long as either blob is read.
+   */
+  virtual inline int ForwardSharedBottom(const int top_index) const {
+    return -1;
+  }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -287,6 +299,27 @@ class Layer {
     param_propagate_down_[param_id] = value;
   }
 
+  /**
+   * @brief Hands the layer a scratch blob shared with the other layers of
+   *        its Net.
+   *
+   * Layers run one at a time, so layers that need temporary buffers (such
+   * as the im2col columns of convolution) can share one allocation instead
+   * of each holding their own. Such layers grow the blob as needed in
+   * Reshape and keep no data in it from one call to the next. By default the
+   * workspace is ignored.
+   */
+  virtual void set_workspace(const shared_ptr<Blob<Dtype> >& workspace) {}
+
+  /**
+   * @brief Returns the number of values of the buffers, beyond its blobs and
+   *        the workspace, that Backward allocates for itself with the current
+   *        shapes and param_propagate_down settings.
+   *
+   * Net counts them in the memory it reports for nets that run backward.
+   */
+  virtual inline size_t BackwardScratchCount() const { return 0; }
+
 
  protected:
   /** The protobuf that stores the layer parameters */
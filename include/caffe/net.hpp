@@ -12,6 +12,7 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/mapped_weights.hpp"
 
 namespace caffe {
 
@@ -26,10 +27,17 @@ class Net {
  public:
   explicit Net(const NetParameter& param);
   explicit Net(const string& param_file, Phase phase);
+  /**
+   * @brief Builds a net of param whose layers use the parameter blobs of the
+   *        layers of the same name in shared, a net of the same param, which
+   *        are neither allocated nor filled. The net keeps the mapped weights
+   *        of shared, so it may outlive it. See NetModel.
+   */
+  Net(const NetParameter& param, const Net* shared);
   virtual ~Net() {}
 
   /// @brief Initialize a network with a NetParameter.
-  void Init(const NetParameter& param);
+  void Init(const NetParameter& param, const Net* shared = NULL);
 
   /**
    * @brief Run Forward with the input Blob%s already fed separately.
@@ -98,7 +106,18 @@ class Net {
    *        another Net.
    */
   void CopyTrainedLayersFrom(const NetParameter& param);
+  /**
+   * @brief Copies the pre-trained layers from a .caffemodel, or maps them
+   *        from mapped weights (see MappedWeights).
+   */
   void CopyTrainedLayersFrom(const string trained_filename);
+  /**
+   * @brief For an already initialized net, points the parameters of the
+   *        pre-trained layers into the mapping of weights, without copying,
+   *        and keeps it alive. Parameters that cannot point into it (double,
+   *        or in flat_params) are copied instead.
+   */
+  void CopyTrainedLayersFrom(const shared_ptr<MappedWeights>& weights);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
 
@@ -151,6 +170,21 @@ class Net {
     return param_names_index_;
   }
   inline const vector<int>& param_owners() const { return param_owners_; }
+  /**
+   * @brief Returns the blob whose data and diff hold those of every parameter
+   *        that owns its data, one after the other, or NULL unless the net
+   *        was created with flat_params (see FlattenParams).
+   */
+  inline const shared_ptr<Blob<Dtype> >& flat_params() const {
+    return flat_params_;
+  }
+  /**
+   * @brief Bumps the data version of every parameter that is a view into
+   *        flat_params, to be called after writing their data through it;
+   *        caches derived from the parameters, such as the blocked filters
+   *        of the convolution layers of a net sharing them, are then redone.
+   */
+  void FlatParamsChanged();
   /// @brief Input and output blob numbers
   inline int num_inputs() const { return net_input_blobs_.size(); }
   inline int num_outputs() const { return net_output_blobs_.size(); }
@@ -209,6 +243,16 @@ class Net {
 
   /// @brief Get misc parameters, e.g. the LR multiplier and weight decay.
   void GetLearningRateAndWeightDecay();
+  /**
+   * @brief Back the intermediate blobs with shared buffers, reusing each
+   *        buffer for blobs whose forward lifetimes do not overlap.
+   */
+  void PlanMemory();
+  /**
+   * @brief Move the data and diffs of the parameters that own their data into
+   *        flat_params_, and make the parameter blobs views into it.
+   */
+  void FlattenParams();
 
   /// @brief The network name
   string name_;
@@ -252,8 +296,18 @@ class Net {
   vector<float> params_lr_;
   /// the weight decay multipliers
   vector<float> params_weight_decay_;
+  /// The data and diffs of all the owned parameters (see FlattenParams)
+  shared_ptr<Blob<Dtype> > flat_params_;
+  /// The mapped weights the parameters point into
+  vector<shared_ptr<MappedWeights> > mapped_weights_;
+  /// Scratch space the layers share, since they run one at a time
+  shared_ptr<Blob<Dtype> > workspace_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// Whether the intermediate blobs are backed by memory_buffers_
+  bool plan_memory_;
+  /// The buffers shared by the intermediate blobs (see PlanMemory)
+  vector<shared_ptr<SyncedMemory> > memory_buffers_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
 
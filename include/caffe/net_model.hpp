@@ -0,0 +1,54 @@
+#ifndef CAFFE_NET_MODEL_HPP_
+#define CAFFE_NET_MODEL_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief A net and its trained parameters, run concurrently by any number of
+ *        threads through execution contexts that share the parameters.
+ *
+ * A Net keeps its activations, and its layers their per-call scratch (the
+ * column buffer of convolution, the scale of LRN and softmax...), so one Net
+ * cannot run forward passes on several threads at once. A NetModel holds the
+ * parameters, once; each thread runs the model through its own context from
+ * NewContext, a Net whose layers point at the parameters of the model and own
+ * only their activations and scratch. Creating a context allocates, fills
+ * and copies no parameter.
+ *
+ * The model is in the TEST phase, and the contexts only read the
+ * parameters: they must not run backward or update them.
+ */
+template <typename Dtype>
+class NetModel {
+ public:
+  // Builds the net of param, with the trained weights_file (a .caffemodel or
+  // mapped weights) if it is not empty.
+  explicit NetModel(const NetParameter& param,
+      const string& weights_file = "");
+  explicit NetModel(const string& param_file,
+      const string& weights_file = "");
+
+  // The net holding the parameters. Use it as a context on one thread at
+  // most.
+  const shared_ptr<Net<Dtype> >& net() const { return net_; }
+  // A new context, for one thread at a time. May be called on any thread.
+  shared_ptr<Net<Dtype> > NewContext() const;
+
+ private:
+  void Init(const NetParameter& param, const string& weights_file);
+
+  NetParameter param_;
+  shared_ptr<Net<Dtype> > net_;
+
+  DISABLE_COPY_AND_ASSIGN(NetModel);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_NET_MODEL_HPP_
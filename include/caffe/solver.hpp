@@ -5,6 +5,9 @@
 #include <vector>
 
 #include "caffe/net.hpp"
+#include "caffe/util/allreduce.hpp"
+#include "caffe/util/snapshot_writer.hpp"
+#include "caffe/util/solver_update.hpp"
 
 namespace caffe {
 
@@ -37,27 +40,53 @@ class Solver {
     return test_nets_;
   }
   int iter() { return iter_; }
+  // Makes this solver one worker of data-parallel training over transport,
+  // and gives its net the parameters of rank 0. Each iteration, the workers
+  // average their gradients before updating, so that their parameters stay
+  // identical; only rank 0 tests and snapshots. Each worker's data layers
+  // should read a different share of the data (see Caffe::solver_rank).
+  void set_transport(const shared_ptr<Transport>& transport);
+  inline const shared_ptr<Transport>& transport() { return transport_; }
+  // Waits until the snapshots being written in the background are on disk.
+  void WaitForSnapshots();
 
  protected:
   // Get the update value for the current iteration.
   virtual void ComputeUpdateValue() = 0;
+  // Computes the update value and applies it to the net: by default,
+  // ComputeUpdateValue() followed by Net::Update().
+  virtual void ApplyUpdate();
   // The Solver::Snapshot function implements the basic snapshotting utility
   // that stores the learned net. You should implement the SnapshotSolverState()
   // function that produces a SolverState protocol buffer that needs to be
-  // written to disk together with the learned net.
+  // written to disk together with the learned net. With snapshot_async, the
+  // snapshot is written by snapshot_writer_ while training goes on.
   void Snapshot();
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
   virtual void SnapshotSolverState(SolverState* state) = 0;
+  // The blobs SnapshotSolverState writes as the history of the state, which
+  // asynchronous snapshots copy instead; NULL, the default, if the state
+  // holds anything else, in which case snapshots are written synchronously.
+  virtual const vector<shared_ptr<Blob<Dtype> > >* SnapshotHistory() {
+    return NULL;
+  }
   virtual void RestoreSolverState(const SolverState& state) = 0;
   void DisplayOutputBlobs(const int net_id);
+  // Averages the gradients of the net over the workers of transport_.
+  void AllreduceDiffs();
 
   SolverParameter param_;
   int iter_;
   int current_step_;
   shared_ptr<Net<Dtype> > net_;
   vector<shared_ptr<Net<Dtype> > > test_nets_;
+  shared_ptr<Transport> transport_;
+  // The diffs of the net gathered for AllreduceDiffs, unless they are all in
+  // its flat parameters.
+  vector<Dtype> allreduce_buffer_;
+  shared_ptr<SnapshotWriter<Dtype> > snapshot_writer_;
 
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
@@ -82,7 +111,23 @@ class SGDSolver : public Solver<Dtype> {
   Dtype GetLearningRate();
   virtual void ComputeUpdateValue();
   virtual void ClipGradients();
+  // On the CPU, updates the parameters with the fused kernels of
+  // util/solver_update.hpp, in chunks spread over the threads, rather than
+  // with separate passes for the weight decay, the history, the update value
+  // and Net::Update. The results are the same.
+  virtual void ApplyUpdate();
+  // Updates count values of parameter param_id, at data, diff and history,
+  // in a single pass, as ComputeUpdateValue and, if update_data,
+  // Blob::Update. Only the given pointers are touched, so that the chunks of
+  // one parameter can run concurrently.
+  virtual void ComputeUpdateValueFused(const int param_id, const Dtype rate,
+      const int count, Dtype* data, Dtype* diff, Dtype* history,
+      const bool update_data);
+  Regularization GetRegularization();
   virtual void SnapshotSolverState(SolverState * state);
+  virtual const vector<shared_ptr<Blob<Dtype> > >* SnapshotHistory() {
+    return &history_;
+  }
   virtual void RestoreSolverState(const SolverState& state);
   // history maintains the historical momentum data.
   // update maintains update related data and is not needed in snapshots.
@@ -90,6 +135,24 @@ class SGDSolver : public Solver<Dtype> {
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
 
+ private:
+  // The pointers are taken once per update, before the chunks run, so the
+  // workers never call the accessors of the shared blobs.
+  struct UpdateChunk {
+    int param_id;
+    int count;
+    Dtype* data;
+    Dtype* diff;
+    Dtype* history;
+    bool update_data;
+  };
+  void UpdateChunkFused(const int chunk_id);
+
+  // The chunks of the parameters, and the learning rate, of the fused update
+  // in progress.
+  vector<UpdateChunk> update_chunks_;
+  Dtype update_rate_;
+
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
 
@@ -103,6 +166,9 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue();
+  virtual void ComputeUpdateValueFused(const int param_id, const Dtype rate,
+      const int count, Dtype* data, Dtype* diff, Dtype* history,
+      const bool update_data);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -117,6 +183,9 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue();
+  virtual void ComputeUpdateValueFused(const int param_id, const Dtype rate,
+      const int count, Dtype* data, Dtype* diff, Dtype* history,
+      const bool update_data);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -2,9 +2,11 @@
 #ifndef CAFFE_SYNCEDMEM_HPP_
 #define CAFFE_SYNCEDMEM_HPP_
 
+#include <atomic>
 #include <cstdlib>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -22,14 +24,17 @@ namespace caffe {
 // are constantly accessing them the memory pages almost always stays in
 // the physical memory (assuming we have large enough memory installed), and
 // does not seem to create a memory bottleneck here.
+//
+// The memory comes from the pooling allocator of Caffe::host_allocator(),
+// aligned to 64 bytes; size must be passed back to CaffeFreeHost.
 
 inline void CaffeMallocHost(void** ptr, size_t size) {
-  *ptr = malloc(size);
+  *ptr = Caffe::host_allocator().Allocate(size);
   CHECK(*ptr) << "host allocation of size " << size << " failed";
 }
 
-inline void CaffeFreeHost(void* ptr) {
-  free(ptr);
+inline void CaffeFreeHost(void* ptr, size_t size) {
+  Caffe::host_allocator().Free(ptr, size);
 }
 
 
@@ -43,10 +48,10 @@ class SyncedMemory {
  public:
   SyncedMemory()
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), version_(0) {}
   explicit SyncedMemory(size_t size)
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), version_(0) {}
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
@@ -56,6 +61,13 @@ class SyncedMemory {
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
   SyncedHead head() { return head_; }
   size_t size() { return size_; }
+  // Counts the calls that hand out the data for writing (mutable_cpu_data,
+  // mutable_gpu_data and set_cpu_data), so that caches derived from the data
+  // can tell when it may have changed. Code writing through a pointer it
+  // obtained earlier, such as a view into a larger buffer, must call
+  // bump_version afterwards, or those caches keep the old contents.
+  size_t version() const { return version_.load(); }
+  void bump_version() { ++version_; }
 
  private:
   void to_cpu();
@@ -65,6 +77,7 @@ class SyncedMemory {
   size_t size_;
   SyncedHead head_;
   bool own_cpu_data_;
+  std::atomic<size_t> version_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
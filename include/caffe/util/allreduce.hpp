@@ -0,0 +1,118 @@
+#ifndef CAFFE_UTIL_ALLREDUCE_HPP_
+#define CAFFE_UTIL_ALLREDUCE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Carries the messages of the workers of data-parallel training, which form
+// a ring: each sends to the next rank, modulo size, and receives from the
+// previous one. Implementations move bytes without blocking; the transfers
+// below are built on that, so that every worker can send and receive at
+// once without the ring deadlocking.
+class Transport {
+ public:
+  Transport(const int rank, const int size);
+  virtual ~Transport() {}
+
+  int rank() const { return rank_; }
+  int size() const { return size_; }
+
+  // Sends send_bytes to the next rank while receiving recv_bytes from the
+  // previous one, and returns when both are done.
+  void SendRecv(const void* send, const size_t send_bytes, void* recv,
+      const size_t recv_bytes);
+  void Send(const void* data, const size_t bytes) {
+    SendRecv(data, bytes, NULL, 0);
+  }
+  void Recv(void* data, const size_t bytes) {
+    SendRecv(NULL, 0, data, bytes);
+  }
+
+ protected:
+  // Send or receive as many of the bytes as possible without waiting, and
+  // return how many were.
+  virtual size_t TrySend(const char* data, const size_t bytes) = 0;
+  virtual size_t TryRecv(char* data, const size_t bytes) = 0;
+  // Waits, for a short while at most, for a chance to send or receive.
+  virtual void Wait(const bool sending, const bool receiving) = 0;
+
+  const int rank_;
+  const int size_;
+
+  DISABLE_COPY_AND_ASSIGN(Transport);
+};
+
+// Workers on the same host, in memory they all map: forked processes, which
+// inherit a region from CreateRegion, or threads. Each worker writes into a
+// ring buffer of capacity bytes read by the next one.
+class ShmTransport : public Transport {
+ public:
+  static size_t RegionBytes(const int size, const size_t capacity);
+  // Maps RegionBytes of zeroed memory shared with the processes forked
+  // afterwards; it is never unmapped.
+  static void* CreateRegion(const size_t bytes);
+
+  // The region must be zeroed before the first worker uses it, and shared by
+  // all size workers with the same capacity.
+  ShmTransport(void* region, const int rank, const int size,
+      const size_t capacity = kDefaultCapacity);
+
+  static const size_t kDefaultCapacity = size_t(4) << 20;
+
+ protected:
+  virtual size_t TrySend(const char* data, const size_t bytes);
+  virtual size_t TryRecv(char* data, const size_t bytes);
+  virtual void Wait(const bool sending, const bool receiving);
+
+ private:
+  struct Channel;
+  Channel* channel(const int rank);
+
+  char* region_;
+  const size_t capacity_;
+};
+
+// Workers on any hosts, over TCP. Each listens on a port, connects to the
+// next rank and accepts the connection of the previous one.
+class TcpTransport : public Transport {
+ public:
+  // Listens on port, or on a free port if 0 (see port()).
+  TcpTransport(const int rank, const int size, const int port);
+  virtual ~TcpTransport();
+  int port() const { return port_; }
+  // Connects to the next rank, at "host:port", retrying until it listens or
+  // timeout_ms has passed, and accepts the previous rank.
+  void Connect(const string& next_address, const int timeout_ms = 60000);
+
+ protected:
+  virtual size_t TrySend(const char* data, const size_t bytes);
+  virtual size_t TryRecv(char* data, const size_t bytes);
+  virtual void Wait(const bool sending, const bool receiving);
+
+ private:
+  int listen_fd_;
+  int next_fd_;
+  int prev_fd_;
+  int port_;
+};
+
+// Sums count values over the workers of transport, leaving the same result
+// on every worker: a reduce-scatter then an allgather, each of size - 1
+// steps moving count / size values between neighbours. Each value is summed
+// in the same order on every worker, so the results are identical.
+template <typename Dtype>
+void ring_allreduce(Transport* transport, Dtype* data, const int count);
+
+// Copies bytes of data from rank 0 to every other worker.
+void ring_broadcast(Transport* transport, void* data, const size_t bytes);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_ALLREDUCE_HPP_
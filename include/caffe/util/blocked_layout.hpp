@@ -0,0 +1,36 @@
+#ifndef CAFFE_UTIL_BLOCKED_LAYOUT_HPP_
+#define CAFFE_UTIL_BLOCKED_LAYOUT_HPP_
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Returns the number of channels interleaved per block in the given layout,
+// which is 1 for plain NCHW.
+inline int blob_layout_block(const BlobLayout layout) {
+  switch (layout) {
+  case NCHW8C:
+    return 8;
+  case NCHW16C:
+    return 16;
+  default:
+    return 1;
+  }
+}
+
+// Reorders num x channels x spatial_dim data into
+// num x channels / block x spatial_dim x block. channels must be a multiple
+// of block.
+template <typename Dtype>
+void nchw_to_blocked_cpu(const Dtype* data, const int num, const int channels,
+    const int spatial_dim, const int block, Dtype* data_blocked);
+
+// The inverse of nchw_to_blocked_cpu.
+template <typename Dtype>
+void blocked_to_nchw_cpu(const Dtype* data_blocked, const int num,
+    const int channels, const int spatial_dim, const int block, Dtype* data);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKED_LAYOUT_HPP_
@@ -0,0 +1,39 @@
+#ifndef CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+#define CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+
+#include <queue>
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// A queue passing items between threads: pop waits until an item has been
+// pushed. Waiting is a boost::thread interruption point, so a thread blocked
+// on the queue can be stopped with InternalThread::StopInternalThread.
+template <typename T>
+class BlockingQueue {
+ public:
+  BlockingQueue();
+
+  void push(const T& t);
+  // Returns false right away if the queue is empty.
+  bool try_pop(T* t);
+  // Logs log_on_wait, if given, when it has to wait.
+  T pop(const string& log_on_wait = "");
+  size_t size() const;
+
+ protected:
+  // Holds the boost synchronization objects, which are kept out of this
+  // header for nvcc.
+  class sync;
+
+  std::queue<T> queue_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKING_QUEUE_HPP_
@@ -23,7 +23,22 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  // Points *data at the value without copying it. The bytes belong to the
+  // cursor: they stay valid until it moves, or, if values_stay_valid(),
+  // until it is destroyed.
+  virtual void value_ref(const char** data, size_t* size) = 0;
+  virtual bool values_stay_valid() const { return false; }
   virtual bool valid() = 0;
+  // Random access, for the backends that support it: the number of records,
+  // and moves the cursor to record index, counting from the first.
+  virtual bool random_access() const { return false; }
+  virtual size_t size() {
+    LOG(FATAL) << "This backend does not support random access";
+    return 0;
+  }
+  virtual void Seek(const size_t index) {
+    LOG(FATAL) << "This backend does not support random access";
+  }
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
@@ -59,6 +74,11 @@ class LevelDBCursor : public Cursor {
   virtual void Next() { iter_->Next(); }
   virtual string key() { return iter_->key().ToString(); }
   virtual string value() { return iter_->value().ToString(); }
+  virtual void value_ref(const char** data, size_t* size) {
+    const leveldb::Slice value = iter_->value();
+    *data = value.data();
+    *size = value.size();
+  }
   virtual bool valid() { return iter_->Valid(); }
 
  private:
@@ -129,6 +149,13 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  virtual void value_ref(const char** data, size_t* size) {
+    *data = static_cast<const char*>(mdb_value_.mv_data);
+    *size = mdb_value_.mv_size;
+  }
+  // The values point into the memory map, which stays valid for the whole
+  // read-only transaction of the cursor.
+  virtual bool values_stay_valid() const { return true; }
   virtual bool valid() { return valid_; }
 
  private:
@@ -0,0 +1,127 @@
+#ifndef CAFFE_UTIL_DB_RECORDS_HPP
+#define CAFFE_UTIL_DB_RECORDS_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+// A directory of record shards, shard_00000, shard_00001, ..., each holding
+// the records back to back followed by a table of their offsets:
+//
+//   record i:  uint32 key size, key, value
+//   padding up to 8 bytes
+//   index:     uint64 offset of each record, then the end of the last one
+//   footer:    uint64 number of records, offset of the index, kMagic
+//
+// Readers map the shards into memory, so that any record is found in constant
+// time from its offset, and several cursors, on one or several threads or
+// processes, read the same pages without locking. Writers append records to
+// the last shard and start a new one when it grows past shard_bytes.
+class RecordDB;
+
+class RecordCursor : public Cursor {
+ public:
+  explicit RecordCursor(const RecordDB* db) : db_(db) { SeekToFirst(); }
+  virtual void SeekToFirst() { Seek(0); }
+  virtual void Next() { Seek(index_ + 1); }
+  virtual string key() { return string(key_, key_size_); }
+  virtual string value() { return string(value_, value_size_); }
+  virtual void value_ref(const char** data, size_t* size) {
+    *data = value_;
+    *size = value_size_;
+  }
+  // The values point into the memory map of the database.
+  virtual bool values_stay_valid() const { return true; }
+  virtual bool valid() { return valid_; }
+  virtual bool random_access() const { return true; }
+  virtual size_t size();
+  virtual void Seek(const size_t index);
+
+ private:
+  const RecordDB* db_;
+  size_t index_;
+  bool valid_;
+  const char* key_;
+  size_t key_size_;
+  const char* value_;
+  size_t value_size_;
+};
+
+class RecordTransaction : public Transaction {
+ public:
+  explicit RecordTransaction(RecordDB* db) : db_(db) { CHECK_NOTNULL(db_); }
+  virtual void Put(const string& key, const string& value) {
+    records_.push_back(std::make_pair(key, value));
+  }
+  virtual void Commit();
+
+ private:
+  RecordDB* db_;
+  vector<std::pair<string, string> > records_;
+
+  DISABLE_COPY_AND_ASSIGN(RecordTransaction);
+};
+
+class RecordDB : public DB {
+ public:
+  static const uint64_t kMagic = 0x3130534452464643ULL;  // "CFFRDS01"
+  static const size_t kDefaultShardBytes = size_t(1) << 30;
+
+  explicit RecordDB(const size_t shard_bytes = kDefaultShardBytes)
+      : shard_bytes_(shard_bytes), file_(NULL) { }
+  virtual ~RecordDB() { Close(); }
+  // READ maps the existing shards. NEW creates the directory; WRITE creates
+  // it if needed and appends shards after the existing ones.
+  virtual void Open(const string& source, Mode mode);
+  virtual void Close();
+  virtual RecordCursor* NewCursor();
+  virtual RecordTransaction* NewTransaction();
+
+  // The number of records, and record index of the database opened for
+  // reading; the pointers stay valid until it is closed.
+  size_t size() const { return shard_starts_.empty() ? 0 :
+      shard_starts_.back(); }
+  void Get(const size_t index, const char** key, size_t* key_size,
+      const char** value, size_t* value_size) const;
+  void Append(const string& key, const string& value);
+
+  int num_shards() const { return shards_.size(); }
+
+ private:
+  struct Shard {
+    const char* data;
+    size_t bytes;
+    const uint64_t* offsets;
+    size_t num_records;
+  };
+
+  string ShardName(const int shard_id) const;
+  void MapShard(const string& filename);
+  // Writes the index and footer of the shard being written, and closes it.
+  void FinishShard();
+
+  string source_;
+  const size_t shard_bytes_;
+  // The mapped shards, and the index of the first record of each, followed
+  // by the number of records.
+  vector<Shard> shards_;
+  vector<size_t> shard_starts_;
+  // The shard being written, its number, size and record offsets.
+  FILE* file_;
+  int next_shard_id_;
+  uint64_t file_bytes_;
+  vector<uint64_t> offsets_;
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_RECORDS_HPP
@@ -0,0 +1,69 @@
+#ifndef CAFFE_UTIL_DIRECT_CONV_HPP_
+#define CAFFE_UTIL_DIRECT_CONV_HPP_
+
+namespace caffe {
+
+// Instruction sets the direct convolution kernels can be dispatched to.
+enum DirectConvISA {
+  DIRECT_CONV_SCALAR = 0,
+  DIRECT_CONV_AVX2 = 1,
+  DIRECT_CONV_AVX512 = 2
+};
+
+// Returns the widest instruction set supported by the running CPU.
+// The result is probed once and cached.
+DirectConvISA direct_conv_isa();
+
+// Restricts dispatch to at most the given instruction set, e.g. to compare
+// kernels in tests and benchmarks. Requests beyond what the CPU supports are
+// clamped to the widest supported set.
+void set_direct_conv_isa(DirectConvISA isa);
+
+// Returns the number of elements of scratch space direct_conv_cpu needs for
+// one image. The input is copied there zero-padded and split into stride_w
+// column phases so that every kernel tap reads a contiguous run of inputs.
+// Unpadded, unit column stride convolutions read the input in place and need
+// no scratch space at all.
+int direct_conv_workspace_size(const int channels, const int height,
+    const int width, const int pad_h, const int pad_w, const int stride_w);
+
+// Convolves a single channels x height x width image with num_output filters
+// of shape channels x kernel_h x kernel_w without unrolling it through
+// im2col. Output tiles are accumulated in registers across the kernel window
+// and the input channel loop. bias may be NULL; with relu, negative outputs
+// are clamped to zero as the tiles are stored. workspace must hold
+// direct_conv_workspace_size() elements.
+template <typename Dtype>
+void direct_conv_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const Dtype* weights, const Dtype* bias, const int num_output,
+    const bool relu, Dtype* workspace, Dtype* data_out);
+
+// Reorders num_output x channels x kernel_h x kernel_w filters into
+// num_output / block x channels x kernel_h x kernel_w x block, the filter
+// layout direct_conv_blocked_cpu expects.
+template <typename Dtype>
+void direct_conv_blocked_weights(const Dtype* weights, const int num_output,
+    const int channels, const int kernel_h, const int kernel_w,
+    const int block, Dtype* blocked_weights);
+
+// Convolves a single image into a channel-blocked output of shape
+// num_output / out_block x height_out x width_out x out_block (see
+// BlobLayout). The input is read in place either as plain channels x height x
+// width (in_block == 1) or blocked by in_block channels, so chains of blocked
+// layers never reorder their activations. out_block must be 8 or 16 and
+// divide num_output; bias may be NULL. relu clamps each output row at zero
+// right after it is accumulated. For float, it runs on AVX2 or AVX-512 as
+// direct_conv_isa allows.
+template <typename Dtype>
+void direct_conv_blocked_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int in_block,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const Dtype* blocked_weights,
+    const Dtype* bias, const int num_output, const int out_block,
+    const bool relu, Dtype* data_out);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DIRECT_CONV_HPP_
@@ -0,0 +1,22 @@
+#ifndef _CAFFE_UTIL_FUSE_LAYERS_HPP_
+#define _CAFFE_UTIL_FUSE_LAYERS_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters rewritten for inference (NetParameter.fuse_layers):
+//  - A ReLU without negative slope whose bottom is the top of a Convolution
+//    or InnerProduct layer, and which is the first layer to read that top,
+//    is removed and applied by the producer instead (fuse_relu). If the ReLU
+//    is not in place, the producer takes over its top, provided nothing
+//    else reads the original one.
+//  - Dropout layers running in the TEST phase, which pass their input
+//    through unchanged, are removed. The readers of a Dropout that is not in
+//    place are renamed to read its bottom, provided nothing else reads that.
+// Expects a filtered net without splits.
+void FuseLayers(const NetParameter& param, NetParameter* param_fused);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_FUSE_LAYERS_HPP_
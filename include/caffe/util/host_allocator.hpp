@@ -0,0 +1,96 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <boost/thread.hpp>
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// The allocator behind CaffeMallocHost and CaffeFreeHost. Use
+// Caffe::host_allocator() rather than creating one.
+//
+// Every block is aligned to kAlignment bytes. Sizes are rounded up to one of
+// four classes per power of two, and freed blocks are kept in a pool for
+// their class, up to max_cached_bytes, so that blobs reshaped back and forth
+// reuse their memory rather than going back to the system. Blocks of
+// kLargeBytes or more are mapped from the system directly, in multiples of
+// kHugePageBytes, so that they may be backed by huge pages and bound to a
+// NUMA node.
+class HostAllocator {
+ public:
+  enum HugePages {
+    // Regular pages only.
+    HUGE_PAGES_NONE,
+    // Ask the kernel to back large blocks with transparent huge pages.
+    HUGE_PAGES_TRANSPARENT,
+    // Map large blocks from the reserved huge pages (hugetlbfs), falling
+    // back to regular pages when none are left.
+    HUGE_PAGES_EXPLICIT
+  };
+
+  struct Stats {
+    // The bytes held by the callers, after rounding, and their maximum.
+    size_t live_bytes;
+    size_t peak_bytes;
+    // The bytes kept in the pool.
+    size_t cached_bytes;
+    // Allocations served from the pool, and from the system.
+    uint64_t pool_hits;
+    uint64_t pool_misses;
+  };
+
+  static const size_t kAlignment = 64;
+  static const size_t kLargeBytes = 2 << 20;
+  static const size_t kHugePageBytes = 2 << 20;
+
+  HostAllocator();
+  ~HostAllocator();
+
+  // size is the size passed to Allocate.
+  void* Allocate(const size_t size);
+  void Free(void* ptr, const size_t size);
+
+  // Returns the pooled blocks to the system.
+  void Trim();
+  Stats stats();
+  void ResetPeak();
+
+  // The settings apply to later allocations. Disabling the pool or lowering
+  // its limit trims it.
+  void set_pooling(const bool pooling);
+  void set_max_cached_bytes(const size_t max_cached_bytes);
+  void set_huge_pages(const HugePages huge_pages);
+  // Binds the pages of large blocks to one NUMA node; -1 leaves them where
+  // they are first touched.
+  void set_numa_node(const int numa_node);
+
+  // The size of the block Allocate(size) returns.
+  static size_t RoundUp(const size_t size);
+
+ private:
+  void* SystemAllocate(const size_t bytes);
+  void SystemFree(void* ptr, const size_t bytes);
+  // Frees pooled blocks until at most max_cached_bytes are left.
+  void TrimTo(const size_t max_cached_bytes);
+
+  // Guards everything below.
+  boost::mutex mutex_;
+  // The free blocks of each size.
+  std::map<size_t, vector<void*> > pool_;
+  Stats stats_;
+  bool pooling_;
+  size_t max_cached_bytes_;
+  HugePages huge_pages_;
+  int numa_node_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
@@ -0,0 +1,116 @@
+#ifndef CAFFE_UTIL_INFERENCE_SERVER_HPP_
+#define CAFFE_UTIL_INFERENCE_SERVER_HPP_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Runs the forward passes of nets for concurrent requests, each one item of
+// the single input of a net, which it coalesces into batches: a batch is run
+// once it holds max_batch_size requests, or max_delay_us after its first
+// request arrived. Each model is loaded once, as a NetModel, and run by
+// replicas contexts, each running batches on its own thread. The layers of
+// all replicas of all models spread their work over the one thread pool of
+// the process (see Caffe::thread_pool), which the server sizes to
+// replicas * threads_per_replica threads while it exists; 0 leaves the pool
+// as it is, one thread per core by default.
+//
+// Clients on the same host reach it on a Unix domain socket (see Listen and
+// InferenceClient) with messages in the byte order of the host:
+//
+//   request:   uint32 size of the model name, the name,
+//              uint32 count of the values of the item, the float values
+//   response:  uint32 status, then if it is 0 (OK)
+//                uint32 count, the float values of the item in each output
+//                blob of the net, in order
+//              and otherwise
+//                uint32 size of an error message, the message
+//
+// Any number of requests may follow each other on a connection; each waits
+// for its response.
+class InferenceServer {
+ public:
+  struct Options {
+    Options() : replicas(1), max_batch_size(32), max_delay_us(1000),
+        threads_per_replica(0) {}
+    int replicas;
+    int max_batch_size;
+    int max_delay_us;
+    int threads_per_replica;
+  };
+  // The requests and batches a model has run.
+  struct Stats {
+    Stats() : requests(0), batches(0) {}
+    int64_t requests;
+    int64_t batches;
+  };
+
+  explicit InferenceServer(const Options& options);
+  ~InferenceServer();
+
+  // Serves the net of param, in TEST phase, as name, with the trained
+  // weights_file if not empty (a .caffemodel or mapped weights).
+  void AddModel(const string& name, const NetParameter& param,
+      const string& weights_file);
+  void AddModel(const string& name, const string& model_file,
+      const string& weights_file);
+  bool HasModel(const string& name) const;
+  // The number of values of one item of the input of the model, and of its
+  // outputs.
+  int input_count(const string& name) const;
+  int output_count(const string& name) const;
+  Stats stats(const string& name) const;
+
+  // Runs input, one item, through the model in the next batch, and returns
+  // the outputs of the item.
+  void Infer(const string& name, const vector<float>& input,
+      vector<float>* output);
+
+  // Accepts clients on socket_path, each served on its own thread, until
+  // Stop.
+  void Listen(const string& socket_path);
+  // Closes the socket and the connections of the clients, and waits for
+  // them.
+  void Stop();
+
+ private:
+  class Model;
+  class Replica;
+  class Listener;
+
+  const Options options_;
+  // The size of the thread pool before the server resized it.
+  const int previous_num_threads_;
+  std::map<string, shared_ptr<Model> > models_;
+  shared_ptr<Listener> listener_;
+
+  DISABLE_COPY_AND_ASSIGN(InferenceServer);
+};
+
+// A connection to the socket of an InferenceServer.
+class InferenceClient {
+ public:
+  explicit InferenceClient(const string& socket_path);
+  ~InferenceClient();
+
+  // Returns false, with the message of the server in error, if the request
+  // failed.
+  bool Infer(const string& name, const vector<float>& input,
+      vector<float>* output, string* error = NULL);
+
+ private:
+  int fd_;
+
+  DISABLE_COPY_AND_ASSIGN(InferenceClient);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_INFERENCE_SERVER_HPP_
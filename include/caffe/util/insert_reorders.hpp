@@ -0,0 +1,29 @@
+#ifndef _CAFFE_UTIL_INSERT_REORDERS_HPP_
+#define _CAFFE_UTIL_INSERT_REORDERS_HPP_
+
+#include <string>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters for the channel-blocked layout param.layout(): the
+// convolutions are told to write that layout, layers that can consume it keep
+// it, and a ReorderLayer is added in front of every other consumer of a
+// possibly blocked blob, and for blocked net outputs. The reordered blob keeps
+// the original name; what was written blocked is renamed to <name>_blocked.
+// Expects splits to be inserted already.
+void InsertReorders(const NetParameter& param, NetParameter* param_reordered);
+
+// Whether the CPU implementation of the layer accepts blocked bottoms (and
+// then writes its tops in the same layout).
+bool LayerAcceptsBlockedLayout(const LayerParameter& layer_param);
+
+void ConfigureReorderLayer(const string& layer_name, const string& bottom_name,
+    const string& top_name, LayerParameter* reorder_layer_param);
+
+string ReorderLayerName(const string& layer_name, const string& blob_name);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_INSERT_REORDERS_HPP_
@@ -1,6 +1,7 @@
 #ifndef CAFFE_UTIL_IO_H_
 #define CAFFE_UTIL_IO_H_
 
+#include <stdint.h>
 #include <unistd.h>
 #include <string>
 
@@ -85,6 +86,11 @@ inline void WriteProtoToBinaryFile(
   WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
+// Writes proto to a temporary file next to filename, syncs it to disk and
+// renames it to filename, so that filename is never seen half written.
+void WriteProtoToBinaryFileAtomically(const Message& proto,
+    const string& filename);
+
 bool ReadFileToDatum(const string& filename, const int label, Datum* datum);
 
 inline bool ReadFileToDatum(const string& filename, Datum* datum) {
@@ -124,6 +130,23 @@ inline bool ReadImageToDatum(const string& filename, const int label,
 bool DecodeDatumNative(Datum* datum);
 bool DecodeDatum(Datum* datum, bool is_color);
 
+// The fields of a serialized Datum, with data pointing into the serialized
+// bytes instead of being copied out of them.
+struct DatumView {
+  int channels;
+  int height;
+  int width;
+  int label;
+  bool encoded;
+  const uint8_t* data;
+  size_t data_size;
+};
+
+// Parses the Datum serialized in bytes without copying its data, which stays
+// owned by the caller. Returns false for a Datum holding float_data, or for
+// malformed bytes, which are left to Datum::ParseFromArray.
+bool ParseDatumView(const char* bytes, const size_t size, DatumView* datum);
+
 cv::Mat ReadImageToCVMat(const string& filename,
     const int height, const int width, const bool is_color);
 
@@ -137,6 +160,8 @@ cv::Mat ReadImageToCVMat(const string& filename);
 
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum);
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color);
+cv::Mat DecodeDatumToCVMatNative(const DatumView& datum);
+cv::Mat DecodeDatumToCVMat(const DatumView& datum, bool is_color);
 
 void CVMatToDatum(const cv::Mat& cv_img, Datum* datum);
 
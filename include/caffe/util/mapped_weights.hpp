@@ -0,0 +1,65 @@
+#ifndef CAFFE_UTIL_MAPPED_WEIGHTS_HPP_
+#define CAFFE_UTIL_MAPPED_WEIGHTS_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// A file of trained weights, the blobs of a .caffemodel, laid out to be used
+// in place once mapped into memory:
+//
+//   header:  uint64 kMagic, uint64 size of the index
+//   index:   a serialized MappedWeightsIndex
+//   padding up to 64 bytes
+//   values:  the float values of each blob, raw, each starting on 64 bytes
+//
+// Loading it maps the file and points the parameter blobs into the mapping
+// (see Net::CopyTrainedLayersFrom), so that nothing is parsed or copied, and
+// the pages are read on first use and shared by every process mapping the
+// same file. Values are stored in the byte order of the writer.
+class MappedWeights {
+ public:
+  static const uint64_t kMagic = 0x3154574546464143ULL;  // "CAFFEWT1"
+
+  // Maps filename copy-on-write: writing to the values, as training does,
+  // changes this process's copy of the pages only, never the file.
+  explicit MappedWeights(const string& filename);
+  ~MappedWeights();
+
+  const MappedWeightsIndex& index() const { return index_; }
+  float* data(const MappedWeightsIndex::Blob& blob) const {
+    return reinterpret_cast<float*>(values_ + blob.offset());
+  }
+  // Copies the weights into the layers of param, as a .caffemodel holds
+  // them.
+  void ToProto(NetParameter* param) const;
+  // Sets the shape of proto to that of blob as the .caffemodel held it, in
+  // the deprecated 4D dimensions if it used them, to be checked with
+  // Blob::ShapeEquals.
+  static void ShapeToProto(const MappedWeightsIndex::Blob& blob,
+      BlobProto* proto);
+
+  // Whether filename starts like a mapped weights file.
+  static bool IsMappedWeights(const string& filename);
+  // Writes the blobs of the layers of param, a trained model, to filename.
+  static void Write(const NetParameter& param, const string& filename);
+
+ private:
+  const string filename_;
+  char* data_;
+  size_t bytes_;
+  char* values_;
+  MappedWeightsIndex index_;
+
+  DISABLE_COPY_AND_ASSIGN(MappedWeights);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MAPPED_WEIGHTS_HPP_
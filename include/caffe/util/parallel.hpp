@@ -0,0 +1,100 @@
+#ifndef CAFFE_UTIL_PARALLEL_HPP_
+#define CAFFE_UTIL_PARALLEL_HPP_
+
+#include <boost/function.hpp>
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// CPU parallelism in Caffe goes through parallel_for and TaskGroup, which
+// run on the backend selected at build time (PARALLEL in Makefile.config or
+// CMake):
+//  - USE_OPENMP: OpenMP worksharing loops.
+//  - USE_THREAD_POOL: the work-stealing pool owned by the Caffe singleton
+//    (see util/thread_pool.hpp).
+//  - neither: everything runs serially on the calling thread.
+
+// Returns the number of threads parallel work is spread over, counting the
+// calling thread: the number set by Caffe::set_num_threads or else the
+// default (OMP_NUM_THREADS for OpenMP, the hardware concurrency for the
+// thread pool). Always 1 for the serial backend.
+int parallel_num_threads();
+
+// A grain for parallel_for over the elements of a blob, large enough that
+// each chunk outweighs the cost of handing it to a thread.
+const int kElementGrain = 4096;
+
+// Runs body(chunk_begin, chunk_end) over disjoint chunks of [begin, end)
+// that together cover it, each at least grain long where possible. Used by
+// the thread pool backend of parallel_for.
+void parallel_for_chunks(const int begin, const int end, const int grain,
+    const boost::function<void(int, int)>& body);
+
+template <typename Func>
+class ParallelForChunk {
+ public:
+  explicit ParallelForChunk(const Func& body) : body_(body) {}
+  void operator()(const int begin, const int end) const {
+    for (int i = begin; i < end; ++i) {
+      body_(i);
+    }
+  }
+ private:
+  const Func& body_;
+};
+
+// Calls body(i) for every i in [begin, end), spreading consecutive runs of at
+// least grain indices over the threads, and returns when all calls are done.
+// The calls must be independent of each other. Nested calls are allowed.
+template <typename Func>
+void parallel_for(const int begin, const int end, const Func& body,
+    const int grain = 1) {
+#if defined(USE_OPENMP)
+  if (end - begin <= grain || omp_in_parallel()) {
+    for (int i = begin; i < end; ++i) {
+      body(i);
+    }
+    return;
+  }
+#pragma omp parallel for schedule(dynamic, grain) \
+    num_threads(parallel_num_threads())
+  for (int i = begin; i < end; ++i) {
+    body(i);
+  }
+#elif defined(USE_THREAD_POOL)
+  parallel_for_chunks(begin, end, grain, ParallelForChunk<Func>(body));
+#else
+  for (int i = begin; i < end; ++i) {
+    body(i);
+  }
+#endif
+}
+
+// Runs a group of independent tasks in parallel. Tasks may start as soon as
+// they are added or as late as wait(), which returns once all of them have
+// finished. The destructor waits as well. While it waits, the calling thread
+// runs the group's tasks no other thread has started, and nothing else.
+class TaskGroup {
+ public:
+  TaskGroup();
+  ~TaskGroup();
+
+  void run(const boost::function<void()>& task);
+  void wait();
+
+  class State;
+
+ private:
+  shared_ptr<State> state_;
+
+  DISABLE_COPY_AND_ASSIGN(TaskGroup);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PARALLEL_HPP_
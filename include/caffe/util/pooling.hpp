@@ -0,0 +1,42 @@
+#ifndef CAFFE_UTIL_POOLING_HPP_
+#define CAFFE_UTIL_POOLING_HPP_
+
+namespace caffe {
+
+// Returns true if pool_stride2_cpu handles the given window: square 2x2 or
+// 3x3 with a stride of 2, the pooling layers of nearly all common models.
+bool pool_stride2_supported(const int kernel_h, const int kernel_w,
+    const int stride_h, const int stride_w);
+
+// Enables or disables the pool_stride2_cpu fast path of PoolingLayer, e.g. to
+// compare it with the generic loops in tests and benchmarks. It is enabled
+// by default.
+void set_pool_fast_path(const bool enabled);
+bool pool_fast_path();
+
+// Max or average pools a single height x width plane with a kernel_size x
+// kernel_size window and a stride of 2 into pooled_height x pooled_width
+// outputs, with the same padding and border rules as PoolingLayer. The
+// window is reduced down the rows first and then along the row, so both
+// passes are vectorized across the output width. No max mask is produced.
+template <typename Dtype>
+void pool_stride2_cpu(const Dtype* data_im, const int height, const int width,
+    const int kernel_size, const int pad_h, const int pad_w,
+    const int pooled_height, const int pooled_width, const bool max_pool,
+    Dtype* data_out);
+
+// Max or average pools one height x width plane of a channel-blocked blob,
+// block channels per pixel, into pooled_height x pooled_width outputs with
+// the border rules of PoolingLayer. Every window is reduced across the
+// channels of the block at once, in vector registers for float. No max mask
+// is produced.
+template <typename Dtype>
+void pool_blocked_cpu(const Dtype* data_im, const int height, const int width,
+    const int block, const int kernel_h, const int kernel_w, const int pad_h,
+    const int pad_w, const int stride_h, const int stride_w,
+    const int pooled_height, const int pooled_width, const bool max_pool,
+    Dtype* data_out);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_POOLING_HPP_
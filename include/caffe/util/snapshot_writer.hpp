@@ -0,0 +1,58 @@
+#ifndef CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+#define CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Writes solver snapshots on a background thread.
+ *
+ * Write copies the parameters of the net and the history of the solver into
+ * a staging slot, which is all the training loop waits for, and the thread
+ * serializes them and writes them with WriteProtoToBinaryFileAtomically, so
+ * that a snapshot file is either complete or absent. At most max_pending
+ * snapshots are staged at once; beyond that, Write waits for the oldest to
+ * be written.
+ */
+template <typename Dtype>
+class SnapshotWriter : public InternalThread {
+ public:
+  explicit SnapshotWriter(const int max_pending);
+  virtual ~SnapshotWriter();
+
+  // Stages a snapshot of net, with its diffs if write_diff, to
+  // model_filename, and of state, with history as its history blobs, to
+  // state_filename.
+  void Write(const Net<Dtype>& net, const bool write_diff,
+      const vector<shared_ptr<Blob<Dtype> > >& history,
+      const SolverState& state, const string& model_filename,
+      const string& state_filename);
+  // Waits until every staged snapshot is written.
+  void Wait();
+
+ protected:
+  virtual void InternalThreadEntry();
+
+ private:
+  struct Staging;
+  void WriteStaging(Staging* staging);
+
+  vector<shared_ptr<Staging> > staging_;
+  BlockingQueue<Staging*> free_;
+  BlockingQueue<Staging*> full_;
+
+  DISABLE_COPY_AND_ASSIGN(SnapshotWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
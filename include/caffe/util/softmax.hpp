@@ -0,0 +1,26 @@
+#ifndef CAFFE_UTIL_SOFTMAX_HPP_
+#define CAFFE_UTIL_SOFTMAX_HPP_
+
+namespace caffe {
+
+// Softmax of one of the outer_num independent slices of SoftmaxLayer: the
+// channels x inner_num values of data_in are normalized over the channels
+// for each of the inner_num positions. The max, exp, sum and normalization
+// run as one pass each over the slice while it is in cache, with a
+// vectorized exp for float. scale is scratch space for inner_num values.
+template <typename Dtype>
+void softmax_cpu(const Dtype* data_in, const int channels,
+    const int inner_num, Dtype* data_out, Dtype* scale);
+
+// The gradient of softmax_cpu for one slice:
+//   bottom_diff = (top_diff - dot(top_diff, top_data)) * top_data,
+// with the dot product taken over the channels. scale is scratch space for
+// inner_num values.
+template <typename Dtype>
+void softmax_backward_cpu(const Dtype* top_data, const Dtype* top_diff,
+    const int channels, const int inner_num, Dtype* bottom_diff,
+    Dtype* scale);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SOFTMAX_HPP_
@@ -0,0 +1,43 @@
+#ifndef CAFFE_UTIL_SOLVER_UPDATE_HPP_
+#define CAFFE_UTIL_SOLVER_UPDATE_HPP_
+
+namespace caffe {
+
+// Fused CPU parameter updates of the SGD, Nesterov and AdaGrad solvers. Each
+// makes a single pass over n values of a parameter: it adds the weight decay
+// to the diff, updates the history, writes the update value to the diff, as
+// ComputeUpdateValue does, and, if update_data, subtracts it from the data,
+// as Blob::Update does. Every value is rounded as in the sequence of
+// BLAS calls it replaces, so that the results are the same bit for bit.
+
+enum Regularization {
+  REGULARIZATION_NONE,
+  REGULARIZATION_L1,
+  REGULARIZATION_L2
+};
+
+template <typename Dtype>
+void sgd_update_cpu(const int n, const Dtype rate, const Dtype momentum,
+    const Dtype decay, const Regularization regularization, Dtype* data,
+    Dtype* diff, Dtype* history, const bool update_data);
+
+template <typename Dtype>
+void nesterov_update_cpu(const int n, const Dtype rate, const Dtype momentum,
+    const Dtype decay, const Regularization regularization, Dtype* data,
+    Dtype* diff, Dtype* history, const bool update_data);
+
+template <typename Dtype>
+void adagrad_update_cpu(const int n, const Dtype rate, const Dtype delta,
+    const Dtype decay, const Regularization regularization, Dtype* data,
+    Dtype* diff, Dtype* history, const bool update_data);
+
+// Whether the solvers use the fused updates on the CPU: on by default, and
+// only when the BLAS axpy of Dtype rounds in a way the kernels reproduce,
+// either with a fused multiply-add or with a product and a sum.
+template <typename Dtype>
+bool fused_update();
+void set_fused_update(const bool enabled);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SOLVER_UPDATE_HPP_
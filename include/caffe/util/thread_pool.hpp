@@ -0,0 +1,76 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// The process-wide pool behind the thread pool backend of parallel_for and
+// TaskGroup (see util/parallel.hpp). Use Caffe::thread_pool() rather than
+// creating one.
+//
+// A pool of num_threads runs num_threads - 1 workers; the thread waiting on
+// a TaskGroup works too. Every worker owns a queue: it pushes and pops tasks
+// at the back of its own queue and, when that runs dry, steals the oldest
+// task at the front of another one, trying the workers on its own NUMA node
+// before the others. Threads outside the pool all submit to queue 0 but
+// never run from it: a thread waiting on a TaskGroup only runs the tasks of
+// that group (see TaskGroup::wait), so concurrent callers such as solver
+// replicas or server requests do not end up running each other's work.
+class ThreadPool {
+ public:
+  // With pin_threads, worker i is bound to one core. The workers are split
+  // into equal consecutive groups, one per node of numa_nodes (all nodes if
+  // it is empty), so that the threads of each group share their caches and
+  // memory. The calling thread counts as the first thread of the first group
+  // but is left unpinned.
+  ThreadPool(const int num_threads, const bool pin_threads,
+      const vector<int>& numa_nodes);
+  ~ThreadPool();
+
+  int num_threads() const { return queues_.size(); }
+  // The NUMA node thread i runs on; 0 unless the threads are pinned.
+  int node(const int thread) const { return node_[thread]; }
+
+  // Queues a task on the current thread's queue.
+  void Submit(const boost::function<void()>& task);
+  // Runs one queued task, if there is any. Returns false if all queues were
+  // empty. Only the workers call this; queue 0 is drained by stealing.
+  bool RunOne();
+
+  // The cores of each NUMA node of this machine; a single node with all cores
+  // where the topology is unknown.
+  static vector<vector<int> > NumaTopology();
+
+ private:
+  struct Queue {
+    boost::mutex mutex;
+    std::deque<boost::function<void()> > tasks;
+  };
+
+  bool Pop(const int index, const bool back, boost::function<void()>* task);
+  void WorkerEntry(const int index, const int cpu);
+
+  vector<shared_ptr<Queue> > queues_;
+  // For each thread, the queues to steal from in order of preference.
+  vector<vector<int> > steal_order_;
+  vector<int> node_;
+  vector<shared_ptr<boost::thread> > threads_;
+  // Guards queued_ and stop_; idle workers sleep on wake_.
+  boost::mutex mutex_;
+  boost::condition_variable wake_;
+  int queued_;
+  bool stop_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
@@ -0,0 +1,32 @@
+#ifndef CAFFE_UTIL_TRANSFORM_HPP_
+#define CAFFE_UTIL_TRANSFORM_HPP_
+
+#include <stdint.h>
+
+namespace caffe {
+
+// Row kernels of DataTransformer. Each transforms one row of n values of a
+// channel, y = (x - mean) * scale, where mean is the matching row of the mean
+// image if mean_row is not NULL and mean_value otherwise. If mirror, the row
+// is written to y in reverse order. The uint8 kernel is vectorized with AVX2
+// for float when the CPU supports it.
+template <typename Dtype>
+void transform_row(const uint8_t* x, const int n, const Dtype* mean_row,
+    const Dtype mean_value, const Dtype scale, const bool mirror, Dtype* y);
+template <typename Dtype>
+void transform_row(const float* x, const int n, const Dtype* mean_row,
+    const Dtype mean_value, const Dtype scale, const bool mirror, Dtype* y);
+
+// Splits a row of n interleaved pixels of the given number of channels, as
+// stored by cv::Mat, into one row of n values per channel, n apart.
+void deinterleave_row(const uint8_t* x, const int n, const int channels,
+    uint8_t* y);
+
+// Enables or disables the vectorized kernels, e.g. to compare them with the
+// scalar loops in tests and benchmarks. They are enabled by default.
+void set_transform_simd(const bool enabled);
+bool transform_simd();
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TRANSFORM_HPP_
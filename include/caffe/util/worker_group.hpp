@@ -0,0 +1,49 @@
+#ifndef CAFFE_UTIL_WORKER_GROUP_HPP_
+#define CAFFE_UTIL_WORKER_GROUP_HPP_
+
+#include <boost/function.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace boost { class thread; }
+
+namespace caffe {
+
+// A fixed set of threads kept alive between runs of the same job, such as
+// the decoding and transformation of the items of a batch in a data layer.
+// Unlike parallel_for, which shares the Caffe thread pool with the layers,
+// the threads are owned by the group, and item i always runs on thread
+// i % num_threads, so that per-thread state such as a random generator gives
+// the same results from run to run.
+class WorkerGroup {
+ public:
+  explicit WorkerGroup(const int num_threads);
+  ~WorkerGroup();
+
+  // Calls job(thread, item) for every item in [0, num_items) and returns
+  // when all calls are done. Thread 0 is the calling thread; the calls for
+  // one thread are made in increasing order of item. Not reentrant.
+  void Run(const int num_items, const boost::function<void(int, int)>& job);
+
+  inline int num_threads() const { return threads_.size() + 1; }
+
+  class Sync;
+
+ protected:
+  void WorkerEntry(const int thread);
+  void RunItems(const int thread);
+
+  vector<shared_ptr<boost::thread> > threads_;
+  shared_ptr<Sync> sync_;
+  // The job of the current run.
+  boost::function<void(int, int)> job_;
+  int num_items_;
+
+  DISABLE_COPY_AND_ASSIGN(WorkerGroup);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WORKER_GROUP_HPP_
@@ -24,11 +24,15 @@ template <typename Dtype>
 class BaseConvolutionLayer : public Layer<Dtype> {
  public:
   explicit BaseConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), workspace_(new Blob<Dtype>()),
+        blocked_weights_source_(NULL), blocked_weights_version_(0) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
+  virtual void set_workspace(const shared_ptr<Blob<Dtype> >& workspace) {
+    workspace_ = workspace;
+  }
 
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
@@ -47,15 +51,29 @@ class BaseConvolutionLayer : public Layer<Dtype> {
       weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
 
-
+  // Variants for running the images of different batch shards in parallel:
+  // each shard gets its own slice of the workspace. Images [shard_start(s),
+  // shard_start(s + 1)) form shard s.
+  inline int shard_start(const int shard) const {
+    return num_ * shard / num_shards_;
+  }
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output, int n, bool skip_im2col = false);
+      Dtype* output, int shard, bool skip_im2col = false);
   void forward_cpu_bias(Dtype* output, const Dtype* bias, int n);
+  // Adds the bias (if not NULL) and applies the fused ReLU in one pass over
+  // the output of one image.
+  void forward_cpu_bias_relu(Dtype* output, const Dtype* bias);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output, int n);
+      Dtype* output, int shard);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
-      weights, int n);
+      weights, int shard);
   void backward_cpu_bias(Dtype* bias, const Dtype* input, int n);
+  // Adds the weight gradient of all num_ images to weights. The shards
+  // accumulate in parallel into private buffers, which are then summed into
+  // weights in shard order. The result is bitwise reproducible for a given
+  // number of threads. input_dim and output_dim are the per-image strides.
+  void weight_cpu_gemm_sharded(const Dtype* input, const int input_dim,
+      const Dtype* output, const int output_dim, Dtype* weights);
 
 
 
@@ -64,11 +82,21 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
 
 
-#ifdef XEON_PHI
-  void forward_convolution(const Dtype* input, const Dtype* weight,
-      Dtype* output, const Dtype* bias);
-  void forward_bias(Dtype* output, const Dtype* bias);
-#endif
+  // Forward pass of the DIRECT engine: convolves one image of the given
+  // shard without im2col, adding the bias (if any) in the same sweep.
+  void forward_cpu_direct(const Dtype* input, const Dtype* weights,
+      const Dtype* bias, Dtype* output, int shard);
+  // Forward pass into a channel-blocked top (top_layout_ != NCHW). input is
+  // read in place in plain (in_block == 1) or blocked form; the filters must
+  // have been reordered by reorder_blocked_weights first, which only redoes
+  // the reordering when the version of the weights' SyncedMemory has changed
+  // since.
+  void reorder_blocked_weights();
+  void forward_cpu_blocked(const Dtype* input, const int in_block,
+      const Dtype* bias, Dtype* output);
+  // Returns the data of a bottom as plain NCHW, unblocking it into a scratch
+  // buffer if its producer wrote a blocked layout.
+  const Dtype* nchw_cpu_data(const Blob<Dtype>& bottom);
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -98,6 +126,17 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int height_out_, width_out_;
   bool bias_term_;
   bool is_1x1_;
+  // Number of batch shards the CPU passes split the images into: one per
+  // thread, but no more than there are images.
+  int num_shards_;
+  // Whether Forward_cpu uses forward_cpu_direct instead of im2col + GEMM.
+  bool direct_forward_;
+  // Whether a ReLU is fused into the forward pass (ConvolutionParameter
+  // fuse_relu).
+  bool fuse_relu_;
+  // Layout of the tops: blocked when the net asks for it (LayerParameter
+  // layout) and the filters split evenly into blocks, NCHW otherwise.
+  BlobLayout top_layout_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -130,8 +169,24 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int col_offset_;
   int output_offset_;
 
-  Blob<Dtype> col_buffer_;
+  // Scratch space holding one image's im2col columns, or the padded input
+  // of the DIRECT engine, per shard. It is shared with the other layers of a
+  // Net (see Layer::set_workspace) and only ever grows.
+  shared_ptr<Blob<Dtype> > workspace_;
+  int workspace_offset_;
   Blob<Dtype> bias_multiplier_;
+  // Size of the DIRECT engine's padded, stride-split input per image.
+  int direct_offset_;
+  // Filters in the blocked order of direct_conv_blocked_cpu, and the weight
+  // memory and version (see SyncedMemory::version) they were reordered from;
+  // NULL when they must be reordered again.
+  Blob<Dtype> blocked_weights_;
+  const SyncedMemory* blocked_weights_source_;
+  size_t blocked_weights_version_;
+  // NCHW copy of a blocked bottom for the im2col and DIRECT paths.
+  Blob<Dtype> nchw_buffer_;
+  // Private weight gradients of the batch shards of weight_cpu_gemm_sharded.
+  Blob<Dtype> weight_diff_buffer_;
 };
 
 /**
@@ -178,13 +233,21 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  first group and input channels 3-4 and output channels 5-8 into the second
    *  group.
    *  - bias_term (\b optional, default true). Whether to have a bias.
-   *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-   *    kernels + stream parallelism) engines.
+   *  - engine: convolution has CAFFE (matrix multiplication), DIRECT
+   *    (register-blocked SIMD kernels on the CPU, dispatched at runtime between
+   *    AVX2 and AVX-512) and CUDNN (library kernels + stream parallelism)
+   *    engines. Builds with XEON_PHI default to DIRECT on the CPU.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
 
   virtual inline const char* type() const { return "Convolution"; }
+  // The private weight gradients of the batch shards, when there are
+  // several and the weights are learned.
+  virtual inline size_t BackwardScratchCount() const {
+    return this->num_shards_ > 1 && this->param_propagate_down_[0] ?
+        static_cast<size_t>(this->num_shards_) * this->blobs_[0]->count() : 0;
+  }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -354,6 +417,9 @@ class LRNLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelForward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
+  // CrossChannelForward_cpu for a channel-blocked bottom.
+  virtual void CrossChannelForward_cpu_blocked(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top);
   virtual void WithinChannelForward(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
@@ -376,6 +442,11 @@ class LRNLayer : public Layer<Dtype> {
   // Fields used for normalization ACROSS_CHANNELS
   // scale_ stores the intermediate summing results
   Blob<Dtype> scale_;
+  // Running window sums of the CPU kernels, one plane per image.
+  Blob<Dtype> accum_;
+  // The zero-padded squares of one pixel across the channels, one row per
+  // image, for the blocked layouts.
+  Blob<Dtype> padded_square_;
 
   // Fields used for normalization WITHIN_CHANNEL
   shared_ptr<SplitLayer<Dtype> > split_layer_;
@@ -431,6 +502,14 @@ class PoolingLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // MAX / AVE pooling of a channel-blocked bottom, vectorized across the
+  // channels of a block. No max mask is kept, so there is no Backward.
+  virtual void Forward_cpu_blocked(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  // Generic MAX pooling of num images; the argmax is written to top_mask
+  // and/or mask unless they are NULL.
+  void MaxPoolForward_cpu(const int num, const Dtype* bottom_data,
+      Dtype* top_data, Dtype* top_mask, int* mask);
 
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
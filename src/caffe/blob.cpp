@@ -4,6 +4,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
+#include "caffe/util/blocked_layout.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -55,17 +56,29 @@ template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int height,
     const int width)
   // capacity_ must be initialized before calling Reshape
-  : capacity_(0) {
+  : capacity_(0), layout_(NCHW) {
   Reshape(num, channels, height, width);
 }
 
 template <typename Dtype>
 Blob<Dtype>::Blob(const vector<int>& shape)
   // capacity_ must be initialized before calling Reshape
-  : capacity_(0) {
+  : capacity_(0), layout_(NCHW) {
   Reshape(shape);
 }
 
+template <typename Dtype>
+void Blob<Dtype>::set_layout(const BlobLayout layout) {
+  const int block = blob_layout_block(layout);
+  if (block > 1) {
+    CHECK_EQ(num_axes(), 4) << "Blocked layouts need 4 axes, "
+        << "corresponding to (num, channels, height, width)";
+    CHECK_EQ(channels() % block, 0) << BlobLayout_Name(layout)
+        << " needs a multiple of " << block << " channels.";
+  }
+  layout_ = layout;
+}
+
 template <typename Dtype>
 const Dtype* Blob<Dtype>::cpu_data() const {
   CHECK(data_);
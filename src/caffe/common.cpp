@@ -1,9 +1,14 @@
+#include <boost/thread.hpp>
 #include <glog/logging.h>
+#include <atomic>
 #include <cstdio>
 #include <ctime>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -39,10 +44,68 @@ void GlobalInit(int* pargc, char*** pargv) {
   ::google::InstallFailureSignalHandler();
 }
 
+// Guards the lazy start of the thread pool, which may be first used by any
+// thread, and its restart with new settings.
+static boost::mutex thread_pool_mutex;
+// The running pool, read without the lock by every parallel_for and
+// TaskGroup; NULL until the pool is started and while it is restarted.
+static std::atomic<ThreadPool*> running_thread_pool(NULL);
+
+ThreadPool& Caffe::thread_pool() {
+  ThreadPool* pool = running_thread_pool.load(std::memory_order_acquire);
+  if (pool) {
+    return *pool;
+  }
+  boost::mutex::scoped_lock lock(thread_pool_mutex);
+  Caffe& caffe = Get();
+  if (!caffe.thread_pool_) {
+    caffe.thread_pool_.reset(new ThreadPool(parallel_num_threads(),
+        caffe.pin_threads_, caffe.numa_nodes_));
+  }
+  running_thread_pool.store(caffe.thread_pool_.get(),
+      std::memory_order_release);
+  return *caffe.thread_pool_;
+}
+
+void Caffe::set_num_threads(const int num_threads) {
+  CHECK_GE(num_threads, 0);
+  boost::mutex::scoped_lock lock(thread_pool_mutex);
+  Get().num_threads_ = num_threads;
+  running_thread_pool.store(NULL, std::memory_order_release);
+  Get().thread_pool_.reset();
+}
+
+void Caffe::set_thread_affinity(const bool pin_threads,
+    const vector<int>& numa_nodes) {
+  const int num_nodes = ThreadPool::NumaTopology().size();
+  for (int i = 0; i < numa_nodes.size(); ++i) {
+    CHECK(numa_nodes[i] >= 0 && numa_nodes[i] < num_nodes)
+        << "No NUMA node " << numa_nodes[i] << "; this machine has "
+        << num_nodes << ".";
+  }
+#ifndef USE_THREAD_POOL
+  LOG_IF(WARNING, pin_threads) << "Thread pinning applies to the thread pool "
+      "backend only; use OMP_PROC_BIND and OMP_PLACES with OpenMP.";
+#endif
+  boost::mutex::scoped_lock lock(thread_pool_mutex);
+  Get().pin_threads_ = pin_threads;
+  Get().numa_nodes_ = numa_nodes;
+  running_thread_pool.store(NULL, std::memory_order_release);
+  Get().thread_pool_.reset();
+}
+
+HostAllocator& Caffe::host_allocator() {
+  // Leaked, as blobs owned by static objects may be freed after it would be
+  // destroyed.
+  static HostAllocator* allocator = new HostAllocator();
+  return *allocator;
+}
+
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
-    : random_generator_(), mode_(Caffe::CPU) { }
+    : random_generator_(), mode_(Caffe::CPU), num_threads_(0),
+    pin_threads_(false), solver_count_(1), solver_rank_(0) { }
 
 Caffe::~Caffe() { }
 
@@ -86,7 +149,8 @@ void* Caffe::RNG::generator() {
 
 Caffe::Caffe()
     : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
-    mode_(Caffe::CPU) {
+    mode_(Caffe::CPU), num_threads_(0), pin_threads_(false),
+    solver_count_(1), solver_rank_(0) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
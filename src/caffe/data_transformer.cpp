@@ -8,6 +8,7 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/transform.hpp"
 
 namespace caffe {
 
@@ -38,16 +39,24 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
                                        Dtype* transformed_data) {
-  const string& data = datum.data();
-  const int datum_channels = datum.channels();
-  const int datum_height = datum.height();
-  const int datum_width = datum.width();
+  if (datum.data().size() > 0) {
+    Transform(reinterpret_cast<const uint8_t*>(datum.data().data()),
+        datum.channels(), datum.height(), datum.width(), transformed_data);
+  } else {
+    Transform(datum.float_data().data(), datum.channels(), datum.height(),
+        datum.width(), transformed_data);
+  }
+}
 
+template<typename Dtype>
+template<typename T>
+void DataTransformer<Dtype>::Transform(const T* data,
+    const int datum_channels, const int datum_height, const int datum_width,
+    Dtype* transformed_data) {
   const int crop_size = param_.crop_size();
   const Dtype scale = param_.scale();
   const bool do_mirror = param_.mirror() && Rand(2);
   const bool has_mean_file = param_.has_mean_file();
-  const bool has_uint8 = data.size() > 0;
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(datum_channels, 0);
@@ -90,46 +99,23 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     }
   }
 
-  Dtype datum_element;
-  int top_index, data_index;
+  // One row kernel call per row of each channel of the crop.
   for (int c = 0; c < datum_channels; ++c) {
+    const Dtype mean_value = has_mean_values ? mean_values_[c] : Dtype(0);
     for (int h = 0; h < height; ++h) {
-      for (int w = 0; w < width; ++w) {
-        data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
-        if (do_mirror) {
-          top_index = (c * height + h) * width + (width - 1 - w);
-        } else {
-          top_index = (c * height + h) * width + w;
-        }
-        if (has_uint8) {
-          datum_element =
-            static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-        } else {
-          datum_element = datum.float_data(data_index);
-        }
-        if (has_mean_file) {
-          transformed_data[top_index] =
-            (datum_element - mean[data_index]) * scale;
-        } else {
-          if (has_mean_values) {
-            transformed_data[top_index] =
-              (datum_element - mean_values_[c]) * scale;
-          } else {
-            transformed_data[top_index] = datum_element * scale;
-          }
-        }
-      }
+      const int data_index = (c * datum_height + h_off + h) * datum_width +
+          w_off;
+      transform_row(data + data_index, width,
+          has_mean_file ? mean + data_index : NULL, mean_value, scale,
+          do_mirror, transformed_data + (c * height + h) * width);
     }
   }
 }
 
 template<typename Dtype>
-void DataTransformer<Dtype>::Transform(const Datum& datum,
-                                       Blob<Dtype>* transformed_blob) {
-  const int datum_channels = datum.channels();
-  const int datum_height = datum.height();
-  const int datum_width = datum.width();
-
+void DataTransformer<Dtype>::CheckShape(const int datum_channels,
+    const int datum_height, const int datum_width,
+    const Blob<Dtype>* transformed_blob) {
   const int channels = transformed_blob->channels();
   const int height = transformed_blob->height();
   const int width = transformed_blob->width();
@@ -149,11 +135,26 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     CHECK_EQ(datum_height, height);
     CHECK_EQ(datum_width, width);
   }
+}
 
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const Datum& datum,
+                                       Blob<Dtype>* transformed_blob) {
+  CheckShape(datum.channels(), datum.height(), datum.width(),
+      transformed_blob);
   Dtype* transformed_data = transformed_blob->mutable_cpu_data();
   Transform(datum, transformed_data);
 }
 
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const uint8_t* data,
+    const int channels, const int height, const int width,
+    Blob<Dtype>* transformed_blob) {
+  CheckShape(channels, height, width, transformed_blob);
+  Transform(data, channels, height, width,
+      transformed_blob->mutable_cpu_data());
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const vector<Datum> & datum_vector,
                                        Blob<Dtype>* transformed_blob) {
@@ -265,32 +266,18 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   CHECK(cv_cropped_img.data);
 
   Dtype* transformed_data = transformed_blob->mutable_cpu_data();
-  int top_index;
+  // Each row of the crop is split into channels, which go through the row
+  // kernel one by one.
+  vector<uint8_t> channel_rows(img_channels * width);
   for (int h = 0; h < height; ++h) {
-    const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
-    int img_index = 0;
-    for (int w = 0; w < width; ++w) {
-      for (int c = 0; c < img_channels; ++c) {
-        if (do_mirror) {
-          top_index = (c * height + h) * width + (width - 1 - w);
-        } else {
-          top_index = (c * height + h) * width + w;
-        }
-        // int top_index = (c * height + h) * width + w;
-        Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
-        if (has_mean_file) {
-          int mean_index = (c * img_height + h_off + h) * img_width + w_off + w;
-          transformed_data[top_index] =
-            (pixel - mean[mean_index]) * scale;
-        } else {
-          if (has_mean_values) {
-            transformed_data[top_index] =
-              (pixel - mean_values_[c]) * scale;
-          } else {
-            transformed_data[top_index] = pixel * scale;
-          }
-        }
-      }
+    deinterleave_row(cv_cropped_img.ptr<uchar>(h), width, img_channels,
+        &channel_rows[0]);
+    for (int c = 0; c < img_channels; ++c) {
+      const int mean_index = (c * img_height + h_off + h) * img_width + w_off;
+      transform_row(&channel_rows[c * width], width,
+          has_mean_file ? mean + mean_index : NULL,
+          has_mean_values ? mean_values_[c] : Dtype(0), scale, do_mirror,
+          transformed_data + (c * height + h) * width);
     }
   }
 }
@@ -1,16 +1,16 @@
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/blocked_layout.hpp"
+#include "caffe/util/direct_conv.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
-#include <pmmintrin.h>
-#include <immintrin.h>
-
-
 namespace caffe {
 
 template <typename Dtype>
@@ -66,7 +66,6 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 #ifdef XEON_PHI_ESSENTIAL_DEBUG
   LOG(INFO) << "XEON group:" << group_;
 #endif
-  CHECK_EQ(group_, 1)<<"ROHITH: Bad assumption";
   CHECK_EQ(channels_ % group_, 0);
   CHECK_EQ(num_output_ % group_, 0)
       << "Number of output should be multiples of group.";
@@ -107,6 +106,19 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  // The DIRECT engine only replaces the forward convolution; deconvolution
+  // keeps im2col + GEMM. XEON_PHI builds use it unless told otherwise.
+  ConvolutionParameter_Engine engine = conv_param.engine();
+#ifdef XEON_PHI
+  if (engine == ConvolutionParameter_Engine_DEFAULT) {
+    engine = ConvolutionParameter_Engine_DIRECT;
+  }
+#endif
+  direct_forward_ = engine == ConvolutionParameter_Engine_DIRECT
+      && !reverse_dimensions();
+  fuse_relu_ = conv_param.fuse_relu();
+  CHECK(!fuse_relu_ || !reverse_dimensions())
+      << "Deconvolution does not support fuse_relu.";
 }
 
 template <typename Dtype>
@@ -139,6 +151,26 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 #endif
     top[top_id]->Reshape(num_, num_output_, height_out_, width_out_);
   }
+  // Write channel-blocked tops when the net asks for them and the blocked
+  // kernel applies; otherwise fall back to NCHW.
+  const BlobLayout layout = this->layer_param_.layout();
+  const int block = blob_layout_block(layout);
+  top_layout_ = block > 1 && group_ == 1 && num_output_ % block == 0
+      && !reverse_dimensions() ? layout : NCHW;
+  for (int top_id = 0; top_id < top.size(); ++top_id) {
+    top[top_id]->set_layout(top_layout_);
+  }
+  if (top_layout_ != NCHW) {
+    blocked_weights_.ReshapeLike(*this->blobs_[0]);
+    // The block size may have changed with the layout.
+    blocked_weights_source_ = NULL;
+  } else {
+    for (int bottom_id = 0; bottom_id < bottom.size(); ++bottom_id) {
+      if (bottom[bottom_id]->layout() != NCHW) {
+        nchw_buffer_.ReshapeLike(*bottom[bottom_id]);
+      }
+    }
+  }
   if (reverse_dimensions()) {
     conv_in_height_ = height_out_;
     conv_in_width_ = width_out_;
@@ -152,21 +184,27 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   weight_offset_ = conv_out_channels_ * kernel_dim_ / group_ / group_;
   col_offset_ = kernel_dim_ * conv_out_spatial_dim_ / group_;
   output_offset_ = conv_out_channels_ * conv_out_spatial_dim_ / group_;
-  // The im2col result buffer will only hold one image at a time to avoid
-  // overly large memory usage. In the special case of 1x1 convolution
-  // it goes lazily unused to save memory.
-  if (reverse_dimensions()) {
-#ifdef XEON_PHI_ESSENTIAL_DEBUG
-    LOG(INFO)<<"---> Reverse: kdim:"<< kernel_dim_ <<" height:"<< height_<<
-	       " width:"<< width_;
-#endif
-    col_buffer_.Reshape(num_, kernel_dim_, height_, width_);
-  } else {
-#ifdef XEON_PHI_ESSENTIAL_DEBUG
-    LOG(INFO)<<"---> kdim:"<< kernel_dim_ <<" height:"<< height_out_<<
-	       " width:"<< width_out_;
-#endif
-    col_buffer_.Reshape(num_, kernel_dim_, height_out_, width_out_);
+  // Each shard needs the im2col columns of one image at a time (except for
+  // 1x1 convolution, which multiplies the input in place) or, for the
+  // DIRECT engine, one padded copy of the input when it cannot read the
+  // bottom in place. The workspace is sized by the number of threads rather
+  // than the batch, and may be shared with other layers, so only grow it.
+  direct_offset_ = 0;
+  if (direct_forward_) {
+    direct_offset_ = direct_conv_workspace_size(conv_in_channels_ / group_,
+        conv_in_height_, conv_in_width_, pad_h_, pad_w_, stride_w_);
+  }
+  num_shards_ = std::max(1, std::min(num_, parallel_num_threads()));
+  const int col_size = is_1x1_ ? 0 : kernel_dim_ * conv_out_spatial_dim_;
+  workspace_offset_ = std::max(col_size, direct_offset_);
+  const int workspace_size = std::max(1, num_shards_ * workspace_offset_);
+  if (workspace_->count() < workspace_size) {
+    workspace_->Reshape(vector<int>(1, workspace_size));
+  }
+  // Allocate it here so that shards running in parallel never race on the
+  // first allocation.
+  if (Caffe::mode() == Caffe::CPU) {
+    workspace_->mutable_cpu_data();
   }
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   if (bias_term_) {
@@ -183,9 +221,9 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
   const Dtype* col_buff = input;
   if (!is_1x1_) {
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, workspace_->mutable_cpu_data());
     }
-    col_buff = col_buffer_.cpu_data();
+    col_buff = workspace_->cpu_data();
   }
   for (int g = 0; g < group_; ++g) {
 
@@ -219,13 +257,15 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
-    const Dtype* weights, Dtype* output, int n, bool skip_im2col) {
+    const Dtype* weights, Dtype* output, int shard, bool skip_im2col) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
+    Dtype* workspace =
+        workspace_->mutable_cpu_data() + workspace_offset_ * shard;
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data() + col_offset_ * n);
+      conv_im2col_cpu(input, workspace);
     }
-    col_buff = col_buffer_.cpu_data() + col_offset_ * n;
+    col_buff = workspace;
   }
   for (int g = 0; g < group_; ++g) {
 
@@ -256,10 +296,24 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
       (Dtype)1., output);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_bias_relu(Dtype* output,
+    const Dtype* bias) {
+  const int spatial_dim = height_out_ * width_out_;
+  for (int o = 0; o < num_output_; ++o) {
+    const Dtype b = bias ? bias[o] : Dtype(0);
+    Dtype* out = output + o * spatial_dim;
+    for (int i = 0; i < spatial_dim; ++i) {
+      out[i] = std::max(out[i] + b, Dtype(0));
+    }
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
-    const Dtype* weights, Dtype* input, int n) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data() + col_offset_ * n;
+    const Dtype* weights, Dtype* input, int shard) {
+  Dtype* col_buff =
+      workspace_->mutable_cpu_data() + workspace_offset_ * shard;
   if (is_1x1_) {
     col_buff = input;
   }
@@ -276,11 +330,13 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
-    const Dtype* output, Dtype* weights, int n) {
+    const Dtype* output, Dtype* weights, int shard) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data() + col_offset_ * n);
-    col_buff = col_buffer_.cpu_data() + col_offset_ * n;
+    Dtype* workspace =
+        workspace_->mutable_cpu_data() + workspace_offset_ * shard;
+    conv_im2col_cpu(input, workspace);
+    col_buff = workspace;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
@@ -297,6 +353,45 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_sharded(const Dtype* input,
+    const int input_dim, const Dtype* output, const int output_dim,
+    Dtype* weights) {
+  if (num_shards_ == 1) {
+    for (int n = 0; n < num_; ++n) {
+      weight_cpu_gemm(input + input_dim * n, output + output_dim * n, weights,
+          0);
+    }
+    return;
+  }
+  // One private weight gradient per shard, so that no two images add into
+  // the shared weight diff at once. It is only allocated here, by nets that
+  // learn the weights, and before the shards start so that they never race
+  // on the allocation.
+  const int count = this->blobs_[0]->count();
+  weight_diff_buffer_.Reshape(vector<int>(1, num_shards_ * count));
+  Dtype* shard_diff = weight_diff_buffer_.mutable_cpu_data();
+  parallel_for(0, num_shards_, [&](int s) {
+    Dtype* diff = shard_diff + count * s;
+    caffe_set(count, Dtype(0), diff);
+    for (int n = shard_start(s); n < shard_start(s + 1); ++n) {
+      weight_cpu_gemm(input + input_dim * n, output + output_dim * n, diff, s);
+    }
+  });
+  // Reduce over disjoint chunks of the weights in parallel; within a chunk
+  // the shards are always added in the same order.
+  const int kChunk = 4096;
+  const int chunks = (count + kChunk - 1) / kChunk;
+  parallel_for(0, chunks, [&](int c) {
+    const int offset = kChunk * c;
+    const int len = std::min(kChunk, count - offset);
+    for (int s = 0; s < num_shards_; ++s) {
+      caffe_axpy(len, Dtype(1), shard_diff + count * s + offset,
+          weights + offset);
+    }
+  });
+}
+
 
 
 
@@ -340,7 +435,7 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
+  Dtype* col_buff = workspace_->mutable_cpu_data();
   if (is_1x1_) {
     col_buff = input;
   }
@@ -360,8 +455,8 @@ void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    conv_im2col_cpu(input, workspace_->mutable_cpu_data());
+    col_buff = workspace_->cpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
@@ -379,207 +474,61 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
 }
 
 
-#ifdef XEON_PHI
-
-/* Perform convolution using for loops */
-void BaseConvolutionLayer<float>::forward_convolution(const float* input,
-    const float* weight, float* output, const float *bias) {
-
-  float b[8];
-  float *a = b;
-
-#ifdef XEON_PHI_ESSENTIAL_DEBUG
-  LOG(INFO)<<"inChan:"<<conv_in_channels_<<" outChan:"<<
-	     conv_out_channels_<<" height_out:"<<height_out_<<
-	     " width_out:"<<width_out_<<" kernel_h:"<<kernel_h_<<
-	     " kernel_w:"<<kernel_w_;
-#endif
-
-  if(!bias){
-    memset(output, 0, conv_out_channels_ * height_out_ * width_out_ * sizeof(float));
-  }
-  else{
-    for(int outChan = 0; outChan < conv_out_channels_; ++outChan) {
-      /* Loop over output image height */
-      for(int h = 0; h < height_out_; ++h) {
-        /* Loop over output image width */
-        for(int w = 0; w < width_out_; ++w) {
-          output[outChan * height_out_ * width_out_ + h * width_out_ + w] = bias[outChan];
-        }
-      }
-    }
-  }
-
-
-/* TODO: what about group? */
-  //for (int g = 0; g < group_; ++g) {
-  /* Loop for number of input channels */
-  for(int inChan = 0; inChan < conv_in_channels_; ++inChan) {
-    /* Loop over all output channels */
-    for(int outChan = 0; outChan < conv_out_channels_; ++outChan) {
-      /* Loop over output image height */
-      for(int h = 0; h < height_out_; ++h) {
-        /* Loop over output image width */
-        for(int w = 0; w < 8*(width_out_/8); w+=8) {
-
-          /* Loop over kernel image height */
-          for(int i = 0; i < kernel_h_; ++i) {
-            /* Loop over kernel image width */
-            for(int j = 0; j < kernel_w_; ++j) {
-
-              __m256 num1 = _mm256_setr_ps (input[inChan * conv_in_height_ * conv_in_width_ +
-                             (h+i) * conv_in_width_ + (w+0) + j],
-                                         input[inChan * conv_in_height_ * conv_in_width_ +
-                             (h+i) * conv_in_width_ + (w+1) + j],
-                                         input[inChan * conv_in_height_ * conv_in_width_ +
-                             (h+i) * conv_in_width_ + (w+2) + j],
-                                         input[inChan * conv_in_height_ * conv_in_width_ +
-                             (h+i) * conv_in_width_ + (w+3) + j],
-                                         input[inChan * conv_in_height_ * conv_in_width_ +
-                             (h+i) * conv_in_width_ + (w+4) + j],
-                                         input[inChan * conv_in_height_ * conv_in_width_ +
-                             (h+i) * conv_in_width_ + (w+5) + j],
-                                         input[inChan * conv_in_height_ * conv_in_width_ +
-                             (h+i) * conv_in_width_ + (w+6) + j],
-                                         input[inChan * conv_in_height_ * conv_in_width_ +
-                             (h+i) * conv_in_width_ + (w+7) + j]);
-              __m256 num2 = _mm256_set1_ps (weight[outChan * conv_in_channels_ * kernel_h_ * kernel_w_ +
-                  inChan * kernel_h_ * kernel_w_ + i * kernel_w_ + j]);
-
-              // __m256 num3 = _mm256_setzero_ps();
-
-              __m256 num3 = _mm256_loadu_ps(output + outChan * height_out_ * width_out_ + h * width_out_ + w);
-
-              // num3 = _mm256_fmadd_ps(num1, num2, num3);
-
-              __m256 num4 = _mm256_mul_ps(num1, num2);
-
-              num4 = _mm256_add_ps(num4, num3);
-
-              _mm256_storeu_ps (output + outChan * height_out_ * width_out_ + h * width_out_ + w, num4);
-
-
-
-              // LOG(INFO)<<"avx shit 2";
-              // for(int d = 0; d < 8; ++d)
-                // *(__m256 *)output[outChan * height_out_ * width_out_ + h * width_out_ + w] = num3;
-
-            }
-          }
-        }
-
-        for(int w = 8*(width_out_/8); w < width_out_; w++) {
-          /* Loop over kernel image height */
-          for(int i = 0; i < kernel_h_; ++i) {
-            /* Loop over kernel image width */
-            for(int j = 0; j < kernel_w_; ++j) {
-
-              output[outChan * height_out_ * width_out_ + h * width_out_ + w] +=
-                  input[inChan * conv_in_height_ * conv_in_width_ +
-                             (h+i) * conv_in_width_ + (w+j)] *
-                                 weight[outChan * conv_in_channels_ * kernel_h_ * kernel_w_ +
-                  inChan * kernel_h_ * kernel_w_ +
-                  i * kernel_w_ + j];
-            }
-          }
-        }
-      }
-    }
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_direct(const Dtype* input,
+    const Dtype* weights, const Dtype* bias, Dtype* output, int shard) {
+  Dtype* workspace = NULL;
+  if (direct_offset_ > 0) {
+    workspace = workspace_->mutable_cpu_data() + workspace_offset_ * shard;
+  }
+  const int in_channels = conv_in_channels_ / group_;
+  const int out_channels = conv_out_channels_ / group_;
+  for (int g = 0; g < group_; ++g) {
+    direct_conv_cpu(input + in_channels * conv_in_height_ * conv_in_width_ * g,
+        in_channels, conv_in_height_, conv_in_width_, kernel_h_, kernel_w_,
+        pad_h_, pad_w_, stride_h_, stride_w_, weights + weight_offset_ * g,
+        bias ? bias + out_channels * g : NULL, out_channels, fuse_relu_,
+        workspace, output + output_offset_ * g);
   }
-  //}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-//   memset(output, 0, conv_out_channels_ * height_out_ * width_out_ * sizeof(Dtype));
-
-//   /* TODO: what about group? */
-//   //for (int g = 0; g < group_; ++g) {
-//   /* Loop for number of input channels */
-//   for(int inChan = 0; inChan < conv_in_channels_; ++inChan) {
-//     /* Loop over all output channels */
-//     for(int outChan = 0; outChan < conv_out_channels_; ++outChan) {
-//       /* Loop over output image height */
-//       for(int h = 0; h < height_out_; ++h) {
-// 	/* Loop over output image width */
-// 	for(int w = 0; w < width_out_; ++w) {
-// 	   //Loop over kernel image height
-// 	  for(int i = 0; i < kernel_h_; ++i) {
-// 	    /* Loop over kernel image width */
-// 	    for(int j = 0; j < kernel_w_; ++j) {
-
-// 	      output[outChan * height_out_ * width_out_ + h * width_out_ + w] +=
-// 	          input[inChan * conv_in_height_ * conv_in_width_ +
-// 		                   (h+i) * conv_in_width_ + (w+j)] *
-//     	                     weight[outChan * conv_in_channels_ * kernel_h_ * kernel_w_ +
-// 				    inChan * kernel_h_ * kernel_w_ +
-// 				    i * kernel_w_ + j];
-// 	    }
-// 	  }
-// 	}
-//       }
-//     }
-//   }
-//   //}
 }
 
-
-
-/*
- * Performing the equivalent of:
- * output = alpha * bias * input + beta * output
- * where alpha = beta = 1
- */
 template <typename Dtype>
-void BaseConvolutionLayer<Dtype>::forward_bias(Dtype* output,
-    const Dtype* bias) {
-  const Dtype* input = bias_multiplier_.cpu_data();
-
-#ifdef XEON_PHI_ESSENTIAL_DEBUG
-  LOG(INFO)<<" outChan:"<<conv_out_channels_<<" height_out:"<<
-	     height_out_<<" width_out:"<<width_out_;
-#endif
+void BaseConvolutionLayer<Dtype>::reorder_blocked_weights() {
+  const SyncedMemory* source = this->blobs_[0]->data().get();
+  // Read before reordering, so a write bumping the version meanwhile is
+  // picked up by the next call.
+  const size_t version = source->version();
+  if (source == blocked_weights_source_ &&
+      version == blocked_weights_version_) {
+    return;
+  }
+  direct_conv_blocked_weights(this->blobs_[0]->cpu_data(), num_output_,
+      channels_, kernel_h_, kernel_w_, blob_layout_block(top_layout_),
+      blocked_weights_.mutable_cpu_data());
+  blocked_weights_source_ = source;
+  blocked_weights_version_ = version;
+}
 
-  /* Loop over all output channels */
-  for(int outChan = 0; outChan < num_output_; ++outChan) {
-    /* Loop over output image height */
-    for(int h = 0; h < height_out_; ++h) {
-      /* Loop over output image width */
-      for(int w = 0; w < width_out_; ++w) {
-	output[outChan * height_out_ * width_out_ + width_out_ * h + w] +=
-	    bias[outChan] * input[h * width_out_ + w];
-      }
-    }
-  }
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_blocked(const Dtype* input,
+    const int in_block, const Dtype* bias, Dtype* output) {
+  direct_conv_blocked_cpu(input, channels_, height_, width_, in_block,
+      kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+      blocked_weights_.cpu_data(), bias, num_output_,
+      blob_layout_block(top_layout_), fuse_relu_, output);
 }
 
-#endif /* XEON_PHI */
+template <typename Dtype>
+const Dtype* BaseConvolutionLayer<Dtype>::nchw_cpu_data(
+    const Blob<Dtype>& bottom) {
+  if (bottom.layout() == NCHW) {
+    return bottom.cpu_data();
+  }
+  blocked_to_nchw_cpu(bottom.cpu_data(), bottom.num(), bottom.channels(),
+      bottom.height() * bottom.width(), blob_layout_block(bottom.layout()),
+      nchw_buffer_.mutable_cpu_data());
+  return nchw_buffer_.cpu_data();
+}
 
 
 #ifndef CPU_ONLY
@@ -590,9 +539,9 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_gemm(const Dtype* input,
   const Dtype* col_buff = input;
   if (!is_1x1_) {
     if (!skip_im2col) {
-      conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
+      conv_im2col_gpu(input, workspace_->mutable_gpu_data());
     }
-    col_buff = col_buffer_.gpu_data();
+    col_buff = workspace_->gpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
@@ -613,7 +562,7 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_bias(Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_gpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_gpu_data();
+  Dtype* col_buff = workspace_->mutable_gpu_data();
   if (is_1x1_) {
     col_buff = input;
   }
@@ -633,8 +582,8 @@ void BaseConvolutionLayer<Dtype>::weight_gpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
-    col_buff = col_buffer_.gpu_data();
+    conv_im2col_gpu(input, workspace_->mutable_gpu_data());
+    col_buff = workspace_->gpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
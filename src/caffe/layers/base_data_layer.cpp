@@ -1,8 +1,11 @@
+#include <boost/thread.hpp>
+
 #include <string>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 
 namespace caffe {
@@ -13,6 +16,18 @@ BaseDataLayer<Dtype>::BaseDataLayer(const LayerParameter& param)
       transform_param_(param.transform_param()) {
 }
 
+template <typename Dtype>
+int BaseDataLayer<Dtype>::WorkerBatchSize(const int batch_size) const {
+  if (this->phase_ != TRAIN) {
+    return batch_size;
+  }
+  CHECK_EQ(batch_size % Caffe::solver_count(), 0) << "The batch size "
+      << batch_size << " of " << this->layer_param_.name() << " must be a "
+      << "multiple of the " << Caffe::solver_count()
+      << " data-parallel workers.";
+  return batch_size / Caffe::solver_count();
+}
+
 template <typename Dtype>
 void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -28,32 +43,62 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   data_transformer_->InitRand();
 }
 
+template <typename Dtype>
+BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
+    const LayerParameter& param)
+    : BaseDataLayer<Dtype>(param),
+      prefetch_(param.data_param().prefetch()),
+      prefetch_current_(NULL) {
+  CHECK_GT(prefetch_.size(), 0) << "At least one batch must be prefetched.";
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i].reset(new Batch<Dtype>());
+  }
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
-  // Now, start the prefetch thread. Before calling prefetch, we make two
-  // cpu_data calls so that the prefetch thread does not accidentally make
-  // simultaneous cudaMalloc calls when the main thread is running. In some
-  // GPUs this seems to cause failures if we do not so.
-  this->prefetch_data_.mutable_cpu_data();
-  if (this->output_labels_) {
-    this->prefetch_label_.mutable_cpu_data();
+  // Before starting the prefetch thread, we make cpu_data calls so that the
+  // prefetch thread does not accidentally make simultaneous cudaMalloc calls
+  // when the main thread is running. In some GPUs this seems to cause
+  // failures if we do not so.
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i]->data_.mutable_cpu_data();
+    if (this->output_labels_) {
+      prefetch_[i]->label_.mutable_cpu_data();
+    }
+    prefetch_free_.push(prefetch_[i].get());
+  }
+  // The first transformer is data_transformer_; the others are seeded from
+  // the Caffe random generator in order, so that a seeded run is repeatable
+  // for a given number of workers.
+  const int num_workers = this->layer_param_.data_param().transform_threads();
+  CHECK_GT(num_workers, 0);
+  transformers_.clear();
+  transformers_.push_back(this->data_transformer_);
+  for (int i = 1; i < num_workers; ++i) {
+    transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+    transformers_[i]->InitRand();
   }
+  transform_workers_.reset(new WorkerGroup(num_workers));
   DLOG(INFO) << "Initializing prefetch";
-  this->CreatePrefetchThread();
-  DLOG(INFO) << "Prefetch initialized.";
-}
-
-template <typename Dtype>
-void BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread() {
-  this->data_transformer_->InitRand();
   CHECK(StartInternalThread()) << "Thread execution failed";
+  DLOG(INFO) << "Prefetch initialized.";
 }
 
 template <typename Dtype>
-void BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread() {
-  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      Batch<Dtype>* batch = prefetch_free_.pop();
+      load_batch(batch);
+      prefetch_full_.push(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
 }
 
 template <typename Dtype>
@@ -62,23 +107,22 @@ void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
 #ifdef XEON_PHI_DEBUG  
   LOG(INFO) << "Forward_cpu in BasePrefetchDataLayer";
 #endif
-  // First, join the thread
-  JoinPrefetchThread();
-  DLOG(INFO) << "Thread joined";
-  // Reshape to loaded data.
-  top[0]->Reshape(this->prefetch_data_.num(), this->prefetch_data_.channels(),
-      this->prefetch_data_.height(), this->prefetch_data_.width());
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-             top[0]->mutable_cpu_data());
-  DLOG(INFO) << "Prefetch copied";
+  // The net is done with the batch the tops point at.
+  if (prefetch_current_) {
+    prefetch_free_.push(prefetch_current_);
+  }
+  CPUTimer timer;
+  timer.Start();
+  Batch<Dtype>* batch = prefetch_full_.pop("Data layer prefetch queue empty");
+  DLOG(INFO) << "Prefetch wait time: " << timer.MilliSeconds() << " ms.";
+  // Point the tops at the loaded batch.
+  top[0]->ReshapeLike(batch->data_);
+  top[0]->set_cpu_data(batch->data_.mutable_cpu_data());
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-               top[1]->mutable_cpu_data());
+    top[1]->ReshapeLike(batch->label_);
+    top[1]->set_cpu_data(batch->label_.mutable_cpu_data());
   }
-  // Start a new prefetch thread
-  DLOG(INFO) << "CreatePrefetchThread";
-  CreatePrefetchThread();
+  prefetch_current_ = batch;
 }
 
 #ifdef CPU_ONLY
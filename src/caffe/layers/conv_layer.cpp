@@ -2,16 +2,12 @@
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/blocked_layout.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
-
-#include <pmmintrin.h>
-#include <immintrin.h>
-#include <cilk/cilk.h>
-#include <cilk/reducer.h>
-
 namespace caffe {
 
 template <typename Dtype>
@@ -29,47 +25,50 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   LOG(INFO) << "XEON conv_layer.cpp: Forward_cpu";
 #endif
   const Dtype* weight = this->blobs_[0]->cpu_data();
-#ifdef XEON_PHI
-  for(int i = 0; i < bottom.size(); ++i) {
-    const Dtype* bottom_data = bottom[i]->cpu_data();
-    Dtype* top_data = top[i]->mutable_cpu_data();
-
-    cilk_for(int n = 0; n < this->num_; ++n) {
-      if(this->bias_term_) {
-        const Dtype* bias = this->blobs_[1]->cpu_data();
-        /* Forward convolution */
-        this->forward_convolution(bottom_data + bottom[i]->offset(n),
-                                  weight,
-                                  top_data + top[i]->offset(n),
-                                  bias);
-      }
-      else{
-        this->forward_convolution(bottom_data + bottom[i]->offset(n),
-                                  weight,
-                                  top_data + top[i]->offset(n),
-                                  NULL);
-      }
-
- //      if(this->bias_term_) {
-        // const Dtype* bias = this->blobs_[1]->cpu_data();
-        // this->forward_bias(top_data + top[i]->offset(n), bias);
- //      }
+  if (this->top_layout_ != NCHW) {
+    const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+    this->reorder_blocked_weights();
+    for (int i = 0; i < bottom.size(); ++i) {
+      const Dtype* bottom_data = bottom[i]->cpu_data();
+      const int in_block = blob_layout_block(bottom[i]->layout());
+      Dtype* top_data = top[i]->mutable_cpu_data();
+      parallel_for(0, this->num_, [&](int n) {
+        this->forward_cpu_blocked(bottom_data + bottom[i]->offset(n),
+            in_block, bias, top_data + top[i]->offset(n));
+      });
+    }
+    return;
+  }
+  if (this->direct_forward_) {
+    const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+    for (int i = 0; i < bottom.size(); ++i) {
+      const Dtype* bottom_data = this->nchw_cpu_data(*bottom[i]);
+      Dtype* top_data = top[i]->mutable_cpu_data();
+      parallel_for(0, this->num_shards_, [&](int s) {
+        for (int n = this->shard_start(s); n < this->shard_start(s + 1); ++n) {
+          this->forward_cpu_direct(bottom_data + bottom[i]->offset(n), weight,
+              bias, top_data + top[i]->offset(n), s);
+        }
+      });
     }
+    return;
   }
-#else
   for (int i = 0; i < bottom.size(); ++i) {
-    const Dtype* bottom_data = bottom[i]->cpu_data();
+    const Dtype* bottom_data = this->nchw_cpu_data(*bottom[i]);
     Dtype* top_data = top[i]->mutable_cpu_data();
     for (int n = 0; n < this->num_; ++n) {
       this->forward_cpu_gemm(bottom_data + bottom[i]->offset(n), weight,
-          top_data + top[i]->offset(n), n);
-      if (this->bias_term_) {
+          top_data + top[i]->offset(n), 0);
+      if (this->fuse_relu_) {
+        const Dtype* bias =
+            this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+        this->forward_cpu_bias_relu(top_data + top[i]->offset(n), bias);
+      } else if (this->bias_term_) {
         const Dtype* bias = this->blobs_[1]->cpu_data();
         this->forward_cpu_bias(top_data + top[i]->offset(n), bias, n);
       }
     }
   }
-#endif
 }
 
 template <typename Dtype>
@@ -85,6 +84,16 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         this->blobs_[1]->mutable_cpu_diff());
   }
   for (int i = 0; i < top.size(); ++i) {
+    CHECK(top[i]->layout() == NCHW && bottom[i]->layout() == NCHW)
+        << "Backward is only implemented for the NCHW layout.";
+    if (this->fuse_relu_) {
+      // Backward of the fused ReLU, in place as for an in-place ReLU layer.
+      const Dtype* top_data = top[i]->cpu_data();
+      Dtype* top_diff = top[i]->mutable_cpu_diff();
+      for (int j = 0; j < top[i]->count(); ++j) {
+        top_diff[j] = top_data[j] > 0 ? top_diff[j] : Dtype(0);
+      }
+    }
     const Dtype* top_diff = top[i]->cpu_diff();
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
@@ -99,15 +108,18 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
 
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
-          cilk_for (int n = 0; n < this->num_; ++n)
-          this->weight_cpu_gemm(bottom_data + bottom[i]->offset(n),
-              top_diff + top[i]->offset(n), weight_diff, n);
+          this->weight_cpu_gemm_sharded(bottom_data, bottom[i]->count(1),
+              top_diff, top[i]->count(1), weight_diff);
         }
         // gradient w.r.t. bottom data, if necessary.
         if (propagate_down[i]) {
-          cilk_for (int n = 0; n < this->num_; ++n)
-          this->backward_cpu_gemm(top_diff + top[i]->offset(n), weight,
-              bottom_diff + bottom[i]->offset(n), n);
+          parallel_for(0, this->num_shards_, [&](int s) {
+            for (int n = this->shard_start(s); n < this->shard_start(s + 1);
+                 ++n) {
+              this->backward_cpu_gemm(top_diff + top[i]->offset(n), weight,
+                  bottom_diff + bottom[i]->offset(n), s);
+            }
+          });
         }
 
     }
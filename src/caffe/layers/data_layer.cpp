@@ -1,8 +1,10 @@
+#include <boost/bind.hpp>
 #include <opencv2/core/core.hpp>
 
 #include <stdint.h>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/common.hpp"
@@ -18,7 +20,7 @@ namespace caffe {
 
 template <typename Dtype>
 DataLayer<Dtype>::~DataLayer<Dtype>() {
-  this->JoinPrefetchThread();
+  this->StopInternalThread();
 }
 
 template <typename Dtype>
@@ -28,6 +30,22 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   db_.reset(db::GetDB(this->layer_param_.data_param().backend()));
   db_->Open(this->layer_param_.data_param().source(), db::READ);
   cursor_.reset(db_->NewCursor());
+  if (this->layer_param_.data_param().shuffle()) {
+    CHECK(cursor_->random_access()) << "Shuffling needs a database backend "
+        << "with random access, such as RECORDS";
+    LOG(INFO) << "Shuffling data";
+    const unsigned int prefetch_rng_seed = caffe_rng_rand();
+    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+    order_.resize(cursor_->size());
+    CHECK_GT(order_.size(), 0) << "No records to shuffle in "
+        << this->layer_param_.data_param().source();
+    for (size_t i = 0; i < order_.size(); ++i) {
+      order_[i] = i;
+    }
+    ShuffleRecords();
+    order_id_ = 0;
+    cursor_->Seek(order_[0]);
+  }
 
   // Check if we should randomly skip a few data points
   if (this->layer_param_.data_param().rand_skip()) {
@@ -35,7 +53,14 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
                         this->layer_param_.data_param().rand_skip();
     LOG(INFO) << "Skipping first " << skip << " data points.";
     while (skip-- > 0) {
-      cursor_->Next();
+      Next();
+    }
+  }
+  // In data-parallel training each worker reads its own share of the
+  // records: those at its rank, modulo the number of workers.
+  if (this->phase_ == TRAIN) {
+    for (int i = 0; i < Caffe::solver_rank(); ++i) {
+      Next();
     }
   }
   // Read a data point, and use it to initialize the top blob.
@@ -52,115 +77,167 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 #ifdef XEON_PHI_DEBUG  
   LOG(INFO) << "XEON: crop_size:" << crop_size;
 #endif
+  const int batch_size = this->WorkerBatchSize(
+      this->layer_param_.data_param().batch_size());
   if (crop_size > 0) {
-    top[0]->Reshape(this->layer_param_.data_param().batch_size(),
-        datum.channels(), crop_size, crop_size);
-    this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-        datum.channels(), crop_size, crop_size);
+    top[0]->Reshape(batch_size, datum.channels(), crop_size, crop_size);
     this->transformed_data_.Reshape(1, datum.channels(), crop_size, crop_size);
   } else {
-    top[0]->Reshape(
-        this->layer_param_.data_param().batch_size(), datum.channels(),
+    top[0]->Reshape(batch_size, datum.channels(),
         datum.height(), datum.width());
-    this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-        datum.channels(), datum.height(), datum.width());
     this->transformed_data_.Reshape(1, datum.channels(),
       datum.height(), datum.width());
   }
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*top[0]);
+  }
   LOG(INFO) << "output data size: " << top[0]->num() << ","
       << top[0]->channels() << "," << top[0]->height() << ","
       << top[0]->width();
   // label
   if (this->output_labels_) {
-    vector<int> label_shape(1, this->layer_param_.data_param().batch_size());
+    vector<int> label_shape(1, batch_size);
     top[1]->Reshape(label_shape);
-    this->prefetch_label_.Reshape(label_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_.Reshape(label_shape);
+    }
   }
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on the prefetch thread. The datums are read from
+// the database in order, then decoded and transformed by the workers.
 template <typename Dtype>
-void DataLayer<Dtype>::InternalThreadEntry() {
+void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer batch_timer;
   batch_timer.Start();
-  double read_time = 0;
-  double trans_time = 0;
   CPUTimer timer;
-  CHECK(this->prefetch_data_.count());
+  CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
 
+  timer.Start();
+  const int batch_size = this->WorkerBatchSize(
+      this->layer_param_.data_param().batch_size());
+  const int stride = this->phase_ == TRAIN ? Caffe::solver_count() : 1;
+  value_refs_.resize(batch_size);
+  values_.resize(batch_size);
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    const char* data;
+    size_t size;
+    cursor_->value_ref(&data, &size);
+    if (!cursor_->values_stay_valid()) {
+      values_[item_id].assign(data, size);
+      data = values_[item_id].data();
+    }
+    value_refs_[item_id] = std::make_pair(data, size);
+    for (int i = 0; i < stride; ++i) {
+      Next();
+    }
+  }
+  const double read_time = timer.MicroSeconds();
+
   // Reshape on single input batches for inputs of varying dimension.
-  const int batch_size = this->layer_param_.data_param().batch_size();
   const int crop_size = this->layer_param_.transform_param().crop_size();
-  bool force_color = this->layer_param_.data_param().force_encoded_color();
   if (batch_size == 1 && crop_size == 0) {
     Datum datum;
-    datum.ParseFromString(cursor_->value());
+    datum.ParseFromArray(value_refs_[0].first, value_refs_[0].second);
     if (datum.encoded()) {
-      if (force_color) {
+      if (this->layer_param_.data_param().force_encoded_color()) {
         DecodeDatum(&datum, true);
       } else {
         DecodeDatumNative(&datum);
       }
     }
-    this->prefetch_data_.Reshape(1, datum.channels(),
-        datum.height(), datum.width());
+    batch->data_.Reshape(1, datum.channels(), datum.height(), datum.width());
     this->transformed_data_.Reshape(1, datum.channels(),
         datum.height(), datum.width());
   }
-
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
   Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
-
   if (this->output_labels_) {
-    top_label = this->prefetch_label_.mutable_cpu_data();
+    top_label = batch->label_.mutable_cpu_data();
   }
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
-    // get a blob
-    Datum datum;
-    datum.ParseFromString(cursor_->value());
 
-    cv::Mat cv_img;
-    if (datum.encoded()) {
-      if (force_color) {
-        cv_img = DecodeDatumToCVMat(datum, true);
-      } else {
-        cv_img = DecodeDatumToCVMatNative(datum);
-      }
-      if (cv_img.channels() != this->transformed_data_.channels()) {
-        LOG(WARNING) << "Your dataset contains encoded images with mixed "
-        << "channel sizes. Consider adding a 'force_color' flag to the "
-        << "model definition, or rebuild your dataset using "
-        << "convert_imageset.";
-      }
-    }
-    read_time += timer.MicroSeconds();
-    timer.Start();
+  timer.Start();
+  this->transform_workers_->Run(batch_size, boost::bind(
+      &DataLayer<Dtype>::load_item, this, _1, _2, top_data, top_label));
+  const double trans_time = timer.MicroSeconds();
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
+  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
+  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+}
 
-    // Apply data transformations (mirror, scale, crop...)
-    int offset = this->prefetch_data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    if (datum.encoded()) {
-      this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    } else {
-      this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    }
-    if (this->output_labels_) {
-      top_label[item_id] = datum.label();
-    }
-    trans_time += timer.MicroSeconds();
-    // go to the next iter
+template <typename Dtype>
+void DataLayer<Dtype>::Next() {
+  if (order_.empty()) {
     cursor_->Next();
     if (!cursor_->valid()) {
       DLOG(INFO) << "Restarting data prefetching from start.";
       cursor_->SeekToFirst();
     }
+    return;
+  }
+  if (++order_id_ == order_.size()) {
+    DLOG(INFO) << "Restarting data prefetching in a new order.";
+    ShuffleRecords();
+    order_id_ = 0;
+  }
+  cursor_->Seek(order_[order_id_]);
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::ShuffleRecords() {
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(order_.begin(), order_.end(), prefetch_rng);
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::load_item(const int thread_id, const int item_id,
+    Dtype* top_data, Dtype* top_label) {
+  // Apply data transformations (mirror, scale, crop...) in place in the
+  // batch, through a blob of the worker's own.
+  Blob<Dtype> transformed_data;
+  transformed_data.ReshapeLike(this->transformed_data_);
+  transformed_data.set_cpu_data(
+      top_data + item_id * transformed_data.count());
+  DataTransformer<Dtype>* transformer = this->transformers_[thread_id].get();
+  // Read the datum in place, and hand its pixels to the transformer without
+  // copying them; only datums of float_data are parsed into a Datum.
+  const std::pair<const char*, size_t>& value = value_refs_[item_id];
+  DatumView view;
+  int label;
+  if (!ParseDatumView(value.first, value.second, &view)) {
+    Datum datum;
+    CHECK(datum.ParseFromArray(value.first, value.second))
+        << "Cannot parse datum " << item_id;
+    transformer->Transform(datum, &transformed_data);
+    label = datum.label();
+  } else if (view.encoded) {
+    cv::Mat cv_img;
+    if (this->layer_param_.data_param().force_encoded_color()) {
+      cv_img = DecodeDatumToCVMat(view, true);
+    } else {
+      cv_img = DecodeDatumToCVMatNative(view);
+    }
+    if (cv_img.channels() != this->transformed_data_.channels()) {
+      LOG(WARNING) << "Your dataset contains encoded images with mixed "
+      << "channel sizes. Consider adding a 'force_color' flag to the "
+      << "model definition, or rebuild your dataset using "
+      << "convert_imageset.";
+    }
+    transformer->Transform(cv_img, &transformed_data);
+    label = view.label;
+  } else {
+    CHECK_EQ(view.data_size, view.channels * view.height * view.width)
+        << "Datum data does not match its shape";
+    transformer->Transform(view.data, view.channels, view.height, view.width,
+        &transformed_data);
+    label = view.label;
+  }
+  if (this->output_labels_) {
+    top_label[item_id] = label;
   }
-  batch_timer.Stop();
-  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
-  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
 INSTANTIATE_CLASS(DataLayer);
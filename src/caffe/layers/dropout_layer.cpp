@@ -7,6 +7,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -39,11 +40,12 @@ void DropoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   unsigned int* mask = rand_vec_.mutable_cpu_data();
   const int count = bottom[0]->count();
   if (this->phase_ == TRAIN) {
-    // Create random numbers
+    // Create random numbers. The mask is drawn serially so that it only
+    // depends on the random seed, not on the number of threads.
     caffe_rng_bernoulli(count, 1. - threshold_, mask);
-    for (int i = 0; i < count; ++i) {
+    parallel_for(0, count, [&](int i) {
       top_data[i] = bottom_data[i] * mask[i] * scale_;
-    }
+    }, kElementGrain);
   } else {
     caffe_copy(bottom[0]->count(), bottom_data, top_data);
   }
@@ -59,9 +61,9 @@ void DropoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     if (this->phase_ == TRAIN) {
       const unsigned int* mask = rand_vec_.cpu_data();
       const int count = bottom[0]->count();
-      for (int i = 0; i < count; ++i) {
+      parallel_for(0, count, [&](int i) {
         bottom_diff[i] = top_diff[i] * mask[i] * scale_;
-      }
+      }, kElementGrain);
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
     }
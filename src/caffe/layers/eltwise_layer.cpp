@@ -1,9 +1,11 @@
 
+#include <algorithm>
 #include <cfloat>
 #include <vector>
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -46,69 +48,90 @@ void EltwiseLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void EltwiseLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  int* mask = NULL;
-  const Dtype* bottom_data_a = NULL;
-  const Dtype* bottom_data_b = NULL;
   const int count = top[0]->count();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  switch (op_) {
-  case EltwiseParameter_EltwiseOp_PROD:
-    caffe_mul(count, bottom[0]->cpu_data(), bottom[1]->cpu_data(), top_data);
-    for (int i = 2; i < bottom.size(); ++i) {
-      caffe_mul(count, top_data, bottom[i]->cpu_data(), top_data);
-    }
-    break;
-  case EltwiseParameter_EltwiseOp_SUM:
-    caffe_set(count, Dtype(0), top_data);
-    // TODO(shelhamer) does BLAS optimize to sum for coeff = 1?
-    for (int i = 0; i < bottom.size(); ++i) {
-      caffe_axpy(count, coeffs_[i], bottom[i]->cpu_data(), top_data);
-    }
-    break;
-  case EltwiseParameter_EltwiseOp_MAX:
-    // Initialize
-    mask = max_idx_.mutable_cpu_data();
-    caffe_set(count, -1, mask);
-    caffe_set(count, Dtype(-FLT_MAX), top_data);
-    // bottom 0 & 1
-    bottom_data_a = bottom[0]->cpu_data();
-    bottom_data_b = bottom[1]->cpu_data();
-    for (int idx = 0; idx < count; ++idx) {
-      if (bottom_data_a[idx] > bottom_data_b[idx]) {
-        top_data[idx] = bottom_data_a[idx];  // maxval
-        mask[idx] = 0;  // maxid
-      } else {
-        top_data[idx] = bottom_data_b[idx];  // maxval
-        mask[idx] = 1;  // maxid
+  int* mask = op_ == EltwiseParameter_EltwiseOp_MAX ?
+      max_idx_.mutable_cpu_data() : NULL;
+  vector<const Dtype*> bottom_datas(bottom.size());
+  for (int i = 0; i < bottom.size(); ++i) {
+    bottom_datas[i] = bottom[i]->cpu_data();
+  }
+  // Every chunk of kElementGrain elements is independent of the others.
+  parallel_for(0, (count - 1) / kElementGrain + 1, [&](int chunk) {
+    const int offset = chunk * kElementGrain;
+    const int n = std::min(kElementGrain, count - offset);
+    Dtype* top_chunk = top_data + offset;
+    const Dtype* bottom_data_a = NULL;
+    const Dtype* bottom_data_b = NULL;
+    int* mask_chunk = NULL;
+    switch (op_) {
+    case EltwiseParameter_EltwiseOp_PROD:
+      caffe_mul(n, bottom_datas[0] + offset,
+          bottom_datas[1] + offset, top_chunk);
+      for (int i = 2; i < bottom.size(); ++i) {
+        caffe_mul(n, top_chunk, bottom_datas[i] + offset, top_chunk);
       }
-    }
-    // bottom 2++
-    for (int blob_idx = 2; blob_idx < bottom.size(); ++blob_idx) {
-      bottom_data_b = bottom[blob_idx]->cpu_data();
-      for (int idx = 0; idx < count; ++idx) {
-        if (bottom_data_b[idx] > top_data[idx]) {
-          top_data[idx] = bottom_data_b[idx];  // maxval
-          mask[idx] = blob_idx;  // maxid
+      break;
+    case EltwiseParameter_EltwiseOp_SUM:
+      caffe_set(n, Dtype(0), top_chunk);
+      // TODO(shelhamer) does BLAS optimize to sum for coeff = 1?
+      for (int i = 0; i < bottom.size(); ++i) {
+        caffe_axpy(n, coeffs_[i], bottom_datas[i] + offset, top_chunk);
+      }
+      break;
+    case EltwiseParameter_EltwiseOp_MAX:
+      mask_chunk = mask + offset;
+      // bottom 0 & 1
+      bottom_data_a = bottom_datas[0] + offset;
+      bottom_data_b = bottom_datas[1] + offset;
+      for (int idx = 0; idx < n; ++idx) {
+        if (bottom_data_a[idx] > bottom_data_b[idx]) {
+          top_chunk[idx] = bottom_data_a[idx];  // maxval
+          mask_chunk[idx] = 0;  // maxid
+        } else {
+          top_chunk[idx] = bottom_data_b[idx];  // maxval
+          mask_chunk[idx] = 1;  // maxid
         }
       }
+      // bottom 2++
+      for (int blob_idx = 2; blob_idx < bottom.size(); ++blob_idx) {
+        bottom_data_b = bottom_datas[blob_idx] + offset;
+        for (int idx = 0; idx < n; ++idx) {
+          if (bottom_data_b[idx] > top_chunk[idx]) {
+            top_chunk[idx] = bottom_data_b[idx];  // maxval
+            mask_chunk[idx] = blob_idx;  // maxid
+          }
+        }
+      }
+      break;
+    default:
+      LOG(FATAL) << "Unknown elementwise operation.";
     }
-    break;
-  default:
-    LOG(FATAL) << "Unknown elementwise operation.";
-  }
+  });
 }
 
 template <typename Dtype>
 void EltwiseLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  const int* mask = NULL;
   const int count = top[0]->count();
   const Dtype* top_data = top[0]->cpu_data();
   const Dtype* top_diff = top[0]->cpu_diff();
+  const int* mask = op_ == EltwiseParameter_EltwiseOp_MAX ?
+      max_idx_.cpu_data() : NULL;
+  vector<const Dtype*> bottom_datas(bottom.size());
   for (int i = 0; i < bottom.size(); ++i) {
-    if (propagate_down[i]) {
-      const Dtype* bottom_data = bottom[i]->cpu_data();
-      Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
+    bottom_datas[i] = bottom[i]->cpu_data();
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (!propagate_down[i]) {
+      continue;
+    }
+    const Dtype* bottom_data = bottom_datas[i];
+    Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
+    parallel_for(0, (count - 1) / kElementGrain + 1, [&](int chunk) {
+      const int offset = chunk * kElementGrain;
+      const int n = std::min(kElementGrain, count - offset);
+      Dtype* diff_chunk = bottom_diff + offset;
       switch (op_) {
       case EltwiseParameter_EltwiseOp_PROD:
         if (stable_prod_grad_) {
@@ -116,28 +139,27 @@ void EltwiseLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
           for (int j = 0; j < bottom.size(); ++j) {
             if (i == j) { continue; }
             if (!initialized) {
-              caffe_copy(count, bottom[j]->cpu_data(), bottom_diff);
+              caffe_copy(n, bottom_datas[j] + offset, diff_chunk);
               initialized = true;
             } else {
-              caffe_mul(count, bottom[j]->cpu_data(), bottom_diff,
-                        bottom_diff);
+              caffe_mul(n, bottom_datas[j] + offset, diff_chunk,
+                        diff_chunk);
             }
           }
         } else {
-          caffe_div(count, top_data, bottom_data, bottom_diff);
+          caffe_div(n, top_data + offset, bottom_data + offset, diff_chunk);
         }
-        caffe_mul(count, bottom_diff, top_diff, bottom_diff);
+        caffe_mul(n, diff_chunk, top_diff + offset, diff_chunk);
         break;
       case EltwiseParameter_EltwiseOp_SUM:
         if (coeffs_[i] == Dtype(1)) {
-          caffe_copy(count, top_diff, bottom_diff);
+          caffe_copy(n, top_diff + offset, diff_chunk);
         } else {
-          caffe_cpu_scale(count, coeffs_[i], top_diff, bottom_diff);
+          caffe_cpu_scale(n, coeffs_[i], top_diff + offset, diff_chunk);
         }
         break;
       case EltwiseParameter_EltwiseOp_MAX:
-        mask = max_idx_.cpu_data();
-        for (int index = 0; index < count; ++index) {
+        for (int index = offset; index < offset + n; ++index) {
           Dtype gradient = 0;
           if (mask[index] == i) {
             gradient += top_diff[index];
@@ -148,7 +170,7 @@ void EltwiseLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       default:
         LOG(FATAL) << "Unknown elementwise operation.";
       }
-    }
+    });
   }
 }
 
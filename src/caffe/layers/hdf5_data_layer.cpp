@@ -76,6 +76,10 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Refuse transformation parameters since HDF5 is totally generic.
   CHECK(!this->layer_param_.has_transform_param()) <<
       this->type() << " does not transform data.";
+  // Every data-parallel worker would read all the rows.
+  CHECK(this->phase_ != TRAIN || Caffe::solver_count() == 1)
+      << this->type() << " does not shard its data between data-parallel "
+      << "workers; use Data or ImageData.";
   // Read the source to parse the filenames.
   const string& source = this->layer_param_.hdf5_data_param().source();
   LOG(INFO) << "Loading list of HDF5 filenames from: " << source;
@@ -1,4 +1,5 @@
 
+#include <boost/bind.hpp>
 #include <opencv2/core/core.hpp>
 
 #include <fstream>  // NOLINT(readability/streams)
@@ -18,7 +19,7 @@ namespace caffe {
 
 template <typename Dtype>
 ImageDataLayer<Dtype>::~ImageDataLayer<Dtype>() {
-  this->JoinPrefetchThread();
+  this->StopInternalThread();
 }
 
 template <typename Dtype>
@@ -60,6 +61,14 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_GT(lines_.size(), skip) << "Not enough points to skip";
     lines_id_ = skip;
   }
+  // In data-parallel training each worker reads its own share of the lines:
+  // those at its rank, modulo the number of workers. The workers shuffle
+  // and skip alike, as they share the random seed.
+  if (this->phase_ == TRAIN) {
+    for (int i = 0; i < Caffe::solver_rank(); ++i) {
+      NextLine();
+    }
+  }
   // Read an image, and use it to initialize the top blob.
   cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
                                     new_height, new_width, is_color);
@@ -68,23 +77,27 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int width = cv_img.cols;
   // image
   const int crop_size = this->layer_param_.transform_param().crop_size();
-  const int batch_size = this->layer_param_.image_data_param().batch_size();
+  const int batch_size = this->WorkerBatchSize(
+      this->layer_param_.image_data_param().batch_size());
   if (crop_size > 0) {
     top[0]->Reshape(batch_size, channels, crop_size, crop_size);
-    this->prefetch_data_.Reshape(batch_size, channels, crop_size, crop_size);
     this->transformed_data_.Reshape(1, channels, crop_size, crop_size);
   } else {
     top[0]->Reshape(batch_size, channels, height, width);
-    this->prefetch_data_.Reshape(batch_size, channels, height, width);
     this->transformed_data_.Reshape(1, channels, height, width);
   }
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*top[0]);
+  }
   LOG(INFO) << "output data size: " << top[0]->num() << ","
       << top[0]->channels() << "," << top[0]->height() << ","
       << top[0]->width();
   // label
   vector<int> label_shape(1, batch_size);
   top[1]->Reshape(label_shape);
-  this->prefetch_label_.Reshape(label_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.Reshape(label_shape);
+  }
 }
 
 template <typename Dtype>
@@ -94,70 +107,87 @@ void ImageDataLayer<Dtype>::ShuffleImages() {
   shuffle(lines_.begin(), lines_.end(), prefetch_rng);
 }
 
-// This function is used to create a thread that prefetches the data.
 template <typename Dtype>
-void ImageDataLayer<Dtype>::InternalThreadEntry() {
+void ImageDataLayer<Dtype>::NextLine() {
+  lines_id_++;
+  if (lines_id_ >= static_cast<int>(lines_.size())) {
+    // We have reached the end. Restart from the first.
+    DLOG(INFO) << "Restarting data prefetching from start.";
+    lines_id_ = 0;
+    if (this->layer_param_.image_data_param().shuffle()) {
+      ShuffleImages();
+    }
+  }
+}
+
+// This function is called on the prefetch thread. The images of the batch
+// are picked in order, then read and transformed by the workers.
+template <typename Dtype>
+void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer batch_timer;
   batch_timer.Start();
-  double read_time = 0;
-  double trans_time = 0;
   CPUTimer timer;
-  CHECK(this->prefetch_data_.count());
+  CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
   ImageDataParameter image_data_param = this->layer_param_.image_data_param();
-  const int batch_size = image_data_param.batch_size();
+  const int batch_size = this->WorkerBatchSize(image_data_param.batch_size());
   const int new_height = image_data_param.new_height();
   const int new_width = image_data_param.new_width();
   const int crop_size = this->layer_param_.transform_param().crop_size();
   const bool is_color = image_data_param.is_color();
   string root_folder = image_data_param.root_folder();
 
+  const int lines_size = lines_.size();
+  // Data-parallel workers skip the lines of the others.
+  const int stride = this->phase_ == TRAIN ? Caffe::solver_count() : 1;
+  batch_lines_.resize(batch_size);
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    CHECK_GT(lines_size, lines_id_);
+    batch_lines_[item_id] = lines_[lines_id_];
+    for (int i = 0; i < stride; ++i) {
+      NextLine();
+    }
+  }
+
   // Reshape on single input batches for inputs of varying dimension.
   if (batch_size == 1 && crop_size == 0 && new_height == 0 && new_width == 0) {
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
+    cv::Mat cv_img = ReadImageToCVMat(root_folder + batch_lines_[0].first,
         0, 0, is_color);
-    this->prefetch_data_.Reshape(1, cv_img.channels(),
-        cv_img.rows, cv_img.cols);
+    batch->data_.Reshape(1, cv_img.channels(), cv_img.rows, cv_img.cols);
     this->transformed_data_.Reshape(1, cv_img.channels(),
         cv_img.rows, cv_img.cols);
   }
 
-  Dtype* prefetch_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* prefetch_label = this->prefetch_label_.mutable_cpu_data();
-
-  // datum scales
-  const int lines_size = lines_.size();
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    timer.Start();
-    CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int offset = this->prefetch_data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
-
-    prefetch_label[item_id] = lines_[lines_id_].second;
-    // go to the next iter
-    lines_id_++;
-    if (lines_id_ >= lines_size) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      lines_id_ = 0;
-      if (this->layer_param_.image_data_param().shuffle()) {
-        ShuffleImages();
-      }
-    }
-  }
+  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
+  Dtype* prefetch_label = batch->label_.mutable_cpu_data();
+  timer.Start();
+  this->transform_workers_->Run(batch_size, boost::bind(
+      &ImageDataLayer<Dtype>::load_item, this, _1, _2, prefetch_data,
+      prefetch_label));
+  const double load_time = timer.MicroSeconds();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
-  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  DLOG(INFO) << "Read and transform time: " << load_time / 1000 << " ms.";
+}
+
+template <typename Dtype>
+void ImageDataLayer<Dtype>::load_item(const int thread_id, const int item_id,
+    Dtype* prefetch_data, Dtype* prefetch_label) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const std::pair<std::string, int>& line = batch_lines_[item_id];
+  cv::Mat cv_img = ReadImageToCVMat(image_data_param.root_folder() +
+      line.first, image_data_param.new_height(), image_data_param.new_width(),
+      image_data_param.is_color());
+  CHECK(cv_img.data) << "Could not load " << line.first;
+  // Apply transformations (mirror, crop...) to the image, in place in the
+  // batch, through a blob of the worker's own.
+  Blob<Dtype> transformed_data;
+  transformed_data.ReshapeLike(this->transformed_data_);
+  transformed_data.set_cpu_data(
+      prefetch_data + item_id * transformed_data.count());
+  this->transformers_[thread_id]->Transform(cv_img, &transformed_data);
+  prefetch_label[item_id] = line.second;
 }
 
 INSTANTIATE_CLASS(ImageDataLayer);
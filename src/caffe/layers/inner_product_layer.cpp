@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -15,6 +16,7 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int num_output = this->layer_param_.inner_product_param().num_output();
   bias_term_ = this->layer_param_.inner_product_param().bias_term();
+  fuse_relu_ = this->layer_param_.inner_product_param().fuse_relu();
   N_ = num_output;
   const int axis = bottom[0]->CanonicalAxisIndex(
       this->layer_param_.inner_product_param().axis());
@@ -92,7 +94,16 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* weight = this->blobs_[0]->cpu_data();
   caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
       bottom_data, weight, (Dtype)0., top_data);
-  if (bias_term_) {
+  if (fuse_relu_) {
+    // Bias and ReLU in one pass over the output.
+    const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+    for (int m = 0; m < M_; ++m) {
+      Dtype* out = top_data + m * N_;
+      for (int n = 0; n < N_; ++n) {
+        out[n] = std::max(out[n] + (bias ? bias[n] : Dtype(0)), Dtype(0));
+      }
+    }
+  } else if (bias_term_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         bias_multiplier_.cpu_data(),
         this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
@@ -103,6 +114,14 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+  if (fuse_relu_) {
+    // Backward of the fused ReLU, in place as for an in-place ReLU layer.
+    const Dtype* top_data = top[0]->cpu_data();
+    Dtype* top_diff = top[0]->mutable_cpu_diff();
+    for (int i = 0; i < top[0]->count(); ++i) {
+      top_diff[i] = top_data[i] > 0 ? top_diff[i] : Dtype(0);
+    }
+  }
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
@@ -1,12 +1,220 @@
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/blocked_layout.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_LRN_X86
+#include <immintrin.h>
+#endif
+
 namespace caffe {
 
+namespace {
+
+// Pixels per task of the cross channel kernels: a window of size_ channel
+// rows of a tile stays in L1 while the tile is swept through the channels.
+const int kTile = 256;
+
+template <typename Dtype>
+inline Dtype lrn_negative_pow(const Dtype x, const Dtype beta) {
+  // x^-0.75 = 1 / sqrt(x * sqrt(x)), for the usual beta of 0.75.
+  return beta == Dtype(0.75) ? Dtype(1) / std::sqrt(x * std::sqrt(x)) :
+      std::pow(x, -beta);
+}
+
+// One channel of the forward sweep over a tile of len pixels:
+//   accum += head^2, scale = k + alpha_over_size * accum,
+//   out = in * scale^-beta, accum -= tail^2.
+// head and tail are NULL where the window overhangs the channel range.
+template <typename Dtype>
+void lrn_forward_step_scalar(const Dtype* in, const Dtype* head,
+    const Dtype* tail, const int len, const Dtype k,
+    const Dtype alpha_over_size, const Dtype beta, Dtype* accum, Dtype* scale,
+    Dtype* out) {
+  for (int p = 0; p < len; ++p) {
+    Dtype a = accum[p];
+    if (head) {
+      a += head[p] * head[p];
+    }
+    const Dtype s = k + alpha_over_size * a;
+    scale[p] = s;
+    out[p] = in[p] * lrn_negative_pow(s, beta);
+    if (tail) {
+      a -= tail[p] * tail[p];
+    }
+    accum[p] = a;
+  }
+}
+
+// One channel of the backward sweep, with the ratios r = top_diff * top_data
+// / scale of the window rows:
+//   accum += r_head, diff = top_diff * scale^-beta
+//       - cache_ratio * bottom * accum, accum -= r_tail.
+// The rows of head (tail) are NULL where the window overhangs.
+template <typename Dtype>
+void lrn_backward_step_scalar(const Dtype* top_diff, const Dtype* scale,
+    const Dtype* bottom, const Dtype* head_diff, const Dtype* head_data,
+    const Dtype* head_scale, const Dtype* tail_diff, const Dtype* tail_data,
+    const Dtype* tail_scale, const int len, const Dtype beta,
+    const Dtype cache_ratio, Dtype* accum, Dtype* diff) {
+  for (int p = 0; p < len; ++p) {
+    Dtype a = accum[p];
+    if (head_diff) {
+      a += head_diff[p] * head_data[p] / head_scale[p];
+    }
+    diff[p] = top_diff[p] * lrn_negative_pow(scale[p], beta)
+        - cache_ratio * bottom[p] * a;
+    if (tail_diff) {
+      a -= tail_diff[p] * tail_data[p] / tail_scale[p];
+    }
+    accum[p] = a;
+  }
+}
+
+#ifdef CAFFE_LRN_X86
+
+bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("fma");
+  return has_avx2;
+}
+
+__attribute__((target("avx2,fma")))
+inline __m256 pow_minus_three_quarters(const __m256 x) {
+  return _mm256_div_ps(_mm256_set1_ps(1.f),
+      _mm256_sqrt_ps(_mm256_mul_ps(x, _mm256_sqrt_ps(x))));
+}
+
+__attribute__((target("avx2,fma")))
+void lrn_forward_step_avx2(const float* in, const float* head,
+    const float* tail, const int len, const float k,
+    const float alpha_over_size, float* accum, float* scale, float* out) {
+  const __m256 vk = _mm256_set1_ps(k);
+  const __m256 valpha = _mm256_set1_ps(alpha_over_size);
+  int p = 0;
+  for (; p + 8 <= len; p += 8) {
+    __m256 a = _mm256_loadu_ps(accum + p);
+    if (head) {
+      const __m256 h = _mm256_loadu_ps(head + p);
+      a = _mm256_fmadd_ps(h, h, a);
+    }
+    const __m256 s = _mm256_fmadd_ps(valpha, a, vk);
+    _mm256_storeu_ps(scale + p, s);
+    _mm256_storeu_ps(out + p,
+        _mm256_mul_ps(_mm256_loadu_ps(in + p), pow_minus_three_quarters(s)));
+    if (tail) {
+      const __m256 t = _mm256_loadu_ps(tail + p);
+      a = _mm256_fnmadd_ps(t, t, a);
+    }
+    _mm256_storeu_ps(accum + p, a);
+  }
+  lrn_forward_step_scalar(in + p, head ? head + p : NULL,
+      tail ? tail + p : NULL, len - p, k, alpha_over_size, 0.75f, accum + p,
+      scale + p, out + p);
+}
+
+__attribute__((target("avx2,fma")))
+void lrn_backward_step_avx2(const float* top_diff, const float* scale,
+    const float* bottom, const float* head_diff, const float* head_data,
+    const float* head_scale, const float* tail_diff, const float* tail_data,
+    const float* tail_scale, const int len, const float cache_ratio,
+    float* accum, float* diff) {
+  const __m256 vratio = _mm256_set1_ps(cache_ratio);
+  int p = 0;
+  for (; p + 8 <= len; p += 8) {
+    __m256 a = _mm256_loadu_ps(accum + p);
+    if (head_diff) {
+      a = _mm256_add_ps(a, _mm256_div_ps(
+          _mm256_mul_ps(_mm256_loadu_ps(head_diff + p),
+              _mm256_loadu_ps(head_data + p)),
+          _mm256_loadu_ps(head_scale + p)));
+    }
+    const __m256 d = _mm256_mul_ps(_mm256_loadu_ps(top_diff + p),
+        pow_minus_three_quarters(_mm256_loadu_ps(scale + p)));
+    _mm256_storeu_ps(diff + p, _mm256_fnmadd_ps(
+        _mm256_mul_ps(vratio, _mm256_loadu_ps(bottom + p)), a, d));
+    if (tail_diff) {
+      a = _mm256_sub_ps(a, _mm256_div_ps(
+          _mm256_mul_ps(_mm256_loadu_ps(tail_diff + p),
+              _mm256_loadu_ps(tail_data + p)),
+          _mm256_loadu_ps(tail_scale + p)));
+    }
+    _mm256_storeu_ps(accum + p, a);
+  }
+  const bool has_head = head_diff != NULL;
+  const bool has_tail = tail_diff != NULL;
+  lrn_backward_step_scalar(top_diff + p, scale + p, bottom + p,
+      has_head ? head_diff + p : NULL, has_head ? head_data + p : NULL,
+      has_head ? head_scale + p : NULL, has_tail ? tail_diff + p : NULL,
+      has_tail ? tail_data + p : NULL, has_tail ? tail_scale + p : NULL,
+      len - p, 0.75f, cache_ratio, accum + p, diff + p);
+}
+
+#endif  // CAFFE_LRN_X86
+
+template <typename Dtype>
+inline void lrn_forward_step(const Dtype* in, const Dtype* head,
+    const Dtype* tail, const int len, const Dtype k,
+    const Dtype alpha_over_size, const Dtype beta, Dtype* accum,
+    Dtype* scale, Dtype* out) {
+  lrn_forward_step_scalar(in, head, tail, len, k, alpha_over_size, beta,
+      accum, scale, out);
+}
+
+template <typename Dtype>
+inline void lrn_backward_step(const Dtype* top_diff, const Dtype* scale,
+    const Dtype* bottom, const Dtype* head_diff, const Dtype* head_data,
+    const Dtype* head_scale, const Dtype* tail_diff, const Dtype* tail_data,
+    const Dtype* tail_scale, const int len, const Dtype beta,
+    const Dtype cache_ratio, Dtype* accum, Dtype* diff) {
+  lrn_backward_step_scalar(top_diff, scale, bottom, head_diff, head_data,
+      head_scale, tail_diff, tail_data, tail_scale, len, beta, cache_ratio,
+      accum, diff);
+}
+
+#ifdef CAFFE_LRN_X86
+
+// float with the usual beta of 0.75 runs vectorized where the CPU allows.
+inline void lrn_forward_step(const float* in, const float* head,
+    const float* tail, const int len, const float k,
+    const float alpha_over_size, const float beta, float* accum,
+    float* scale, float* out) {
+  if (beta == 0.75f && cpu_has_avx2()) {
+    lrn_forward_step_avx2(in, head, tail, len, k, alpha_over_size, accum,
+        scale, out);
+  } else {
+    lrn_forward_step_scalar(in, head, tail, len, k, alpha_over_size, beta,
+        accum, scale, out);
+  }
+}
+
+inline void lrn_backward_step(const float* top_diff, const float* scale,
+    const float* bottom, const float* head_diff, const float* head_data,
+    const float* head_scale, const float* tail_diff, const float* tail_data,
+    const float* tail_scale, const int len, const float beta,
+    const float cache_ratio, float* accum, float* diff) {
+  if (beta == 0.75f && cpu_has_avx2()) {
+    lrn_backward_step_avx2(top_diff, scale, bottom, head_diff, head_data,
+        head_scale, tail_diff, tail_data, tail_scale, len, cache_ratio,
+        accum, diff);
+  } else {
+    lrn_backward_step_scalar(top_diff, scale, bottom, head_diff, head_data,
+        head_scale, tail_diff, tail_data, tail_scale, len, beta, cache_ratio,
+        accum, diff);
+  }
+}
+
+#endif  // CAFFE_LRN_X86
+
+}  // namespace
+
 template <typename Dtype>
 void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -79,9 +287,16 @@ void LRNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   switch (this->layer_param_.lrn_param().norm_region()) {
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
     top[0]->Reshape(num_, channels_, height_, width_);
+    top[0]->set_layout(bottom[0]->layout());
     scale_.Reshape(num_, channels_, height_, width_);
+    accum_.Reshape(num_, 1, height_, width_);
+    if (bottom[0]->layout() != NCHW) {
+      padded_square_.Reshape(num_, 1, 1, channels_ + size_ - 1);
+    }
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
+    CHECK_EQ(bottom[0]->layout(), NCHW)
+        << "WITHIN_CHANNEL LRN is only implemented for the NCHW layout.";
     split_layer_->Reshape(bottom, split_top_vec_);
     square_layer_->Reshape(square_bottom_vec_, square_top_vec_);
     pool_layer_->Reshape(square_top_vec_, pool_top_vec_);
@@ -99,7 +314,11 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 #endif
   switch (this->layer_param_.lrn_param().norm_region()) {
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
-    CrossChannelForward_cpu(bottom, top);
+    if (bottom[0]->layout() != NCHW) {
+      CrossChannelForward_cpu_blocked(bottom, top);
+    } else {
+      CrossChannelForward_cpu(bottom, top);
+    }
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
     WithinChannelForward(bottom, top);
@@ -115,45 +334,84 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
+  Dtype* accum_data = accum_.mutable_cpu_data();
+  const int plane = height_ * width_;
+  const int tiles = (plane - 1) / kTile + 1;
+  const int post_pad = size_ - 1 - pre_pad_;
   Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
+  // Each task sweeps the channels of one tile of pixels of one image once,
+  // keeping the sum of squares over the window of size_ channels in accum.
+  parallel_for(0, num_ * tiles, [&](int i) {
+    const int n = i / tiles;
+    const int offset = (i % tiles) * kTile;
+    const int len = std::min(kTile, plane - offset);
+    const Dtype* image = bottom_data + bottom[0]->offset(n) + offset;
+    Dtype* image_scale = scale_data + scale_.offset(n) + offset;
+    Dtype* image_top = top_data + top[0]->offset(n) + offset;
+    Dtype* accum = accum_data + n * plane + offset;
+    caffe_set(len, Dtype(0), accum);
+    for (int c = 0; c < std::min(post_pad, channels_); ++c) {
+      const Dtype* in = image + c * plane;
+      for (int p = 0; p < len; ++p) {
+        accum[p] += in[p] * in[p];
+      }
     }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+    for (int c = 0; c < channels_; ++c) {
+      lrn_forward_step(image + c * plane,
+          c + post_pad < channels_ ? image + (c + post_pad) * plane : NULL,
+          c >= pre_pad_ ? image + (c - pre_pad_) * plane : NULL, len, k_,
+          alpha_over_size, beta_, accum, image_scale + c * plane,
+          image_top + c * plane);
     }
-  }
+  });
+}
 
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
+template <typename Dtype>
+void LRNLayer<Dtype>::CrossChannelForward_cpu_blocked(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int block = blob_layout_block(bottom[0]->layout());
+  const int plane = height_ * width_;
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  Dtype* scale_data = scale_.mutable_cpu_data();
+  Dtype* padded_square_data = padded_square_.mutable_cpu_data();
+  Dtype alpha_over_size = alpha_ / size_;
+  parallel_for(0, num_, [&](int n) {
+    // The squares of one pixel across all channels, padded with zeros.
+    Dtype* padded_square = padded_square_data + padded_square_.offset(n);
+    caffe_set(pre_pad_, Dtype(0), padded_square);
+    caffe_set(size_ - 1 - pre_pad_, Dtype(0),
+        padded_square + pre_pad_ + channels_);
+    const Dtype* image = bottom_data + bottom[0]->offset(n);
+    Dtype* image_scale = scale_data + scale_.offset(n);
+    for (int p = 0; p < plane; ++p) {
+      for (int cb = 0; cb < channels_ / block; ++cb) {
+        const Dtype* in = image + (cb * plane + p) * block;
+        for (int b = 0; b < block; ++b) {
+          padded_square[pre_pad_ + cb * block + b] = in[b] * in[b];
+        }
+      }
+      // Slide the window of size_ channels, as CrossChannelForward_cpu does
+      // for whole channel planes.
+      Dtype accum = 0;
+      for (int c = 0; c < size_ - 1; ++c) {
+        accum += padded_square[c];
+      }
+      for (int cb = 0; cb < channels_ / block; ++cb) {
+        Dtype* scale = image_scale + (cb * plane + p) * block;
+        for (int b = 0; b < block; ++b) {
+          const int c = cb * block + b;
+          accum += padded_square[c + size_ - 1];
+          scale[b] = k_ + alpha_over_size * accum;
+          accum -= padded_square[c];
+        }
+      }
+    }
+    // The output is elementwise in the scale, so the layout does not matter.
+    Dtype* image_top = top_data + top[0]->offset(n);
+    caffe_powx<Dtype>(bottom[0]->count(1), image_scale, -beta_, image_top);
+    caffe_mul<Dtype>(bottom[0]->count(1), image_top, image, image_top);
+  });
 }
 
 template <typename Dtype>
@@ -169,6 +427,8 @@ void LRNLayer<Dtype>::WithinChannelForward(
 template <typename Dtype>
 void LRNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK_EQ(bottom[0]->layout(), NCHW)
+      << "Backward is only implemented for the NCHW layout.";
   switch (this->layer_param_.lrn_param().norm_region()) {
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
     CrossChannelBackward_cpu(top, propagate_down, bottom);
@@ -190,50 +450,37 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* scale_data = scale_.cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
+  Dtype* accum_data = accum_.mutable_cpu_data();
+  const int plane = height_ * width_;
+  const int tiles = (plane - 1) / kTile + 1;
+  const int post_pad = size_ - 1 - pre_pad_;
   Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
-
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+  // As in Forward, one sweep per tile of pixels. accum holds the sum of the
+  // ratios diff_i * y_i / s_i over the window of size_ channels.
+  parallel_for(0, num_ * tiles, [&](int i) {
+    const int n = i / tiles;
+    const int offset = scale_.offset(n) + (i % tiles) * kTile;
+    const int len = std::min(kTile, plane - (i % tiles) * kTile);
+    Dtype* accum = accum_data + n * plane + (i % tiles) * kTile;
+    caffe_set(len, Dtype(0), accum);
+    for (int c = 0; c < std::min(post_pad, channels_); ++c) {
+      const int o = offset + c * plane;
+      for (int p = 0; p < len; ++p) {
+        accum[p] += top_diff[o + p] * top_data[o + p] / scale_data[o + p];
+      }
     }
     for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+      const int o = offset + c * plane;
+      const int head = c + post_pad < channels_ ? o + post_pad * plane : -1;
+      const int tail = c >= pre_pad_ ? o - pre_pad_ * plane : -1;
+      lrn_backward_step(top_diff + o, scale_data + o, bottom_data + o,
+          head < 0 ? NULL : top_diff + head, head < 0 ? NULL : top_data + head,
+          head < 0 ? NULL : scale_data + head,
+          tail < 0 ? NULL : top_diff + tail, tail < 0 ? NULL : top_data + tail,
+          tail < 0 ? NULL : scale_data + tail, len, beta_, cache_ratio_value,
+          accum, bottom_diff + o);
     }
-  }
+  });
 }
 
 template <typename Dtype>
@@ -12,6 +12,10 @@ namespace caffe {
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
      const vector<Blob<Dtype>*>& top) {
+  // The data is whatever each process adds, not a shard of shared data.
+  CHECK(this->phase_ != TRAIN || Caffe::solver_count() == 1)
+      << this->type() << " does not shard its data between data-parallel "
+      << "workers; use Data or ImageData.";
   batch_size_ = this->layer_param_.memory_data_param().batch_size();
   channels_ = this->layer_param_.memory_data_param().channels();
   height_ = this->layer_param_.memory_data_param().height();
@@ -9,6 +9,8 @@ template <typename Dtype>
 void NeuronLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   top[0]->ReshapeLike(*bottom[0]);
+  // Elementwise, so any layout carries over.
+  top[0]->set_layout(bottom[0]->layout());
 }
 
 INSTANTIATE_CLASS(NeuronLayer);
@@ -6,7 +6,10 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
+#include "caffe/util/blocked_layout.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/pooling.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -109,6 +112,13 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
   top[0]->Reshape(bottom[0]->num(), channels_, pooled_height_,
       pooled_width_);
+  if (bottom[0]->layout() != NCHW) {
+    CHECK_EQ(top.size(), 1) << "No max mask output for blocked layouts.";
+    CHECK(this->layer_param_.pooling_param().pool() !=
+        PoolingParameter_PoolMethod_STOCHASTIC)
+        << "Stochastic pooling is not implemented for blocked layouts.";
+  }
+  top[0]->set_layout(bottom[0]->layout());
   if (top.size() > 1) {
     top[1]->ReshapeLike(*top[0]);
   }
@@ -126,6 +136,51 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void PoolingLayer<Dtype>::MaxPoolForward_cpu(const int num,
+    const Dtype* bottom_data, Dtype* top_data, Dtype* top_mask, int* mask) {
+  const int top_count = num * channels_ * pooled_height_ * pooled_width_;
+  // Initialize
+  if (top_mask) {
+    caffe_set(top_count, Dtype(-1), top_mask);
+  }
+  if (mask) {
+    caffe_set(top_count, -1, mask);
+  }
+  caffe_set(top_count, Dtype(-FLT_MAX), top_data);
+  // The main loop, over the (n, c) planes
+  parallel_for(0, num * channels_, [&](int nc) {
+    const Dtype* plane_bottom = bottom_data + nc * height_ * width_;
+    const int plane_offset = nc * pooled_height_ * pooled_width_;
+    Dtype* plane_top = top_data + plane_offset;
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        int hstart = ph * stride_h_ - pad_h_;
+        int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_);
+        int wend = min(wstart + kernel_w_, width_);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        const int pool_index = ph * pooled_width_ + pw;
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            const int index = h * width_ + w;
+            if (plane_bottom[index] > plane_top[pool_index]) {
+              plane_top[pool_index] = plane_bottom[index];
+              if (top_mask) {
+                top_mask[plane_offset + pool_index] =
+                    static_cast<Dtype>(index);
+              } else if (mask) {
+                mask[plane_offset + pool_index] = index;
+              }
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
 // TODO(Yangqing): Is there a faster way to do pooling in the channel-first
 // case?
 template <typename Dtype>
@@ -134,96 +189,71 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 #ifdef XEON_PHI_ESSENTIAL_DEBUG
   LOG(INFO) << "pooling_layer.cpp: Forward_cpu";
 #endif
+  if (bottom[0]->layout() != NCHW) {
+    Forward_cpu_blocked(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int top_count = top[0]->count();
+  const PoolingParameter_PoolMethod pool =
+      this->layer_param_.pooling_param().pool();
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
-  int* mask = NULL;  // suppress warnings about uninitalized variables
+  // Common window shapes without a max mask take the vectorized path.
+  if (!use_top_mask && (pool == PoolingParameter_PoolMethod_AVE ||
+      (pool == PoolingParameter_PoolMethod_MAX && this->phase_ == TEST)) &&
+      pool_fast_path() &&
+      pool_stride2_supported(kernel_h_, kernel_w_, stride_h_, stride_w_)) {
+    parallel_for(0, bottom[0]->num() * channels_, [&](int nc) {
+      pool_stride2_cpu(bottom_data + nc * height_ * width_, height_, width_,
+          kernel_h_, pad_h_, pad_w_, pooled_height_, pooled_width_,
+          pool == PoolingParameter_PoolMethod_MAX,
+          top_data + nc * pooled_height_ * pooled_width_);
+    });
+    return;
+  }
   Dtype* top_mask = NULL;
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
-  switch (this->layer_param_.pooling_param().pool()) {
+  switch (pool) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
     if (use_top_mask) {
       top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
-    } else {
-      mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
-    }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
-      }
     }
+    MaxPoolForward_cpu(bottom[0]->num(), bottom_data, top_data, top_mask,
+        this->phase_ == TRAIN && !use_top_mask ?
+        max_idx_.mutable_cpu_data() : NULL);
     break;
   case PoolingParameter_PoolMethod_AVE:
     for (int i = 0; i < top_count; ++i) {
       top_data[i] = 0;
     }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
+    // The main loop, over the (n, c) planes
+    parallel_for(0, bottom[0]->num() * channels_, [&](int nc) {
+      const Dtype* plane_bottom = bottom_data + nc * height_ * width_;
+      Dtype* plane_top = top_data + nc * pooled_height_ * pooled_width_;
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          int hstart = ph * stride_h_ - pad_h_;
+          int wstart = pw * stride_w_ - pad_w_;
+          int hend = min(hstart + kernel_h_, height_ + pad_h_);
+          int wend = min(wstart + kernel_w_, width_ + pad_w_);
+          int pool_size = (hend - hstart) * (wend - wstart);
+          hstart = max(hstart, 0);
+          wstart = max(wstart, 0);
+          hend = min(hend, height_);
+          wend = min(wend, width_);
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              plane_top[ph * pooled_width_ + pw] +=
+                  plane_bottom[h * width_ + w];
             }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
           }
+          plane_top[ph * pooled_width_ + pw] /= pool_size;
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
       }
-    }
+    });
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -233,12 +263,31 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void PoolingLayer<Dtype>::Forward_cpu_blocked(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int block = blob_layout_block(bottom[0]->layout());
+  const int blocks = bottom[0]->num() * channels_ / block;
+  const bool max_pool = this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX;
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  parallel_for(0, blocks, [&](int cb) {
+    pool_blocked_cpu(bottom_data + cb * height_ * width_ * block, height_,
+        width_, block, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+        stride_w_, pooled_height_, pooled_width_, max_pool,
+        top_data + cb * pooled_height_ * pooled_width_ * block);
+  });
+}
+
 template <typename Dtype>
 void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   if (!propagate_down[0]) {
     return;
   }
+  CHECK_EQ(bottom[0]->layout(), NCHW)
+      << "Backward is only implemented for the NCHW layout.";
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
   // Different pooling methods. We explicitly do the switch outside the for
@@ -254,56 +303,49 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
     } else {
+      if (this->phase_ == TEST) {
+        // Forward_cpu does not keep the mask in the TEST phase.
+        Blob<Dtype> pooled(top[0]->shape());
+        MaxPoolForward_cpu(top[0]->num(), bottom[0]->cpu_data(),
+            pooled.mutable_cpu_data(), NULL, max_idx_.mutable_cpu_data());
+      }
       mask = max_idx_.cpu_data();
     }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
-          }
-        }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
+    parallel_for(0, top[0]->num() * channels_, [&](int nc) {
+      Dtype* plane_bottom = bottom_diff + nc * height_ * width_;
+      const int plane_offset = nc * pooled_height_ * pooled_width_;
+      for (int index = 0; index < pooled_height_ * pooled_width_; ++index) {
+        const int bottom_index = use_top_mask ?
+            top_mask[plane_offset + index] : mask[plane_offset + index];
+        plane_bottom[bottom_index] += top_diff[plane_offset + index];
       }
-    }
+    });
     break;
   case PoolingParameter_PoolMethod_AVE:
-    // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
+    // The main loop, over the (n, c) planes
+    parallel_for(0, top[0]->num() * channels_, [&](int nc) {
+      Dtype* plane_bottom = bottom_diff + nc * height_ * width_;
+      const Dtype* plane_top = top_diff + nc * pooled_height_ * pooled_width_;
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          int hstart = ph * stride_h_ - pad_h_;
+          int wstart = pw * stride_w_ - pad_w_;
+          int hend = min(hstart + kernel_h_, height_ + pad_h_);
+          int wend = min(wstart + kernel_w_, width_ + pad_w_);
+          int pool_size = (hend - hstart) * (wend - wstart);
+          hstart = max(hstart, 0);
+          wstart = max(wstart, 0);
+          hend = min(hend, height_);
+          wend = min(wend, width_);
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              plane_bottom[h * width_ + w] +=
+                plane_top[ph * pooled_width_ + pw] / pool_size;
             }
           }
         }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
       }
-    }
+    });
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -0,0 +1,49 @@
+#include <vector>
+
+#include "caffe/common_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/blocked_layout.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void ReorderLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_NE(top[0], bottom[0]) << this->type() << " Layer does not "
+      "allow in-place computation.";
+  top[0]->ReshapeLike(*bottom[0]);
+  top[0]->set_layout(NCHW);
+  passthrough_ = bottom[0]->layout() == NCHW;
+}
+
+template <typename Dtype>
+void ReorderLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  if (passthrough_) {
+    top[0]->ShareData(*bottom[0]);
+    return;
+  }
+  blocked_to_nchw_cpu(bottom[0]->cpu_data(), bottom[0]->num(),
+      bottom[0]->channels(), bottom[0]->height() * bottom[0]->width(),
+      blob_layout_block(bottom[0]->layout()), top[0]->mutable_cpu_data());
+}
+
+template <typename Dtype>
+void ReorderLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  if (bottom[0]->layout() == NCHW) {
+    caffe_copy(top[0]->count(), top[0]->cpu_diff(),
+        bottom[0]->mutable_cpu_diff());
+    return;
+  }
+  nchw_to_blocked_cpu(top[0]->cpu_diff(), bottom[0]->num(),
+      bottom[0]->channels(), bottom[0]->height() * bottom[0]->width(),
+      blob_layout_block(bottom[0]->layout()), bottom[0]->mutable_cpu_diff());
+}
+
+INSTANTIATE_CLASS(ReorderLayer);
+REGISTER_LAYER_CLASS(Reorder);
+
+}  // namespace caffe
@@ -9,6 +9,8 @@
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fuse_layers.hpp"
+#include "caffe/util/insert_reorders.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -24,6 +26,11 @@ Net<Dtype>::Net(const NetParameter& param) {
   Init(param);
 }
 
+template <typename Dtype>
+Net<Dtype>::Net(const NetParameter& param, const Net* shared) {
+  Init(param, shared);
+}
+
 template <typename Dtype>
 Net<Dtype>::Net(const string& param_file, Phase phase) {
   NetParameter param;
@@ -33,18 +40,48 @@ Net<Dtype>::Net(const string& param_file, Phase phase) {
 }
 
 template <typename Dtype>
-void Net<Dtype>::Init(const NetParameter& in_param) {
+void Net<Dtype>::Init(const NetParameter& in_param, const Net* shared) {
   // Set phase from the state.
   phase_ = in_param.state().phase();
+  // The parameters of shared may point into mapped weights, which must
+  // outlive this net as well.
+  if (shared) {
+    mapped_weights_ = shared->mapped_weights_;
+  }
   // Filter layers based on their include/exclude rules and
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  // Fold activations into their producers and drop no-op layers.
+  if (filtered_param.fuse_layers()) {
+    if (phase_ == TEST) {
+      CHECK_EQ(Caffe::mode(), Caffe::CPU)
+          << "Layer fusion is only implemented on the CPU.";
+      NetParameter param_unfused;
+      param_unfused.Swap(&filtered_param);
+      FuseLayers(param_unfused, &filtered_param);
+    } else {
+      LOG(INFO) << "Ignoring fuse_layers outside the TEST phase.";
+    }
+  }
   LOG(INFO) << "Initializing net from parameters: " << std::endl
             << filtered_param.DebugString();
   // Create a copy of filtered_param with splits added where necessary.
   NetParameter param;
   InsertSplits(filtered_param, &param);
+  // Keep activations channel-blocked between the layers that support it.
+  if (param.layout() != NCHW) {
+    if (phase_ == TEST) {
+      CHECK_EQ(Caffe::mode(), Caffe::CPU)
+          << "Blocked layouts are only implemented on the CPU.";
+      NetParameter param_split;
+      param_split.Swap(&param);
+      InsertReorders(param_split, &param);
+    } else {
+      LOG(INFO) << "Ignoring layout " << BlobLayout_Name(param.layout())
+          << " outside the TEST phase.";
+    }
+  }
   // Basically, build all the layers and set up their connections.
   name_ = param.name();
   map<string, int> blob_name_to_idx;
@@ -60,6 +97,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
         << "Exactly one input_shape must be specified per input.";
   }
   memory_used_ = 0;
+  workspace_.reset(new Blob<Dtype>());
   // set the input blobs
   for (int input_id = 0; input_id < param.input_size(); ++input_id) {
     const int layer_id = -1;  // inputs have fake layer ID -1
@@ -81,6 +119,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     // Setup layer.
     const LayerParameter& layer_param = param.layer(layer_id);
     layers_.push_back(LayerRegistry<Dtype>::CreateLayer(layer_param));
+    layers_[layer_id]->set_workspace(workspace_);
     layer_names_.push_back(layer_param.name());
     LOG(INFO) << "Creating Layer " << layer_param.name();
     bool need_backward = false;
@@ -110,6 +149,14 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
         AppendTop(param, layer_id, num_top, NULL, NULL);
       }
     }
+    // With the parameters of shared, SetUp skips their initialization.
+    if (shared) {
+      const shared_ptr<Layer<Dtype> > source =
+          shared->layer_by_name(layer_param.name());
+      CHECK(source) << "Layer " << layer_param.name() << " is not in "
+          << shared->name();
+      layers_[layer_id]->blobs() = source->blobs();
+    }
     // After this layer is connected, set it up.
     LOG(INFO) << "Setting up " << layer_names_[layer_id];
     layers_[layer_id]->SetUp(bottom_vecs_[layer_id], top_vecs_[layer_id]);
@@ -216,7 +263,38 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   GetLearningRateAndWeightDecay();
   debug_info_ = param.debug_info();
   LOG(INFO) << "Network initialization done.";
+  LOG(INFO) << "Memory required for workspace: "
+      << workspace_->count() * sizeof(Dtype);
+  memory_used_ += workspace_->count();
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (layer_need_backward_[layer_id]) {
+      memory_used_ += layers_[layer_id]->BackwardScratchCount();
+    }
+  }
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
+  // Share activation memory between blobs that are not live at once.
+  plan_memory_ = false;
+  if (param.plan_memory()) {
+    if (std::find(layer_need_backward_.begin(), layer_need_backward_.end(),
+                  true) == layer_need_backward_.end()) {
+      CHECK_EQ(Caffe::mode(), Caffe::CPU)
+          << "Memory planning is only implemented on the CPU.";
+      plan_memory_ = true;
+      PlanMemory();
+    } else {
+      LOG(INFO) << "Ignoring plan_memory for a net that runs backward.";
+    }
+  }
+  // Gather the parameters into one buffer for the solvers.
+  if (param.flat_params()) {
+    if (phase_ == TRAIN) {
+      CHECK_EQ(Caffe::mode(), Caffe::CPU)
+          << "Flat parameters are only implemented on the CPU.";
+      FlattenParams();
+    } else {
+      LOG(INFO) << "Ignoring flat_params outside the TRAIN phase.";
+    }
+  }
 }
 
 template <typename Dtype>
@@ -438,8 +516,11 @@ void Net<Dtype>::AppendParam(const NetParameter& param, const int layer_id,
       // Strict dimension checking -- all dims must be the same.
       CHECK(this_blob->shape() == owner_blob->shape());
     }
-    layers_[layer_id]->blobs()[param_id]->ShareData(
-        *layers_[owner_layer_id]->blobs()[owner_param_id]);
+    // Parameters taken from a shared net already share, and may be in use
+    // on other threads.
+    if (this_blob->data() != owner_blob->data()) {
+      this_blob->ShareData(*owner_blob);
+    }
   }
 }
 
@@ -656,6 +737,9 @@ void Net<Dtype>::UpdateDebugInfo(const int param_id) {
 
 template <typename Dtype>
 void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
+  // The diffs of the parameters would be left behind in flat_params_.
+  CHECK(!flat_params_) << "Cannot share the parameters of " << other->name()
+      << " with the flat parameters of " << name_;
   int num_source_layers = other->layers().size();
   for (int i = 0; i < num_source_layers; ++i) {
     Layer<Dtype>* source_layer = other->layers()[i].get();
@@ -680,6 +764,9 @@ void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
       target_blobs[j]->ShareData(*source_blob);
     }
   }
+  // Keep the mapped weights the shared data may point into.
+  mapped_weights_.insert(mapped_weights_.end(),
+      other->mapped_weights_.begin(), other->mapped_weights_.end());
 }
 
 template <typename Dtype>
@@ -717,6 +804,178 @@ void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  if (plan_memory_) {
+    PlanMemory();
+  }
+}
+
+// Orders (bytes, group id) pairs by decreasing size, then in network order.
+static bool LargerGroupFirst(const pair<size_t, int>& a,
+    const pair<size_t, int>& b) {
+  return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanMemory() {
+  // Blobs sharing data (in-place layers, and the tops of layers sharing the
+  // data of their bottoms) form one group, live from the first layer that
+  // touches any of them to the last.
+  map<SyncedMemory*, int> group_ids;
+  vector<Blob<Dtype>*> group_blobs;
+  vector<size_t> group_bytes;
+  vector<int> group_begin, group_end;
+  vector<bool> group_pinned;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<Blob<Dtype>*>& bottom = bottom_vecs_[layer_id];
+    const vector<Blob<Dtype>*>& top = top_vecs_[layer_id];
+    // Share now, rather than in Forward, to release the memory of the top.
+    for (int top_id = 0; top_id < top.size(); ++top_id) {
+      const int bottom_id = layers_[layer_id]->ForwardSharedBottom(top_id);
+      if (bottom_id >= 0) {
+        top[top_id]->ShareData(*bottom[bottom_id]);
+      }
+    }
+    // Data layers may fill their tops once, or ahead of Forward.
+    const bool pinned = bottom.empty();
+    for (int i = 0; i < bottom.size() + top.size(); ++i) {
+      const bool is_top = i >= bottom.size();
+      Blob<Dtype>* blob = is_top ? top[i - bottom.size()] : bottom[i];
+      if (!blob->count()) { continue; }
+      SyncedMemory* data = blob->data().get();
+      map<SyncedMemory*, int>::iterator it = group_ids.find(data);
+      if (it == group_ids.end()) {
+        it = group_ids.insert(make_pair(data, group_blobs.size())).first;
+        group_blobs.push_back(blob);
+        group_bytes.push_back(0);
+        group_begin.push_back(layer_id);
+        group_end.push_back(layer_id);
+        group_pinned.push_back(false);
+      }
+      const int group_id = it->second;
+      group_bytes[group_id] = std::max(group_bytes[group_id],
+          blob->count() * sizeof(Dtype));
+      group_end[group_id] = layer_id;
+      group_pinned[group_id] = group_pinned[group_id] || (is_top && pinned);
+    }
+  }
+  for (int i = 0; i < net_input_blobs_.size(); ++i) {
+    map<SyncedMemory*, int>::iterator it =
+        group_ids.find(net_input_blobs_[i]->data().get());
+    if (it != group_ids.end()) { group_pinned[it->second] = true; }
+  }
+  for (int i = 0; i < net_output_blobs_.size(); ++i) {
+    map<SyncedMemory*, int>::iterator it =
+        group_ids.find(net_output_blobs_[i]->data().get());
+    if (it != group_ids.end()) { group_pinned[it->second] = true; }
+  }
+  // Place the largest groups first, each in the smallest buffer holding no
+  // group live at the same time, growing it if needed.
+  vector<pair<size_t, int> > order;
+  size_t unplanned_bytes = 0;
+  for (int group_id = 0; group_id < group_blobs.size(); ++group_id) {
+    if (group_pinned[group_id]) { continue; }
+    order.push_back(make_pair(group_bytes[group_id], group_id));
+    unplanned_bytes += group_bytes[group_id];
+  }
+  std::sort(order.begin(), order.end(), LargerGroupFirst);
+  vector<size_t> buffer_bytes;
+  vector<vector<int> > buffer_groups;
+  vector<int> group_buffer(group_blobs.size(), -1);
+  for (int i = 0; i < order.size(); ++i) {
+    const int group_id = order[i].second;
+    int best = -1;
+    for (int buffer_id = 0; buffer_id < buffer_groups.size(); ++buffer_id) {
+      bool overlaps = false;
+      for (int j = 0; j < buffer_groups[buffer_id].size(); ++j) {
+        const int other = buffer_groups[buffer_id][j];
+        if (group_begin[group_id] <= group_end[other] &&
+            group_begin[other] <= group_end[group_id]) {
+          overlaps = true;
+          break;
+        }
+      }
+      if (!overlaps &&
+          (best < 0 || buffer_bytes[buffer_id] < buffer_bytes[best])) {
+        best = buffer_id;
+      }
+    }
+    if (best < 0) {
+      best = buffer_groups.size();
+      buffer_bytes.push_back(0);
+      buffer_groups.push_back(vector<int>());
+    }
+    buffer_bytes[best] = std::max(buffer_bytes[best], order[i].first);
+    buffer_groups[best].push_back(group_id);
+    group_buffer[group_id] = best;
+  }
+  // Allocate the new buffers before releasing those of a previous plan,
+  // which the blobs may still point into.
+  vector<shared_ptr<SyncedMemory> > buffers(buffer_bytes.size());
+  size_t planned_bytes = 0;
+  for (int buffer_id = 0; buffer_id < buffers.size(); ++buffer_id) {
+    buffers[buffer_id].reset(new SyncedMemory(buffer_bytes[buffer_id]));
+    planned_bytes += buffer_bytes[buffer_id];
+  }
+  for (int group_id = 0; group_id < group_blobs.size(); ++group_id) {
+    if (group_buffer[group_id] < 0) { continue; }
+    group_blobs[group_id]->set_cpu_data(static_cast<Dtype*>(
+        buffers[group_buffer[group_id]]->mutable_cpu_data()));
+  }
+  memory_buffers_.swap(buffers);
+  LOG(INFO) << "Planned activation memory: " << planned_bytes << " bytes in "
+      << memory_buffers_.size() << " buffers (unplanned: " << unplanned_bytes
+      << " bytes)";
+}
+
+template <typename Dtype>
+void Net<Dtype>::FlattenParams() {
+  // Each parameter starts on a cache line, as the memory of the host
+  // allocator does, and keeps the whole capacity of its blob. The gaps stay
+  // zero in both data and diff, so that updates leave them zero and they add
+  // nothing to norms.
+  const int align = std::max<int>(1, 64 / sizeof(Dtype));
+  vector<int> offsets(params_.size(), -1);
+  vector<int> capacities(params_.size(), 0);
+  int count = 0;
+  for (int i = 0; i < params_.size(); ++i) {
+    // Shared parameters use the data of their owner, which is moved with it;
+    // their diffs are added to the owner's in Update, and stay apart.
+    if (param_owners_[i] >= 0) { continue; }
+    capacities[i] = params_[i]->data()->size() / sizeof(Dtype);
+    CHECK_EQ(params_[i]->diff()->size(), params_[i]->data()->size());
+    offsets[i] = count;
+    count += (capacities[i] + align - 1) / align * align;
+  }
+  if (count == 0) { return; }
+  flat_params_.reset(new Blob<Dtype>(vector<int>(1, count)));
+  Dtype* data = flat_params_->mutable_cpu_data();
+  Dtype* diff = flat_params_->mutable_cpu_diff();
+  for (int i = 0; i < params_.size(); ++i) {
+    if (offsets[i] < 0) { continue; }
+    const shared_ptr<SyncedMemory>& param_data = params_[i]->data();
+    const shared_ptr<SyncedMemory>& param_diff = params_[i]->diff();
+    if (param_data->head() != SyncedMemory::UNINITIALIZED) {
+      caffe_copy(capacities[i], static_cast<const Dtype*>(
+          param_data->cpu_data()), data + offsets[i]);
+    }
+    if (param_diff->head() != SyncedMemory::UNINITIALIZED) {
+      caffe_copy(capacities[i], static_cast<const Dtype*>(
+          param_diff->cpu_data()), diff + offsets[i]);
+    }
+    param_data->set_cpu_data(data + offsets[i]);
+    param_diff->set_cpu_data(diff + offsets[i]);
+  }
+  LOG(INFO) << "Flattened " << count * sizeof(Dtype)
+      << " bytes of parameters";
+}
+
+template <typename Dtype>
+void Net<Dtype>::FlatParamsChanged() {
+  for (int i = 0; flat_params_ && i < params_.size(); ++i) {
+    if (param_owners_[i] < 0) {
+      params_[i]->data()->bump_version();
+    }
+  }
 }
 
 template <typename Dtype>
@@ -748,11 +1007,65 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const string trained_filename) {
+  if (MappedWeights::IsMappedWeights(trained_filename)) {
+    CopyTrainedLayersFrom(shared_ptr<MappedWeights>(
+        new MappedWeights(trained_filename)));
+    return;
+  }
   NetParameter param;
   ReadNetParamsFromBinaryFileOrDie(trained_filename, &param);
   CopyTrainedLayersFrom(param);
 }
 
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFrom(
+    const shared_ptr<MappedWeights>& weights) {
+  const MappedWeightsIndex& index = weights->index();
+  // The parameters in flat_params_ must stay there.
+  const bool map = sizeof(Dtype) == sizeof(float) && !flat_params_;
+  bool mapped = false;
+  for (int i = 0; i < index.layer_size(); ++i) {
+    const MappedWeightsIndex::Layer& source_layer = index.layer(i);
+    const string& source_layer_name = source_layer.name();
+    int target_layer_id = 0;
+    while (target_layer_id != layer_names_.size() &&
+        layer_names_[target_layer_id] != source_layer_name) {
+      ++target_layer_id;
+    }
+    if (target_layer_id == layer_names_.size()) {
+      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      continue;
+    }
+    DLOG(INFO) << "Mapping source layer " << source_layer_name;
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    for (int j = 0; j < target_blobs.size(); ++j) {
+      const MappedWeightsIndex::Blob& source_blob = source_layer.blobs(j);
+      Blob<Dtype>* target_blob = target_blobs[j].get();
+      BlobProto source_shape;
+      MappedWeights::ShapeToProto(source_blob, &source_shape);
+      CHECK(target_blob->ShapeEquals(source_shape))
+          << "shape mismatch for blob " << j << " of layer "
+          << source_layer_name;
+      float* data = weights->data(source_blob);
+      if (map) {
+        target_blob->set_cpu_data(reinterpret_cast<Dtype*>(data));
+        mapped = true;
+      } else {
+        Dtype* target_data = target_blob->mutable_cpu_data();
+        for (int k = 0; k < target_blob->count(); ++k) {
+          target_data[k] = data[k];
+        }
+      }
+    }
+  }
+  if (mapped) {
+    mapped_weights_.push_back(weights);
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   param->Clear();
@@ -804,7 +1117,15 @@ void Net<Dtype>::Update() {
       LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
     }
   }
-  // Now, update the owned parameters.
+  // Now, update the owned parameters, at once if they are flat.
+  if (flat_params_) {
+    for (int i = 0; debug_info_ && i < params_.size(); ++i) {
+      if (param_owners_[i] < 0) { UpdateDebugInfo(i); }
+    }
+    flat_params_->Update();
+    FlatParamsChanged();
+    return;
+  }
   for (int i = 0; i < params_.size(); ++i) {
     if (param_owners_[i] >= 0) { continue; }
     if (debug_info_) { UpdateDebugInfo(i); }
@@ -0,0 +1,55 @@
+#include <string>
+#include <vector>
+
+#include "caffe/net_model.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+NetModel<Dtype>::NetModel(const NetParameter& param,
+    const string& weights_file) {
+  Init(param, weights_file);
+}
+
+template <typename Dtype>
+NetModel<Dtype>::NetModel(const string& param_file,
+    const string& weights_file) {
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(param_file, &param);
+  Init(param, weights_file);
+}
+
+template <typename Dtype>
+void NetModel<Dtype>::Init(const NetParameter& param,
+    const string& weights_file) {
+  param_.CopyFrom(param);
+  param_.mutable_state()->set_phase(TEST);
+  net_.reset(new Net<Dtype>(param_));
+  if (!weights_file.empty()) {
+    net_->CopyTrainedLayersFrom(weights_file);
+  }
+  // The contexts take the parameters from net_, not from the blobs of
+  // the layers.
+  for (int i = 0; i < param_.layer_size(); ++i) {
+    param_.mutable_layer(i)->clear_blobs();
+  }
+  // Settles the memory of the parameters where the contexts read it, so that
+  // reading it changes nothing.
+  const vector<shared_ptr<Blob<Dtype> > >& params = net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    params[i]->cpu_data();
+    if (Caffe::mode() == Caffe::GPU) {
+      params[i]->gpu_data();
+    }
+  }
+}
+
+template <typename Dtype>
+shared_ptr<Net<Dtype> > NetModel<Dtype>::NewContext() const {
+  return shared_ptr<Net<Dtype> >(new Net<Dtype>(param_, net_.get()));
+}
+
+INSTANTIATE_CLASS(NetModel);
+
+}  // namespace caffe
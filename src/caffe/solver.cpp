@@ -1,4 +1,6 @@
 
+#include <boost/bind.hpp>
+
 #include <cstdio>
 
 #include <algorithm>
@@ -8,8 +10,10 @@
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -208,8 +212,10 @@ void Solver<Dtype>::Step(int iters) {
         }
       }
     }
-    ComputeUpdateValue();
-    net_->Update();
+    if (transport_) {
+      AllreduceDiffs();
+    }
+    ApplyUpdate();
 
     // Save a snapshot if needed.
     if (param_.snapshot() && (iter_ + 1) % param_.snapshot() == 0) {
@@ -218,6 +224,77 @@ void Solver<Dtype>::Step(int iters) {
   }
 }
 
+template <typename Dtype>
+void Solver<Dtype>::set_transport(const shared_ptr<Transport>& transport) {
+  transport_ = transport;
+  LOG(INFO) << "Data-parallel worker " << transport_->rank() << " of "
+      << transport_->size();
+  // Start from the parameters of rank 0. Shared parameters use the data of
+  // their owner.
+  const vector<shared_ptr<Blob<Dtype> > >& params = net_->params();
+  const shared_ptr<Blob<Dtype> >& flat_params = net_->flat_params();
+  if (flat_params) {
+    ring_broadcast(transport_.get(), flat_params->mutable_cpu_data(),
+        flat_params->count() * sizeof(Dtype));
+    net_->FlatParamsChanged();
+    return;
+  }
+  for (int i = 0; i < params.size(); ++i) {
+    if (net_->param_owners()[i] < 0) {
+      ring_broadcast(transport_.get(), params[i]->mutable_cpu_data(),
+          params[i]->count() * sizeof(Dtype));
+    }
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::AllreduceDiffs() {
+  const vector<shared_ptr<Blob<Dtype> > >& params = net_->params();
+  const shared_ptr<Blob<Dtype> >& flat_params = net_->flat_params();
+  // The blobs whose diffs are reduced: the flat parameters and the shared
+  // parameters they leave out, or all the parameters.
+  vector<Blob<Dtype>*> blobs;
+  if (flat_params) {
+    blobs.push_back(flat_params.get());
+  }
+  for (int i = 0; i < params.size(); ++i) {
+    if (!flat_params || net_->param_owners()[i] >= 0) {
+      blobs.push_back(params[i].get());
+    }
+  }
+  const Dtype scale = Dtype(1) / transport_->size();
+  if (blobs.size() == 1) {
+    Blob<Dtype>* blob = blobs[0];
+    ring_allreduce(transport_.get(), blob->mutable_cpu_diff(), blob->count());
+    blob->scale_diff(scale);
+    return;
+  }
+  int count = 0;
+  for (int i = 0; i < blobs.size(); ++i) {
+    count += blobs[i]->count();
+  }
+  if (count == 0) { return; }
+  allreduce_buffer_.resize(count);
+  Dtype* buffer = &allreduce_buffer_[0];
+  for (int i = 0, offset = 0; i < blobs.size(); ++i) {
+    caffe_copy(blobs[i]->count(), blobs[i]->cpu_diff(), buffer + offset);
+    offset += blobs[i]->count();
+  }
+  ring_allreduce(transport_.get(), buffer, count);
+  caffe_scal(count, scale, buffer);
+  for (int i = 0, offset = 0; i < blobs.size(); ++i) {
+    caffe_copy(blobs[i]->count(), buffer + offset,
+        blobs[i]->mutable_cpu_diff());
+    offset += blobs[i]->count();
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ApplyUpdate() {
+  ComputeUpdateValue();
+  net_->Update();
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Solve(const char* resume_file) {
   LOG(INFO) << "Solving " << net_->name();
@@ -251,12 +328,14 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   if (param_.test_interval() && iter_ % param_.test_interval() == 0) {
     TestAll();
   }
+  WaitForSnapshots();
   LOG(INFO) << "Optimization Done.";
 }
 
 
 template <typename Dtype>
 void Solver<Dtype>::TestAll() {
+  if (transport_ && transport_->rank() > 0) { return; }
   for (int test_net_id = 0; test_net_id < test_nets_.size(); ++test_net_id) {
     Test(test_net_id);
   }
@@ -321,9 +400,9 @@ void Solver<Dtype>::Test(const int test_net_id) {
 
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
-  NetParameter net_param;
-  // For intermediate results, we will also dump the gradient values.
-  net_->ToProto(&net_param, param_.snapshot_diff());
+  if (transport_ && transport_->rank() > 0) { return; }
+  CPUTimer timer;
+  timer.Start();
   string filename(param_.snapshot_prefix());
   string model_filename, snapshot_filename;
   const int kBufferSize = 20;
@@ -332,20 +411,47 @@ void Solver<Dtype>::Snapshot() {
   snprintf(iter_str_buffer, kBufferSize, "_iter_%d", iter_ + 1);
   filename += iter_str_buffer;
   model_filename = filename + ".caffemodel";
-  LOG(INFO) << "Snapshotting to " << model_filename;
-  WriteProtoToBinaryFile(net_param, model_filename.c_str());
+  snapshot_filename = filename + ".solverstate";
   SolverState state;
-  SnapshotSolverState(&state);
   state.set_iter(iter_ + 1);
   state.set_learned_net(model_filename);
   state.set_current_step(current_step_);
-  snapshot_filename = filename + ".solverstate";
-  LOG(INFO) << "Snapshotting solver state to " << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  const vector<shared_ptr<Blob<Dtype> > >* history = SnapshotHistory();
+  if (param_.snapshot_async() && history) {
+    if (!snapshot_writer_) {
+      snapshot_writer_.reset(
+          new SnapshotWriter<Dtype>(param_.max_pending_snapshots()));
+    }
+    LOG(INFO) << "Snapshotting to " << model_filename << " and "
+        << snapshot_filename << " in the background";
+    // For intermediate results, we will also dump the gradient values.
+    snapshot_writer_->Write(*net_, param_.snapshot_diff(), *history, state,
+        model_filename, snapshot_filename);
+  } else {
+    NetParameter net_param;
+    // For intermediate results, we will also dump the gradient values.
+    net_->ToProto(&net_param, param_.snapshot_diff());
+    LOG(INFO) << "Snapshotting to " << model_filename;
+    WriteProtoToBinaryFileAtomically(net_param, model_filename);
+    SnapshotSolverState(&state);
+    LOG(INFO) << "Snapshotting solver state to " << snapshot_filename;
+    WriteProtoToBinaryFileAtomically(state, snapshot_filename);
+  }
+  LOG(INFO) << "Snapshot stalled training for " << timer.MilliSeconds()
+      << " ms";
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WaitForSnapshots() {
+  if (snapshot_writer_) {
+    snapshot_writer_->Wait();
+  }
 }
 
 template <typename Dtype>
 void Solver<Dtype>::Restore(const char* state_file) {
+  // The state may be one being written.
+  WaitForSnapshots();
   SolverState state;
   NetParameter net_param;
   ReadProtoFromBinaryFile(state_file, &state);
@@ -433,8 +539,13 @@ void SGDSolver<Dtype>::ClipGradients() {
   const Dtype clip_gradients = this->param_.clip_gradients();
   if (clip_gradients < 0) { return; }
   const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
+  // Flat parameters hold the diffs of all the owned parameters in one blob.
+  const shared_ptr<Blob<Dtype> >& flat_params = this->net_->flat_params();
   Dtype sumsq_diff = 0;
-  for (int i = 0; i < net_params.size(); ++i) {
+  if (flat_params) {
+    sumsq_diff = flat_params->sumsq_diff();
+  }
+  for (int i = 0; !flat_params && i < net_params.size(); ++i) {
     if (this->net_->param_owners()[i] < 0) {
       sumsq_diff += net_params[i]->sumsq_diff();
     }
@@ -445,6 +556,10 @@ void SGDSolver<Dtype>::ClipGradients() {
     LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
         << l2norm_diff << " > " << clip_gradients << ") "
         << "by scale factor " << scale_factor;
+    if (flat_params) {
+      flat_params->scale_diff(scale_factor);
+      return;
+    }
     for (int i = 0; i < net_params.size(); ++i) {
       if (this->net_->param_owners()[i] < 0) {
         net_params[i]->scale_diff(scale_factor);
@@ -548,6 +663,99 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   }
 }
 
+template <typename Dtype>
+Regularization SGDSolver<Dtype>::GetRegularization() {
+  const string& regularization_type = this->param_.regularization_type();
+  if (regularization_type == "L2") {
+    return REGULARIZATION_L2;
+  } else if (regularization_type == "L1") {
+    return REGULARIZATION_L1;
+  }
+  LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+  return REGULARIZATION_NONE;
+}
+
+// The values updated by one task of the fused update.
+const int kUpdateChunk = 1 << 16;
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ApplyUpdate() {
+  if (Caffe::mode() != Caffe::CPU || this->param_.debug_info() ||
+      !fused_update<Dtype>()) {
+    Solver<Dtype>::ApplyUpdate();
+    return;
+  }
+  update_rate_ = GetLearningRate();
+  if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
+    LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << update_rate_;
+  }
+  ClipGradients();
+  // Parameters that share their data are updated by Net::Update, once the
+  // diffs of the others have been added to the diff of their owner; the
+  // fused update only computes their update value.
+  const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
+  const vector<int>& param_owners = this->net_->param_owners();
+  vector<bool> shared(net_params.size(), false);
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    if (param_owners[param_id] >= 0) {
+      shared[param_id] = true;
+      shared[param_owners[param_id]] = true;
+    }
+  }
+  update_chunks_.clear();
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    // Bring the blobs to the CPU before the tasks share them.
+    Dtype* data = net_params[param_id]->mutable_cpu_data();
+    Dtype* diff = net_params[param_id]->mutable_cpu_diff();
+    Dtype* history = history_[param_id]->mutable_cpu_data();
+    const int count = net_params[param_id]->count();
+    for (int begin = 0; begin < count; begin += kUpdateChunk) {
+      UpdateChunk chunk;
+      chunk.param_id = param_id;
+      chunk.count = std::min(kUpdateChunk, count - begin);
+      chunk.data = data + begin;
+      chunk.diff = diff + begin;
+      chunk.history = history + begin;
+      chunk.update_data = !shared[param_id];
+      update_chunks_.push_back(chunk);
+    }
+  }
+  parallel_for(0, update_chunks_.size(),
+      boost::bind(&SGDSolver<Dtype>::UpdateChunkFused, this, _1));
+  // Net::Update, restricted to the shared parameters.
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    if (param_owners[param_id] >= 0) {
+      Blob<Dtype>* owner = net_params[param_owners[param_id]].get();
+      caffe_add(owner->count(), net_params[param_id]->cpu_diff(),
+          owner->cpu_diff(), owner->mutable_cpu_diff());
+    }
+  }
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    if (shared[param_id] && param_owners[param_id] < 0) {
+      net_params[param_id]->Update();
+    }
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::UpdateChunkFused(const int chunk_id) {
+  const UpdateChunk& chunk = update_chunks_[chunk_id];
+  ComputeUpdateValueFused(chunk.param_id, update_rate_, chunk.count,
+      chunk.data, chunk.diff, chunk.history, chunk.update_data);
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeUpdateValueFused(const int param_id,
+    const Dtype rate, const int count, Dtype* data, Dtype* diff,
+    Dtype* history, const bool update_data) {
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype local_decay = Dtype(this->param_.weight_decay()) *
+      this->net_->params_weight_decay()[param_id];
+  sgd_update_cpu(count, local_rate, Dtype(this->param_.momentum()),
+      local_decay, local_decay ? GetRegularization() : REGULARIZATION_NONE,
+      data, diff, history, update_data);
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverState(SolverState* state) {
   state->clear_history();
@@ -685,6 +893,32 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
   }
 }
 
+template <typename Dtype>
+void NesterovSolver<Dtype>::ComputeUpdateValueFused(const int param_id,
+    const Dtype rate, const int count, Dtype* data, Dtype* diff,
+    Dtype* history, const bool update_data) {
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype local_decay = Dtype(this->param_.weight_decay()) *
+      this->net_->params_weight_decay()[param_id];
+  nesterov_update_cpu(count, local_rate,
+      Dtype(this->param_.momentum()), local_decay,
+      local_decay ? this->GetRegularization() : REGULARIZATION_NONE,
+      data, diff, history, update_data);
+}
+
+template <typename Dtype>
+void AdaGradSolver<Dtype>::ComputeUpdateValueFused(const int param_id,
+    const Dtype rate, const int count, Dtype* data, Dtype* diff,
+    Dtype* history, const bool update_data) {
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype local_decay = Dtype(this->param_.weight_decay()) *
+      this->net_->params_weight_decay()[param_id];
+  adagrad_update_cpu(count, local_rate, Dtype(this->param_.delta()),
+      local_decay,
+      local_decay ? this->GetRegularization() : REGULARIZATION_NONE,
+      data, diff, history, update_data);
+}
+
 template <typename Dtype>
 void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
@@ -0,0 +1,213 @@
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/solver.hpp"
+#include "caffe/util/allreduce.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Runs body(rank) for every rank on its own thread, as the workers would
+// run in their own processes.
+void RunWorkers(const int size, const boost::function<void(int)>& body) {
+  boost::thread_group threads;
+  for (int rank = 0; rank < size; ++rank) {
+    threads.create_thread(boost::bind(body, rank));
+  }
+  threads.join_all();
+}
+
+template <typename Dtype>
+class AllreduceTest : public ::testing::Test {
+ protected:
+  // A small capacity, so that messages wrap around the buffers.
+  static const size_t kCapacity = 4096;
+
+  void AllreduceWorker(const int rank, const int size, const int count,
+      shared_ptr<Transport> transport, vector<vector<Dtype> >* results) {
+    vector<Dtype>& data = (*results)[rank];
+    data.resize(count);
+    for (int i = 0; i < count; ++i) {
+      data[i] = (rank + 1) * (i % 13);
+    }
+    ring_allreduce(transport.get(), count ? &data[0] : NULL, count);
+  }
+
+  void CheckAllreduce(const int size, const int count,
+      const vector<vector<Dtype> >& results) {
+    for (int rank = 0; rank < size; ++rank) {
+      ASSERT_EQ(count, results[rank].size());
+      for (int i = 0; i < count; ++i) {
+        EXPECT_EQ((i % 13) * size * (size + 1) / 2, results[rank][i])
+            << "rank " << rank << " of " << size << ", value " << i;
+      }
+    }
+  }
+
+  void TestShmAllreduce(const int size, const int count) {
+    vector<char> region(ShmTransport::RegionBytes(size, kCapacity), 0);
+    vector<shared_ptr<Transport> > transports(size);
+    for (int rank = 0; rank < size; ++rank) {
+      transports[rank].reset(new ShmTransport(&region[0], rank, size,
+          kCapacity));
+    }
+    vector<vector<Dtype> > results(size);
+    RunWorkers(size, [&](int rank) {
+      AllreduceWorker(rank, size, count, transports[rank], &results);
+    });
+    CheckAllreduce(size, count, results);
+  }
+};
+
+TYPED_TEST_CASE(AllreduceTest, TestDtypes);
+
+TYPED_TEST(AllreduceTest, TestShmAllreduce) {
+  const int kCounts[] = { 0, 1, 3, 1000, 100003 };
+  for (int size = 1; size <= 4; ++size) {
+    for (int c = 0; c < sizeof(kCounts) / sizeof(kCounts[0]); ++c) {
+      this->TestShmAllreduce(size, kCounts[c]);
+    }
+  }
+}
+
+TYPED_TEST(AllreduceTest, TestTcpAllreduce) {
+  typedef TypeParam Dtype;
+  const int kSize = 3;
+  const int kCount = 100003;
+  vector<TcpTransport*> tcp(kSize);
+  vector<shared_ptr<Transport> > transports(kSize);
+  for (int rank = 0; rank < kSize; ++rank) {
+    tcp[rank] = new TcpTransport(rank, kSize, 0);
+    transports[rank].reset(tcp[rank]);
+  }
+  vector<vector<Dtype> > results(kSize);
+  RunWorkers(kSize, [&](int rank) {
+    tcp[rank]->Connect("127.0.0.1:" +
+        boost::lexical_cast<string>(tcp[(rank + 1) % kSize]->port()));
+    this->AllreduceWorker(rank, kSize, kCount, transports[rank], &results);
+  });
+  this->CheckAllreduce(kSize, kCount, results);
+}
+
+TEST(BroadcastTest, TestShmBroadcast) {
+  const int kSize = 3;
+  const int kCount = 10000;
+  vector<char> region(ShmTransport::RegionBytes(kSize, 4096), 0);
+  vector<vector<int> > data(kSize, vector<int>(kCount, -1));
+  for (int i = 0; i < kCount; ++i) {
+    data[0][i] = i;
+  }
+  RunWorkers(kSize, [&](int rank) {
+    ShmTransport transport(&region[0], rank, kSize, 4096);
+    ring_broadcast(&transport, &data[rank][0], kCount * sizeof(int));
+  });
+  for (int rank = 0; rank < kSize; ++rank) {
+    for (int i = 0; i < kCount; ++i) {
+      EXPECT_EQ(i, data[rank][i]) << "rank " << rank;
+    }
+  }
+}
+
+template <typename Dtype>
+class DataParallelSolverTest : public ::testing::Test {
+ protected:
+  DataParallelSolverTest() {
+    Caffe::set_mode(Caffe::CPU);
+  }
+
+  // A least squares problem on constant data, so that the workers draw no
+  // random numbers while they run.
+  shared_ptr<SGDSolver<Dtype> > NewSolver() {
+    const string& proto =
+        "max_iter: 5 "
+        "base_lr: 0.01 "
+        "lr_policy: 'fixed' "
+        "momentum: 0.9 "
+        "weight_decay: 0.01 "
+        "snapshot_after_train: false "
+        "solver_mode: CPU "
+        "net_param { "
+        "  name: 'TestNetwork' "
+        "  layer { "
+        "    name: 'data' "
+        "    type: 'DummyData' "
+        "    dummy_data_param { "
+        "      shape { dim: 4 dim: 10 } "
+        "      shape { dim: 4 dim: 1 } "
+        "      data_filler { type: 'constant' value: 0.5 } "
+        "      data_filler { type: 'constant' value: 2 } "
+        "    } "
+        "    top: 'data' "
+        "    top: 'targets' "
+        "  } "
+        "  layer { "
+        "    name: 'innerprod' "
+        "    type: 'InnerProduct' "
+        "    inner_product_param { "
+        "      num_output: 1 "
+        "      weight_filler { type: 'gaussian' } "
+        "      bias_filler { type: 'gaussian' } "
+        "    } "
+        "    bottom: 'data' "
+        "    top: 'innerprod' "
+        "  } "
+        "  layer { "
+        "    name: 'loss' "
+        "    type: 'EuclideanLoss' "
+        "    bottom: 'innerprod' "
+        "    bottom: 'targets' "
+        "  } "
+        "} ";
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    return shared_ptr<SGDSolver<Dtype> >(new SGDSolver<Dtype>(param));
+  }
+};
+
+TYPED_TEST_CASE(DataParallelSolverTest, TestDtypes);
+
+TYPED_TEST(DataParallelSolverTest, TestWorkersMatchSingleSolver) {
+  typedef TypeParam Dtype;
+  const int kSize = 2;
+  // Every worker sees the same data, so the average of their gradients is
+  // that of a single solver, and so are the updates.
+  Caffe::set_random_seed(1701);
+  shared_ptr<SGDSolver<Dtype> > expected = this->NewSolver();
+  expected->Solve();
+  vector<shared_ptr<SGDSolver<Dtype> > > solvers(kSize);
+  for (int rank = 0; rank < kSize; ++rank) {
+    // Only rank 0 starts from the same parameters; the others receive them.
+    Caffe::set_random_seed(1701 + rank);
+    solvers[rank] = this->NewSolver();
+  }
+  vector<char> region(ShmTransport::RegionBytes(kSize, 4096), 0);
+  RunWorkers(kSize, [&](int rank) {
+    solvers[rank]->set_transport(shared_ptr<Transport>(
+        new ShmTransport(&region[0], rank, kSize, 4096)));
+    solvers[rank]->Solve();
+  });
+  const vector<shared_ptr<Blob<Dtype> > >& params =
+      expected->net()->params();
+  for (int rank = 0; rank < kSize; ++rank) {
+    const vector<shared_ptr<Blob<Dtype> > >& worker_params =
+        solvers[rank]->net()->params();
+    ASSERT_EQ(params.size(), worker_params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(params[i]->cpu_data()[j], worker_params[i]->cpu_data()[j])
+            << "rank " << rank << ", param " << i << ", value " << j;
+      }
+    }
+  }
+}
+
+}  // namespace caffe
@@ -1,5 +1,8 @@
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <limits>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -7,6 +10,8 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/blocked_layout.hpp"
+#include "caffe/util/direct_conv.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -369,6 +374,248 @@ TYPED_TEST(ConvolutionLayerTest, TestSobelConvolution) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionDirect) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+  caffe_conv(this->blob_bottom_2_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_2_));
+  top_data = this->blob_top_2_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDirectConvolutionMatchesGEMM) {
+  typedef typename TypeParam::Dtype Dtype;
+  // kernel, stride, pad, group and num_output chosen to hit full and partial
+  // register tiles, filter block remainders, groups, and both the in-place
+  // and the padded / strided input paths.
+  const int kNumConfigs = 7;
+  const int configs[kNumConfigs][5] = {
+    {3, 1, 0, 1, 11}, {3, 1, 1, 2, 16}, {5, 1, 2, 1, 9}, {3, 2, 1, 1, 20},
+    {11, 4, 0, 1, 5}, {1, 1, 0, 1, 13}, {3, 2, 0, 3, 6}
+  };
+  const DirectConvISA isas[] = {
+    DIRECT_CONV_SCALAR, DIRECT_CONV_AVX2, DIRECT_CONV_AVX512
+  };
+  Blob<Dtype> bottom(2, 6, 37, 41);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  for (int isa = 0; isa < 3; ++isa) {
+    set_direct_conv_isa(isas[isa]);
+    for (int c = 0; c < kNumConfigs; ++c) {
+      LayerParameter layer_param;
+      ConvolutionParameter* convolution_param =
+          layer_param.mutable_convolution_param();
+      convolution_param->set_kernel_size(configs[c][0]);
+      convolution_param->set_stride(configs[c][1]);
+      convolution_param->set_pad(configs[c][2]);
+      convolution_param->set_group(configs[c][3]);
+      convolution_param->set_num_output(configs[c][4]);
+      convolution_param->mutable_weight_filler()->set_type("gaussian");
+      convolution_param->mutable_weight_filler()->set_std(0.1);
+      convolution_param->mutable_bias_filler()->set_type("gaussian");
+      convolution_param->set_engine(ConvolutionParameter_Engine_CAFFE);
+      Blob<Dtype> gemm_top;
+      vector<Blob<Dtype>*> gemm_top_vec(1, &gemm_top);
+      ConvolutionLayer<Dtype> gemm_layer(layer_param);
+      gemm_layer.SetUp(bottom_vec, gemm_top_vec);
+      gemm_layer.Forward(bottom_vec, gemm_top_vec);
+      convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+      Blob<Dtype> direct_top;
+      vector<Blob<Dtype>*> direct_top_vec(1, &direct_top);
+      ConvolutionLayer<Dtype> direct_layer(layer_param);
+      direct_layer.SetUp(bottom_vec, direct_top_vec);
+      for (int j = 0; j < gemm_layer.blobs().size(); ++j) {
+        direct_layer.blobs()[j]->CopyFrom(*gemm_layer.blobs()[j]);
+      }
+      direct_layer.Forward(bottom_vec, direct_top_vec);
+      ASSERT_EQ(gemm_top.count(), direct_top.count());
+      const Dtype* gemm_data = gemm_top.cpu_data();
+      const Dtype* direct_data = direct_top.cpu_data();
+      for (int i = 0; i < gemm_top.count(); ++i) {
+        EXPECT_NEAR(gemm_data[i], direct_data[i], 1e-4)
+            << "config " << c << ", isa " << isas[isa];
+      }
+    }
+  }
+  set_direct_conv_isa(DIRECT_CONV_AVX512);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDirectConvolutionFusedReLUNaN) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The fused ReLU of every kernel keeps a NaN, as the ReLU layer does, so
+  // that a diverged net still shows it.
+  Caffe::set_mode(Caffe::CPU);
+  const DirectConvISA isas[] = {
+    DIRECT_CONV_SCALAR, DIRECT_CONV_AVX2, DIRECT_CONV_AVX512
+  };
+  Blob<Dtype> bottom(1, 6, 19, 23);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  bottom.mutable_cpu_data()[bottom.offset(0, 2, 9, 11)] =
+      std::numeric_limits<Dtype>::quiet_NaN();
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(20);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_weight_filler()->set_std(0.1);
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  convolution_param->set_engine(ConvolutionParameter_Engine_CAFFE);
+  Blob<Dtype> gemm_top;
+  vector<Blob<Dtype>*> gemm_top_vec(1, &gemm_top);
+  ConvolutionLayer<Dtype> gemm_layer(layer_param);
+  gemm_layer.SetUp(bottom_vec, gemm_top_vec);
+  gemm_layer.Forward(bottom_vec, gemm_top_vec);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->set_fuse_relu(true);
+  for (int isa = 0; isa < 3; ++isa) {
+    set_direct_conv_isa(isas[isa]);
+    Blob<Dtype> direct_top;
+    vector<Blob<Dtype>*> direct_top_vec(1, &direct_top);
+    ConvolutionLayer<Dtype> direct_layer(layer_param);
+    direct_layer.SetUp(bottom_vec, direct_top_vec);
+    for (int j = 0; j < gemm_layer.blobs().size(); ++j) {
+      direct_layer.blobs()[j]->CopyFrom(*gemm_layer.blobs()[j]);
+    }
+    direct_layer.Forward(bottom_vec, direct_top_vec);
+    ASSERT_EQ(gemm_top.count(), direct_top.count());
+    const Dtype* gemm_data = gemm_top.cpu_data();
+    const Dtype* direct_data = direct_top.cpu_data();
+    int num_nan = 0;
+    for (int i = 0; i < gemm_top.count(); ++i) {
+      if (std::isnan(gemm_data[i])) {
+        EXPECT_TRUE(std::isnan(direct_data[i])) << i << ", isa " << isas[isa];
+        ++num_nan;
+      } else {
+        EXPECT_NEAR(std::max(gemm_data[i], Dtype(0)), direct_data[i], 1e-4)
+            << i << ", isa " << isas[isa];
+      }
+    }
+    // The 3x3 neighbourhood of the NaN, in every output channel.
+    EXPECT_EQ(9 * 20, num_nan);
+  }
+  set_direct_conv_isa(DIRECT_CONV_AVX512);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestBlockedConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Blocked layouts are CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  const BlobLayout layouts[] = { NCHW8C, NCHW16C };
+  const DirectConvISA isas[] = {
+    DIRECT_CONV_SCALAR, DIRECT_CONV_AVX2, DIRECT_CONV_AVX512
+  };
+  // 3 input channels are read as plain NCHW; 16 also in blocked form.
+  const int input_channels[] = { 3, 16 };
+  for (int l = 0; l < 2; ++l) {
+    const int block = blob_layout_block(layouts[l]);
+    for (int c = 0; c < 2; ++c) {
+      const int channels = input_channels[c];
+      Blob<Dtype> bottom(2, channels, 9, 8);
+      FillerParameter filler_param;
+      GaussianFiller<Dtype> filler(filler_param);
+      filler.Fill(&bottom);
+      vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+      LayerParameter layer_param;
+      ConvolutionParameter* convolution_param =
+          layer_param.mutable_convolution_param();
+      convolution_param->set_kernel_size(3);
+      convolution_param->set_stride(2);
+      convolution_param->set_pad(1);
+      convolution_param->set_num_output(32);
+      convolution_param->mutable_weight_filler()->set_type("gaussian");
+      convolution_param->mutable_bias_filler()->set_type("gaussian");
+      Blob<Dtype> ref_top;
+      vector<Blob<Dtype>*> ref_top_vec(1, &ref_top);
+      ConvolutionLayer<Dtype> ref_layer(layer_param);
+      ref_layer.SetUp(bottom_vec, ref_top_vec);
+      ref_layer.Forward(bottom_vec, ref_top_vec);
+      layer_param.set_layout(layouts[l]);
+      Blob<Dtype> blocked_top;
+      vector<Blob<Dtype>*> blocked_top_vec(1, &blocked_top);
+      ConvolutionLayer<Dtype> layer(layer_param);
+      layer.SetUp(bottom_vec, blocked_top_vec);
+      EXPECT_EQ(layouts[l], blocked_top.layout());
+      for (int j = 0; j < ref_layer.blobs().size(); ++j) {
+        layer.blobs()[j]->CopyFrom(*ref_layer.blobs()[j]);
+      }
+      Blob<Dtype> blocked_bottom(2, channels, 9, 8);
+      if (channels % block == 0) {
+        nchw_to_blocked_cpu(bottom.cpu_data(), 2, channels, 9 * 8, block,
+            blocked_bottom.mutable_cpu_data());
+        blocked_bottom.set_layout(layouts[l]);
+      } else {
+        blocked_bottom.CopyFrom(bottom);
+      }
+      vector<Blob<Dtype>*> blocked_bottom_vec(1, &blocked_bottom);
+      Blob<Dtype> top(1, 1, 1, 1);
+      for (int isa = 0; isa < 3; ++isa) {
+        set_direct_conv_isa(isas[isa]);
+        for (int b = 0; b < 2; ++b) {
+          layer.Reshape(b ? blocked_bottom_vec : bottom_vec, blocked_top_vec);
+          layer.Forward(b ? blocked_bottom_vec : bottom_vec, blocked_top_vec);
+          top.ReshapeLike(blocked_top);
+          blocked_to_nchw_cpu(blocked_top.cpu_data(), 2, 32,
+              blocked_top.height() * blocked_top.width(), block,
+              top.mutable_cpu_data());
+          ASSERT_EQ(ref_top.count(), top.count());
+          for (int i = 0; i < top.count(); ++i) {
+            EXPECT_NEAR(ref_top.cpu_data()[i], top.cpu_data()[i], 1e-4)
+                << "isa " << isas[isa];
+          }
+        }
+      }
+      // The filters are reordered once, and again when they change.
+      filler.Fill(ref_layer.blobs()[0].get());
+      ref_layer.Forward(bottom_vec, ref_top_vec);
+      layer.blobs()[0]->CopyFrom(*ref_layer.blobs()[0]);
+      layer.Forward(blocked_bottom_vec, blocked_top_vec);
+      blocked_to_nchw_cpu(blocked_top.cpu_data(), 2, 32,
+          blocked_top.height() * blocked_top.width(), block,
+          top.mutable_cpu_data());
+      for (int i = 0; i < top.count(); ++i) {
+        EXPECT_NEAR(ref_top.cpu_data()[i], top.cpu_data()[i], 1e-4);
+      }
+    }
+  }
+  set_direct_conv_isa(DIRECT_CONV_AVX512);
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -422,6 +669,146 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestGradientDirect) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWeightGradientDeterministic) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The weight gradient is reduced across parallel batch shards; repeated
+  // backward passes must agree bitwise and match a serial reference. Run on
+  // several shards even on small machines.
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_num_threads(3);
+  Blob<Dtype> bottom(9, 3, 6, 4);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(bottom_vec, this->blob_top_vec_);
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  const Blob<Dtype>& weights = *layer.blobs()[0];
+  // Serial reference: sum over images of top_diff correlated with bottom.
+  Blob<Dtype> ref_diff;
+  ref_diff.ReshapeLike(weights);
+  caffe_set(ref_diff.count(), Dtype(0), ref_diff.mutable_cpu_data());
+  for (int n = 0; n < bottom.num(); ++n) {
+    for (int o = 0; o < weights.num(); ++o) {
+      for (int c = 0; c < weights.channels(); ++c) {
+        for (int p = 0; p < 3; ++p) {
+          for (int q = 0; q < 3; ++q) {
+            Dtype sum = 0;
+            for (int y = 0; y < this->blob_top_->height(); ++y) {
+              for (int x = 0; x < this->blob_top_->width(); ++x) {
+                const int h = y * 2 + p - 1;
+                const int w = x * 2 + q - 1;
+                if (h >= 0 && h < bottom.height() && w >= 0
+                    && w < bottom.width()) {
+                  sum += this->blob_top_->diff_at(n, o, y, x)
+                      * bottom.data_at(n, c, h, w);
+                }
+              }
+            }
+            ref_diff.mutable_cpu_data()[ref_diff.offset(o, c, p, q)] += sum;
+          }
+        }
+      }
+    }
+  }
+  Blob<Dtype> first_diff;
+  first_diff.ReshapeLike(weights);
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Backward(this->blob_top_vec_, vector<bool>(1, true), bottom_vec);
+    if (iter == 0) {
+      caffe_copy(weights.count(), weights.cpu_diff(),
+          first_diff.mutable_cpu_data());
+    }
+    for (int i = 0; i < weights.count(); ++i) {
+      EXPECT_EQ(first_diff.cpu_data()[i], weights.cpu_diff()[i]);
+      EXPECT_NEAR(ref_diff.cpu_data()[i], weights.cpu_diff()[i], 1e-4);
+    }
+  }
+  // One private weight gradient per shard, unless the weights are fixed.
+  EXPECT_EQ(3 * weights.count(), layer.BackwardScratchCount());
+  layer.set_param_propagate_down(0, false);
+  EXPECT_EQ(0, layer.BackwardScratchCount());
+  Caffe::set_num_threads(0);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestSharedWorkspace) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Two layers share one workspace; the second needs more columns and grows
+  // it, which must not disturb the first.
+  shared_ptr<Blob<Dtype> > workspace(new Blob<Dtype>());
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> small_layer(layer_param);
+  small_layer.set_workspace(workspace);
+  small_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int small_count = workspace->count();
+  EXPECT_GT(small_count, 0);
+  LayerParameter large_layer_param(layer_param);
+  ConvolutionParameter* large_convolution_param =
+      large_layer_param.mutable_convolution_param();
+  large_convolution_param->set_kernel_size(3);
+  large_convolution_param->set_pad(1);
+  vector<Blob<Dtype>*> top_vec(1, this->blob_top_2_);
+  ConvolutionLayer<Dtype> large_layer(large_layer_param);
+  large_layer.set_workspace(workspace);
+  large_layer.SetUp(this->blob_bottom_vec_, top_vec);
+  EXPECT_GT(workspace->count(), small_count);
+  small_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  large_layer.Forward(this->blob_bottom_vec_, top_vec);
+  // Per shard, 3 * 2 * 2 x 5 * 3 columns for the small layer and
+  // 3 * 3 * 3 x 6 * 4 columns for the large one.
+  EXPECT_EQ(small_count / (12 * 15) * (27 * 24), workspace->count());
+  caffe_conv(this->blob_bottom_, convolution_param, small_layer.blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(this->ref_blob_top_->cpu_data()[i],
+        this->blob_top_->cpu_data()[i], 1e-4);
+  }
+  caffe_conv(this->blob_bottom_, large_convolution_param, large_layer.blobs(),
+      this->MakeReferenceTop(this->blob_top_2_));
+  for (int i = 0; i < this->blob_top_2_->count(); ++i) {
+    EXPECT_NEAR(this->ref_blob_top_->cpu_data()[i],
+        this->blob_top_2_->cpu_data()[i], 1e-4);
+  }
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
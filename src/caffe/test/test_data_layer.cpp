@@ -28,7 +28,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
       : backend_(DataParameter_DB_LEVELDB),
         blob_top_data_(new Blob<Dtype>()),
         blob_top_label_(new Blob<Dtype>()),
-        seed_(1701) {}
+        seed_(1701), prefetch_(3), transform_threads_(1) {}
   virtual void SetUp() {
     filename_.reset(new string());
     MakeTempDir(filename_.get());
@@ -75,6 +75,8 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_prefetch(prefetch_);
+    data_param->set_transform_threads(transform_threads_);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -105,6 +107,48 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Each epoch of batch_size 5 holds every datum once, in an order that
+  // changes from epoch to epoch.
+  void TestReadShuffle() {
+    const Dtype scale = 3;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle(true);
+    data_param->set_transform_threads(transform_threads_);
+    param.mutable_transform_param()->set_scale(scale);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    vector<vector<int> > orders;
+    for (int iter = 0; iter < 20; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      vector<int> order;
+      vector<bool> seen(5, false);
+      for (int i = 0; i < 5; ++i) {
+        const int label = blob_top_label_->cpu_data()[i];
+        ASSERT_GE(label, 0);
+        ASSERT_LT(label, 5);
+        EXPECT_FALSE(seen[label]) << "debug: iter " << iter << " i " << i;
+        seen[label] = true;
+        order.push_back(label);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(scale * label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+      orders.push_back(order);
+    }
+    int num_changes = 0;
+    for (int iter = 1; iter < orders.size(); ++iter) {
+      num_changes += orders[iter] != orders[iter - 1];
+    }
+    EXPECT_GT(num_changes, 0);
+  }
+
   void TestReshape(DataParameter_DB backend) {
     const int num_inputs = 5;
     // Save data of varying shapes.
@@ -231,6 +275,8 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_prefetch(prefetch_);
+    data_param->set_transform_threads(transform_threads_);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -345,6 +391,8 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
   vector<Blob<Dtype>*> blob_bottom_vec_;
   vector<Blob<Dtype>*> blob_top_vec_;
   int seed_;
+  int prefetch_;
+  int transform_threads_;
 };
 
 TYPED_TEST_CASE(DataLayerTest, TestDtypesAndDevices);
@@ -393,6 +441,14 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadParallelLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->prefetch_ = 4;
+  this->transform_threads_ = 3;
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead();
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -411,6 +467,16 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that the sequence stays consistent when the items are transformed by
+// several workers, each with its own random generator.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededParallelLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->prefetch_ = 1;
+  this->transform_threads_ = 2;
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadCropTrainSequenceSeeded();
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
@@ -425,4 +491,56 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLMDB) {
   this->TestReadCrop(TEST);
 }
 
-}  // namespace caffe
\ No newline at end of file
+TYPED_TEST(DataLayerTest, TestReadRecords) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_RECORDS);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReshapeRecords) {
+  this->TestReshape(DataParameter_DB_RECORDS);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededRecords) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_RECORDS);
+  this->TestReadCropTrainSequenceSeeded();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleRecords) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->transform_threads_ = 2;
+  this->Fill(unique_pixels, DataParameter_DB_RECORDS);
+  this->TestReadShuffle();
+}
+
+TYPED_TEST(DataLayerTest, TestReadWorkerShardRecords) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Worker 1 of 2 loads half of each batch of 4: every other record,
+  // starting at record 1 and going round the 5 records.
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_RECORDS);
+  Caffe::set_solver_count(2);
+  Caffe::set_solver_rank(1);
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(4);
+  data_param->set_source(this->filename_->c_str());
+  data_param->set_backend(DataParameter_DB_RECORDS);
+  DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(2, this->blob_top_data_->num());
+  EXPECT_EQ(2, this->blob_top_label_->num());
+  for (int iter = 0; iter < 5; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_EQ((1 + 2 * (2 * iter + i)) % 5,
+          this->blob_top_label_->cpu_data()[i]) << "debug: iter " << iter;
+    }
+  }
+  Caffe::set_solver_count(1);
+  Caffe::set_solver_rank(0);
+}
+
+}  // namespace caffe
@@ -1,3 +1,4 @@
+#include <opencv2/core/core.hpp>
 
 #include <string>
 #include <vector>
@@ -11,6 +12,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "caffe/util/transform.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -353,4 +355,56 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
-}  // namespace caffe
\ No newline at end of file
+// The rows are wider than a vector and not a multiple of it, so that both
+// the vectorized kernels and their scalar tails are exercised.
+TYPED_TEST(DataTransformTest, TestCropMirrorMeanSIMD) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int label = 0;
+  const int channels = 3;
+  const int height = 23;
+  const int width = 21;
+  const int crop_size = 19;
+
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  transform_param.set_scale(0.5);
+  transform_param.add_mean_value(10);
+  transform_param.add_mean_value(20);
+  transform_param.add_mean_value(30);
+  Datum datum;
+  FillDatum(label, channels, height, width, unique_pixels, &datum);
+  // The same image as a cv::Mat, with interleaved channels.
+  cv::Mat cv_img(height, width, CV_8UC3);
+  for (int h = 0; h < height; ++h) {
+    for (int w = 0; w < width; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        cv_img.at<cv::Vec3b>(h, w)[c] = static_cast<uint8_t>(
+            datum.data()[(c * height + h) * width + w]);
+      }
+    }
+  }
+  DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+  Blob<TypeParam> scalar_blob(1, channels, crop_size, crop_size);
+  Blob<TypeParam> simd_blob(1, channels, crop_size, crop_size);
+  Blob<TypeParam> mat_blob(1, channels, crop_size, crop_size);
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    Caffe::set_random_seed(this->seed_ + iter);
+    transformer.InitRand();
+    set_transform_simd(false);
+    transformer.Transform(datum, &scalar_blob);
+    Caffe::set_random_seed(this->seed_ + iter);
+    transformer.InitRand();
+    set_transform_simd(true);
+    transformer.Transform(datum, &simd_blob);
+    Caffe::set_random_seed(this->seed_ + iter);
+    transformer.InitRand();
+    transformer.Transform(cv_img, &mat_blob);
+    for (int j = 0; j < scalar_blob.count(); ++j) {
+      EXPECT_EQ(scalar_blob.cpu_data()[j], simd_blob.cpu_data()[j]);
+      EXPECT_EQ(scalar_blob.cpu_data()[j], mat_blob.cpu_data()[j]);
+    }
+  }
+}
+
+}  // namespace caffe
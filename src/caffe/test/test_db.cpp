@@ -1,4 +1,6 @@
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "boost/scoped_ptr.hpp"
 #include "gtest/gtest.h"
@@ -6,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_records.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -56,8 +59,13 @@ struct TypeLMDB {
 };
 DataParameter_DB TypeLMDB::backend = DataParameter_DB_LMDB;
 
+struct TypeRecords {
+  static DataParameter_DB backend;
+};
+DataParameter_DB TypeRecords::backend = DataParameter_DB_RECORDS;
+
 // typedef ::testing::Types<TypeLmdb> TestTypes;
-typedef ::testing::Types<TypeLevelDB, TypeLMDB> TestTypes;
+typedef ::testing::Types<TypeLevelDB, TypeLMDB, TypeRecords> TestTypes;
 
 TYPED_TEST_CASE(DBTest, TestTypes);
 
@@ -116,6 +124,28 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestValueRef) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  vector<string> values;
+  vector<std::pair<const char*, size_t> > refs;
+  for (; cursor->valid(); cursor->Next()) {
+    const char* data;
+    size_t size;
+    cursor->value_ref(&data, &size);
+    EXPECT_EQ(cursor->value(), string(data, size));
+    values.push_back(cursor->value());
+    refs.push_back(std::make_pair(data, size));
+  }
+  EXPECT_EQ(values.size(), 2);
+  if (cursor->values_stay_valid()) {
+    for (int i = 0; i < values.size(); ++i) {
+      EXPECT_EQ(values[i], string(refs[i].first, refs[i].second));
+    }
+  }
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
@@ -131,4 +161,98 @@ TYPED_TEST(DBTest, TestWrite) {
   txn->Commit();
 }
 
+class RecordDBTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempDir(&source_);
+    source_ += "/db";
+  }
+
+  // Writes records "key_<i>" -> i copies of char 'a' + i % 26, for i in
+  // [begin, end).
+  void Write(const int begin, const int end, const db::Mode mode) {
+    db::RecordDB db(kShardBytes);
+    db.Open(source_, mode);
+    scoped_ptr<db::Transaction> txn(db.NewTransaction());
+    for (int i = begin; i < end; ++i) {
+      txn->Put(Key(i), Value(i));
+      if (i % 7 == 0) {
+        txn->Commit();
+      }
+    }
+    txn->Commit();
+  }
+
+  static string Key(const int i) {
+    stringstream ss;
+    ss << "key_" << i;
+    return ss.str();
+  }
+  static string Value(const int i) {
+    return string(i, 'a' + i % 26);
+  }
+
+  // Small enough to spread the records over several shards.
+  static const size_t kShardBytes = 256;
+  string source_;
+};
+
+const size_t RecordDBTest::kShardBytes;
+
+TEST_F(RecordDBTest, TestSequential) {
+  Write(0, 50, db::NEW);
+  db::RecordDB db;
+  db.Open(source_, db::READ);
+  EXPECT_EQ(db.size(), 50);
+  EXPECT_GT(db.num_shards(), 1);
+  scoped_ptr<db::Cursor> cursor(db.NewCursor());
+  EXPECT_TRUE(cursor->random_access());
+  EXPECT_EQ(cursor->size(), 50);
+  for (int i = 0; i < 50; ++i, cursor->Next()) {
+    ASSERT_TRUE(cursor->valid());
+    EXPECT_EQ(Key(i), cursor->key());
+    EXPECT_EQ(Value(i), cursor->value());
+  }
+  EXPECT_FALSE(cursor->valid());
+}
+
+TEST_F(RecordDBTest, TestRandomAccess) {
+  Write(0, 50, db::NEW);
+  db::RecordDB db;
+  db.Open(source_, db::READ);
+  // Two cursors read independently from the same mapping.
+  scoped_ptr<db::Cursor> cursor(db.NewCursor());
+  scoped_ptr<db::Cursor> other(db.NewCursor());
+  vector<std::pair<const char*, size_t> > refs(50);
+  for (int k = 0; k < 50; ++k) {
+    const int i = (k * 17) % 50;
+    cursor->Seek(i);
+    other->Seek(49 - i);
+    ASSERT_TRUE(cursor->valid());
+    ASSERT_TRUE(other->valid());
+    EXPECT_EQ(Key(i), cursor->key());
+    EXPECT_EQ(Key(49 - i), other->key());
+    cursor->value_ref(&refs[i].first, &refs[i].second);
+  }
+  for (int i = 0; i < 50; ++i) {
+    EXPECT_EQ(Value(i), string(refs[i].first, refs[i].second));
+  }
+  cursor->Seek(50);
+  EXPECT_FALSE(cursor->valid());
+}
+
+TEST_F(RecordDBTest, TestAppend) {
+  Write(0, 20, db::NEW);
+  Write(20, 30, db::WRITE);
+  db::RecordDB db;
+  db.Open(source_, db::READ);
+  EXPECT_EQ(db.size(), 30);
+  scoped_ptr<db::Cursor> cursor(db.NewCursor());
+  for (int i = 0; i < 30; ++i, cursor->Next()) {
+    ASSERT_TRUE(cursor->valid());
+    EXPECT_EQ(Key(i), cursor->key());
+    EXPECT_EQ(Value(i), cursor->value());
+  }
+}
+
 }  // namespace caffe
@@ -1,5 +1,9 @@
 
+#include <unistd.h>
+
 #include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <iterator>
 #include <string>
 #include <utility>
 #include <vector>
@@ -11,6 +15,7 @@
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
+#include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -24,12 +29,17 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 
  protected:
   GradientBasedSolverTest() :
-      seed_(1701), num_(5), channels_(3), height_(10), width_(10) {}
+      seed_(1701), num_(5), channels_(3), height_(10), width_(10),
+      regularization_type_("L2"), snapshot_(0), snapshot_async_(false) {}
 
   shared_ptr<SGDSolver<Dtype> > solver_;
   int seed_;
   int num_, channels_, height_, width_;
   Dtype delta_;  // Stability constant for AdaGrad.
+  string regularization_type_;
+  int snapshot_;
+  string snapshot_prefix_;
+  bool snapshot_async_;
 
   virtual SolverParameter_SolverType solver_type() = 0;
   virtual void InitSolver(const SolverParameter& param) = 0;
@@ -114,6 +124,15 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (momentum != 0) {
       proto << "momentum: " << momentum << " ";
     }
+    if (regularization_type_ != "L2") {
+      proto << "regularization_type: '" << regularization_type_ << "' ";
+    }
+    if (snapshot_) {
+      proto << "snapshot: " << snapshot_ << " "
+            << "snapshot_prefix: '" << snapshot_prefix_ << "' "
+            << "snapshot_async: " << (snapshot_async_ ? "true" : "false")
+            << " ";
+    }
     Caffe::set_random_seed(this->seed_);
     this->InitSolverFromProtoString(proto.str());
     this->solver_->Solve();
@@ -304,6 +323,95 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     // Check that the solver's solution matches ours.
     CheckLeastSquaresUpdate(updated_params);
   }
+
+  // Checks that the fused CPU update gives exactly the parameters and history
+  // of the separate BLAS calls it replaces.
+  void TestFusedUpdate(const Dtype learning_rate, const Dtype weight_decay,
+      const Dtype momentum, const int num_iters,
+      const string& regularization_type = "L2") {
+    regularization_type_ = regularization_type;
+    set_fused_update(false);
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters);
+    vector<shared_ptr<Blob<Dtype> > > expected;
+    const vector<shared_ptr<Blob<Dtype> > >& params =
+        solver_->net()->params();
+    const vector<shared_ptr<Blob<Dtype> > >& history = solver_->history();
+    for (int i = 0; i < params.size(); ++i) {
+      expected.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      expected.back()->CopyFrom(*params[i], false, true);
+      expected.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      expected.back()->CopyFrom(*history[i], false, true);
+    }
+    set_fused_update(true);
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters);
+    regularization_type_ = "L2";
+    ASSERT_EQ(2 * params.size(), expected.size());
+    for (int i = 0; i < params.size(); ++i) {
+      const Blob<Dtype>& param = *solver_->net()->params()[i];
+      const Blob<Dtype>& hist = *solver_->history()[i];
+      for (int j = 0; j < param.count(); ++j) {
+        EXPECT_EQ(expected[2 * i]->cpu_data()[j], param.cpu_data()[j])
+            << "param " << i << " value " << j;
+        EXPECT_EQ(expected[2 * i + 1]->cpu_data()[j], hist.cpu_data()[j])
+            << "history " << i << " value " << j;
+      }
+    }
+  }
+
+  static string ReadFile(const string& filename) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    EXPECT_TRUE(file.good()) << "Missing " << filename;
+    return string(std::istreambuf_iterator<char>(file),
+                  std::istreambuf_iterator<char>());
+  }
+
+  // Checks that snapshots written in the background are the same files as
+  // the ones written synchronously, and that none is left half-written.
+  void TestSnapshot(const Dtype learning_rate, const Dtype weight_decay,
+      const Dtype momentum, const int num_iters, const int snapshot) {
+    string sync_dir, async_dir;
+    MakeTempDir(&sync_dir);
+    MakeTempDir(&async_dir);
+    snapshot_ = snapshot;
+    snapshot_prefix_ = sync_dir + "/solver";
+    snapshot_async_ = false;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters);
+    snapshot_prefix_ = async_dir + "/solver";
+    snapshot_async_ = true;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters);
+    snapshot_ = 0;
+    for (int iter = snapshot; iter <= num_iters; iter += snapshot) {
+      ostringstream suffix;
+      suffix << "/solver_iter_" << iter;
+      EXPECT_EQ(ReadFile(sync_dir + suffix.str() + ".caffemodel"),
+                ReadFile(async_dir + suffix.str() + ".caffemodel"))
+          << "iteration " << iter;
+      // The states differ only in the path of their model.
+      SolverState sync_state, async_state;
+      ReadProtoFromBinaryFileOrDie(sync_dir + suffix.str() + ".solverstate",
+                                   &sync_state);
+      ReadProtoFromBinaryFileOrDie(async_dir + suffix.str() + ".solverstate",
+                                   &async_state);
+      EXPECT_EQ(async_dir + suffix.str() + ".caffemodel",
+                async_state.learned_net());
+      sync_state.clear_learned_net();
+      async_state.clear_learned_net();
+      EXPECT_EQ(sync_state.SerializeAsString(),
+                async_state.SerializeAsString()) << "iteration " << iter;
+      const string dirs[] = { sync_dir, async_dir };
+      const char* extensions[] = { ".caffemodel", ".solverstate" };
+      for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2; ++j) {
+          const string filename = dirs[i] + suffix.str() + extensions[j];
+          EXPECT_NE(0, access((filename + ".tmp").c_str(), F_OK))
+              << "Left " << filename << ".tmp";
+          unlink(filename.c_str());
+        }
+      }
+    }
+    rmdir(sync_dir.c_str());
+    rmdir(async_dir.c_str());
+  }
 };
 
 
@@ -373,6 +481,28 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestFusedUpdateWithEverything) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+                        "L1");
+}
+
+TYPED_TEST(SGDSolverTest, TestSnapshot) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 6;
+  const int kSnapshot = 2;
+  this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+                     kSnapshot);
+}
+
 
 template <typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -417,6 +547,17 @@ TYPED_TEST(AdaGradSolverTest, TestAdaGradLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdaGradSolverTest, TestAdaGradFusedUpdateWithEverything) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.0;
+  const int kNumIters = 4;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+                        "L1");
+}
+
 
 template <typename TypeParam>
 class NesterovSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -483,4 +624,15 @@ TYPED_TEST(NesterovSolverTest, TestNesterovLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(NesterovSolverTest, TestNesterovFusedUpdateWithEverything) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+                        "L1");
+}
+
 }  // namespace caffe
\ No newline at end of file
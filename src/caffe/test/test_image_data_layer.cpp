@@ -87,6 +87,33 @@ TYPED_TEST(ImageDataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestReadWorkerShard) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Worker 1 of 2 loads half of each batch of 4: every other line, starting
+  // at line 1 and going round the 5 lines.
+  Caffe::set_solver_count(2);
+  Caffe::set_solver_rank(1);
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(4);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_shuffle(false);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(2, this->blob_top_data_->num());
+  EXPECT_EQ(2, this->blob_top_label_->num());
+  for (int iter = 0; iter < 5; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_EQ((1 + 2 * (2 * iter + i)) % 5,
+          this->blob_top_label_->cpu_data()[i]) << "debug: iter " << iter;
+    }
+  }
+  Caffe::set_solver_count(1);
+  Caffe::set_solver_rank(0);
+}
+
 TYPED_TEST(ImageDataLayerTest, TestResize) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
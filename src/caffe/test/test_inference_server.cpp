@@ -0,0 +1,184 @@
+#include <unistd.h>
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/inference_server.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class InferenceServerTest : public ::testing::Test {
+ protected:
+  static const int kNumItems = 16;
+  static const int kInputCount = 8;
+  static const int kOutputCount = 5;
+
+  InferenceServerTest() {
+    const string proto =
+        "name: 'TestNetwork' "
+        "input: 'data' "
+        "input_shape { dim: 1 dim: 8 } "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { type: 'gaussian' std: 1 } "
+        "    bias_filler { type: 'gaussian' std: 1 } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'ip' "
+        "} "
+        "layer { "
+        "  name: 'prob' "
+        "  type: 'Softmax' "
+        "  bottom: 'ip' "
+        "  top: 'prob' "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    Caffe::set_random_seed(1701);
+    Net<float> net(param_);
+    NetParameter trained;
+    net.ToProto(&trained);
+    MakeTempFilename(&weights_file_);
+    WriteProtoToBinaryFile(trained, weights_file_);
+    // The outputs of each item on its own.
+    inputs_.resize(kNumItems);
+    expected_.resize(kNumItems);
+    for (int i = 0; i < kNumItems; ++i) {
+      inputs_[i].resize(kInputCount);
+      caffe_rng_gaussian<float>(kInputCount, 0, 1, inputs_[i].data());
+      caffe_copy(kInputCount, inputs_[i].data(),
+          net.input_blobs()[0]->mutable_cpu_data());
+      const Blob<float>& output = *net.ForwardPrefilled()[0];
+      expected_[i].assign(output.cpu_data(), output.cpu_data() + kOutputCount);
+    }
+  }
+
+  virtual ~InferenceServerTest() {
+    unlink(weights_file_.c_str());
+  }
+
+  InferenceServer::Options options(const int replicas,
+      const int max_batch_size, const int max_delay_us) {
+    InferenceServer::Options options;
+    options.replicas = replicas;
+    options.max_batch_size = max_batch_size;
+    options.max_delay_us = max_delay_us;
+    options.threads_per_replica = 1;
+    return options;
+  }
+
+  void CheckOutput(const int item, const vector<float>& output) {
+    ASSERT_EQ(kOutputCount, output.size());
+    for (int i = 0; i < kOutputCount; ++i) {
+      EXPECT_NEAR(expected_[item][i], output[i], 1e-5)
+          << "item " << item << ", value " << i;
+    }
+  }
+
+  // Infers every num_threads-th item from first, in process.
+  void InferItems(InferenceServer* server, const int first,
+      const int num_threads) {
+    vector<float> output;
+    for (int i = first; i < kNumItems; i += num_threads) {
+      server->Infer("net", inputs_[i], &output);
+      CheckOutput(i, output);
+    }
+  }
+
+  // The same, as a client of socket_path.
+  void InferItemsAsClient(const string& socket_path, const int first,
+      const int num_threads) {
+    InferenceClient client(socket_path);
+    vector<float> output;
+    for (int i = first; i < kNumItems; i += num_threads) {
+      EXPECT_TRUE(client.Infer("net", inputs_[i], &output));
+      CheckOutput(i, output);
+    }
+  }
+
+  NetParameter param_;
+  string weights_file_;
+  vector<vector<float> > inputs_;
+  vector<vector<float> > expected_;
+};
+
+const int InferenceServerTest::kNumItems;
+const int InferenceServerTest::kInputCount;
+const int InferenceServerTest::kOutputCount;
+
+TEST_F(InferenceServerTest, TestInfer) {
+  {
+    InferenceServer server(options(2, 4, 1000));
+    // The replicas share a pool of threads_per_replica threads each.
+    EXPECT_EQ(2, Caffe::requested_num_threads());
+    server.AddModel("net", param_, weights_file_);
+    EXPECT_EQ(kInputCount, server.input_count("net"));
+    EXPECT_EQ(kOutputCount, server.output_count("net"));
+    const int kNumThreads = 8;
+    boost::thread_group threads;
+    for (int i = 0; i < kNumThreads; ++i) {
+      threads.create_thread([&, i]() { InferItems(&server, i, kNumThreads); });
+    }
+    threads.join_all();
+    EXPECT_EQ(kNumItems, server.stats("net").requests);
+  }
+  EXPECT_EQ(0, Caffe::requested_num_threads());
+}
+
+TEST_F(InferenceServerTest, TestFullBatchRunsAtOnce) {
+  // Were the batch run on its deadline instead, the test would time out.
+  const int kBatchSize = 4;
+  InferenceServer server(options(1, kBatchSize, 1000 * 1000 * 1000));
+  server.AddModel("net", param_, weights_file_);
+  boost::thread_group threads;
+  for (int i = 0; i < kBatchSize; ++i) {
+    threads.create_thread([&, i]() { InferItems(&server, i, kNumItems); });
+  }
+  threads.join_all();
+  EXPECT_EQ(kBatchSize, server.stats("net").requests);
+  EXPECT_EQ(1, server.stats("net").batches);
+}
+
+TEST_F(InferenceServerTest, TestClients) {
+  InferenceServer server(options(2, 4, 1000));
+  server.AddModel("net", param_, weights_file_);
+  string socket_path;
+  MakeTempFilename(&socket_path);
+  server.Listen(socket_path);
+  const int kNumThreads = 4;
+  boost::thread_group threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.create_thread([&, i]() {
+      InferItemsAsClient(socket_path, i, kNumThreads);
+    });
+  }
+  threads.join_all();
+  EXPECT_EQ(kNumItems, server.stats("net").requests);
+
+  // Bad requests fail without closing the connection.
+  InferenceClient client(socket_path);
+  vector<float> output;
+  string error;
+  EXPECT_FALSE(client.Infer("other", inputs_[0], &output, &error));
+  EXPECT_EQ("No model other", error);
+  EXPECT_FALSE(client.Infer("net", vector<float>(3), &output, &error));
+  EXPECT_EQ("Model net takes 8 values per item, not 3", error);
+  EXPECT_TRUE(client.Infer("net", inputs_[0], &output));
+  CheckOutput(0, output);
+  server.Stop();
+  EXPECT_NE(0, access(socket_path.c_str(), F_OK));
+}
+
+}  // namespace caffe
@@ -20,4 +20,30 @@ TEST_F(InternalThreadTest, TestStartAndExit) {
   EXPECT_FALSE(thread.is_started());
 }
 
+class LoopingThread : public InternalThread {
+ public:
+  LoopingThread() : iterations_(0) {}
+  virtual ~LoopingThread() { StopInternalThread(); }
+
+  volatile int iterations_;
+
+ protected:
+  virtual void InternalThreadEntry() {
+    while (!must_stop()) {
+      iterations_ = iterations_ + 1;
+    }
+  }
+};
+
+TEST_F(InternalThreadTest, TestStop) {
+  LoopingThread thread;
+  EXPECT_TRUE(thread.StartInternalThread());
+  while (thread.iterations_ == 0) {}
+  EXPECT_TRUE(thread.StopInternalThread());
+  EXPECT_FALSE(thread.is_started());
+  const int iterations = thread.iterations_;
+  EXPECT_GT(iterations, 0);
+  EXPECT_EQ(iterations, thread.iterations_);
+}
+
 }  // namespace caffe
@@ -420,4 +420,66 @@ TEST_F(IOTest, TestDecodeDatumToCVMatContentNative) {
   }
 }
 
-}  // namespace caffe
\ No newline at end of file
+TEST_F(IOTest, TestParseDatumView) {
+  Datum datum;
+  datum.set_channels(2);
+  datum.set_height(3);
+  datum.set_width(4);
+  datum.set_label(-7);
+  for (int i = 0; i < 24; ++i) {
+    datum.mutable_data()->push_back(static_cast<char>(i * 10));
+  }
+  string out;
+  CHECK(datum.SerializeToString(&out));
+  DatumView view;
+  EXPECT_TRUE(ParseDatumView(out.data(), out.size(), &view));
+  EXPECT_EQ(view.channels, 2);
+  EXPECT_EQ(view.height, 3);
+  EXPECT_EQ(view.width, 4);
+  EXPECT_EQ(view.label, -7);
+  EXPECT_FALSE(view.encoded);
+  ASSERT_EQ(view.data_size, 24);
+  // The data points into the serialized bytes.
+  EXPECT_GE(reinterpret_cast<const char*>(view.data), out.data());
+  EXPECT_LE(reinterpret_cast<const char*>(view.data) + view.data_size,
+      out.data() + out.size());
+  for (int i = 0; i < 24; ++i) {
+    EXPECT_EQ(view.data[i], static_cast<uint8_t>(i * 10));
+  }
+}
+
+TEST_F(IOTest, TestParseDatumViewEncoded) {
+  Datum datum;
+  datum.set_data("not really a jpeg");
+  datum.set_label(3);
+  datum.set_encoded(true);
+  string out;
+  CHECK(datum.SerializeToString(&out));
+  DatumView view;
+  EXPECT_TRUE(ParseDatumView(out.data(), out.size(), &view));
+  EXPECT_TRUE(view.encoded);
+  EXPECT_EQ(view.label, 3);
+  EXPECT_EQ(string(reinterpret_cast<const char*>(view.data), view.data_size),
+      datum.data());
+}
+
+TEST_F(IOTest, TestParseDatumViewFloatData) {
+  Datum datum;
+  datum.set_channels(1);
+  datum.set_height(1);
+  datum.set_width(2);
+  datum.add_float_data(0.5);
+  datum.add_float_data(1.5);
+  string out;
+  CHECK(datum.SerializeToString(&out));
+  DatumView view;
+  EXPECT_FALSE(ParseDatumView(out.data(), out.size(), &view));
+  // Truncated bytes are rejected as well.
+  datum.clear_float_data();
+  datum.set_data("abcd");
+  CHECK(datum.SerializeToString(&out));
+  EXPECT_TRUE(ParseDatumView(out.data(), out.size(), &view));
+  EXPECT_FALSE(ParseDatumView(out.data(), out.size() - 1, &view));
+}
+
+}  // namespace caffe
@@ -8,6 +8,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/blocked_layout.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -155,6 +156,76 @@ TYPED_TEST(LRNLayerTest, TestForwardAcrossChannelsLargeRegion) {
   }
 }
 
+TYPED_TEST(LRNLayerTest, TestForwardAcrossChannelsTiled) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Planes spanning several tiles of the CPU kernel, and a beta other than
+  // the usual 0.75.
+  this->blob_bottom_->Reshape(2, 10, 17, 19);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.mutable_lrn_param()->set_beta(0.6);
+  LRNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top_reference;
+  this->ReferenceLRNForward(*(this->blob_bottom_), layer_param,
+      &top_reference);
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i],
+                this->epsilon_);
+  }
+}
+
+TYPED_TEST(LRNLayerTest, TestGradientAcrossChannelsTiled) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(1, 3, 17, 16);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  LRNLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(LRNLayerTest, TestForwardAcrossChannelsBlocked) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Blocked layouts are CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  const int num = 2, channels = 16, height = 3, width = 3;
+  this->blob_bottom_->Reshape(num, channels, height, width);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  Blob<Dtype> top_reference;
+  this->ReferenceLRNForward(*(this->blob_bottom_), layer_param,
+      &top_reference);
+  const BlobLayout layouts[] = { NCHW8C, NCHW16C };
+  for (int l = 0; l < 2; ++l) {
+    const int block = blob_layout_block(layouts[l]);
+    Blob<Dtype> blocked_bottom(num, channels, height, width);
+    nchw_to_blocked_cpu(this->blob_bottom_->cpu_data(), num, channels,
+        height * width, block, blocked_bottom.mutable_cpu_data());
+    blocked_bottom.set_layout(layouts[l]);
+    vector<Blob<Dtype>*> blocked_bottom_vec(1, &blocked_bottom);
+    LRNLayer<Dtype> layer(layer_param);
+    layer.SetUp(blocked_bottom_vec, this->blob_top_vec_);
+    EXPECT_EQ(layouts[l], this->blob_top_->layout());
+    layer.Forward(blocked_bottom_vec, this->blob_top_vec_);
+    Blob<Dtype> top(num, channels, height, width);
+    blocked_to_nchw_cpu(this->blob_top_->cpu_data(), num, channels,
+        height * width, block, top.mutable_cpu_data());
+    for (int i = 0; i < top.count(); ++i) {
+      EXPECT_NEAR(top.cpu_data()[i], top_reference.cpu_data()[i],
+                  this->epsilon_);
+    }
+  }
+}
+
 TYPED_TEST(LRNLayerTest, TestGradientAcrossChannels) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
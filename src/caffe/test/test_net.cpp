@@ -9,6 +9,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -613,6 +614,461 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitFlattenableNet(const bool flat) {
+    const string& proto =
+        "name: 'FlattenableNetwork' "
+        "state: { phase: TRAIN } "
+        "flat_params: " + string(flat ? "true " : "false ") +
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    num: 4 "
+        "    channels: 6 "
+        "    height: 1 "
+        "    width: 1 "
+        "    num: 4 "
+        "    channels: 3 "
+        "    height: 1 "
+        "    width: 1 "
+        "    data_filler { "
+        "      type: 'gaussian' "
+        "    } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'targets' "
+        "} "
+        "layer { "
+        "  name: 'innerproduct1' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 6 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "  param { name: 'sharedweights' } "
+        "  bottom: 'data' "
+        "  top: 'innerproduct1' "
+        "} "
+        "layer { "
+        "  name: 'innerproduct2' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 6 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "  param { name: 'sharedweights' } "
+        "  bottom: 'innerproduct1' "
+        "  top: 'innerproduct2' "
+        "} "
+        "layer { "
+        "  name: 'innerproduct3' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "  bottom: 'innerproduct2' "
+        "  top: 'innerproduct3' "
+        "} "
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: 'innerproduct3' "
+        "  bottom: 'targets' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitPlannableNet(const bool plan) {
+    const string& proto =
+        "name: 'PlannableNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 13 "
+        "input_dim: 13 "
+        "state: { phase: TEST } "
+        "plan_memory: " + string(plan ? "true " : "false ") +
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 16 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'pool1' "
+        "  type: 'Pooling' "
+        "  bottom: 'conv1' "
+        "  top: 'pool1' "
+        "  pooling_param { "
+        "    pool: MAX "
+        "    kernel_size: 2 "
+        "    stride: 2 "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'pool1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 16 "
+        "    kernel_size: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu2' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv2' "
+        "  top: 'relu2' "
+        "} "
+        "layer { "
+        "  name: 'sum2' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv2' "
+        "  bottom: 'relu2' "
+        "  top: 'sum2' "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'sum2' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'prob' "
+        "  type: 'Softmax' "
+        "  bottom: 'ip1' "
+        "  top: 'prob' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitFusableNet(const bool fuse, const string& layout) {
+    const string& proto =
+        "name: 'FusableNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 13 "
+        "input_dim: 13 "
+        "state: { phase: TEST } "
+        "force_backward: true "
+        "layout: " + layout + " "
+        "fuse_layers: " + (fuse ? "true " : "false ") +
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 16 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 16 "
+        "    kernel_size: 3 "
+        "    engine: DIRECT "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu2' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv2' "
+        "  top: 'conv2' "
+        "} "
+        "layer { "
+        "  name: 'pool1' "
+        "  type: 'Pooling' "
+        "  bottom: 'conv2' "
+        "  top: 'pool1' "
+        "  pooling_param { "
+        "    pool: MAX "
+        "    kernel_size: 2 "
+        "    stride: 2 "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv3' "
+        "  type: 'Convolution' "
+        "  bottom: 'pool1' "
+        "  top: 'conv3' "
+        "  convolution_param { "
+        "    num_output: 8 "
+        "    kernel_size: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu3' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv3' "
+        "  top: 'relu3' "
+        "} "
+        "layer { "
+        "  name: 'sum3' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv3' "
+        "  bottom: 'relu3' "
+        "  top: 'sum3' "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'sum3' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu4' "
+        "  type: 'ReLU' "
+        "  bottom: 'ip1' "
+        "  top: 'relu4' "
+        "} "
+        "layer { "
+        "  name: 'drop4' "
+        "  type: 'Dropout' "
+        "  bottom: 'relu4' "
+        "  top: 'relu4' "
+        "} "
+        "layer { "
+        "  name: 'ip2' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'relu4' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 4 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'drop5' "
+        "  type: 'Dropout' "
+        "  bottom: 'ip2' "
+        "  top: 'drop5' "
+        "} "
+        "layer { "
+        "  name: 'prob' "
+        "  type: 'Softmax' "
+        "  bottom: 'drop5' "
+        "  top: 'prob' "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  // With flat, the net is a TRAIN net with flat parameters instead.
+  virtual void InitBlockedNet(const string& layout, const bool flat = false) {
+    const string& proto =
+        "name: 'BlockedNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 13 "
+        "input_dim: 13 " +
+        string(flat ? "state: { phase: TRAIN } flat_params: true " :
+            "state: { phase: TEST } ") +
+        "layout: " + layout + " "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 16 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'constant' "
+        "      value: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'pool1' "
+        "  type: 'Pooling' "
+        "  bottom: 'conv1' "
+        "  top: 'pool1' "
+        "  pooling_param { "
+        "    pool: MAX "
+        "    kernel_size: 3 "
+        "    stride: 2 "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'norm1' "
+        "  type: 'LRN' "
+        "  bottom: 'pool1' "
+        "  top: 'norm1' "
+        "  lrn_param { "
+        "    local_size: 3 "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  bottom: 'norm1' "
+        "  top: 'conv2' "
+        "  convolution_param { "
+        "    num_output: 5 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'conv2' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 4 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv3' "
+        "  type: 'Convolution' "
+        "  bottom: 'pool1' "
+        "  top: 'conv3' "
+        "  convolution_param { "
+        "    num_output: 16 "
+        "    kernel_size: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sigmoid3' "
+        "  type: 'Sigmoid' "
+        "  bottom: 'conv3' "
+        "  top: 'conv3' "
+        "} "
+        "layer { "
+        "  name: 'conv4' "
+        "  type: 'Convolution' "
+        "  bottom: 'pool1' "
+        "  top: 'conv4' "
+        "  convolution_param { "
+        "    num_output: 16 "
+        "    kernel_size: 2 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} ";
+    InitNetFromProtoString(proto);
+  }
+
   int seed_;
   shared_ptr<Net<Dtype> > net_;
 };
@@ -2224,4 +2680,379 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+TYPED_TEST(NetTest, TestBlockedLayout) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Blocked layouts are CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  this->InitBlockedNet("NCHW");
+  shared_ptr<Net<Dtype> > net = this->net_;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(net->input_blobs()[0]);
+  net->ForwardPrefilled();
+  const char* kLayouts[] = { "NCHW8C", "NCHW16C" };
+  const char* kOutputs[] = { "ip", "conv3", "conv4" };
+  for (int l = 0; l < 2; ++l) {
+    this->InitBlockedNet(kLayouts[l]);
+    // Reorders go in front of the inner product (conv2 reads norm1 blocked
+    // and writes NCHW itself), the in-place sigmoid, and the blocked output.
+    EXPECT_TRUE(this->net_->has_layer("conv3_sigmoid3_reorder"));
+    EXPECT_TRUE(this->net_->has_layer("conv4_output_reorder"));
+    EXPECT_FALSE(this->net_->has_layer("conv2_ip_reorder"));
+    this->net_->ShareTrainedLayersWith(net.get());
+    this->net_->input_blobs()[0]->CopyFrom(*net->input_blobs()[0]);
+    this->net_->ForwardPrefilled();
+    EXPECT_NE(NCHW, this->net_->blob_by_name("pool1")->layout());
+    EXPECT_EQ(NCHW, this->net_->blob_by_name("conv2")->layout());
+    ASSERT_EQ(net->output_blobs().size(), this->net_->output_blobs().size());
+    for (int i = 0; i < 3; ++i) {
+      const Blob<Dtype>* expected = net->blob_by_name(kOutputs[i]).get();
+      const Blob<Dtype>* actual = this->net_->blob_by_name(kOutputs[i]).get();
+      EXPECT_EQ(NCHW, actual->layout());
+      ASSERT_EQ(expected->count(), actual->count());
+      for (int j = 0; j < expected->count(); ++j) {
+        EXPECT_NEAR(expected->cpu_data()[j], actual->cpu_data()[j], 1e-4)
+            << kOutputs[i] << " " << kLayouts[l];
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestBlockedLayoutSharedFlatParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Blocked layouts and flat parameters are CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  this->InitBlockedNet("NCHW", true);
+  shared_ptr<Net<Dtype> > train_net = this->net_;
+  ASSERT_TRUE(train_net->flat_params().get());
+  this->InitBlockedNet("NCHW");
+  shared_ptr<Net<Dtype> > net = this->net_;
+  net->ShareTrainedLayersWith(train_net.get());
+  this->InitBlockedNet("NCHW16C");
+  this->net_->ShareTrainedLayersWith(train_net.get());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(net->input_blobs()[0]);
+  this->net_->input_blobs()[0]->CopyFrom(*net->input_blobs()[0]);
+  // The first pass reorders the filters of the blocked net; the update,
+  // written through the flat parameters, must make it reorder them again.
+  this->net_->ForwardPrefilled();
+  const vector<shared_ptr<Blob<Dtype> > >& params = train_net->params();
+  for (int i = 0; i < params.size(); ++i) {
+    if (train_net->param_owners()[i] < 0) {
+      caffe_rng_gaussian(params[i]->count(), Dtype(0), Dtype(0.1),
+          params[i]->mutable_cpu_diff());
+    }
+  }
+  train_net->Update();
+  net->ForwardPrefilled();
+  this->net_->ForwardPrefilled();
+  const char* kOutputs[] = { "ip", "conv3", "conv4" };
+  for (int i = 0; i < 3; ++i) {
+    const Blob<Dtype>* expected = net->blob_by_name(kOutputs[i]).get();
+    const Blob<Dtype>* actual = this->net_->blob_by_name(kOutputs[i]).get();
+    ASSERT_EQ(expected->count(), actual->count());
+    for (int j = 0; j < expected->count(); ++j) {
+      EXPECT_NEAR(expected->cpu_data()[j], actual->cpu_data()[j], 1e-4)
+          << kOutputs[i];
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFuseLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Layer fusion is CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  this->InitFusableNet(false, "NCHW");
+  shared_ptr<Net<Dtype> > net = this->net_;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(net->input_blobs()[0]);
+  net->ForwardPrefilled();
+  caffe_set(net->output_blobs()[0]->count(), Dtype(0),
+      net->output_blobs()[0]->mutable_cpu_diff());
+  net->output_blobs()[0]->mutable_cpu_diff()[1] = 1;
+  net->Backward();
+  const char* kLayouts[] = { "NCHW", "NCHW8C" };
+  // Blobs stored as NCHW in both layouts.
+  const char* kBlobs[] = { "sum3", "prob" };
+  for (int l = 0; l < 2; ++l) {
+    this->InitFusableNet(true, kLayouts[l]);
+    // relu3 stays, as sum3 reads its bottom as well.
+    EXPECT_FALSE(this->net_->has_layer("relu1"));
+    EXPECT_FALSE(this->net_->has_layer("relu2"));
+    EXPECT_TRUE(this->net_->has_layer("relu3"));
+    EXPECT_FALSE(this->net_->has_layer("relu4"));
+    EXPECT_FALSE(this->net_->has_layer("drop4"));
+    EXPECT_FALSE(this->net_->has_layer("drop5"));
+    this->net_->ShareTrainedLayersWith(net.get());
+    this->net_->input_blobs()[0]->CopyFrom(*net->input_blobs()[0]);
+    this->net_->ForwardPrefilled();
+    for (int i = 0; i < 2; ++i) {
+      const Blob<Dtype>* expected = net->blob_by_name(kBlobs[i]).get();
+      const Blob<Dtype>* actual = this->net_->blob_by_name(kBlobs[i]).get();
+      ASSERT_EQ(expected->count(), actual->count());
+      for (int j = 0; j < expected->count(); ++j) {
+        EXPECT_NEAR(expected->cpu_data()[j], actual->cpu_data()[j], 1e-4)
+            << kBlobs[i] << " " << kLayouts[l];
+      }
+    }
+  }
+  // The fused ReLUs also apply in the backward pass.
+  this->InitFusableNet(true, "NCHW");
+  this->net_->ShareTrainedLayersWith(net.get());
+  this->net_->input_blobs()[0]->CopyFrom(*net->input_blobs()[0]);
+  this->net_->ForwardPrefilled();
+  caffe_set(this->net_->output_blobs()[0]->count(), Dtype(0),
+      this->net_->output_blobs()[0]->mutable_cpu_diff());
+  this->net_->output_blobs()[0]->mutable_cpu_diff()[1] = 1;
+  this->net_->Backward();
+  const Blob<Dtype>* expected = net->input_blobs()[0];
+  const Blob<Dtype>* actual = this->net_->input_blobs()[0];
+  for (int j = 0; j < expected->count(); ++j) {
+    EXPECT_NEAR(expected->cpu_diff()[j], actual->cpu_diff()[j], 1e-4);
+  }
+}
+
+TYPED_TEST(NetTest, TestPlanMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Memory planning is CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  this->InitPlannableNet(false);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  this->InitPlannableNet(true);
+  this->net_->ShareTrainedLayersWith(net.get());
+  // conv1 is dead once pool1 has run, so conv2 and its split reuse it, and
+  // relu2 reuses pool1.
+  const Dtype* conv1_data = this->net_->blob_by_name("conv1")->cpu_data();
+  const Dtype* pool1_data = this->net_->blob_by_name("pool1")->cpu_data();
+  EXPECT_NE(conv1_data, pool1_data);
+  EXPECT_EQ(conv1_data, this->net_->blob_by_name("conv2")->cpu_data());
+  EXPECT_EQ(conv1_data,
+      this->net_->blob_by_name("conv2_conv2_0_split_1")->cpu_data());
+  EXPECT_EQ(pool1_data, this->net_->blob_by_name("relu2")->cpu_data());
+  EXPECT_NE(conv1_data, this->net_->blob_by_name("sum2")->cpu_data());
+  EXPECT_NE(pool1_data, this->net_->blob_by_name("sum2")->cpu_data());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  // The plan is redone when the net is reshaped.
+  for (int num = 2; num <= 3; ++num) {
+    net->input_blobs()[0]->Reshape(num, 3, 13, 13);
+    net->Reshape();
+    this->net_->input_blobs()[0]->Reshape(num, 3, 13, 13);
+    this->net_->Reshape();
+    filler.Fill(net->input_blobs()[0]);
+    this->net_->input_blobs()[0]->CopyFrom(*net->input_blobs()[0]);
+    net->ForwardPrefilled();
+    this->net_->ForwardPrefilled();
+    const Blob<Dtype>* expected = net->output_blobs()[0];
+    const Blob<Dtype>* actual = this->net_->output_blobs()[0];
+    ASSERT_EQ(expected->count(), actual->count());
+    for (int j = 0; j < expected->count(); ++j) {
+      EXPECT_NEAR(expected->cpu_data()[j], actual->cpu_data()[j], 1e-6);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFlatParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Flat parameters are CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_random_seed(this->seed_);
+  this->InitFlattenableNet(false);
+  shared_ptr<Net<Dtype> > net = this->net_;
+  EXPECT_FALSE(net->flat_params().get());
+  Caffe::set_random_seed(this->seed_);
+  this->InitFlattenableNet(true);
+  const shared_ptr<Blob<Dtype> > flat_params = this->net_->flat_params();
+  ASSERT_TRUE(flat_params.get());
+  // The owned parameters are views into flat_params, in order and aligned to
+  // cache lines; the shared weights of innerproduct2 are those of
+  // innerproduct1.
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  const Dtype* data = flat_params->cpu_data();
+  const Dtype* diff = flat_params->cpu_diff();
+  const int align = 64 / sizeof(Dtype);
+  int offset = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    const int owner = this->net_->param_owners()[i];
+    if (owner >= 0) {
+      EXPECT_EQ(params[owner]->cpu_data(), params[i]->cpu_data());
+      continue;
+    }
+    EXPECT_EQ(data + offset, params[i]->cpu_data());
+    EXPECT_EQ(diff + offset, params[i]->cpu_diff());
+    offset += (params[i]->count() + align - 1) / align * align;
+  }
+  EXPECT_EQ(offset, flat_params->count());
+  // Training changes the flat parameters as it does the separate ones.
+  vector<Blob<Dtype>*> bottom;
+  const int kNumIters = 3;
+  Caffe::set_random_seed(this->seed_);
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    net->ForwardBackward(bottom);
+    net->Update();
+  }
+  Caffe::set_random_seed(this->seed_);
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    this->net_->ForwardBackward(bottom);
+    this->net_->Update();
+  }
+  ASSERT_EQ(net->params().size(), params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    const Blob<Dtype>& expected = *net->params()[i];
+    ASSERT_EQ(expected.count(), params[i]->count());
+    for (int j = 0; j < expected.count(); ++j) {
+      EXPECT_EQ(expected.cpu_data()[j], params[i]->cpu_data()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestMappedWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_random_seed(this->seed_);
+  this->InitFlattenableNet(false);
+  shared_ptr<Net<Dtype> > trained = this->net_;
+  NetParameter trained_param;
+  trained->ToProto(&trained_param);
+  string filename;
+  MakeTempFilename(&filename);
+  MappedWeights::Write(trained_param, filename);
+  EXPECT_TRUE(MappedWeights::IsMappedWeights(filename));
+  // The weights are stored as floats, as in a .caffemodel.
+  NetParameter mapped_param;
+  MappedWeights(filename).ToProto(&mapped_param);
+  for (int i = 0, j = 0; i < trained_param.layer_size(); ++i) {
+    const LayerParameter& layer = trained_param.layer(i);
+    if (!layer.blobs_size()) { continue; }
+    const LayerParameter& mapped_layer = mapped_param.layer(j++);
+    EXPECT_EQ(layer.name(), mapped_layer.name());
+    ASSERT_EQ(layer.blobs_size(), mapped_layer.blobs_size());
+    for (int k = 0; k < layer.blobs_size(); ++k) {
+      ASSERT_EQ(layer.blobs(k).data_size(), mapped_layer.blobs(k).data_size());
+      for (int l = 0; l < layer.blobs(k).data_size(); ++l) {
+        EXPECT_EQ(layer.blobs(k).data(l), mapped_layer.blobs(k).data(l));
+      }
+    }
+  }
+  // Loading them points float parameters into the mapping and copies the
+  // others, and into flat parameters, which must stay in place.
+  for (int flat = 0; flat < 2; ++flat) {
+    Caffe::set_random_seed(this->seed_ + 1);
+    this->InitFlattenableNet(flat);
+    const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+    vector<const Dtype*> param_data;
+    for (int i = 0; i < params.size(); ++i) {
+      param_data.push_back(params[i]->cpu_data());
+    }
+    shared_ptr<MappedWeights> weights(new MappedWeights(filename));
+    this->net_->CopyTrainedLayersFrom(weights);
+    const bool mapped = sizeof(Dtype) == sizeof(float) && !flat;
+    const MappedWeightsIndex::Layer& layer = weights->index().layer(2);
+    ASSERT_EQ("innerproduct3", layer.name());
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        this->net_->layer_by_name(layer.name())->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      EXPECT_EQ(mapped, reinterpret_cast<const void*>(blobs[j]->cpu_data()) ==
+          weights->data(layer.blobs(j)));
+    }
+    for (int i = 0; i < params.size(); ++i) {
+      if (!mapped) {
+        EXPECT_EQ(param_data[i], params[i]->cpu_data());
+      }
+      const Blob<Dtype>& expected = *trained->params()[i];
+      ASSERT_EQ(expected.count(), params[i]->count());
+      for (int j = 0; j < expected.count(); ++j) {
+        EXPECT_EQ(static_cast<float>(expected.cpu_data()[j]),
+            params[i]->cpu_data()[j]);
+      }
+    }
+  }
+  // Training changes the mapped parameters, but not the file.
+  vector<Blob<Dtype>*> bottom;
+  this->net_.reset();
+  Caffe::set_random_seed(this->seed_);
+  this->InitFlattenableNet(false);
+  this->net_->CopyTrainedLayersFrom(filename);
+  this->net_->ForwardBackward(bottom);
+  this->net_->Update();
+  MappedWeights(filename).ToProto(&mapped_param);
+  const LayerParameter& layer = mapped_param.layer(2);
+  const Blob<Dtype>& updated =
+      *this->net_->layer_by_name(layer.name())->blobs()[0];
+  bool changed = false;
+  for (int i = 0; i < updated.count(); ++i) {
+    changed |= layer.blobs(0).data(i) != updated.cpu_data()[i];
+  }
+  EXPECT_TRUE(changed);
+  const LayerParameter& trained_layer = trained_param.layer(3);
+  ASSERT_EQ(trained_layer.name(), layer.name());
+  for (int i = 0; i < updated.count(); ++i) {
+    EXPECT_EQ(trained_layer.blobs(0).data(i), layer.blobs(0).data(i));
+  }
+  remove(filename.c_str());
+}
+
+TYPED_TEST(NetTest, TestMappedWeightsLegacyShapes) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_random_seed(this->seed_);
+  this->InitFlattenableNet(false);
+  shared_ptr<Net<Dtype> > trained = this->net_;
+  // Store the blobs in the deprecated 4D dimensions of old models, e.g. an
+  // inner product weight of shape (M, N) as (1, 1, M, N).
+  NetParameter trained_param;
+  trained->ToProto(&trained_param);
+  for (int i = 0; i < trained_param.layer_size(); ++i) {
+    LayerParameter* layer = trained_param.mutable_layer(i);
+    for (int j = 0; j < layer->blobs_size(); ++j) {
+      BlobProto* proto = layer->mutable_blobs(j);
+      const BlobShape shape = proto->shape();
+      ASSERT_LE(shape.dim_size(), 4);
+      int dims[4] = { 1, 1, 1, 1 };
+      for (int k = 0; k < shape.dim_size(); ++k) {
+        dims[4 - shape.dim_size() + k] = shape.dim(k);
+      }
+      proto->clear_shape();
+      proto->set_num(dims[0]);
+      proto->set_channels(dims[1]);
+      proto->set_height(dims[2]);
+      proto->set_width(dims[3]);
+    }
+  }
+  string filename;
+  MakeTempFilename(&filename);
+  MappedWeights::Write(trained_param, filename);
+  // They are converted back as they were, and load as the .caffemodel does.
+  NetParameter mapped_param;
+  MappedWeights(filename).ToProto(&mapped_param);
+  for (int i = 0, j = 0; i < trained_param.layer_size(); ++i) {
+    const LayerParameter& layer = trained_param.layer(i);
+    if (!layer.blobs_size()) { continue; }
+    const LayerParameter& mapped_layer = mapped_param.layer(j++);
+    ASSERT_EQ(layer.blobs_size(), mapped_layer.blobs_size());
+    for (int k = 0; k < layer.blobs_size(); ++k) {
+      EXPECT_FALSE(mapped_layer.blobs(k).has_shape());
+      EXPECT_EQ(layer.blobs(k).num(), mapped_layer.blobs(k).num());
+      EXPECT_EQ(layer.blobs(k).channels(), mapped_layer.blobs(k).channels());
+      EXPECT_EQ(layer.blobs(k).height(), mapped_layer.blobs(k).height());
+      EXPECT_EQ(layer.blobs(k).width(), mapped_layer.blobs(k).width());
+    }
+  }
+  Caffe::set_random_seed(this->seed_ + 1);
+  this->InitFlattenableNet(false);
+  this->net_->CopyTrainedLayersFrom(filename);
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    const Blob<Dtype>& expected = *trained->params()[i];
+    ASSERT_EQ(expected.shape(), params[i]->shape());
+    for (int j = 0; j < expected.count(); ++j) {
+      EXPECT_EQ(static_cast<float>(expected.cpu_data()[j]),
+          params[i]->cpu_data()[j]);
+    }
+  }
+  remove(filename.c_str());
+}
+
 }  // namespace caffe
@@ -0,0 +1,165 @@
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net_model.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mapped_weights.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class NetModelTest : public ::testing::Test {
+ protected:
+  static const int kNumItems = 12;
+
+  NetModelTest() {
+    // The layers keeping per-call scratch: the column buffer of the
+    // convolution, the scale of LRN and of the softmax.
+    const string proto =
+        "name: 'TestNetwork' "
+        "input: 'data' "
+        "input_shape { dim: 2 dim: 3 dim: 9 dim: 9 } "
+        "layer { "
+        "  name: 'conv' "
+        "  type: 'Convolution' "
+        "  convolution_param { "
+        "    num_output: 8 "
+        "    kernel_size: 3 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "} "
+        "layer { "
+        "  name: 'norm' "
+        "  type: 'LRN' "
+        "  bottom: 'conv' "
+        "  top: 'norm' "
+        "} "
+        "layer { "
+        "  name: 'pool' "
+        "  type: 'Pooling' "
+        "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+        "  bottom: 'norm' "
+        "  top: 'pool' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "  bottom: 'pool' "
+        "  top: 'ip' "
+        "} "
+        "layer { "
+        "  name: 'prob' "
+        "  type: 'Softmax' "
+        "  bottom: 'ip' "
+        "  top: 'prob' "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    Caffe::set_random_seed(1701);
+    model_.reset(new NetModel<Dtype>(param_));
+    // The outputs of each item, run on this thread alone.
+    Net<Dtype>& net = *model_->net();
+    const int input_count = net.input_blobs()[0]->count();
+    inputs_.resize(kNumItems);
+    expected_.resize(kNumItems);
+    for (int i = 0; i < kNumItems; ++i) {
+      inputs_[i].resize(input_count);
+      caffe_rng_gaussian<Dtype>(input_count, 0, 1, inputs_[i].data());
+      caffe_copy(input_count, inputs_[i].data(),
+          net.input_blobs()[0]->mutable_cpu_data());
+      const Blob<Dtype>& output = *net.ForwardPrefilled()[0];
+      expected_[i].assign(output.cpu_data(),
+          output.cpu_data() + output.count());
+    }
+  }
+
+  // Runs every item num_passes times, starting from first, on a context of
+  // its own.
+  void RunContext(const int first, const int num_passes) {
+    RunItems(model_->NewContext().get(), first, num_passes);
+  }
+
+  void RunItems(Net<Dtype>* context, const int first, const int num_passes) {
+    Blob<Dtype>* input = context->input_blobs()[0];
+    for (int pass = 0; pass < num_passes; ++pass) {
+      for (int j = 0; j < kNumItems; ++j) {
+        const int item = (first + j) % kNumItems;
+        caffe_copy(input->count(), inputs_[item].data(),
+            input->mutable_cpu_data());
+        const Blob<Dtype>& output = *context->ForwardPrefilled()[0];
+        ASSERT_EQ(expected_[item].size(), output.count());
+        for (int k = 0; k < output.count(); ++k) {
+          EXPECT_NEAR(expected_[item][k], output.cpu_data()[k], 1e-5)
+              << "item " << item << ", pass " << pass << ", value " << k;
+        }
+      }
+    }
+  }
+
+  NetParameter param_;
+  shared_ptr<NetModel<Dtype> > model_;
+  vector<vector<Dtype> > inputs_;
+  vector<vector<Dtype> > expected_;
+};
+
+TYPED_TEST_CASE(NetModelTest, TestDtypes);
+
+TYPED_TEST(NetModelTest, TestContextsShareParameters) {
+  shared_ptr<Net<TypeParam> > context = this->model_->NewContext();
+  const vector<shared_ptr<Blob<TypeParam> > >& params =
+      this->model_->net()->params();
+  ASSERT_EQ(params.size(), context->params().size());
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(params[i]->cpu_data(), context->params()[i]->cpu_data());
+  }
+  // The activations are the context's own.
+  EXPECT_NE(this->model_->net()->input_blobs()[0]->cpu_data(),
+            context->input_blobs()[0]->cpu_data());
+}
+
+TYPED_TEST(NetModelTest, TestConcurrentContexts) {
+  const int kNumThreads = 8;
+  const int kNumPasses = 5;
+  // The contexts share the thread pool, which is sized before they run, as
+  // resizing it restarts it.
+  Caffe::set_num_threads(2);
+  boost::thread_group threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.create_thread([this, i]() { this->RunContext(i, kNumPasses); });
+  }
+  threads.join_all();
+  Caffe::set_num_threads(0);
+}
+
+TYPED_TEST(NetModelTest, TestContextOutlivesMappedModel) {
+  NetParameter trained_param;
+  this->model_->net()->ToProto(&trained_param);
+  string filename;
+  MakeTempFilename(&filename);
+  MappedWeights::Write(trained_param, filename);
+  shared_ptr<NetModel<TypeParam> > model(
+      new NetModel<TypeParam>(this->param_, filename));
+  shared_ptr<Net<TypeParam> > context = model->NewContext();
+  // The context keeps the parameters it points into mapped.
+  model.reset();
+  remove(filename.c_str());
+  this->RunItems(context.get(), 0, 1);
+}
+
+}  // namespace caffe
@@ -0,0 +1,153 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ParallelTest : public ::testing::Test {
+ protected:
+  ParallelTest() {
+    // Run on several threads even on small machines.
+    Caffe::set_num_threads(4);
+  }
+  virtual ~ParallelTest() {
+    Caffe::set_num_threads(0);
+    Caffe::set_thread_affinity(false, vector<int>());
+  }
+};
+
+TEST_F(ParallelTest, TestNumThreads) {
+  Caffe::set_num_threads(3);
+#if defined(USE_OPENMP) || defined(USE_THREAD_POOL)
+  EXPECT_EQ(3, parallel_num_threads());
+#else
+  EXPECT_EQ(1, parallel_num_threads());
+#endif
+  Caffe::set_num_threads(0);
+  EXPECT_GE(parallel_num_threads(), 1);
+}
+
+TEST_F(ParallelTest, TestParallelForVisitsEachIndexOnce) {
+  const int kCount = 1000;
+  for (int grain = 1; grain <= 64; grain *= 4) {
+    vector<int> visits(kCount, 0);
+    parallel_for(0, kCount, [&](int i) { ++visits[i]; }, grain);
+    for (int i = 0; i < kCount; ++i) {
+      EXPECT_EQ(1, visits[i]) << "index " << i << ", grain " << grain;
+    }
+  }
+}
+
+TEST_F(ParallelTest, TestParallelForEmptyAndOffsetRanges) {
+  int calls = 0;
+  parallel_for(5, 5, [&](int i) { ++calls; });
+  parallel_for(5, 3, [&](int i) { ++calls; });
+  EXPECT_EQ(0, calls);
+  vector<int> visits(10, 0);
+  parallel_for(3, 10, [&](int i) { ++visits[i]; });
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(i >= 3 ? 1 : 0, visits[i]);
+  }
+}
+
+TEST_F(ParallelTest, TestNestedParallelFor) {
+  const int kOuter = 16;
+  const int kInner = 37;
+  vector<int> visits(kOuter * kInner, 0);
+  parallel_for(0, kOuter, [&](int i) {
+    parallel_for(0, kInner, [&](int j) { ++visits[i * kInner + j]; });
+  });
+  for (int i = 0; i < kOuter * kInner; ++i) {
+    EXPECT_EQ(1, visits[i]);
+  }
+}
+
+TEST_F(ParallelTest, TestTaskGroup) {
+  boost::mutex mutex;
+  int value = 0;
+  boost::function<void()> increment = [&]() {
+    boost::mutex::scoped_lock lock(mutex);
+    ++value;
+  };
+  {
+    TaskGroup group;
+    for (int i = 0; i < 100; ++i) {
+      group.run(increment);
+    }
+    group.wait();
+    EXPECT_EQ(100, value);
+    // A group can be reused after wait(); the destructor waits too.
+    for (int i = 0; i < 10; ++i) {
+      group.run(increment);
+    }
+  }
+  EXPECT_EQ(110, value);
+}
+
+TEST_F(ParallelTest, TestTaskGroupWaitRunsOnlyItsOwnTasks) {
+  // Two threads outside the pool fill and wait on their own groups at the
+  // same time; neither may run a task of the other's group.
+  const int kTasks = 50;
+  boost::mutex mutex;
+  vector<boost::thread::id> ran_on[2];
+  boost::function<void(int)> fill_and_wait = [&](int g) {
+    TaskGroup group;
+    for (int i = 0; i < kTasks; ++i) {
+      group.run([&, g]() {
+        boost::this_thread::sleep(boost::posix_time::microseconds(200));
+        boost::mutex::scoped_lock lock(mutex);
+        ran_on[g].push_back(boost::this_thread::get_id());
+      });
+    }
+    group.wait();
+  };
+  boost::thread first(boost::bind(fill_and_wait, 0));
+  boost::thread second(boost::bind(fill_and_wait, 1));
+  const boost::thread::id ids[2] = {first.get_id(), second.get_id()};
+  first.join();
+  second.join();
+  for (int g = 0; g < 2; ++g) {
+    ASSERT_EQ(kTasks, ran_on[g].size());
+    for (int i = 0; i < kTasks; ++i) {
+      EXPECT_NE(ids[1 - g], ran_on[g][i]) << "group " << g << ", task " << i;
+    }
+  }
+}
+
+TEST_F(ParallelTest, TestNumaTopology) {
+  const vector<vector<int> > topology = ThreadPool::NumaTopology();
+  ASSERT_GE(topology.size(), 1);
+  for (int node = 0; node < topology.size(); ++node) {
+    for (int i = 0; i < topology[node].size(); ++i) {
+      EXPECT_GE(topology[node][i], 0);
+    }
+  }
+}
+
+TEST_F(ParallelTest, TestPinnedThreads) {
+  Caffe::set_thread_affinity(true, vector<int>(1, 0));
+#ifdef USE_THREAD_POOL
+  const ThreadPool& pool = Caffe::thread_pool();
+  EXPECT_EQ(4, pool.num_threads());
+  for (int i = 0; i < pool.num_threads(); ++i) {
+    EXPECT_EQ(0, pool.node(i));
+  }
+#endif
+  const int kCount = 1000;
+  vector<int> visits(kCount, 0);
+  parallel_for(0, kCount, [&](int i) { ++visits[i]; });
+  for (int i = 0; i < kCount; ++i) {
+    EXPECT_EQ(1, visits[i]);
+  }
+}
+
+}  // namespace caffe
@@ -7,6 +7,8 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/blocked_layout.hpp"
+#include "caffe/util/pooling.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -538,6 +540,117 @@ TYPED_TEST(PoolingLayerTest, TestGradientMaxTopMask) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestForwardBlocked) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Blocked layouts are CPU only.
+  Caffe::set_mode(Caffe::CPU);
+  const int num = 2, channels = 16, height = 7, width = 6;
+  this->blob_bottom_->Reshape(num, channels, height, width);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Blob<Dtype> blocked_bottom(num, channels, height, width);
+  Blob<Dtype> blocked_top;
+  Blob<Dtype> top(1, 1, 1, 1);
+  vector<Blob<Dtype>*> blocked_bottom_vec(1, &blocked_bottom);
+  vector<Blob<Dtype>*> blocked_top_vec(1, &blocked_top);
+  const PoolingParameter_PoolMethod pools[] = {
+    PoolingParameter_PoolMethod_MAX, PoolingParameter_PoolMethod_AVE
+  };
+  const BlobLayout layouts[] = { NCHW8C, NCHW16C };
+  for (int p = 0; p < 2; ++p) {
+    for (int l = 0; l < 2; ++l) {
+      const int block = blob_layout_block(layouts[l]);
+      nchw_to_blocked_cpu(this->blob_bottom_->cpu_data(), num, channels,
+          height * width, block, blocked_bottom.mutable_cpu_data());
+      blocked_bottom.set_layout(layouts[l]);
+      LayerParameter layer_param;
+      PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+      pooling_param->set_kernel_size(3);
+      pooling_param->set_stride(2);
+      pooling_param->set_pad(1);
+      pooling_param->set_pool(pools[p]);
+      PoolingLayer<Dtype> layer(layer_param);
+      layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      PoolingLayer<Dtype> blocked_layer(layer_param);
+      blocked_layer.SetUp(blocked_bottom_vec, blocked_top_vec);
+      EXPECT_EQ(layouts[l], blocked_top.layout());
+      blocked_layer.Forward(blocked_bottom_vec, blocked_top_vec);
+      top.ReshapeLike(blocked_top);
+      blocked_to_nchw_cpu(blocked_top.cpu_data(), num, channels,
+          blocked_top.height() * blocked_top.width(), block,
+          top.mutable_cpu_data());
+      ASSERT_EQ(this->blob_top_->count(), top.count());
+      for (int i = 0; i < top.count(); ++i) {
+        EXPECT_NEAR(this->blob_top_->cpu_data()[i], top.cpu_data()[i], 1e-5);
+      }
+    }
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestForwardFastPath) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  // Odd and even sizes, with widths past one vector of outputs.
+  const int heights[] = { 13, 8 };
+  const int widths[] = { 37, 20 };
+  const PoolingParameter_PoolMethod pools[] = {
+    PoolingParameter_PoolMethod_MAX, PoolingParameter_PoolMethod_AVE
+  };
+  Blob<Dtype> expected;
+  vector<Blob<Dtype>*> expected_vec(1, &expected);
+  for (int s = 0; s < 2; ++s) {
+    this->blob_bottom_->Reshape(2, 3, heights[s], widths[s]);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    for (int kernel = 2; kernel <= 3; ++kernel) {
+      for (int pad = 0; pad < kernel; ++pad) {
+        for (int p = 0; p < 2; ++p) {
+          LayerParameter layer_param;
+          layer_param.set_phase(TEST);
+          PoolingParameter* pooling_param =
+              layer_param.mutable_pooling_param();
+          pooling_param->set_kernel_size(kernel);
+          pooling_param->set_stride(2);
+          pooling_param->set_pad(pad);
+          pooling_param->set_pool(pools[p]);
+          PoolingLayer<Dtype> layer(layer_param);
+          layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+          expected.ReshapeLike(*this->blob_top_);
+          set_pool_fast_path(false);
+          layer.Forward(this->blob_bottom_vec_, expected_vec);
+          set_pool_fast_path(true);
+          layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+          ASSERT_EQ(expected.count(), this->blob_top_->count());
+          for (int i = 0; i < expected.count(); ++i) {
+            EXPECT_NEAR(expected.cpu_data()[i],
+                this->blob_top_->cpu_data()[i], 1e-5)
+                << "kernel " << kernel << ", pad " << pad << ", pool " << p;
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestGradientMaxTestPhase) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Forward skips the max mask in the TEST phase; Backward recomputes it.
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pad(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  PoolingLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-4, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 TYPED_TEST(PoolingLayerTest, TestForwardAve) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -0,0 +1,242 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/insert_reorders.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class ReorderLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  ReorderLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 16, 3, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    // Blocked layouts are CPU only.
+    Caffe::set_mode(Caffe::CPU);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~ReorderLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+  }
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(ReorderLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(ReorderLayerTest, TestForwardNCHW) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ReorderLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(NCHW, this->blob_top_->layout());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_->cpu_data()[i],
+        this->blob_top_->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(ReorderLayerTest, TestForwardBackwardBlocked) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Channel c of pixel (h, w) sits at ((c / 8 * 3 + h) * 5 + w) * 8 + c % 8.
+  this->blob_bottom_->set_layout(NCHW8C);
+  LayerParameter layer_param;
+  ReorderLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(NCHW, this->blob_top_->layout());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  for (int n = 0; n < 2; ++n) {
+    for (int c = 0; c < 16; ++c) {
+      for (int h = 0; h < 3; ++h) {
+        for (int w = 0; w < 5; ++w) {
+          const int blocked_index =
+              (((n * 2 + c / 8) * 3 + h) * 5 + w) * 8 + c % 8;
+          EXPECT_EQ(bottom_data[blocked_index],
+              this->blob_top_->data_at(n, c, h, w));
+        }
+      }
+    }
+  }
+  // Backward reorders the diff the other way.
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+      this->blob_bottom_vec_);
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_->cpu_data()[i],
+        this->blob_bottom_->cpu_diff()[i]);
+  }
+}
+
+class ReorderLayerInsertionTest : public ::testing::Test {
+ protected:
+  void RunInsertionTest(
+      const string& input_param_string, const string& output_param_string) {
+    // Test that InsertReorders called on the proto specified by
+    // input_param_string results in the proto specified by
+    // output_param_string.
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    InsertReorders(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+  }
+};
+
+TEST_F(ReorderLayerInsertionTest, TestInsertion) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layout: NCHW8C "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { num_output: 16 } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'pool1' "
+      "  type: 'Pooling' "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  bottom: 'pool1' "
+      "  top: 'conv2' "
+      "  convolution_param { num_output: 10 } "
+      "} "
+      "layer { "
+      "  name: 'sigmoid2' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'conv2' "
+      "  top: 'conv2' "
+      "} "
+      "layer { "
+      "  name: 'conv3' "
+      "  type: 'Convolution' "
+      "  bottom: 'conv2' "
+      "  top: 'conv3' "
+      "  convolution_param { num_output: 8 } "
+      "} "
+      "layer { "
+      "  name: 'sigmoid3' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'conv3' "
+      "  top: 'conv3' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'conv3' "
+      "  top: 'ip' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layout: NCHW8C "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  layout: NCHW8C "
+      "  convolution_param { num_output: 16 } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'pool1' "
+      "  type: 'Pooling' "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  bottom: 'pool1' "
+      "  top: 'conv2' "
+      "  convolution_param { num_output: 10 } "
+      "} "
+      "layer { "
+      "  name: 'sigmoid2' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'conv2' "
+      "  top: 'conv2' "
+      "} "
+      "layer { "
+      "  name: 'conv3' "
+      "  type: 'Convolution' "
+      "  bottom: 'conv2' "
+      "  top: 'conv3_blocked' "
+      "  layout: NCHW8C "
+      "  convolution_param { num_output: 8 } "
+      "} "
+      "layer { "
+      "  name: 'conv3_sigmoid3_reorder' "
+      "  type: 'Reorder' "
+      "  bottom: 'conv3_blocked' "
+      "  top: 'conv3' "
+      "} "
+      "layer { "
+      "  name: 'sigmoid3' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'conv3' "
+      "  top: 'conv3' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'conv3' "
+      "  top: 'ip' "
+      "} ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
+}  // namespace caffe
@@ -1,6 +1,8 @@
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <limits>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -72,6 +74,87 @@ TYPED_TEST(SoftmaxLayerTest, TestForward) {
   }
 }
 
+TYPED_TEST(SoftmaxLayerTest, TestForwardWide) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A 1000 class classifier and a softmax over the channels of 17 x 9 maps,
+  // with scores spread far enough to reach the clamped range of the exp.
+  vector<int> classifier_shape(2);
+  classifier_shape[0] = 3;
+  classifier_shape[1] = 1000;
+  vector<int> map_shape(4);
+  map_shape[0] = 2;
+  map_shape[1] = 21;
+  map_shape[2] = 17;
+  map_shape[3] = 9;
+  const vector<int> shapes[] = { classifier_shape, map_shape };
+  for (int s = 0; s < 2; ++s) {
+    this->blob_bottom_->Reshape(shapes[s]);
+    FillerParameter filler_param;
+    filler_param.set_min(-60);
+    filler_param.set_max(60);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    LayerParameter layer_param;
+    SoftmaxLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const int outer_num = this->blob_bottom_->shape(0);
+    const int channels = this->blob_bottom_->shape(1);
+    const int inner_num = this->blob_bottom_->count(2);
+    const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    for (int i = 0; i < outer_num; ++i) {
+      for (int k = 0; k < inner_num; ++k) {
+        const int offset = i * channels * inner_num + k;
+        double max = bottom_data[offset];
+        for (int j = 1; j < channels; ++j) {
+          max = std::max(max,
+              static_cast<double>(bottom_data[offset + j * inner_num]));
+        }
+        double sum = 0;
+        for (int j = 0; j < channels; ++j) {
+          sum += exp(bottom_data[offset + j * inner_num] - max);
+        }
+        for (int j = 0; j < channels; ++j) {
+          const double expected =
+              exp(bottom_data[offset + j * inner_num] - max) / sum;
+          EXPECT_NEAR(top_data[offset + j * inner_num], expected,
+              1e-5 * expected + 1e-30) << "debug: " << i << " " << j;
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(SoftmaxLayerTest, TestForwardNaN) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A NaN score, first in its row or in the middle of it, makes the whole
+  // row NaN, as a diverged net should show; the other rows are unaffected.
+  vector<int> shape(2);
+  shape[0] = 3;
+  shape[1] = 40;
+  this->blob_bottom_->Reshape(shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Dtype* bottom_data = this->blob_bottom_->mutable_cpu_data();
+  bottom_data[0] = std::numeric_limits<Dtype>::quiet_NaN();
+  bottom_data[40 + 21] = std::numeric_limits<Dtype>::quiet_NaN();
+  LayerParameter layer_param;
+  SoftmaxLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  Dtype sum = 0;
+  for (int j = 0; j < 40; ++j) {
+    EXPECT_TRUE(std::isnan(top_data[j])) << "debug: 0 " << j;
+    EXPECT_TRUE(std::isnan(top_data[40 + j])) << "debug: 1 " << j;
+    EXPECT_FALSE(std::isnan(top_data[80 + j])) << "debug: 2 " << j;
+    sum += top_data[80 + j];
+  }
+  EXPECT_NEAR(1, sum, 1e-4);
+}
+
 TYPED_TEST(SoftmaxLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <cstring>
 #include <vector>
 
@@ -7,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/device_alternate.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -69,6 +71,98 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestVersion) {
+  SyncedMemory mem(10);
+  size_t version = mem.version();
+  mem.cpu_data();
+  EXPECT_EQ(version, mem.version());
+  mem.mutable_cpu_data();
+  EXPECT_LT(version, mem.version());
+  version = mem.version();
+  mem.bump_version();
+  EXPECT_LT(version, mem.version());
+}
+
+TEST_F(SyncedMemoryTest, TestCPUReuseIsZeroed) {
+  // The second allocation may get the block of the first from the pool.
+  for (int i = 0; i < 2; ++i) {
+    SyncedMemory mem(1000);
+    const char* cpu_data = static_cast<const char*>(mem.cpu_data());
+    for (int j = 0; j < mem.size(); ++j) {
+      EXPECT_EQ(cpu_data[j], 0);
+    }
+    caffe_memset(mem.size(), 1, mem.mutable_cpu_data());
+  }
+}
+
+TEST_F(SyncedMemoryTest, TestHostAllocatorAlignment) {
+  HostAllocator allocator;
+  const size_t kSizes[] = { 1, 10, 100, 1000, 100000, 3 << 20 };
+  for (int i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+    const size_t bytes = HostAllocator::RoundUp(kSizes[i]);
+    EXPECT_GE(bytes, kSizes[i]);
+    if (bytes < HostAllocator::kLargeBytes) {
+      EXPECT_LE(bytes, std::max(kSizes[i] * 5 / 4,
+          kSizes[i] + HostAllocator::kAlignment));
+    } else {
+      EXPECT_EQ(bytes % HostAllocator::kHugePageBytes, 0);
+    }
+    char* ptr = static_cast<char*>(allocator.Allocate(kSizes[i]));
+    ASSERT_TRUE(ptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % HostAllocator::kAlignment,
+        0);
+    caffe_memset(kSizes[i], 1, ptr);
+    EXPECT_EQ(ptr[kSizes[i] - 1], 1);
+    allocator.Free(ptr, kSizes[i]);
+  }
+  EXPECT_EQ(allocator.stats().live_bytes, 0);
+}
+
+TEST_F(SyncedMemoryTest, TestHostAllocatorPool) {
+  HostAllocator allocator;
+  void* ptr = allocator.Allocate(1000);
+  HostAllocator::Stats stats = allocator.stats();
+  EXPECT_EQ(stats.live_bytes, HostAllocator::RoundUp(1000));
+  EXPECT_EQ(stats.pool_misses, 1);
+  allocator.Free(ptr, 1000);
+  EXPECT_EQ(allocator.stats().cached_bytes, HostAllocator::RoundUp(1000));
+  // A size of the same class reuses the block.
+  EXPECT_EQ(allocator.Allocate(990), ptr);
+  stats = allocator.stats();
+  EXPECT_EQ(stats.pool_hits, 1);
+  EXPECT_EQ(stats.cached_bytes, 0);
+  EXPECT_EQ(stats.peak_bytes, HostAllocator::RoundUp(1000));
+  allocator.Free(ptr, 990);
+  allocator.set_pooling(false);
+  EXPECT_EQ(allocator.stats().cached_bytes, 0);
+  ptr = allocator.Allocate(1000);
+  allocator.Free(ptr, 1000);
+  stats = allocator.stats();
+  EXPECT_EQ(stats.pool_misses, 2);
+  EXPECT_EQ(stats.cached_bytes, 0);
+  EXPECT_EQ(stats.live_bytes, 0);
+}
+
+TEST_F(SyncedMemoryTest, TestHostAllocatorHugePages) {
+  HostAllocator allocator;
+  allocator.set_huge_pages(HostAllocator::HUGE_PAGES_TRANSPARENT);
+  allocator.set_numa_node(0);
+  const size_t size = 5 << 20;
+  float* ptr = static_cast<float*>(allocator.Allocate(size));
+  ASSERT_TRUE(ptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % HostAllocator::kAlignment, 0);
+  caffe_set(size / sizeof(float), 1.f, ptr);
+  EXPECT_EQ(ptr[size / sizeof(float) - 1], 1.f);
+  allocator.Free(ptr, size);
+  allocator.set_huge_pages(HostAllocator::HUGE_PAGES_EXPLICIT);
+  // Falls back to regular pages if none are reserved.
+  ptr = static_cast<float*>(allocator.Allocate(size));
+  ASSERT_TRUE(ptr);
+  caffe_set(size / sizeof(float), 2.f, ptr);
+  EXPECT_EQ(ptr[0], 2.f);
+  allocator.Free(ptr, size);
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
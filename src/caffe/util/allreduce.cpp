@@ -0,0 +1,302 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/allreduce.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+Transport::Transport(const int rank, const int size)
+    : rank_(rank), size_(size) {
+  CHECK_GE(rank, 0);
+  CHECK_LT(rank, size);
+}
+
+void Transport::SendRecv(const void* send, const size_t send_bytes,
+    void* recv, const size_t recv_bytes) {
+  const char* send_data = static_cast<const char*>(send);
+  char* recv_data = static_cast<char*>(recv);
+  size_t sent = 0;
+  size_t received = 0;
+  while (sent < send_bytes || received < recv_bytes) {
+    size_t moved = 0;
+    if (sent < send_bytes) {
+      const size_t n = TrySend(send_data + sent, send_bytes - sent);
+      sent += n;
+      moved += n;
+    }
+    if (received < recv_bytes) {
+      const size_t n = TryRecv(recv_data + received, recv_bytes - received);
+      received += n;
+      moved += n;
+    }
+    if (!moved) {
+      Wait(sent < send_bytes, received < recv_bytes);
+    }
+  }
+}
+
+// The ring buffer from one worker to the next. written and read count the
+// bytes ever written and read; they sit on separate cache lines, as each is
+// only written by one side.
+struct ShmTransport::Channel {
+  std::atomic<uint64_t> written;
+  char padding0[64 - sizeof(std::atomic<uint64_t>)];
+  std::atomic<uint64_t> read;
+  char padding1[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+const size_t ShmTransport::kDefaultCapacity;
+
+size_t ShmTransport::RegionBytes(const int size, const size_t capacity) {
+  return size * (sizeof(Channel) + capacity);
+}
+
+void* ShmTransport::CreateRegion(const size_t bytes) {
+  void* region = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  CHECK(region != MAP_FAILED) << "Cannot map " << bytes
+      << " bytes of shared memory";
+  return region;
+}
+
+ShmTransport::ShmTransport(void* region, const int rank, const int size,
+    const size_t capacity)
+    : Transport(rank, size), region_(static_cast<char*>(region)),
+      capacity_(capacity) {
+  CHECK(region_);
+  CHECK_EQ(capacity % 64, 0) << "The capacity must be a multiple of 64";
+}
+
+ShmTransport::Channel* ShmTransport::channel(const int rank) {
+  return reinterpret_cast<Channel*>(region_ +
+      rank * (sizeof(Channel) + capacity_));
+}
+
+size_t ShmTransport::TrySend(const char* data, const size_t bytes) {
+  Channel* out = channel(rank_);
+  char* buffer = reinterpret_cast<char*>(out + 1);
+  const uint64_t written = out->written.load(std::memory_order_relaxed);
+  const uint64_t read = out->read.load(std::memory_order_acquire);
+  const size_t n = std::min<size_t>(bytes, capacity_ - (written - read));
+  const size_t begin = written % capacity_;
+  const size_t first = std::min(n, capacity_ - begin);
+  memcpy(buffer + begin, data, first);
+  memcpy(buffer, data + first, n - first);
+  out->written.store(written + n, std::memory_order_release);
+  return n;
+}
+
+size_t ShmTransport::TryRecv(char* data, const size_t bytes) {
+  Channel* in = channel((rank_ + size_ - 1) % size_);
+  const char* buffer = reinterpret_cast<const char*>(in + 1);
+  const uint64_t read = in->read.load(std::memory_order_relaxed);
+  const uint64_t written = in->written.load(std::memory_order_acquire);
+  const size_t n = std::min<size_t>(bytes, written - read);
+  const size_t begin = read % capacity_;
+  const size_t first = std::min(n, capacity_ - begin);
+  memcpy(data, buffer + begin, first);
+  memcpy(data + first, buffer, n - first);
+  in->read.store(read + n, std::memory_order_release);
+  return n;
+}
+
+void ShmTransport::Wait(const bool sending, const bool receiving) {
+  // The neighbours are usually a few microseconds behind; yielding lets them
+  // run when there are fewer cores than workers.
+  sched_yield();
+}
+
+namespace {
+
+void SetNonBlocking(const int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  CHECK_GE(flags, 0);
+  CHECK_EQ(fcntl(fd, F_SETFL, flags | O_NONBLOCK), 0);
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+}  // namespace
+
+TcpTransport::TcpTransport(const int rank, const int size, const int port)
+    : Transport(rank, size), listen_fd_(-1), next_fd_(-1), prev_fd_(-1),
+      port_(port) {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(listen_fd_, 0) << "Cannot create a socket";
+  const int one = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  CHECK_EQ(bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+      sizeof(address)), 0) << "Cannot bind port " << port << ": "
+      << strerror(errno);
+  CHECK_EQ(listen(listen_fd_, 1), 0) << "Cannot listen on port " << port;
+  socklen_t length = sizeof(address);
+  CHECK_EQ(getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+      &length), 0);
+  port_ = ntohs(address.sin_port);
+}
+
+TcpTransport::~TcpTransport() {
+  if (next_fd_ >= 0) { close(next_fd_); }
+  if (prev_fd_ >= 0) { close(prev_fd_); }
+  if (listen_fd_ >= 0) { close(listen_fd_); }
+}
+
+void TcpTransport::Connect(const string& next_address, const int timeout_ms) {
+  CHECK_LT(next_fd_, 0) << "Already connected";
+  const size_t colon = next_address.rfind(':');
+  CHECK_NE(colon, string::npos) << "Expected host:port, got "
+      << next_address;
+  const string host = next_address.substr(0, colon);
+  const string port = next_address.substr(colon + 1);
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* info = NULL;
+  CHECK_EQ(getaddrinfo(host.c_str(), port.c_str(), &hints, &info), 0)
+      << "Cannot resolve " << next_address;
+  // The next worker may not be listening yet.
+  const boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::local_time();
+  while (true) {
+    next_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(next_fd_, 0) << "Cannot create a socket";
+    if (connect(next_fd_, info->ai_addr, info->ai_addrlen) == 0) {
+      break;
+    }
+    close(next_fd_);
+    next_fd_ = -1;
+    CHECK_LT((boost::posix_time::microsec_clock::local_time() - start)
+        .total_milliseconds(), timeout_ms) << "Cannot connect to "
+        << next_address;
+    usleep(100000);
+  }
+  freeaddrinfo(info);
+  // Introduce ourselves, so that the next worker knows it accepted its
+  // previous rank.
+  const int32_t rank = rank_;
+  CHECK_EQ(send(next_fd_, &rank, sizeof(rank), 0), sizeof(rank));
+  prev_fd_ = accept(listen_fd_, NULL, NULL);
+  CHECK_GE(prev_fd_, 0) << "Cannot accept the previous worker";
+  int32_t prev_rank = -1;
+  CHECK_EQ(recv(prev_fd_, &prev_rank, sizeof(prev_rank), MSG_WAITALL),
+      sizeof(prev_rank));
+  CHECK_EQ(prev_rank, (rank_ + size_ - 1) % size_)
+      << "Accepted a worker that is not the previous rank";
+  SetNonBlocking(next_fd_);
+  SetNonBlocking(prev_fd_);
+}
+
+size_t TcpTransport::TrySend(const char* data, const size_t bytes) {
+  const ssize_t n = send(next_fd_, data, bytes, MSG_NOSIGNAL);
+  if (n < 0) {
+    CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        << "Cannot send to rank " << (rank_ + 1) % size_ << ": "
+        << strerror(errno);
+    return 0;
+  }
+  return n;
+}
+
+size_t TcpTransport::TryRecv(char* data, const size_t bytes) {
+  const ssize_t n = recv(prev_fd_, data, bytes, 0);
+  if (n < 0) {
+    CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        << "Cannot receive from rank " << (rank_ + size_ - 1) % size_ << ": "
+        << strerror(errno);
+    return 0;
+  }
+  CHECK_GT(n, 0) << "Rank " << (rank_ + size_ - 1) % size_
+      << " closed the connection";
+  return n;
+}
+
+void TcpTransport::Wait(const bool sending, const bool receiving) {
+  pollfd fds[2];
+  int num_fds = 0;
+  if (sending) {
+    fds[num_fds].fd = next_fd_;
+    fds[num_fds++].events = POLLOUT;
+  }
+  if (receiving) {
+    fds[num_fds].fd = prev_fd_;
+    fds[num_fds++].events = POLLIN;
+  }
+  poll(fds, num_fds, 100);
+}
+
+template <typename Dtype>
+void ring_allreduce(Transport* transport, Dtype* data, const int count) {
+  const int size = transport->size();
+  const int rank = transport->rank();
+  if (size == 1 || count == 0) { return; }
+  // Segment s is [begin(s), begin(s + 1)).
+  vector<int> begin(size + 1);
+  for (int s = 0; s <= size; ++s) {
+    begin[s] = static_cast<int>(static_cast<int64_t>(count) * s / size);
+  }
+  vector<Dtype> received(begin[1] - begin[0] + 1);
+  // Reduce-scatter: at step k, send the partial sum of segment rank - k and
+  // add that of segment rank - k - 1 to ours. At the end, segment rank + 1
+  // holds the sum over all workers.
+  for (int k = 0; k < size - 1; ++k) {
+    const int send_segment = (rank - k + size) % size;
+    const int recv_segment = (rank - k - 1 + size) % size;
+    const int recv_count = begin[recv_segment + 1] - begin[recv_segment];
+    transport->SendRecv(data + begin[send_segment],
+        (begin[send_segment + 1] - begin[send_segment]) * sizeof(Dtype),
+        &received[0], recv_count * sizeof(Dtype));
+    if (recv_count > 0) {
+      caffe_add(recv_count, data + begin[recv_segment], &received[0],
+          data + begin[recv_segment]);
+    }
+  }
+  // Allgather: pass the complete sums around the ring.
+  for (int k = 0; k < size - 1; ++k) {
+    const int send_segment = (rank + 1 - k + size) % size;
+    const int recv_segment = (rank - k + size) % size;
+    transport->SendRecv(data + begin[send_segment],
+        (begin[send_segment + 1] - begin[send_segment]) * sizeof(Dtype),
+        data + begin[recv_segment],
+        (begin[recv_segment + 1] - begin[recv_segment]) * sizeof(Dtype));
+  }
+}
+
+void ring_broadcast(Transport* transport, void* data, const size_t bytes) {
+  const int rank = transport->rank();
+  if (rank > 0) {
+    transport->Recv(data, bytes);
+  }
+  if (rank < transport->size() - 1) {
+    transport->Send(data, bytes);
+  }
+}
+
+template void ring_allreduce<float>(Transport* transport, float* data,
+    const int count);
+template void ring_allreduce<double>(Transport* transport, double* data,
+    const int count);
+
+}  // namespace caffe
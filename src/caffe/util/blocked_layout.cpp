@@ -0,0 +1,51 @@
+#include "caffe/util/blocked_layout.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void nchw_to_blocked_cpu(const Dtype* data, const int num, const int channels,
+    const int spatial_dim, const int block, Dtype* data_blocked) {
+  CHECK_EQ(channels % block, 0) << "channels must be a multiple of " << block;
+  const int blocks = num * channels / block;
+  for (int cb = 0; cb < blocks; ++cb) {
+    const Dtype* src = data + cb * block * spatial_dim;
+    Dtype* dst = data_blocked + cb * block * spatial_dim;
+    for (int b = 0; b < block; ++b) {
+      for (int i = 0; i < spatial_dim; ++i) {
+        dst[i * block + b] = src[b * spatial_dim + i];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void blocked_to_nchw_cpu(const Dtype* data_blocked, const int num,
+    const int channels, const int spatial_dim, const int block, Dtype* data) {
+  CHECK_EQ(channels % block, 0) << "channels must be a multiple of " << block;
+  const int blocks = num * channels / block;
+  for (int cb = 0; cb < blocks; ++cb) {
+    const Dtype* src = data_blocked + cb * block * spatial_dim;
+    Dtype* dst = data + cb * block * spatial_dim;
+    for (int b = 0; b < block; ++b) {
+      for (int i = 0; i < spatial_dim; ++i) {
+        dst[b * spatial_dim + i] = src[i * block + b];
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void nchw_to_blocked_cpu<float>(const float* data, const int num,
+    const int channels, const int spatial_dim, const int block,
+    float* data_blocked);
+template void nchw_to_blocked_cpu<double>(const double* data, const int num,
+    const int channels, const int spatial_dim, const int block,
+    double* data_blocked);
+template void blocked_to_nchw_cpu<float>(const float* data_blocked,
+    const int num, const int channels, const int spatial_dim, const int block,
+    float* data);
+template void blocked_to_nchw_cpu<double>(const double* data_blocked,
+    const int num, const int channels, const int spatial_dim, const int block,
+    double* data);
+
+}  // namespace caffe
@@ -1,5 +1,6 @@
 
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_records.hpp"
 
 #include <sys/stat.h>
 #include <string>
@@ -66,6 +67,8 @@ DB* GetDB(DataParameter::DB backend) {
     return new LevelDB();
   case DataParameter_DB_LMDB:
     return new LMDB();
+  case DataParameter_DB_RECORDS:
+    return new RecordDB();
   default:
     LOG(FATAL) << "Unknown database backend";
   }
@@ -77,6 +80,8 @@ DB* GetDB(const string& backend) {
     return new LevelDB();
   } else if (backend == "lmdb") {
     return new LMDB();
+  } else if (backend == "records") {
+    return new RecordDB();
   } else {
     LOG(FATAL) << "Unknown database backend";
   }
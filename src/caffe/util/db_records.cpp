@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/db_records.hpp"
+
+namespace caffe { namespace db {
+
+const uint64_t RecordDB::kMagic;
+const size_t RecordDB::kDefaultShardBytes;
+
+size_t RecordCursor::size() {
+  return db_->size();
+}
+
+void RecordCursor::Seek(const size_t index) {
+  index_ = index;
+  valid_ = index < db_->size();
+  if (valid_) {
+    db_->Get(index, &key_, &key_size_, &value_, &value_size_);
+  }
+}
+
+void RecordTransaction::Commit() {
+  for (int i = 0; i < records_.size(); ++i) {
+    db_->Append(records_[i].first, records_[i].second);
+  }
+  records_.clear();
+}
+
+string RecordDB::ShardName(const int shard_id) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/shard_%05d", shard_id);
+  return source_ + name;
+}
+
+void RecordDB::Open(const string& source, Mode mode) {
+  CHECK(shards_.empty() && !file_) << "Record db already open";
+  source_ = source;
+  if (mode == NEW) {
+    CHECK_EQ(mkdir(source.c_str(), 0744), 0) << "mkdir " << source
+        << " failed";
+  } else if (mode == WRITE) {
+    CHECK(mkdir(source.c_str(), 0744) == 0 || errno == EEXIST)
+        << "mkdir " << source << " failed";
+  }
+  // Shards are numbered from 0 without gaps.
+  int shard_id = 0;
+  struct stat shard_stat;
+  for (; stat(ShardName(shard_id).c_str(), &shard_stat) == 0; ++shard_id) {
+    if (mode == READ) {
+      MapShard(ShardName(shard_id));
+    }
+  }
+  next_shard_id_ = shard_id;
+  if (mode == READ) {
+    CHECK(shard_id) << "No record shards in " << source;
+    LOG(INFO) << "Opened record db " << source << ": " << size()
+        << " records in " << shards_.size() << " shards";
+  } else {
+    LOG(INFO) << "Opened record db " << source << " for writing";
+  }
+}
+
+void RecordDB::MapShard(const string& filename) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "Cannot open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Cannot stat " << filename;
+  Shard shard;
+  shard.bytes = file_stat.st_size;
+  CHECK_GE(shard.bytes, 3 * sizeof(uint64_t)) << "Truncated shard "
+      << filename;
+  void* data = mmap(NULL, shard.bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(data != MAP_FAILED) << "Cannot map " << filename;
+  shard.data = static_cast<const char*>(data);
+  uint64_t footer[3];
+  memcpy(footer, shard.data + shard.bytes - sizeof(footer), sizeof(footer));
+  CHECK_EQ(footer[2], kMagic) << "Not a record shard: " << filename;
+  shard.num_records = footer[0];
+  CHECK(footer[1] % sizeof(uint64_t) == 0 && footer[1] +
+      (footer[0] + 1) * sizeof(uint64_t) + sizeof(footer) == shard.bytes)
+      << "Corrupt record index in " << filename;
+  shard.offsets = reinterpret_cast<const uint64_t*>(shard.data + footer[1]);
+  if (shard_starts_.empty()) {
+    shard_starts_.push_back(0);
+  }
+  shards_.push_back(shard);
+  shard_starts_.push_back(shard_starts_.back() + shard.num_records);
+}
+
+void RecordDB::Close() {
+  if (file_) {
+    FinishShard();
+  }
+  for (int i = 0; i < shards_.size(); ++i) {
+    munmap(const_cast<char*>(shards_[i].data), shards_[i].bytes);
+  }
+  shards_.clear();
+  shard_starts_.clear();
+}
+
+RecordCursor* RecordDB::NewCursor() {
+  CHECK(!shards_.empty()) << "Record db not open for reading";
+  return new RecordCursor(this);
+}
+
+RecordTransaction* RecordDB::NewTransaction() {
+  return new RecordTransaction(this);
+}
+
+void RecordDB::Get(const size_t index, const char** key, size_t* key_size,
+    const char** value, size_t* value_size) const {
+  DCHECK_LT(index, size());
+  // The last shard whose first record is at most index.
+  const int shard_id = std::upper_bound(shard_starts_.begin(),
+      shard_starts_.end(), index) - shard_starts_.begin() - 1;
+  const Shard& shard = shards_[shard_id];
+  const size_t i = index - shard_starts_[shard_id];
+  const uint64_t begin = shard.offsets[i];
+  const uint64_t end = shard.offsets[i + 1];
+  uint32_t size;
+  memcpy(&size, shard.data + begin, sizeof(size));
+  CHECK_LE(begin + sizeof(size) + size, end) << "Corrupt record " << index;
+  *key = shard.data + begin + sizeof(size);
+  *key_size = size;
+  *value = *key + size;
+  *value_size = end - begin - sizeof(size) - size;
+}
+
+void RecordDB::Append(const string& key, const string& value) {
+  if (!file_) {
+    const string filename = ShardName(next_shard_id_++);
+    file_ = fopen(filename.c_str(), "wb");
+    CHECK(file_) << "Cannot create " << filename;
+    file_bytes_ = 0;
+    offsets_.clear();
+  }
+  const uint32_t key_size = key.size();
+  offsets_.push_back(file_bytes_);
+  CHECK_EQ(fwrite(&key_size, sizeof(key_size), 1, file_), 1);
+  CHECK_EQ(fwrite(key.data(), 1, key.size(), file_), key.size());
+  CHECK_EQ(fwrite(value.data(), 1, value.size(), file_), value.size());
+  file_bytes_ += sizeof(key_size) + key.size() + value.size();
+  if (file_bytes_ >= shard_bytes_) {
+    FinishShard();
+  }
+}
+
+void RecordDB::FinishShard() {
+  offsets_.push_back(file_bytes_);
+  const char padding[sizeof(uint64_t)] = { 0 };
+  const size_t padding_size = (sizeof(uint64_t) -
+      file_bytes_ % sizeof(uint64_t)) % sizeof(uint64_t);
+  CHECK_EQ(fwrite(padding, 1, padding_size, file_), padding_size);
+  const uint64_t footer[3] = { offsets_.size() - 1, file_bytes_ + padding_size,
+      kMagic };
+  CHECK_EQ(fwrite(&offsets_[0], sizeof(uint64_t), offsets_.size(), file_),
+      offsets_.size());
+  CHECK_EQ(fwrite(footer, sizeof(footer), 1, file_), 1);
+  CHECK_EQ(fclose(file_), 0) << "Cannot write record shard";
+  file_ = NULL;
+}
+
+}  // namespace db
+}  // namespace caffe
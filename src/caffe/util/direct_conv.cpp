@@ -0,0 +1,718 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/direct_conv.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_DIRECT_CONV_X86
+#include <immintrin.h>
+#endif
+
+namespace caffe {
+
+namespace {
+
+// Layout of the input as seen by the kernels: every tap of the kernel window
+// is a fixed offset from the first input feeding an output pixel, and output
+// pixels that are adjacent in a row read adjacent inputs.
+struct DirectConvGeometry {
+  int channels;
+  int kernel_dim;
+  int channel_stride;
+  int row_stride;
+  int stride_h;
+  int height_out;
+  int width_out;
+  const int* tap_offset;
+  // Clamp the outputs at zero (a fused ReLU).
+  bool relu;
+};
+
+int detect_direct_conv_isa() {
+#ifdef CAFFE_DIRECT_CONV_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return DIRECT_CONV_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return DIRECT_CONV_AVX2;
+  }
+#endif
+  return DIRECT_CONV_SCALAR;
+}
+
+int& direct_conv_isa_limit() {
+  static int limit = detect_direct_conv_isa();
+  return limit;
+}
+
+// Copies the image into the workspace zero-padded, with each padded row split
+// into stride_w phases (columns p, p + stride_w, p + 2 * stride_w, ...). Tap
+// (kh, kw) of output column x then reads phase kw % stride_w at index
+// x + kw / stride_w, which is contiguous in x for any stride.
+template <typename Dtype>
+const Dtype* direct_conv_prepare(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_w, Dtype* workspace,
+    int* channel_stride, int* row_stride, vector<int>* tap_offset) {
+  tap_offset->resize(kernel_h * kernel_w);
+  if (direct_conv_workspace_size(channels, height, width, pad_h, pad_w,
+      stride_w) == 0) {
+    *row_stride = width;
+    *channel_stride = height * width;
+    for (int i = 0; i < kernel_h; ++i) {
+      for (int j = 0; j < kernel_w; ++j) {
+        (*tap_offset)[i * kernel_w + j] = i * width + j;
+      }
+    }
+    return data_im;
+  }
+  CHECK(workspace) << "Direct convolution requires a workspace.";
+  const int padded_height = height + 2 * pad_h;
+  const int padded_width = width + 2 * pad_w;
+  const int phase_len = (padded_width + stride_w - 1) / stride_w;
+  *row_stride = stride_w * phase_len;
+  *channel_stride = padded_height * (*row_stride);
+  for (int i = 0; i < kernel_h; ++i) {
+    for (int j = 0; j < kernel_w; ++j) {
+      (*tap_offset)[i * kernel_w + j] = i * (*row_stride)
+          + (j % stride_w) * phase_len + j / stride_w;
+    }
+  }
+  for (int c = 0; c < channels; ++c) {
+    for (int r = 0; r < padded_height; ++r) {
+      Dtype* row = workspace + c * (*channel_stride) + r * (*row_stride);
+      const int h = r - pad_h;
+      if (h < 0 || h >= height) {
+        memset(row, 0, sizeof(Dtype) * (*row_stride));
+        continue;
+      }
+      const Dtype* src = data_im + (c * height + h) * width;
+      if (stride_w == 1) {
+        memset(row, 0, sizeof(Dtype) * pad_w);
+        memcpy(row + pad_w, src, sizeof(Dtype) * width);
+        memset(row + pad_w + width, 0,
+            sizeof(Dtype) * (*row_stride - pad_w - width));
+        continue;
+      }
+      for (int p = 0; p < stride_w; ++p) {
+        Dtype* dst = row + p * phase_len;
+        for (int j = 0; j < phase_len; ++j) {
+          const int w = j * stride_w + p - pad_w;
+          dst[j] = (w >= 0 && w < width) ? src[w] : Dtype(0);
+        }
+      }
+    }
+  }
+  return workspace;
+}
+
+template <typename Dtype>
+void direct_conv_scalar(const Dtype* in, const Dtype* weights,
+    const Dtype* bias, const int num_output, const DirectConvGeometry& g,
+    Dtype* out) {
+  const int weight_stride = g.channels * g.kernel_dim;
+  const int out_stride = g.height_out * g.width_out;
+  for (int o = 0; o < num_output; ++o) {
+    const Dtype* w_o = weights + o * weight_stride;
+    const Dtype b = bias ? bias[o] : Dtype(0);
+    for (int y = 0; y < g.height_out; ++y) {
+      const Dtype* in_y = in + y * g.stride_h * g.row_stride;
+      Dtype* out_y = out + o * out_stride + y * g.width_out;
+      for (int x = 0; x < g.width_out; ++x) {
+        Dtype sum = b;
+        for (int c = 0; c < g.channels; ++c) {
+          const Dtype* in_c = in_y + c * g.channel_stride + x;
+          const Dtype* w_c = w_o + c * g.kernel_dim;
+          for (int k = 0; k < g.kernel_dim; ++k) {
+            sum += in_c[g.tap_offset[k]] * w_c[k];
+          }
+        }
+        out_y[x] = g.relu ? std::max(sum, Dtype(0)) : sum;
+      }
+    }
+  }
+}
+
+#ifdef CAFFE_DIRECT_CONV_X86
+
+// Computes an OCB output channel x (NV * 8) output pixel tile. The tile stays
+// in registers for the whole channel and kernel window loop; each input
+// vector is loaded once and reused for all OCB filters. kTail handles the
+// last partial vector of a row with masked loads and stores.
+template <int OCB, int NV, bool kTail>
+__attribute__((target("avx2,fma")))
+inline void direct_conv_tile_avx2(const float* in, const float* weights,
+    const float* bias, const int weight_stride, const DirectConvGeometry& g,
+    const int tail, float* out, const int out_stride) {
+  __m256 acc[OCB][NV];
+  for (int o = 0; o < OCB; ++o) {
+    const __m256 b = bias ? _mm256_set1_ps(bias[o]) : _mm256_setzero_ps();
+    for (int v = 0; v < NV; ++v) {
+      acc[o][v] = b;
+    }
+  }
+  const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(tail),
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  for (int c = 0; c < g.channels; ++c) {
+    const float* in_c = in + c * g.channel_stride;
+    const float* w_c = weights + c * g.kernel_dim;
+    for (int k = 0; k < g.kernel_dim; ++k) {
+      const float* p = in_c + g.tap_offset[k];
+      __m256 x[NV];
+      for (int v = 0; v < NV; ++v) {
+        x[v] = kTail ? _mm256_maskload_ps(p + 8 * v, mask)
+                     : _mm256_loadu_ps(p + 8 * v);
+      }
+      for (int o = 0; o < OCB; ++o) {
+        const __m256 w = _mm256_broadcast_ss(w_c + o * weight_stride + k);
+        for (int v = 0; v < NV; ++v) {
+          acc[o][v] = _mm256_fmadd_ps(x[v], w, acc[o][v]);
+        }
+      }
+    }
+  }
+  for (int o = 0; o < OCB; ++o) {
+    for (int v = 0; v < NV; ++v) {
+      if (g.relu) {
+        // The sum goes second so that NaNs stay NaN, as with std::max.
+        acc[o][v] = _mm256_max_ps(_mm256_setzero_ps(), acc[o][v]);
+      }
+      if (kTail) {
+        _mm256_maskstore_ps(out + o * out_stride + 8 * v, mask, acc[o][v]);
+      } else {
+        _mm256_storeu_ps(out + o * out_stride + 8 * v, acc[o][v]);
+      }
+    }
+  }
+}
+
+template <int OCB>
+__attribute__((target("avx2,fma")))
+void direct_conv_block_avx2(const float* in, const float* weights,
+    const float* bias, const DirectConvGeometry& g, float* out) {
+  const int weight_stride = g.channels * g.kernel_dim;
+  const int out_stride = g.height_out * g.width_out;
+  for (int y = 0; y < g.height_out; ++y) {
+    const float* in_y = in + y * g.stride_h * g.row_stride;
+    float* out_y = out + y * g.width_out;
+    int x = 0;
+    for (; x + 24 <= g.width_out; x += 24) {
+      direct_conv_tile_avx2<OCB, 3, false>(in_y + x, weights, bias,
+          weight_stride, g, 0, out_y + x, out_stride);
+    }
+    for (; x + 8 <= g.width_out; x += 8) {
+      direct_conv_tile_avx2<OCB, 1, false>(in_y + x, weights, bias,
+          weight_stride, g, 0, out_y + x, out_stride);
+    }
+    if (x < g.width_out) {
+      direct_conv_tile_avx2<OCB, 1, true>(in_y + x, weights, bias,
+          weight_stride, g, g.width_out - x, out_y + x, out_stride);
+    }
+  }
+}
+
+void direct_conv_avx2(const float* in, const float* weights,
+    const float* bias, const int num_output, const DirectConvGeometry& g,
+    float* out) {
+  const int weight_stride = g.channels * g.kernel_dim;
+  const int out_stride = g.height_out * g.width_out;
+  int o = 0;
+  for (; o + 4 <= num_output; o += 4) {
+    direct_conv_block_avx2<4>(in, weights + o * weight_stride,
+        bias ? bias + o : NULL, g, out + o * out_stride);
+  }
+  for (; o < num_output; ++o) {
+    direct_conv_block_avx2<1>(in, weights + o * weight_stride,
+        bias ? bias + o : NULL, g, out + o * out_stride);
+  }
+}
+
+// AVX-512 variant of direct_conv_tile_avx2: 16 pixels per vector, and the
+// larger register file holds an 8 x 32 tile.
+template <int OCB, int NV, bool kTail>
+__attribute__((target("avx512f")))
+inline void direct_conv_tile_avx512(const float* in, const float* weights,
+    const float* bias, const int weight_stride, const DirectConvGeometry& g,
+    const int tail, float* out, const int out_stride) {
+  __m512 acc[OCB][NV];
+  for (int o = 0; o < OCB; ++o) {
+    const __m512 b = bias ? _mm512_set1_ps(bias[o]) : _mm512_setzero_ps();
+    for (int v = 0; v < NV; ++v) {
+      acc[o][v] = b;
+    }
+  }
+  const __mmask16 mask = static_cast<__mmask16>((1u << tail) - 1);
+  for (int c = 0; c < g.channels; ++c) {
+    const float* in_c = in + c * g.channel_stride;
+    const float* w_c = weights + c * g.kernel_dim;
+    for (int k = 0; k < g.kernel_dim; ++k) {
+      const float* p = in_c + g.tap_offset[k];
+      __m512 x[NV];
+      for (int v = 0; v < NV; ++v) {
+        x[v] = kTail ? _mm512_maskz_loadu_ps(mask, p + 16 * v)
+                     : _mm512_loadu_ps(p + 16 * v);
+      }
+      for (int o = 0; o < OCB; ++o) {
+        const __m512 w = _mm512_set1_ps(w_c[o * weight_stride + k]);
+        for (int v = 0; v < NV; ++v) {
+          acc[o][v] = _mm512_fmadd_ps(x[v], w, acc[o][v]);
+        }
+      }
+    }
+  }
+  for (int o = 0; o < OCB; ++o) {
+    for (int v = 0; v < NV; ++v) {
+      if (g.relu) {
+        // The sum goes second so that NaNs stay NaN, as with std::max. The
+        // zero-masking form, as GCC's _mm512_max_ps starts from an undefined
+        // register and warns about it.
+        acc[o][v] = _mm512_maskz_max_ps(0xFFFF, _mm512_setzero_ps(),
+            acc[o][v]);
+      }
+      if (kTail) {
+        _mm512_mask_storeu_ps(out + o * out_stride + 16 * v, mask, acc[o][v]);
+      } else {
+        _mm512_storeu_ps(out + o * out_stride + 16 * v, acc[o][v]);
+      }
+    }
+  }
+}
+
+template <int OCB>
+__attribute__((target("avx512f")))
+void direct_conv_block_avx512(const float* in, const float* weights,
+    const float* bias, const DirectConvGeometry& g, float* out) {
+  const int weight_stride = g.channels * g.kernel_dim;
+  const int out_stride = g.height_out * g.width_out;
+  for (int y = 0; y < g.height_out; ++y) {
+    const float* in_y = in + y * g.stride_h * g.row_stride;
+    float* out_y = out + y * g.width_out;
+    int x = 0;
+    for (; x + 32 <= g.width_out; x += 32) {
+      direct_conv_tile_avx512<OCB, 2, false>(in_y + x, weights, bias,
+          weight_stride, g, 0, out_y + x, out_stride);
+    }
+    for (; x + 16 <= g.width_out; x += 16) {
+      direct_conv_tile_avx512<OCB, 1, false>(in_y + x, weights, bias,
+          weight_stride, g, 0, out_y + x, out_stride);
+    }
+    if (x < g.width_out) {
+      direct_conv_tile_avx512<OCB, 1, true>(in_y + x, weights, bias,
+          weight_stride, g, g.width_out - x, out_y + x, out_stride);
+    }
+  }
+}
+
+void direct_conv_avx512(const float* in, const float* weights,
+    const float* bias, const int num_output, const DirectConvGeometry& g,
+    float* out) {
+  const int weight_stride = g.channels * g.kernel_dim;
+  const int out_stride = g.height_out * g.width_out;
+  int o = 0;
+  for (; o + 8 <= num_output; o += 8) {
+    direct_conv_block_avx512<8>(in, weights + o * weight_stride,
+        bias ? bias + o : NULL, g, out + o * out_stride);
+  }
+  for (; o < num_output; ++o) {
+    direct_conv_block_avx512<1>(in, weights + o * weight_stride,
+        bias ? bias + o : NULL, g, out + o * out_stride);
+  }
+}
+
+#endif  // CAFFE_DIRECT_CONV_X86
+
+}  // namespace
+
+DirectConvISA direct_conv_isa() {
+  return static_cast<DirectConvISA>(direct_conv_isa_limit());
+}
+
+void set_direct_conv_isa(DirectConvISA isa) {
+  direct_conv_isa_limit() = std::min(static_cast<int>(isa),
+      detect_direct_conv_isa());
+}
+
+int direct_conv_workspace_size(const int channels, const int height,
+    const int width, const int pad_h, const int pad_w, const int stride_w) {
+  if (pad_h == 0 && pad_w == 0 && stride_w == 1) {
+    return 0;
+  }
+  const int padded_width = width + 2 * pad_w;
+  const int phase_len = (padded_width + stride_w - 1) / stride_w;
+  return channels * (height + 2 * pad_h) * stride_w * phase_len;
+}
+
+template <typename Dtype>
+void direct_conv_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const Dtype* weights, const Dtype* bias, const int num_output,
+    const bool relu, Dtype* workspace, Dtype* data_out) {
+  vector<int> tap_offset;
+  DirectConvGeometry g;
+  const Dtype* in = direct_conv_prepare(data_im, channels, height, width,
+      kernel_h, kernel_w, pad_h, pad_w, stride_w, workspace,
+      &g.channel_stride, &g.row_stride, &tap_offset);
+  g.channels = channels;
+  g.kernel_dim = kernel_h * kernel_w;
+  g.stride_h = stride_h;
+  g.height_out = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  g.width_out = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  g.tap_offset = &tap_offset[0];
+  g.relu = relu;
+  direct_conv_scalar(in, weights, bias, num_output, g, data_out);
+}
+
+template <>
+void direct_conv_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const float* weights, const float* bias, const int num_output,
+    const bool relu, float* workspace, float* data_out) {
+  vector<int> tap_offset;
+  DirectConvGeometry g;
+  const float* in = direct_conv_prepare(data_im, channels, height, width,
+      kernel_h, kernel_w, pad_h, pad_w, stride_w, workspace,
+      &g.channel_stride, &g.row_stride, &tap_offset);
+  g.channels = channels;
+  g.kernel_dim = kernel_h * kernel_w;
+  g.stride_h = stride_h;
+  g.height_out = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  g.width_out = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  g.tap_offset = &tap_offset[0];
+  g.relu = relu;
+  switch (direct_conv_isa()) {
+#ifdef CAFFE_DIRECT_CONV_X86
+  case DIRECT_CONV_AVX512:
+    direct_conv_avx512(in, weights, bias, num_output, g, data_out);
+    break;
+  case DIRECT_CONV_AVX2:
+    direct_conv_avx2(in, weights, bias, num_output, g, data_out);
+    break;
+#endif
+  default:
+    direct_conv_scalar(in, weights, bias, num_output, g, data_out);
+  }
+}
+
+template <typename Dtype>
+void direct_conv_blocked_weights(const Dtype* weights, const int num_output,
+    const int channels, const int kernel_h, const int kernel_w,
+    const int block, Dtype* blocked_weights) {
+  CHECK_EQ(num_output % block, 0);
+  const int kernel_dim = channels * kernel_h * kernel_w;
+  for (int o = 0; o < num_output; ++o) {
+    const Dtype* src = weights + o * kernel_dim;
+    Dtype* dst = blocked_weights + (o / block) * kernel_dim * block + o % block;
+    for (int k = 0; k < kernel_dim; ++k) {
+      dst[k * block] = src[k];
+    }
+  }
+}
+
+namespace {
+
+// The output columns of a row of the blocked kernels whose input column for
+// kernel tap kx lies inside the image: [*x_begin, *x_end), the first of which
+// reads input column *in_begin.
+inline void blocked_columns(const int width, const int width_out,
+    const int pad_w, const int stride_w, const int kx, int* x_begin,
+    int* x_end, int* in_begin) {
+  const int lead = pad_w - kx;
+  *x_begin = lead > 0 ? (lead + stride_w - 1) / stride_w : 0;
+  const int last = width - 1 + pad_w - kx;
+  *x_end = last < 0 ? 0 : std::min(last / stride_w + 1, width_out);
+  *in_begin = *x_begin * stride_w - lead;
+}
+
+// Blocked output kernel. Every input value is broadcast against the kBlock
+// filter taps of an output block and accumulated into kBlock contiguous
+// outputs, whatever the input layout. This is the portable version; the
+// vector kernels below do the same with one or two multiply-adds.
+template <typename Dtype, int kBlock>
+void direct_conv_blocked(const Dtype* data_im, const int channels,
+    const int height, const int width, const int in_block,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const Dtype* blocked_weights,
+    const Dtype* bias, const int num_output, const bool relu,
+    Dtype* data_out) {
+  const int height_out = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_out = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  const int plane = height * width;
+  const int filter_dim = channels * kernel_h * kernel_w * kBlock;
+  for (int ob = 0; ob < num_output / kBlock; ++ob) {
+    const Dtype* filter = blocked_weights + ob * filter_dim;
+    for (int oy = 0; oy < height_out; ++oy) {
+      Dtype* out_row = data_out + (ob * height_out + oy) * width_out * kBlock;
+      for (int ox = 0; ox < width_out; ++ox) {
+        for (int b = 0; b < kBlock; ++b) {
+          out_row[ox * kBlock + b] = bias ? bias[ob * kBlock + b] : Dtype(0);
+        }
+      }
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* in_channel = data_im + (c / in_block) * plane * in_block
+            + c % in_block;
+        for (int ky = 0; ky < kernel_h; ++ky) {
+          const int iy = oy * stride_h - pad_h + ky;
+          if (iy < 0 || iy >= height) {
+            continue;
+          }
+          const Dtype* in_row = in_channel + iy * width * in_block;
+          for (int kx = 0; kx < kernel_w; ++kx) {
+            const Dtype* w =
+                filter + ((c * kernel_h + ky) * kernel_w + kx) * kBlock;
+            int x_begin, x_end, in_begin;
+            blocked_columns(width, width_out, pad_w, stride_w, kx, &x_begin,
+                &x_end, &in_begin);
+            const Dtype* in = in_row + in_begin * in_block;
+            Dtype* out = out_row + x_begin * kBlock;
+            for (int ox = x_begin; ox < x_end; ++ox) {
+              const Dtype v = *in;
+              for (int b = 0; b < kBlock; ++b) {
+                out[b] += v * w[b];
+              }
+              in += stride_w * in_block;
+              out += kBlock;
+            }
+          }
+        }
+      }
+      if (relu) {
+        for (int i = 0; i < width_out * kBlock; ++i) {
+          out_row[i] = std::max(out_row[i], Dtype(0));
+        }
+      }
+    }
+  }
+}
+
+#ifdef CAFFE_DIRECT_CONV_X86
+
+// direct_conv_blocked for float blocks of NV AVX2 vectors (kBlock = 8 * NV):
+// the taps of a filter position stay in registers across the row.
+template <int NV>
+__attribute__((target("avx2,fma")))
+void direct_conv_blocked_avx2(const float* data_im, const int channels,
+    const int height, const int width, const int in_block,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const float* blocked_weights,
+    const float* bias, const int num_output, const bool relu,
+    float* data_out) {
+  const int kBlock = 8 * NV;
+  const int height_out = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_out = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  const int plane = height * width;
+  const int filter_dim = channels * kernel_h * kernel_w * kBlock;
+  for (int ob = 0; ob < num_output / kBlock; ++ob) {
+    const float* filter = blocked_weights + ob * filter_dim;
+    __m256 b[NV];
+    for (int v = 0; v < NV; ++v) {
+      b[v] = bias ? _mm256_loadu_ps(bias + ob * kBlock + 8 * v)
+                  : _mm256_setzero_ps();
+    }
+    for (int oy = 0; oy < height_out; ++oy) {
+      float* out_row = data_out + (ob * height_out + oy) * width_out * kBlock;
+      for (int ox = 0; ox < width_out; ++ox) {
+        for (int v = 0; v < NV; ++v) {
+          _mm256_storeu_ps(out_row + ox * kBlock + 8 * v, b[v]);
+        }
+      }
+      for (int c = 0; c < channels; ++c) {
+        const float* in_channel = data_im + (c / in_block) * plane * in_block
+            + c % in_block;
+        for (int ky = 0; ky < kernel_h; ++ky) {
+          const int iy = oy * stride_h - pad_h + ky;
+          if (iy < 0 || iy >= height) {
+            continue;
+          }
+          const float* in_row = in_channel + iy * width * in_block;
+          for (int kx = 0; kx < kernel_w; ++kx) {
+            const float* w =
+                filter + ((c * kernel_h + ky) * kernel_w + kx) * kBlock;
+            __m256 wv[NV];
+            for (int v = 0; v < NV; ++v) {
+              wv[v] = _mm256_loadu_ps(w + 8 * v);
+            }
+            int x_begin, x_end, in_begin;
+            blocked_columns(width, width_out, pad_w, stride_w, kx, &x_begin,
+                &x_end, &in_begin);
+            const float* in = in_row + in_begin * in_block;
+            float* out = out_row + x_begin * kBlock;
+            for (int ox = x_begin; ox < x_end; ++ox) {
+              const __m256 x = _mm256_set1_ps(*in);
+              for (int v = 0; v < NV; ++v) {
+                _mm256_storeu_ps(out + 8 * v, _mm256_fmadd_ps(x, wv[v],
+                    _mm256_loadu_ps(out + 8 * v)));
+              }
+              in += stride_w * in_block;
+              out += kBlock;
+            }
+          }
+        }
+      }
+      if (relu) {
+        // The output goes second so that NaNs stay NaN, as with std::max.
+        for (int i = 0; i < width_out * kBlock; i += 8) {
+          _mm256_storeu_ps(out_row + i, _mm256_max_ps(_mm256_setzero_ps(),
+              _mm256_loadu_ps(out_row + i)));
+        }
+      }
+    }
+  }
+}
+
+// direct_conv_blocked for float blocks of 16, one AVX-512 vector.
+__attribute__((target("avx512f")))
+void direct_conv_blocked_avx512(const float* data_im, const int channels,
+    const int height, const int width, const int in_block,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const float* blocked_weights,
+    const float* bias, const int num_output, const bool relu,
+    float* data_out) {
+  const int kBlock = 16;
+  const int height_out = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_out = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  const int plane = height * width;
+  const int filter_dim = channels * kernel_h * kernel_w * kBlock;
+  for (int ob = 0; ob < num_output / kBlock; ++ob) {
+    const float* filter = blocked_weights + ob * filter_dim;
+    const __m512 b = bias ? _mm512_loadu_ps(bias + ob * kBlock)
+                          : _mm512_setzero_ps();
+    for (int oy = 0; oy < height_out; ++oy) {
+      float* out_row = data_out + (ob * height_out + oy) * width_out * kBlock;
+      for (int ox = 0; ox < width_out; ++ox) {
+        _mm512_storeu_ps(out_row + ox * kBlock, b);
+      }
+      for (int c = 0; c < channels; ++c) {
+        const float* in_channel = data_im + (c / in_block) * plane * in_block
+            + c % in_block;
+        for (int ky = 0; ky < kernel_h; ++ky) {
+          const int iy = oy * stride_h - pad_h + ky;
+          if (iy < 0 || iy >= height) {
+            continue;
+          }
+          const float* in_row = in_channel + iy * width * in_block;
+          for (int kx = 0; kx < kernel_w; ++kx) {
+            const __m512 w = _mm512_loadu_ps(
+                filter + ((c * kernel_h + ky) * kernel_w + kx) * kBlock);
+            int x_begin, x_end, in_begin;
+            blocked_columns(width, width_out, pad_w, stride_w, kx, &x_begin,
+                &x_end, &in_begin);
+            const float* in = in_row + in_begin * in_block;
+            float* out = out_row + x_begin * kBlock;
+            for (int ox = x_begin; ox < x_end; ++ox) {
+              _mm512_storeu_ps(out, _mm512_fmadd_ps(_mm512_set1_ps(*in), w,
+                  _mm512_loadu_ps(out)));
+              in += stride_w * in_block;
+              out += kBlock;
+            }
+          }
+        }
+      }
+      if (relu) {
+        for (int i = 0; i < width_out * kBlock; i += kBlock) {
+          _mm512_storeu_ps(out_row + i, _mm512_maskz_max_ps(0xFFFF,
+              _mm512_setzero_ps(), _mm512_loadu_ps(out_row + i)));
+        }
+      }
+    }
+  }
+}
+
+#endif  // CAFFE_DIRECT_CONV_X86
+
+}  // namespace
+
+template <typename Dtype>
+void direct_conv_blocked_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int in_block,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const Dtype* blocked_weights,
+    const Dtype* bias, const int num_output, const int out_block,
+    const bool relu, Dtype* data_out) {
+  CHECK_EQ(num_output % out_block, 0);
+  CHECK_EQ(channels % in_block, 0);
+  switch (out_block) {
+  case 8:
+    direct_conv_blocked<Dtype, 8>(data_im, channels, height, width, in_block,
+        kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+        blocked_weights, bias, num_output, relu, data_out);
+    break;
+  case 16:
+    direct_conv_blocked<Dtype, 16>(data_im, channels, height, width, in_block,
+        kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+        blocked_weights, bias, num_output, relu, data_out);
+    break;
+  default:
+    LOG(FATAL) << "Unsupported output block size " << out_block;
+  }
+}
+
+template <>
+void direct_conv_blocked_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int in_block,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const float* blocked_weights,
+    const float* bias, const int num_output, const int out_block,
+    const bool relu, float* data_out) {
+  CHECK_EQ(num_output % out_block, 0);
+  CHECK_EQ(channels % in_block, 0);
+  CHECK(out_block == 8 || out_block == 16)
+      << "Unsupported output block size " << out_block;
+#ifdef CAFFE_DIRECT_CONV_X86
+  const DirectConvISA isa = direct_conv_isa();
+  if (isa == DIRECT_CONV_AVX512 && out_block == 16) {
+    direct_conv_blocked_avx512(data_im, channels, height, width, in_block,
+        kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+        blocked_weights, bias, num_output, relu, data_out);
+    return;
+  }
+  if (isa >= DIRECT_CONV_AVX2) {
+    if (out_block == 8) {
+      direct_conv_blocked_avx2<1>(data_im, channels, height, width, in_block,
+          kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+          blocked_weights, bias, num_output, relu, data_out);
+    } else {
+      direct_conv_blocked_avx2<2>(data_im, channels, height, width, in_block,
+          kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+          blocked_weights, bias, num_output, relu, data_out);
+    }
+    return;
+  }
+#endif
+  if (out_block == 8) {
+    direct_conv_blocked<float, 8>(data_im, channels, height, width, in_block,
+        kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+        blocked_weights, bias, num_output, relu, data_out);
+  } else {
+    direct_conv_blocked<float, 16>(data_im, channels, height, width,
+        in_block, kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+        blocked_weights, bias, num_output, relu, data_out);
+  }
+}
+
+// Explicit instantiation
+template void direct_conv_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const double* weights, const double* bias,
+    const int num_output, const bool relu, double* workspace,
+    double* data_out);
+
+template void direct_conv_blocked_weights<float>(const float* weights,
+    const int num_output, const int channels, const int kernel_h,
+    const int kernel_w, const int block, float* blocked_weights);
+template void direct_conv_blocked_weights<double>(const double* weights,
+    const int num_output, const int channels, const int kernel_h,
+    const int kernel_w, const int block, double* blocked_weights);
+template void direct_conv_blocked_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width, const int in_block,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const double* blocked_weights,
+    const double* bias, const int num_output, const int out_block,
+    const bool relu, double* data_out);
+
+}  // namespace caffe
@@ -0,0 +1,107 @@
+#include <map>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+namespace caffe {
+
+// Whether the layer can apply a following ReLU itself.
+static bool CanFuseReLU(const LayerParameter& layer_param) {
+  if (layer_param.top_size() != 1) {
+    return false;
+  }
+  if (layer_param.type() == "Convolution") {
+    return !layer_param.convolution_param().fuse_relu();
+  }
+  if (layer_param.type() == "InnerProduct") {
+    return !layer_param.inner_product_param().fuse_relu();
+  }
+  return false;
+}
+
+static void SetFuseReLU(LayerParameter* layer_param) {
+  if (layer_param->type() == "Convolution") {
+    layer_param->mutable_convolution_param()->set_fuse_relu(true);
+  } else {
+    layer_param->mutable_inner_product_param()->set_fuse_relu(true);
+  }
+}
+
+void FuseLayers(const NetParameter& param, NetParameter* param_fused) {
+  // Initialize by copying from the input NetParameter.
+  param_fused->CopyFrom(param);
+  param_fused->clear_layer();
+  // The number of layers reading each blob, in place or not.
+  map<string, int> blob_readers;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    for (int j = 0; j < param.layer(i).bottom_size(); ++j) {
+      ++blob_readers[param.layer(i).bottom(j)];
+    }
+  }
+  // Blobs renamed to the bottom of a removed Dropout.
+  map<string, string> renamed_blobs;
+  // Blobs written by a layer of param_fused that can take a ReLU, mapped to
+  // its index, until some other layer reads them.
+  map<string, int> fusable_blobs;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    LayerParameter layer_param(param.layer(i));
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      map<string, string>::const_iterator it =
+          renamed_blobs.find(layer_param.bottom(j));
+      if (it != renamed_blobs.end()) {
+        layer_param.set_bottom(j, it->second);
+      }
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      map<string, string>::const_iterator it =
+          renamed_blobs.find(layer_param.top(j));
+      if (it != renamed_blobs.end()) {
+        layer_param.set_top(j, it->second);
+      }
+    }
+    const bool single_blob =
+        layer_param.bottom_size() == 1 && layer_param.top_size() == 1;
+    const string bottom_name = single_blob ? layer_param.bottom(0) : "";
+    const string top_name = single_blob ? layer_param.top(0) : "";
+    const bool in_place = single_blob && bottom_name == top_name;
+    if (single_blob && layer_param.type() == "ReLU" &&
+        layer_param.relu_param().negative_slope() == 0 &&
+        fusable_blobs.count(bottom_name) &&
+        (in_place || blob_readers[bottom_name] == 1)) {
+      LayerParameter* producer =
+          param_fused->mutable_layer(fusable_blobs[bottom_name]);
+      LOG(INFO) << "Fusing " << layer_param.name() << " into "
+          << producer->name();
+      SetFuseReLU(producer);
+      producer->set_top(0, top_name);
+      fusable_blobs.erase(bottom_name);
+      --blob_readers[bottom_name];
+      continue;
+    }
+    const Phase phase =
+        layer_param.has_phase() ? layer_param.phase() : param.state().phase();
+    if (single_blob && layer_param.type() == "Dropout" && phase == TEST &&
+        (in_place || (blob_readers[bottom_name] == 1 &&
+                      blob_readers[top_name] > 0))) {
+      LOG(INFO) << "Removing " << layer_param.name();
+      if (!in_place) {
+        renamed_blobs[top_name] = bottom_name;
+        blob_readers[bottom_name] += blob_readers[top_name] - 1;
+      }
+      continue;
+    }
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      fusable_blobs.erase(layer_param.bottom(j));
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      fusable_blobs.erase(layer_param.top(j));
+    }
+    if (CanFuseReLU(layer_param)) {
+      fusable_blobs[layer_param.top(0)] = param_fused->layer_size();
+    }
+    param_fused->add_layer()->CopyFrom(layer_param);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+const size_t HostAllocator::kAlignment;
+const size_t HostAllocator::kLargeBytes;
+const size_t HostAllocator::kHugePageBytes;
+
+HostAllocator::HostAllocator()
+    : pooling_(true), max_cached_bytes_(size_t(1) << 30),
+      huge_pages_(HUGE_PAGES_NONE), numa_node_(-1) {
+  stats_.live_bytes = 0;
+  stats_.peak_bytes = 0;
+  stats_.cached_bytes = 0;
+  stats_.pool_hits = 0;
+  stats_.pool_misses = 0;
+}
+
+HostAllocator::~HostAllocator() {
+  Trim();
+}
+
+size_t HostAllocator::RoundUp(const size_t size) {
+  if (size <= kAlignment) {
+    return kAlignment;
+  }
+  // Four classes between consecutive powers of two: the waste is below 25%.
+  size_t power = kAlignment;
+  while (power < size) {
+    power <<= 1;
+  }
+  const size_t step = std::max(kAlignment, power / 8);
+  size_t bytes = (size + step - 1) / step * step;
+  if (bytes >= kLargeBytes) {
+    bytes = (bytes + kHugePageBytes - 1) / kHugePageBytes * kHugePageBytes;
+  }
+  return bytes;
+}
+
+void* HostAllocator::Allocate(const size_t size) {
+  const size_t bytes = RoundUp(size);
+  void* ptr = NULL;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    std::map<size_t, vector<void*> >::iterator it = pool_.find(bytes);
+    if (it != pool_.end() && !it->second.empty()) {
+      ptr = it->second.back();
+      it->second.pop_back();
+      stats_.cached_bytes -= bytes;
+      ++stats_.pool_hits;
+    } else {
+      ++stats_.pool_misses;
+    }
+  }
+  if (!ptr) {
+    ptr = SystemAllocate(bytes);
+    if (!ptr) {
+      // Give the pooled memory back and retry once.
+      Trim();
+      ptr = SystemAllocate(bytes);
+    }
+    if (!ptr) {
+      return NULL;
+    }
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.live_bytes += bytes;
+  stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.live_bytes);
+  return ptr;
+}
+
+void HostAllocator::Free(void* ptr, const size_t size) {
+  if (!ptr) {
+    return;
+  }
+  const size_t bytes = RoundUp(size);
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stats_.live_bytes -= bytes;
+    if (pooling_ && stats_.cached_bytes + bytes <= max_cached_bytes_) {
+      pool_[bytes].push_back(ptr);
+      stats_.cached_bytes += bytes;
+      return;
+    }
+  }
+  SystemFree(ptr, bytes);
+}
+
+void HostAllocator::Trim() {
+  TrimTo(0);
+}
+
+void HostAllocator::TrimTo(const size_t max_cached_bytes) {
+  vector<std::pair<void*, size_t> > blocks;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    // Free the largest blocks first.
+    for (std::map<size_t, vector<void*> >::reverse_iterator it =
+         pool_.rbegin(); it != pool_.rend(); ++it) {
+      while (stats_.cached_bytes > max_cached_bytes && !it->second.empty()) {
+        blocks.push_back(std::make_pair(it->second.back(), it->first));
+        it->second.pop_back();
+        stats_.cached_bytes -= it->first;
+      }
+    }
+  }
+  for (int i = 0; i < blocks.size(); ++i) {
+    SystemFree(blocks[i].first, blocks[i].second);
+  }
+}
+
+HostAllocator::Stats HostAllocator::stats() {
+  boost::mutex::scoped_lock lock(mutex_);
+  return stats_;
+}
+
+void HostAllocator::ResetPeak() {
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.peak_bytes = stats_.live_bytes;
+}
+
+void HostAllocator::set_pooling(const bool pooling) {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    pooling_ = pooling;
+  }
+  if (!pooling) {
+    Trim();
+  }
+}
+
+void HostAllocator::set_max_cached_bytes(const size_t max_cached_bytes) {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_cached_bytes_ = max_cached_bytes;
+  }
+  TrimTo(max_cached_bytes);
+}
+
+void HostAllocator::set_huge_pages(const HugePages huge_pages) {
+  boost::mutex::scoped_lock lock(mutex_);
+  huge_pages_ = huge_pages;
+}
+
+void HostAllocator::set_numa_node(const int numa_node) {
+  CHECK_GE(numa_node, -1);
+  boost::mutex::scoped_lock lock(mutex_);
+  numa_node_ = numa_node;
+}
+
+#ifdef __linux__
+
+void* HostAllocator::SystemAllocate(const size_t bytes) {
+  if (bytes < kLargeBytes) {
+    void* ptr = NULL;
+    return posix_memalign(&ptr, kAlignment, bytes) ? NULL : ptr;
+  }
+  HugePages huge_pages;
+  int numa_node;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    huge_pages = huge_pages_;
+    numa_node = numa_node_;
+  }
+  void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (huge_pages == HUGE_PAGES_EXPLICIT) {
+    ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  }
+#endif
+  if (ptr == MAP_FAILED) {
+    // Over-map by a huge page and unmap the ends, so that the block starts
+    // at a huge page boundary where transparent huge pages can back it.
+    char* base = static_cast<char*>(mmap(NULL, bytes + kHugePageBytes,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED) {
+      return NULL;
+    }
+    const size_t head = (kHugePageBytes - reinterpret_cast<uintptr_t>(base) %
+        kHugePageBytes) % kHugePageBytes;
+    if (head) {
+      munmap(base, head);
+    }
+    munmap(base + head + bytes, kHugePageBytes - head);
+    ptr = base + head;
+#ifdef MADV_HUGEPAGE
+    if (huge_pages != HUGE_PAGES_NONE) {
+      madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+#endif
+  }
+#ifdef SYS_mbind
+  if (numa_node >= 0) {
+    // mbind(MPOL_PREFERRED) without libnuma: the pages go to numa_node when
+    // first touched, or elsewhere if it is full.
+    const int kMpolPreferred = 1;
+    const int kBitsPerWord = 8 * sizeof(unsigned long);  // NOLINT(runtime/int)
+    vector<unsigned long> mask(numa_node / kBitsPerWord + 1, 0);  // NOLINT
+    mask[numa_node / kBitsPerWord] = 1UL << (numa_node % kBitsPerWord);
+    const long error = syscall(SYS_mbind, ptr, bytes,  // NOLINT(runtime/int)
+        kMpolPreferred, &mask[0], mask.size() * kBitsPerWord + 1, 0);
+    LOG_IF(WARNING, error) << "Cannot bind host memory to NUMA node "
+        << numa_node;
+  }
+#endif
+  return ptr;
+}
+
+void HostAllocator::SystemFree(void* ptr, const size_t bytes) {
+  if (bytes < kLargeBytes) {
+    free(ptr);
+  } else {
+    munmap(ptr, bytes);
+  }
+}
+
+#else
+
+void* HostAllocator::SystemAllocate(const size_t bytes) {
+  void* ptr = NULL;
+  return posix_memalign(&ptr, kAlignment, bytes) ? NULL : ptr;
+}
+
+void HostAllocator::SystemFree(void* ptr, const size_t bytes) {
+  free(ptr);
+}
+
+#endif  // __linux__
+
+}  // namespace caffe
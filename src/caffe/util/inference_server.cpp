@@ -0,0 +1,511 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/internal_thread.hpp"
+#include "caffe/net.hpp"
+#include "caffe/net_model.hpp"
+#include "caffe/util/inference_server.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+namespace caffe {
+
+namespace {
+
+// A malformed request is answered with an error, but one larger than this is
+// not even read: the connection is closed.
+const uint32_t kMaxRequestValues = 1 << 28;
+const uint32_t kMaxNameSize = 1 << 12;
+
+// Reads or writes all bytes, or returns false if the connection is closed.
+bool ReadFully(const int fd, void* data, size_t bytes) {
+  char* next = static_cast<char*>(data);
+  while (bytes) {
+    const ssize_t done = recv(fd, next, bytes, 0);
+    if (done < 0 && errno == EINTR) { continue; }
+    if (done <= 0) { return false; }
+    next += done;
+    bytes -= done;
+  }
+  return true;
+}
+
+bool WriteFully(const int fd, const void* data, size_t bytes) {
+  const char* next = static_cast<const char*>(data);
+  while (bytes) {
+    const ssize_t done = send(fd, next, bytes, MSG_NOSIGNAL);
+    if (done < 0 && errno == EINTR) { continue; }
+    if (done <= 0) { return false; }
+    next += done;
+    bytes -= done;
+  }
+  return true;
+}
+
+void Append(string* message, const void* data, const size_t bytes) {
+  message->append(static_cast<const char*>(data), bytes);
+}
+
+void AppendSize(string* message, const uint32_t size) {
+  Append(message, &size, sizeof(size));
+}
+
+sockaddr_un SocketAddress(const string& socket_path) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  CHECK_LT(socket_path.size(), sizeof(address.sun_path))
+      << "Socket path too long: " << socket_path;
+  memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  return address;
+}
+
+}  // namespace
+
+// The replicas of a net and the requests they share.
+class InferenceServer::Model {
+ public:
+  struct Request {
+    const vector<float>* input;
+    vector<float>* output;
+    boost::system_time arrival;
+    bool done;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+  };
+
+  Model(const NetParameter& param, const string& weights_file,
+      const Options& options);
+  ~Model();
+
+  int input_count() const { return input_count_; }
+  int output_count() const { return output_count_; }
+  Stats stats() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return stats_;
+  }
+
+  void Infer(const vector<float>& input, vector<float>* output);
+  // Waits for the next batch, for a replica.
+  void NextBatch(vector<Request*>* batch);
+
+ private:
+  const Options options_;
+  shared_ptr<NetModel<float> > model_;
+  int input_count_;
+  int output_count_;
+  vector<shared_ptr<Replica> > replicas_;
+  // Guards queue_ and stats_; queued_ is notified on every request.
+  mutable boost::mutex mutex_;
+  boost::condition_variable queued_;
+  std::deque<Request*> queue_;
+  Stats stats_;
+};
+
+// A net running the batches of a model on its own thread.
+class InferenceServer::Replica : public InternalThread {
+ public:
+  Replica(Model* model, const shared_ptr<Net<float> >& net)
+      : model_(model), net_(net), mode_(Caffe::mode()) {
+    CHECK(StartInternalThread()) << "Cannot start a replica of "
+        << net->name();
+  }
+  virtual ~Replica() { StopInternalThread(); }
+
+ protected:
+  virtual void InternalThreadEntry();
+
+ private:
+  void Run(const vector<Model::Request*>& batch);
+
+  Model* model_;
+  shared_ptr<Net<float> > net_;
+  const Caffe::Brew mode_;
+};
+
+InferenceServer::Model::Model(const NetParameter& param,
+    const string& weights_file, const Options& options)
+    : options_(options) {
+  CHECK_GT(options.replicas, 0);
+  CHECK_GT(options.max_batch_size, 0);
+  CHECK_GE(options.max_delay_us, 0);
+  model_.reset(new NetModel<float>(param, weights_file));
+  const Net<float>& net = *model_->net();
+  CHECK_EQ(net.num_inputs(), 1) << "Served nets take a single input; "
+      << net.name() << " takes " << net.num_inputs();
+  const Blob<float>& input = *net.input_blobs()[0];
+  CHECK_GT(input.num_axes(), 0) << "The input of " << net.name()
+      << " has no batch axis";
+  input_count_ = input.count(1);
+  output_count_ = 0;
+  for (int i = 0; i < net.num_outputs(); ++i) {
+    const Blob<float>& output = *net.output_blobs()[i];
+    CHECK(output.num_axes() > 0 && output.shape(0) == input.shape(0))
+        << "Output " << net.blob_names()[net.output_blob_indices()[i]]
+        << " of " << net.name() << " does not have an item per input item";
+    output_count_ += output.count(1);
+  }
+  for (int i = 0; i < options.replicas; ++i) {
+    replicas_.push_back(shared_ptr<Replica>(new Replica(this,
+        i ? model_->NewContext() : model_->net())));
+  }
+}
+
+InferenceServer::Model::~Model() {
+  // Stops the replicas before the queue they wait on goes away.
+  replicas_.clear();
+}
+
+void InferenceServer::Model::Infer(const vector<float>& input,
+    vector<float>* output) {
+  CHECK_EQ(static_cast<int>(input.size()), input_count_)
+      << "Wrong number of input values";
+  Request request;
+  request.input = &input;
+  request.output = output;
+  request.done = false;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    request.arrival = boost::get_system_time();
+    queue_.push_back(&request);
+    queued_.notify_all();
+  }
+  boost::mutex::scoped_lock lock(request.mutex);
+  while (!request.done) {
+    request.cond.wait(lock);
+  }
+}
+
+void InferenceServer::Model::NextBatch(vector<Request*>* batch) {
+  boost::mutex::scoped_lock lock(mutex_);
+  // Several replicas may wait for the same requests: whichever finds the
+  // batch full, or its delay over, takes it, and the others wait for the
+  // next one.
+  for (;;) {
+    while (queue_.empty()) {
+      queued_.wait(lock);
+    }
+    const boost::system_time deadline = queue_.front()->arrival +
+        boost::posix_time::microseconds(options_.max_delay_us);
+    if (static_cast<int>(queue_.size()) >= options_.max_batch_size ||
+        boost::get_system_time() >= deadline) {
+      break;
+    }
+    queued_.timed_wait(lock, deadline);
+  }
+  const int size = std::min<int>(queue_.size(), options_.max_batch_size);
+  batch->assign(queue_.begin(), queue_.begin() + size);
+  queue_.erase(queue_.begin(), queue_.begin() + size);
+  stats_.requests += size;
+  ++stats_.batches;
+  if (!queue_.empty()) {
+    queued_.notify_all();
+  }
+}
+
+void InferenceServer::Replica::InternalThreadEntry() {
+  Caffe::set_mode(mode_);
+  try {
+    vector<Model::Request*> batch;
+    while (!must_stop()) {
+      model_->NextBatch(&batch);
+      Run(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+void InferenceServer::Replica::Run(const vector<Model::Request*>& batch) {
+  const int size = batch.size();
+  Blob<float>* input = net_->input_blobs()[0];
+  if (input->shape(0) != size) {
+    vector<int> shape = input->shape();
+    shape[0] = size;
+    input->Reshape(shape);
+    net_->Reshape();
+  }
+  const int input_count = input->count(1);
+  float* input_data = input->mutable_cpu_data();
+  for (int i = 0; i < size; ++i) {
+    caffe_copy(input_count, &(*batch[i]->input)[0],
+        input_data + i * input_count);
+  }
+  const vector<Blob<float>*>& outputs = net_->ForwardPrefilled();
+  for (int i = 0; i < size; ++i) {
+    Model::Request* request = batch[i];
+    request->output->resize(model_->output_count());
+    float* output_data = &(*request->output)[0];
+    for (int j = 0; j < outputs.size(); ++j) {
+      const int count = outputs[j]->count(1);
+      caffe_copy(count, outputs[j]->cpu_data() + i * count, output_data);
+      output_data += count;
+    }
+    // Notified under the lock: the request is gone as soon as its thread
+    // sees done.
+    boost::mutex::scoped_lock lock(request->mutex);
+    request->done = true;
+    request->cond.notify_one();
+  }
+}
+
+// Accepts the clients of the server, and serves each on its own thread.
+class InferenceServer::Listener : public InternalThread {
+ public:
+  Listener(InferenceServer* server, const string& socket_path);
+  virtual ~Listener();
+
+ protected:
+  virtual void InternalThreadEntry();
+
+ private:
+  void Serve(const int fd);
+  // Answers the request for values of model name in *response.
+  void Answer(const string& name, const vector<float>& input,
+      string* response);
+
+  InferenceServer* server_;
+  const string socket_path_;
+  int listen_fd_;
+  // Guards the connections; the last to close notifies closed_.
+  boost::mutex mutex_;
+  boost::condition_variable closed_;
+  std::set<int> connections_;
+  bool stopping_;
+};
+
+InferenceServer::Listener::Listener(InferenceServer* server,
+    const string& socket_path)
+    : server_(server), socket_path_(socket_path), stopping_(false) {
+  const sockaddr_un address = SocketAddress(socket_path);
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_GE(listen_fd_, 0) << "Cannot create a socket";
+  unlink(socket_path.c_str());
+  CHECK_EQ(bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address),
+      sizeof(address)), 0) << "Cannot bind " << socket_path << ": "
+      << strerror(errno);
+  CHECK_EQ(listen(listen_fd_, SOMAXCONN), 0) << "Cannot listen on "
+      << socket_path;
+  CHECK(StartInternalThread()) << "Cannot start listening on " << socket_path;
+}
+
+InferenceServer::Listener::~Listener() {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopping_ = true;
+  }
+  // Wakes the thread blocked in accept.
+  shutdown(listen_fd_, SHUT_RDWR);
+  StopInternalThread();
+  close(listen_fd_);
+  unlink(socket_path_.c_str());
+  boost::mutex::scoped_lock lock(mutex_);
+  for (std::set<int>::iterator it = connections_.begin();
+      it != connections_.end(); ++it) {
+    shutdown(*it, SHUT_RDWR);
+  }
+  while (!connections_.empty()) {
+    closed_.wait(lock);
+  }
+}
+
+void InferenceServer::Listener::InternalThreadEntry() {
+  for (;;) {
+    const int fd = accept(listen_fd_, NULL, NULL);
+    boost::mutex::scoped_lock lock(mutex_);
+    if (stopping_) {
+      if (fd >= 0) { close(fd); }
+      return;
+    }
+    if (fd < 0) {
+      LOG_IF(WARNING, errno != EINTR) << "Cannot accept a client: "
+          << strerror(errno);
+      continue;
+    }
+    connections_.insert(fd);
+    boost::thread(&Listener::Serve, this, fd).detach();
+  }
+}
+
+void InferenceServer::Listener::Serve(const int fd) {
+  vector<float> input;
+  string response;
+  for (;;) {
+    uint32_t name_size = 0;
+    if (!ReadFully(fd, &name_size, sizeof(name_size)) ||
+        name_size > kMaxNameSize) {
+      break;
+    }
+    string name(name_size, '\0');
+    uint32_t count = 0;
+    if (!ReadFully(fd, &name[0], name_size) ||
+        !ReadFully(fd, &count, sizeof(count)) || count > kMaxRequestValues) {
+      break;
+    }
+    input.resize(count);
+    if (!ReadFully(fd, input.data(), count * sizeof(float))) {
+      break;
+    }
+    Answer(name, input, &response);
+    if (!WriteFully(fd, response.data(), response.size())) {
+      break;
+    }
+  }
+  close(fd);
+  boost::mutex::scoped_lock lock(mutex_);
+  connections_.erase(fd);
+  if (connections_.empty()) {
+    closed_.notify_all();
+  }
+}
+
+void InferenceServer::Listener::Answer(const string& name,
+    const vector<float>& input, string* response) {
+  response->clear();
+  string error;
+  if (!server_->HasModel(name)) {
+    error = "No model " + name;
+  } else if (static_cast<int>(input.size()) != server_->input_count(name)) {
+    std::ostringstream message;
+    message << "Model " << name << " takes " << server_->input_count(name)
+        << " values per item, not " << input.size();
+    error = message.str();
+  }
+  if (!error.empty()) {
+    AppendSize(response, 1);
+    AppendSize(response, error.size());
+    response->append(error);
+    return;
+  }
+  vector<float> output;
+  server_->Infer(name, input, &output);
+  AppendSize(response, 0);
+  AppendSize(response, output.size());
+  Append(response, output.data(), output.size() * sizeof(float));
+}
+
+InferenceServer::InferenceServer(const Options& options)
+    : options_(options),
+      previous_num_threads_(Caffe::requested_num_threads()) {
+  CHECK_GE(options.threads_per_replica, 0);
+  // Resizing the pool restarts it, so it is done once, before any replica
+  // runs, rather than by each replica.
+  if (options.threads_per_replica) {
+    Caffe::set_num_threads(options.replicas * options.threads_per_replica);
+  }
+}
+
+InferenceServer::~InferenceServer() {
+  Stop();
+  models_.clear();
+  if (options_.threads_per_replica) {
+    Caffe::set_num_threads(previous_num_threads_);
+  }
+}
+
+void InferenceServer::AddModel(const string& name, const NetParameter& param,
+    const string& weights_file) {
+  CHECK(!listener_) << "Add the models before listening";
+  CHECK(!HasModel(name)) << "Model " << name << " is already served";
+  models_[name].reset(new Model(param, weights_file, options_));
+  LOG(INFO) << "Serving " << name << " on " << options_.replicas
+      << " replica(s)";
+}
+
+void InferenceServer::AddModel(const string& name, const string& model_file,
+    const string& weights_file) {
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(model_file, &param);
+  AddModel(name, param, weights_file);
+}
+
+bool InferenceServer::HasModel(const string& name) const {
+  return models_.count(name) > 0;
+}
+
+int InferenceServer::input_count(const string& name) const {
+  CHECK(HasModel(name)) << "No model " << name;
+  return models_.find(name)->second->input_count();
+}
+
+int InferenceServer::output_count(const string& name) const {
+  CHECK(HasModel(name)) << "No model " << name;
+  return models_.find(name)->second->output_count();
+}
+
+InferenceServer::Stats InferenceServer::stats(const string& name) const {
+  CHECK(HasModel(name)) << "No model " << name;
+  return models_.find(name)->second->stats();
+}
+
+void InferenceServer::Infer(const string& name, const vector<float>& input,
+    vector<float>* output) {
+  CHECK(HasModel(name)) << "No model " << name;
+  models_[name]->Infer(input, output);
+}
+
+void InferenceServer::Listen(const string& socket_path) {
+  CHECK(!listener_) << "Already listening";
+  listener_.reset(new Listener(this, socket_path));
+  LOG(INFO) << "Listening on " << socket_path;
+}
+
+void InferenceServer::Stop() {
+  listener_.reset();
+}
+
+InferenceClient::InferenceClient(const string& socket_path) {
+  const sockaddr_un address = SocketAddress(socket_path);
+  fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_GE(fd_, 0) << "Cannot create a socket";
+  CHECK_EQ(connect(fd_, reinterpret_cast<const sockaddr*>(&address),
+      sizeof(address)), 0) << "Cannot connect to " << socket_path << ": "
+      << strerror(errno);
+}
+
+InferenceClient::~InferenceClient() {
+  close(fd_);
+}
+
+bool InferenceClient::Infer(const string& name, const vector<float>& input,
+    vector<float>* output, string* error) {
+  string request;
+  AppendSize(&request, name.size());
+  request.append(name);
+  AppendSize(&request, input.size());
+  Append(&request, input.data(), input.size() * sizeof(float));
+  CHECK(WriteFully(fd_, request.data(), request.size()))
+      << "Lost the connection to the server";
+  uint32_t status = 0;
+  uint32_t size = 0;
+  CHECK(ReadFully(fd_, &status, sizeof(status)) &&
+      ReadFully(fd_, &size, sizeof(size)))
+      << "Lost the connection to the server";
+  if (status) {
+    string message(size, '\0');
+    CHECK(ReadFully(fd_, &message[0], size))
+        << "Lost the connection to the server";
+    if (error) {
+      *error = message;
+    }
+    return false;
+  }
+  output->resize(size);
+  CHECK(ReadFully(fd_, output->data(), size * sizeof(float)))
+      << "Lost the connection to the server";
+  return true;
+}
+
+}  // namespace caffe
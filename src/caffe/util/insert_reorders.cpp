@@ -0,0 +1,127 @@
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/blocked_layout.hpp"
+#include "caffe/util/insert_reorders.hpp"
+
+namespace caffe {
+
+// Renames every use of a blob in the layers added so far.
+static void RenameBlob(const string& blob_name, const string& new_name,
+    NetParameter* param) {
+  for (int i = 0; i < param->layer_size(); ++i) {
+    LayerParameter* layer_param = param->mutable_layer(i);
+    for (int j = 0; j < layer_param->bottom_size(); ++j) {
+      if (layer_param->bottom(j) == blob_name) {
+        layer_param->set_bottom(j, new_name);
+      }
+    }
+    for (int j = 0; j < layer_param->top_size(); ++j) {
+      if (layer_param->top(j) == blob_name) {
+        layer_param->set_top(j, new_name);
+      }
+    }
+  }
+}
+
+void InsertReorders(const NetParameter& param, NetParameter* param_reordered) {
+  // Initialize by copying from the input NetParameter.
+  param_reordered->CopyFrom(param);
+  param_reordered->clear_layer();
+  // Blobs whose latest version may be blocked, mapped to whether any layer
+  // has read that version yet.
+  map<string, bool> blocked_blob_consumed;
+  const int block = blob_layout_block(param.layout());
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    const bool accepts = LayerAcceptsBlockedLayout(layer_param);
+    bool blocked_bottom = false;
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& blob_name = layer_param.bottom(j);
+      map<string, bool>::iterator blocked =
+          blocked_blob_consumed.find(blob_name);
+      if (blocked == blocked_blob_consumed.end()) {
+        continue;
+      }
+      if (accepts) {
+        blocked->second = true;
+        blocked_bottom = true;
+        continue;
+      }
+      // Reorder in front of this layer under the original name, so that
+      // in-place layers and later readers need no renaming; the blocked
+      // versions written so far move to a new name instead.
+      const string blocked_name = blob_name + "_blocked";
+      RenameBlob(blob_name, blocked_name, param_reordered);
+      ConfigureReorderLayer(layer_param.name(), blocked_name, blob_name,
+          param_reordered->add_layer());
+      blocked_blob_consumed.erase(blocked);
+    }
+    LayerParameter* reordered_layer_param = param_reordered->add_layer();
+    reordered_layer_param->CopyFrom(layer_param);
+    // Convolutions whose filters split evenly into blocks write blocked tops
+    // whatever their bottoms are; the other accepting layers keep the layout
+    // of their bottoms.
+    bool blocked_top = accepts && blocked_bottom;
+    if (accepts && layer_param.type() == "Convolution") {
+      const ConvolutionParameter& conv_param = layer_param.convolution_param();
+      blocked_top = conv_param.group() == 1 &&
+          conv_param.num_output() % block == 0;
+      if (blocked_top) {
+        reordered_layer_param->set_layout(param.layout());
+      }
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      if (blocked_top) {
+        blocked_blob_consumed[layer_param.top(j)] = false;
+      } else {
+        blocked_blob_consumed.erase(layer_param.top(j));
+      }
+    }
+  }
+  // Net outputs are read by the caller, so reorder those as well.
+  for (map<string, bool>::const_iterator it = blocked_blob_consumed.begin();
+       it != blocked_blob_consumed.end(); ++it) {
+    if (!it->second) {
+      const string& blob_name = it->first;
+      const string blocked_name = blob_name + "_blocked";
+      RenameBlob(blob_name, blocked_name, param_reordered);
+      ConfigureReorderLayer("output", blocked_name, blob_name,
+          param_reordered->add_layer());
+    }
+  }
+}
+
+bool LayerAcceptsBlockedLayout(const LayerParameter& layer_param) {
+  const string& type = layer_param.type();
+  if (type == "Pooling") {
+    return layer_param.top_size() == 1 &&
+        layer_param.pooling_param().pool() !=
+        PoolingParameter_PoolMethod_STOCHASTIC;
+  }
+  if (type == "LRN") {
+    return layer_param.lrn_param().norm_region() ==
+        LRNParameter_NormRegion_ACROSS_CHANNELS;
+  }
+  return type == "Convolution" || type == "ReLU" || type == "Dropout" ||
+      type == "Split";
+}
+
+void ConfigureReorderLayer(const string& layer_name, const string& bottom_name,
+    const string& top_name, LayerParameter* reorder_layer_param) {
+  reorder_layer_param->Clear();
+  reorder_layer_param->set_name(ReorderLayerName(layer_name, top_name));
+  reorder_layer_param->set_type("Reorder");
+  reorder_layer_param->add_bottom(bottom_name);
+  reorder_layer_param->add_top(top_name);
+}
+
+string ReorderLayerName(const string& layer_name, const string& blob_name) {
+  ostringstream reorder_layer_name;
+  reorder_layer_name << blob_name << "_" << layer_name << "_reorder";
+  return reorder_layer_name.str();
+}
+
+}  // namespace caffe
@@ -8,6 +8,8 @@
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
@@ -68,6 +70,21 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
+void WriteProtoToBinaryFileAtomically(const Message& proto,
+    const string& filename) {
+  const string temp_filename = filename + ".tmp";
+  int fd = open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK_NE(fd, -1) << "Cannot create " << temp_filename;
+  FileOutputStream* output = new FileOutputStream(fd);
+  CHECK(proto.SerializeToZeroCopyStream(output) && output->Flush())
+      << "Cannot write " << temp_filename;
+  delete output;
+  CHECK_EQ(fsync(fd), 0) << "Cannot sync " << temp_filename;
+  CHECK_EQ(close(fd), 0) << "Cannot write " << temp_filename;
+  CHECK_EQ(rename(temp_filename.c_str(), filename.c_str()), 0)
+      << "Cannot rename " << temp_filename << " to " << filename;
+}
+
 cv::Mat ReadImageToCVMat(const string& filename,
     const int height, const int width, const bool is_color) {
   cv::Mat cv_img;
@@ -157,29 +174,115 @@ bool ReadFileToDatum(const string& filename, const int label,
   }
 }
 
-cv::Mat DecodeDatumToCVMatNative(const Datum& datum) {
-  cv::Mat cv_img;
-  CHECK(datum.encoded()) << "Datum not encoded";
-  const string& data = datum.data();
-  std::vector<char> vec_data(data.c_str(), data.c_str() + data.size());
-  cv_img = cv::imdecode(vec_data, -1);
+// Decodes the image in data without copying it.
+static cv::Mat DecodeBytesToCVMat(const uint8_t* data, const size_t size,
+    const int cv_read_flag) {
+  const cv::Mat buffer(1, size, CV_8UC1, const_cast<uint8_t*>(data));
+  cv::Mat cv_img = cv::imdecode(buffer, cv_read_flag);
   if (!cv_img.data) {
     LOG(ERROR) << "Could not decode datum ";
   }
   return cv_img;
 }
+
+cv::Mat DecodeDatumToCVMatNative(const Datum& datum) {
+  CHECK(datum.encoded()) << "Datum not encoded";
+  const string& data = datum.data();
+  return DecodeBytesToCVMat(reinterpret_cast<const uint8_t*>(data.data()),
+      data.size(), -1);
+}
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color) {
-  cv::Mat cv_img;
   CHECK(datum.encoded()) << "Datum not encoded";
   const string& data = datum.data();
-  std::vector<char> vec_data(data.c_str(), data.c_str() + data.size());
   int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
     CV_LOAD_IMAGE_GRAYSCALE);
-  cv_img = cv::imdecode(vec_data, cv_read_flag);
-  if (!cv_img.data) {
-    LOG(ERROR) << "Could not decode datum ";
+  return DecodeBytesToCVMat(reinterpret_cast<const uint8_t*>(data.data()),
+      data.size(), cv_read_flag);
+}
+
+cv::Mat DecodeDatumToCVMatNative(const DatumView& datum) {
+  CHECK(datum.encoded) << "Datum not encoded";
+  return DecodeBytesToCVMat(datum.data, datum.data_size, -1);
+}
+cv::Mat DecodeDatumToCVMat(const DatumView& datum, bool is_color) {
+  CHECK(datum.encoded) << "Datum not encoded";
+  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+    CV_LOAD_IMAGE_GRAYSCALE);
+  return DecodeBytesToCVMat(datum.data, datum.data_size, cv_read_flag);
+}
+
+bool ParseDatumView(const char* bytes, const size_t size, DatumView* datum) {
+  datum->channels = 0;
+  datum->height = 0;
+  datum->width = 0;
+  datum->label = 0;
+  datum->encoded = false;
+  datum->data = NULL;
+  datum->data_size = 0;
+  CHECK_LE(size, static_cast<size_t>(kProtoReadBytesLimit));
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(bytes), size);
+  // The wire types of the protobuf encoding.
+  const int kVarint = 0, kFixed64 = 1, kLengthDelimited = 2, kFixed32 = 5;
+  while (uint32_t tag = input.ReadTag()) {
+    const int field = tag >> 3;
+    switch (tag & 7) {
+    case kVarint: {
+      uint64_t value;
+      if (!input.ReadVarint64(&value)) {
+        return false;
+      }
+      const int32_t int_value = static_cast<int32_t>(value);
+      switch (field) {
+      case Datum::kChannelsFieldNumber: datum->channels = int_value; break;
+      case Datum::kHeightFieldNumber: datum->height = int_value; break;
+      case Datum::kWidthFieldNumber: datum->width = int_value; break;
+      case Datum::kLabelFieldNumber: datum->label = int_value; break;
+      case Datum::kEncodedFieldNumber: datum->encoded = value != 0; break;
+      }
+      break;
+    }
+    case kLengthDelimited: {
+      uint32_t length;
+      if (!input.ReadVarint32(&length) ||
+          field == Datum::kFloatDataFieldNumber) {
+        return false;
+      }
+      if (field == Datum::kDataFieldNumber) {
+        const void* data = NULL;
+        int available = 0;
+        if (length > 0 && (!input.GetDirectBufferPointer(&data, &available)
+                           || available < length)) {
+          return false;
+        }
+        datum->data = static_cast<const uint8_t*>(data);
+        datum->data_size = length;
+      }
+      if (!input.Skip(length)) {
+        return false;
+      }
+      break;
+    }
+    case kFixed32: {
+      uint32_t value;
+      if (field == Datum::kFloatDataFieldNumber ||
+          !input.ReadLittleEndian32(&value)) {
+        return false;
+      }
+      break;
+    }
+    case kFixed64: {
+      uint64_t value;
+      if (!input.ReadLittleEndian64(&value)) {
+        return false;
+      }
+      break;
+    }
+    default:
+      return false;
+    }
   }
-  return cv_img;
+  // ReadTag also returns 0 on a malformed tag.
+  return input.CurrentPosition() == size;
 }
 
 // If Datum is encoded will decoded using DecodeDatumToCVMat and CVMatToDatum
@@ -0,0 +1,174 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "caffe/util/mapped_weights.hpp"
+
+namespace caffe {
+
+const uint64_t MappedWeights::kMagic;
+
+namespace {
+
+const size_t kHeaderBytes = 2 * sizeof(uint64_t);
+const size_t kAlignment = 64;
+
+size_t RoundUp(const size_t bytes) {
+  return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// The shape of proto, from its 4D dimensions if it uses the deprecated ones,
+// which are then marked as such.
+void GetShape(const BlobProto& proto, MappedWeightsIndex::Blob* blob) {
+  BlobShape* shape = blob->mutable_shape();
+  if (proto.has_num() || proto.has_channels() ||
+      proto.has_height() || proto.has_width()) {
+    shape->Clear();
+    shape->add_dim(proto.num());
+    shape->add_dim(proto.channels());
+    shape->add_dim(proto.height());
+    shape->add_dim(proto.width());
+    blob->set_legacy_shape(true);
+  } else {
+    shape->CopyFrom(proto.shape());
+  }
+}
+
+uint64_t Count(const BlobShape& shape) {
+  uint64_t count = 1;
+  for (int i = 0; i < shape.dim_size(); ++i) {
+    count *= shape.dim(i);
+  }
+  return count;
+}
+
+}  // namespace
+
+MappedWeights::MappedWeights(const string& filename)
+    : filename_(filename), data_(NULL), bytes_(0), values_(NULL) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "Cannot open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Cannot stat " << filename;
+  bytes_ = file_stat.st_size;
+  CHECK_GE(bytes_, kHeaderBytes) << "Truncated weights " << filename;
+  void* data = mmap(NULL, bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  CHECK(data != MAP_FAILED) << "Cannot map " << filename;
+  data_ = static_cast<char*>(data);
+  uint64_t header[2];
+  memcpy(header, data_, sizeof(header));
+  CHECK_EQ(header[0], kMagic) << "Not a mapped weights file: " << filename;
+  CHECK_LE(kHeaderBytes + header[1], bytes_) << "Truncated weights "
+      << filename;
+  CHECK(index_.ParseFromArray(data_ + kHeaderBytes, header[1]))
+      << "Corrupt weights index in " << filename;
+  values_ = data_ + RoundUp(kHeaderBytes + header[1]);
+  for (int i = 0; i < index_.layer_size(); ++i) {
+    const MappedWeightsIndex::Layer& layer = index_.layer(i);
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      const MappedWeightsIndex::Blob& blob = layer.blobs(j);
+      CHECK(blob.offset() % kAlignment == 0 && values_ + blob.offset() +
+          Count(blob.shape()) * sizeof(float) <= data_ + bytes_)
+          << "Corrupt blob " << j << " of layer " << layer.name() << " in "
+          << filename;
+    }
+  }
+}
+
+MappedWeights::~MappedWeights() {
+  munmap(data_, bytes_);
+}
+
+void MappedWeights::ToProto(NetParameter* param) const {
+  param->Clear();
+  for (int i = 0; i < index_.layer_size(); ++i) {
+    const MappedWeightsIndex::Layer& layer = index_.layer(i);
+    LayerParameter* layer_param = param->add_layer();
+    layer_param->set_name(layer.name());
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      const MappedWeightsIndex::Blob& blob = layer.blobs(j);
+      BlobProto* proto = layer_param->add_blobs();
+      ShapeToProto(blob, proto);
+      const int count = Count(blob.shape());
+      proto->mutable_data()->Resize(count, 0);
+      memcpy(proto->mutable_data()->mutable_data(), data(blob),
+          count * sizeof(float));
+    }
+  }
+}
+
+void MappedWeights::ShapeToProto(const MappedWeightsIndex::Blob& blob,
+    BlobProto* proto) {
+  const BlobShape& shape = blob.shape();
+  if (blob.legacy_shape()) {
+    CHECK_EQ(shape.dim_size(), 4);
+    proto->set_num(shape.dim(0));
+    proto->set_channels(shape.dim(1));
+    proto->set_height(shape.dim(2));
+    proto->set_width(shape.dim(3));
+  } else {
+    proto->mutable_shape()->CopyFrom(shape);
+  }
+}
+
+bool MappedWeights::IsMappedWeights(const string& filename) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) { return false; }
+  uint64_t magic = 0;
+  const bool read = fread(&magic, sizeof(magic), 1, file) == 1;
+  fclose(file);
+  return read && magic == kMagic;
+}
+
+void MappedWeights::Write(const NetParameter& param, const string& filename) {
+  MappedWeightsIndex index;
+  uint64_t offset = 0;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    if (!layer_param.blobs_size()) { continue; }
+    MappedWeightsIndex::Layer* layer = index.add_layer();
+    layer->set_name(layer_param.name());
+    for (int j = 0; j < layer_param.blobs_size(); ++j) {
+      const BlobProto& proto = layer_param.blobs(j);
+      MappedWeightsIndex::Blob* blob = layer->add_blobs();
+      GetShape(proto, blob);
+      CHECK_EQ(Count(blob->shape()), static_cast<uint64_t>(proto.data_size()))
+          << "Blob " << j << " of layer " << layer_param.name()
+          << " does not hold its values";
+      blob->set_offset(offset);
+      offset += RoundUp(proto.data_size() * sizeof(float));
+    }
+  }
+  string serialized_index;
+  CHECK(index.SerializeToString(&serialized_index));
+
+  FILE* file = fopen(filename.c_str(), "wb");
+  CHECK(file) << "Cannot create " << filename;
+  const uint64_t header[2] = { kMagic, serialized_index.size() };
+  CHECK_EQ(fwrite(header, sizeof(header), 1, file), 1);
+  CHECK_EQ(fwrite(serialized_index.data(), 1, serialized_index.size(), file),
+      serialized_index.size());
+  const char padding[kAlignment] = { 0 };
+  size_t written = kHeaderBytes + serialized_index.size();
+  CHECK_EQ(fwrite(padding, 1, RoundUp(written) - written, file),
+      RoundUp(written) - written);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    for (int j = 0; j < layer_param.blobs_size(); ++j) {
+      const BlobProto& proto = layer_param.blobs(j);
+      written = proto.data_size() * sizeof(float);
+      CHECK_EQ(fwrite(proto.data().data(), 1, written, file), written);
+      CHECK_EQ(fwrite(padding, 1, RoundUp(written) - written, file),
+          RoundUp(written) - written);
+    }
+  }
+  CHECK_EQ(fclose(file), 0) << "Cannot write " << filename;
+}
+
+}  // namespace caffe
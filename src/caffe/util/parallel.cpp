@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class TaskGroup::State {
+ public:
+  State() : pending_(0) {}
+
+  // Thread pool: tasks submitted but not yet finished, and those of them no
+  // thread has started yet.
+  int pending_;
+  std::deque<boost::function<void()> > queued_;
+  boost::mutex mutex_;
+  boost::condition_variable done_;
+  // OpenMP: tasks deferred until wait().
+  vector<boost::function<void()> > deferred_;
+};
+
+#ifdef USE_THREAD_POOL
+
+namespace {
+
+// Runs one task of the group that no thread has started yet, newest first
+// for the thread waiting on the group and oldest first for the pool.
+// Returns false if there was none.
+bool RunGroupTask(const shared_ptr<TaskGroup::State>& group,
+    const bool newest) {
+  boost::function<void()> task;
+  {
+    boost::mutex::scoped_lock lock(group->mutex_);
+    if (group->queued_.empty()) {
+      return false;
+    }
+    if (newest) {
+      task = group->queued_.back();
+      group->queued_.pop_back();
+    } else {
+      task = group->queued_.front();
+      group->queued_.pop_front();
+    }
+  }
+  task();
+  boost::mutex::scoped_lock lock(group->mutex_);
+  if (--group->pending_ == 0) {
+    group->done_.notify_all();
+  }
+  return true;
+}
+
+void RunPoolTask(const shared_ptr<TaskGroup::State>& group) {
+  RunGroupTask(group, false);
+}
+
+}  // namespace
+
+#endif  // USE_THREAD_POOL
+
+int parallel_num_threads() {
+  const int num_threads = Caffe::requested_num_threads();
+#if defined(USE_OPENMP)
+  return num_threads > 0 ? num_threads : omp_get_max_threads();
+#elif defined(USE_THREAD_POOL)
+  if (num_threads > 0) {
+    return num_threads;
+  }
+  return std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+#else
+  return 1;
+#endif
+}
+
+void parallel_for_chunks(const int begin, const int end, const int grain,
+    const boost::function<void(int, int)>& body) {
+  CHECK_GT(grain, 0);
+  const int count = end - begin;
+  if (count <= 0) {
+    return;
+  }
+  // A few chunks per thread let idle threads steal work from slow ones.
+  const int kChunksPerThread = 4;
+  const int chunks = std::min((count - 1) / grain + 1,
+      parallel_num_threads() * kChunksPerThread);
+  if (chunks <= 1) {
+    body(begin, end);
+    return;
+  }
+  TaskGroup group;
+  for (int c = 1; c < chunks; ++c) {
+    group.run(boost::bind(body,
+        begin + static_cast<int>(static_cast<int64_t>(count) * c / chunks),
+        begin + static_cast<int>(static_cast<int64_t>(count) * (c + 1)
+            / chunks)));
+  }
+  body(begin, begin + count / chunks);
+  group.wait();
+}
+
+TaskGroup::TaskGroup() : state_(new State()) {}
+
+TaskGroup::~TaskGroup() {
+  wait();
+}
+
+void TaskGroup::run(const boost::function<void()>& task) {
+#if defined(USE_OPENMP)
+  state_->deferred_.push_back(task);
+#elif defined(USE_THREAD_POOL)
+  if (parallel_num_threads() == 1) {
+    task();
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(state_->mutex_);
+    ++state_->pending_;
+    state_->queued_.push_back(task);
+  }
+  // The pool task runs whichever task of the group is still queued, if the
+  // waiting thread has not run them all by then.
+  Caffe::thread_pool().Submit(boost::bind(&RunPoolTask, state_));
+#else
+  task();
+#endif
+}
+
+void TaskGroup::wait() {
+#if defined(USE_OPENMP)
+  vector<boost::function<void()> > tasks;
+  tasks.swap(state_->deferred_);
+  const int num_tasks = tasks.size();
+#pragma omp parallel for schedule(dynamic, 1) \
+    num_threads(parallel_num_threads()) if (!omp_in_parallel())
+  for (int i = 0; i < num_tasks; ++i) {
+    tasks[i]();
+  }
+#elif defined(USE_THREAD_POOL)
+  // Run the group's own queued tasks, never those of other groups, then
+  // sleep until the tasks still running elsewhere finish.
+  while (RunGroupTask(state_, true)) {
+  }
+  boost::mutex::scoped_lock lock(state_->mutex_);
+  while (state_->pending_ > 0) {
+    state_->done_.wait(lock);
+  }
+#endif
+}
+
+}  // namespace caffe
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/pooling.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_POOLING_X86
+#include <immintrin.h>
+#endif
+
+namespace caffe {
+
+namespace {
+
+bool fast_path_enabled = true;
+
+// Scalar kernels. reduce_rows combines rows of the input column by column;
+// reduce_cols_stride2 combines the kernel_size columns of every window along
+// one row.
+template <typename Dtype>
+void reduce_rows(const Dtype* in, const int rows, const int stride,
+    const int cols, const bool max_pool, Dtype* out) {
+  for (int c = 0; c < cols; ++c) {
+    Dtype v = in[c];
+    for (int r = 1; r < rows; ++r) {
+      v = max_pool ? std::max(v, in[r * stride + c]) : v + in[r * stride + c];
+    }
+    out[c] = v;
+  }
+}
+
+template <typename Dtype, int K>
+void reduce_cols_stride2(const Dtype* row, const int begin, const int end,
+    const bool max_pool, Dtype* out) {
+  for (int x = begin; x < end; ++x) {
+    const Dtype* in = row + 2 * x;
+    Dtype v = in[0];
+    for (int k = 1; k < K; ++k) {
+      v = max_pool ? std::max(v, in[k]) : v + in[k];
+    }
+    out[x] = v;
+  }
+}
+
+// Reduces the window [hstart, hend) x [wstart, wend) of a blocked plane into
+// the block values at out, one channel of the block after the other.
+template <typename Dtype>
+void reduce_window_blocked(const Dtype* in, const int width, const int block,
+    const int hstart, const int hend, const int wstart, const int wend,
+    const int pool_size, const bool max_pool, Dtype* out) {
+  for (int b = 0; b < block; ++b) {
+    out[b] = max_pool ? Dtype(-FLT_MAX) : Dtype(0);
+  }
+  for (int h = hstart; h < hend; ++h) {
+    for (int w = wstart; w < wend; ++w) {
+      const Dtype* pixel = in + (h * width + w) * block;
+      for (int b = 0; b < block; ++b) {
+        out[b] = max_pool ? std::max(out[b], pixel[b]) : out[b] + pixel[b];
+      }
+    }
+  }
+  if (!max_pool) {
+    for (int b = 0; b < block; ++b) {
+      out[b] /= pool_size;
+    }
+  }
+}
+
+#ifdef CAFFE_POOLING_X86
+
+bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+
+__attribute__((target("avx2")))
+void reduce_rows_avx2(const float* in, const int rows, const int stride,
+    const int cols, const bool max_pool, float* out) {
+  int c = 0;
+  for (; c + 8 <= cols; c += 8) {
+    __m256 v = _mm256_loadu_ps(in + c);
+    for (int r = 1; r < rows; ++r) {
+      const __m256 x = _mm256_loadu_ps(in + r * stride + c);
+      v = max_pool ? _mm256_max_ps(v, x) : _mm256_add_ps(v, x);
+    }
+    _mm256_storeu_ps(out + c, v);
+  }
+  reduce_rows(in + c, rows, stride, cols - c, max_pool, out + c);
+}
+
+// Eight outputs read the 16 (K = 2) or 18 (K = 3) inputs from row + 2 * x.
+// The even and odd inputs are split with in-lane shuffles, combined, and the
+// result put back in order with one cross-lane permute.
+template <int K>
+__attribute__((target("avx2")))
+void reduce_cols_stride2_avx2(const float* row, const int width,
+    const bool max_pool, float* out) {
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const float* in = row + 2 * x;
+    const __m256 a = _mm256_loadu_ps(in);
+    const __m256 b = _mm256_loadu_ps(in + 8);
+    const __m256 even = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    const __m256 odd = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    __m256 v = max_pool ? _mm256_max_ps(even, odd) : _mm256_add_ps(even, odd);
+    if (K == 3) {
+      const __m256 c = _mm256_loadu_ps(in + 2);
+      const __m256 d = _mm256_loadu_ps(in + 10);
+      const __m256 next = _mm256_shuffle_ps(c, d, _MM_SHUFFLE(2, 0, 2, 0));
+      v = max_pool ? _mm256_max_ps(v, next) : _mm256_add_ps(v, next);
+    }
+    _mm256_storeu_ps(out + x, _mm256_castpd_ps(_mm256_permute4x64_pd(
+        _mm256_castps_pd(v), _MM_SHUFFLE(3, 1, 2, 0))));
+  }
+  reduce_cols_stride2<float, K>(row, x, width, max_pool, out);
+}
+
+// The block channels of a window, 8 or 16 of them, are kept in one or two
+// registers. The max takes the accumulator as its second operand, so like
+// std::max it ignores a NaN input.
+__attribute__((target("avx2")))
+void reduce_window_blocked_avx2(const float* in, const int width,
+    const int block, const int hstart, const int hend, const int wstart,
+    const int wend, const int pool_size, const bool max_pool, float* out) {
+  for (int v = 0; v < block; v += 8) {
+    __m256 acc = max_pool ? _mm256_set1_ps(-FLT_MAX) : _mm256_setzero_ps();
+    for (int h = hstart; h < hend; ++h) {
+      for (int w = wstart; w < wend; ++w) {
+        const __m256 x = _mm256_loadu_ps(in + (h * width + w) * block + v);
+        acc = max_pool ? _mm256_max_ps(x, acc) : _mm256_add_ps(acc, x);
+      }
+    }
+    if (!max_pool) {
+      acc = _mm256_div_ps(acc, _mm256_set1_ps(static_cast<float>(pool_size)));
+    }
+    _mm256_storeu_ps(out + v, acc);
+  }
+}
+
+#endif  // CAFFE_POOLING_X86
+
+template <typename Dtype, int K>
+struct PoolKernels {
+  static void rows(const Dtype* in, const int rows, const int stride,
+      const int cols, const bool max_pool, Dtype* out) {
+    reduce_rows(in, rows, stride, cols, max_pool, out);
+  }
+  static void cols(const Dtype* row, const int width, const bool max_pool,
+      Dtype* out) {
+    reduce_cols_stride2<Dtype, K>(row, 0, width, max_pool, out);
+  }
+};
+
+template <typename Dtype>
+struct BlockedPoolKernel {
+  static void window(const Dtype* in, const int width, const int block,
+      const int hstart, const int hend, const int wstart, const int wend,
+      const int pool_size, const bool max_pool, Dtype* out) {
+    reduce_window_blocked(in, width, block, hstart, hend, wstart, wend,
+        pool_size, max_pool, out);
+  }
+};
+
+#ifdef CAFFE_POOLING_X86
+template <>
+struct BlockedPoolKernel<float> {
+  static void window(const float* in, const int width, const int block,
+      const int hstart, const int hend, const int wstart, const int wend,
+      const int pool_size, const bool max_pool, float* out) {
+    if (cpu_has_avx2() && block % 8 == 0) {
+      reduce_window_blocked_avx2(in, width, block, hstart, hend, wstart, wend,
+          pool_size, max_pool, out);
+    } else {
+      reduce_window_blocked(in, width, block, hstart, hend, wstart, wend,
+          pool_size, max_pool, out);
+    }
+  }
+};
+#endif  // CAFFE_POOLING_X86
+
+#ifdef CAFFE_POOLING_X86
+template <int K>
+struct PoolKernels<float, K> {
+  static void rows(const float* in, const int rows, const int stride,
+      const int cols, const bool max_pool, float* out) {
+    if (cpu_has_avx2()) {
+      reduce_rows_avx2(in, rows, stride, cols, max_pool, out);
+    } else {
+      reduce_rows(in, rows, stride, cols, max_pool, out);
+    }
+  }
+  static void cols(const float* row, const int width, const bool max_pool,
+      float* out) {
+    if (cpu_has_avx2()) {
+      reduce_cols_stride2_avx2<K>(row, width, max_pool, out);
+    } else {
+      reduce_cols_stride2<float, K>(row, 0, width, max_pool, out);
+    }
+  }
+};
+#endif  // CAFFE_POOLING_X86
+
+template <typename Dtype, int K>
+void pool_stride2(const Dtype* data_im, const int height, const int width,
+    const int pad_h, const int pad_w, const int pooled_height,
+    const int pooled_width, const bool max_pool, Dtype* data_out) {
+  // One row of column results, zero padded (-FLT_MAX padded for max) on both
+  // sides; the vector kernels may read up to 16 values past the last window.
+  const int row_size = 2 * (pooled_width - 1) + K;
+  const int cols = std::min(width, row_size - pad_w);
+  const Dtype fill = max_pool ? Dtype(-FLT_MAX) : Dtype(0);
+  vector<Dtype> row(row_size + 16, fill);
+  // The average divides by the window size, counting padding but not the
+  // part of the last window that overhangs the padded plane.
+  vector<int> pool_w(pooled_width);
+  for (int pw = 0; pw < pooled_width; ++pw) {
+    const int wstart = pw * 2 - pad_w;
+    pool_w[pw] = std::min(wstart + K, width + pad_w) - wstart;
+  }
+  for (int ph = 0; ph < pooled_height; ++ph) {
+    const int hstart = ph * 2 - pad_h;
+    const int hend = std::min(hstart + K, height);
+    const int h = std::max(hstart, 0);
+    PoolKernels<Dtype, K>::rows(data_im + h * width, hend - h, width, cols,
+        max_pool, &row[pad_w]);
+    Dtype* out = data_out + ph * pooled_width;
+    PoolKernels<Dtype, K>::cols(&row[0], pooled_width, max_pool, out);
+    if (!max_pool) {
+      const int pool_h = std::min(hstart + K, height + pad_h) - hstart;
+      for (int pw = 0; pw < pooled_width; ++pw) {
+        out[pw] /= pool_h * pool_w[pw];
+      }
+    }
+  }
+}
+
+}  // namespace
+
+bool pool_stride2_supported(const int kernel_h, const int kernel_w,
+    const int stride_h, const int stride_w) {
+  return kernel_h == kernel_w && (kernel_h == 2 || kernel_h == 3) &&
+      stride_h == 2 && stride_w == 2;
+}
+
+void set_pool_fast_path(const bool enabled) {
+  fast_path_enabled = enabled;
+}
+
+bool pool_fast_path() {
+  return fast_path_enabled;
+}
+
+template <typename Dtype>
+void pool_stride2_cpu(const Dtype* data_im, const int height, const int width,
+    const int kernel_size, const int pad_h, const int pad_w,
+    const int pooled_height, const int pooled_width, const bool max_pool,
+    Dtype* data_out) {
+  CHECK(pad_h < kernel_size && pad_w < kernel_size);
+  switch (kernel_size) {
+  case 2:
+    pool_stride2<Dtype, 2>(data_im, height, width, pad_h, pad_w,
+        pooled_height, pooled_width, max_pool, data_out);
+    break;
+  case 3:
+    pool_stride2<Dtype, 3>(data_im, height, width, pad_h, pad_w,
+        pooled_height, pooled_width, max_pool, data_out);
+    break;
+  default:
+    LOG(FATAL) << "Unsupported kernel size " << kernel_size;
+  }
+}
+
+template <typename Dtype>
+void pool_blocked_cpu(const Dtype* data_im, const int height, const int width,
+    const int block, const int kernel_h, const int kernel_w, const int pad_h,
+    const int pad_w, const int stride_h, const int stride_w,
+    const int pooled_height, const int pooled_width, const bool max_pool,
+    Dtype* data_out) {
+  for (int ph = 0; ph < pooled_height; ++ph) {
+    for (int pw = 0; pw < pooled_width; ++pw) {
+      int hstart = ph * stride_h - pad_h;
+      int wstart = pw * stride_w - pad_w;
+      int hend = std::min(hstart + kernel_h, height + pad_h);
+      int wend = std::min(wstart + kernel_w, width + pad_w);
+      const int pool_size = (hend - hstart) * (wend - wstart);
+      hstart = std::max(hstart, 0);
+      wstart = std::max(wstart, 0);
+      hend = std::min(hend, height);
+      wend = std::min(wend, width);
+      BlockedPoolKernel<Dtype>::window(data_im, width, block, hstart, hend,
+          wstart, wend, pool_size, max_pool,
+          data_out + (ph * pooled_width + pw) * block);
+    }
+  }
+}
+
+template void pool_stride2_cpu<float>(const float* data_im, const int height,
+    const int width, const int kernel_size, const int pad_h, const int pad_w,
+    const int pooled_height, const int pooled_width, const bool max_pool,
+    float* data_out);
+template void pool_stride2_cpu<double>(const double* data_im,
+    const int height, const int width, const int kernel_size, const int pad_h,
+    const int pad_w, const int pooled_height, const int pooled_width,
+    const bool max_pool, double* data_out);
+
+template void pool_blocked_cpu<float>(const float* data_im, const int height,
+    const int width, const int block, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int pooled_height, const int pooled_width, const bool max_pool,
+    float* data_out);
+template void pool_blocked_cpu<double>(const double* data_im,
+    const int height, const int width, const int block, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int pooled_height, const int pooled_width,
+    const bool max_pool, double* data_out);
+
+}  // namespace caffe
@@ -0,0 +1,149 @@
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/snapshot_writer.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+struct SnapshotWriter<Dtype>::Staging {
+  // The net without the values of its blobs, which are in blobs.
+  NetParameter net_param;
+  vector<vector<shared_ptr<Blob<Dtype> > > > blobs;
+  bool write_diff;
+  // The solver state without its history, which is in history.
+  SolverState state;
+  vector<shared_ptr<Blob<Dtype> > > history;
+  string model_filename;
+  string state_filename;
+};
+
+namespace {
+
+// Copies source into *staged, reusing its memory from the last snapshot.
+template <typename Dtype>
+void Stage(const Blob<Dtype>& source, const bool copy_diff,
+    shared_ptr<Blob<Dtype> >* staged) {
+  if (!*staged) {
+    staged->reset(new Blob<Dtype>());
+  }
+  (*staged)->ReshapeLike(source);
+  caffe_copy(source.count(), source.cpu_data(),
+      (*staged)->mutable_cpu_data());
+  if (copy_diff) {
+    caffe_copy(source.count(), source.cpu_diff(),
+        (*staged)->mutable_cpu_diff());
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+SnapshotWriter<Dtype>::SnapshotWriter(const int max_pending) {
+  CHECK_GT(max_pending, 0);
+  for (int i = 0; i < max_pending; ++i) {
+    staging_.push_back(shared_ptr<Staging>(new Staging()));
+    free_.push(staging_.back().get());
+  }
+  CHECK(StartInternalThread()) << "Cannot start the snapshot thread";
+}
+
+template <typename Dtype>
+SnapshotWriter<Dtype>::~SnapshotWriter() {
+  Wait();
+  StopInternalThread();
+}
+
+template <typename Dtype>
+void SnapshotWriter<Dtype>::Write(const Net<Dtype>& net,
+    const bool write_diff, const vector<shared_ptr<Blob<Dtype> > >& history,
+    const SolverState& state, const string& model_filename,
+    const string& state_filename) {
+  Staging* staging = free_.pop("Waiting for a previous snapshot to be "
+      "written");
+  // As Net::ToProto writes it.
+  NetParameter& net_param = staging->net_param;
+  net_param.Clear();
+  net_param.set_name(net.name());
+  for (int i = 0; i < net.input_blob_indices().size(); ++i) {
+    net_param.add_input(net.blob_names()[net.input_blob_indices()[i]]);
+  }
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net.layers();
+  staging->blobs.resize(layers.size());
+  for (int i = 0; i < layers.size(); ++i) {
+    LayerParameter* layer_param = net_param.add_layer();
+    layer_param->CopyFrom(layers[i]->layer_param());
+    layer_param->clear_blobs();
+    const vector<shared_ptr<Blob<Dtype> > >& blobs = layers[i]->blobs();
+    staging->blobs[i].resize(blobs.size());
+    for (int j = 0; j < blobs.size(); ++j) {
+      Stage(*blobs[j], write_diff, &staging->blobs[i][j]);
+    }
+  }
+  staging->write_diff = write_diff;
+  staging->state.CopyFrom(state);
+  staging->state.clear_history();
+  staging->history.resize(history.size());
+  for (int i = 0; i < history.size(); ++i) {
+    Stage(*history[i], false, &staging->history[i]);
+  }
+  staging->model_filename = model_filename;
+  staging->state_filename = state_filename;
+  full_.push(staging);
+}
+
+template <typename Dtype>
+void SnapshotWriter<Dtype>::Wait() {
+  vector<Staging*> written;
+  for (int i = 0; i < staging_.size(); ++i) {
+    written.push_back(free_.pop());
+  }
+  for (int i = 0; i < written.size(); ++i) {
+    free_.push(written[i]);
+  }
+}
+
+template <typename Dtype>
+void SnapshotWriter<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      Staging* staging = full_.pop();
+      WriteStaging(staging);
+      free_.push(staging);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template <typename Dtype>
+void SnapshotWriter<Dtype>::WriteStaging(Staging* staging) {
+  CPUTimer timer;
+  timer.Start();
+  NetParameter& net_param = staging->net_param;
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    for (int j = 0; j < staging->blobs[i].size(); ++j) {
+      staging->blobs[i][j]->ToProto(net_param.mutable_layer(i)->add_blobs(),
+          staging->write_diff);
+    }
+  }
+  WriteProtoToBinaryFileAtomically(net_param, staging->model_filename);
+  net_param.Clear();
+  SolverState& state = staging->state;
+  for (int i = 0; i < staging->history.size(); ++i) {
+    staging->history[i]->ToProto(state.add_history());
+  }
+  WriteProtoToBinaryFileAtomically(state, staging->state_filename);
+  state.Clear();
+  LOG(INFO) << "Wrote snapshot " << staging->model_filename << " in "
+      << timer.MilliSeconds() << " ms";
+}
+
+INSTANTIATE_CLASS(SnapshotWriter);
+
+}  // namespace caffe
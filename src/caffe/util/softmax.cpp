@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/softmax.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_SOFTMAX_X86
+#include <immintrin.h>
+#endif
+
+namespace caffe {
+
+namespace {
+
+// Scalar kernels. row_max reduces one contiguous row, exp_shift_sum writes
+// y = exp(x - shift) and returns the sum of y, and exp_shift_rows subtracts
+// a separate shift for every position of the row.
+template <typename Dtype>
+Dtype row_max(const Dtype* x, const int n) {
+  Dtype m = x[0];
+  for (int i = 1; i < n; ++i) {
+    m = std::max(m, x[i]);
+  }
+  return m;
+}
+
+template <typename Dtype>
+Dtype exp_shift_sum(const Dtype* x, const Dtype shift, const int n,
+    Dtype* y) {
+  Dtype sum = 0;
+  for (int i = 0; i < n; ++i) {
+    y[i] = std::exp(x[i] - shift);
+    sum += y[i];
+  }
+  return sum;
+}
+
+template <typename Dtype>
+void exp_shift_rows(const Dtype* x, const Dtype* shift, const int n,
+    Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = std::exp(x[i] - shift[i]);
+  }
+}
+
+#ifdef CAFFE_SOFTMAX_X86
+
+bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("fma");
+  return has_avx2;
+}
+
+// exp(x) = 2^n * exp(r) with n = round(x / ln 2) and |r| <= ln 2 / 2, where
+// exp(r) is the degree 7 polynomial of the Cephes expf; about 1 ulp. x is
+// clamped to [ln FLT_MIN, 88] so that 2^n stays a normal float. max and min
+// return their second operand when either is NaN, so x goes second to keep
+// NaNs, as std::exp does.
+__attribute__((target("avx2,fma")))
+inline __m256 exp256(__m256 x) {
+  x = _mm256_min_ps(_mm256_set1_ps(88.f),
+      _mm256_max_ps(_mm256_set1_ps(-87.3365448f), x));
+  const __m256 n = _mm256_round_ps(
+      _mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  // ln 2 is split in two so that n * 0.693359375 is exact.
+  __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+  __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r),
+      _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+  const __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(
+      _mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(pow2n));
+}
+
+__attribute__((target("avx2,fma")))
+float row_max_avx2(const float* x, const int n) {
+  if (n < 8) {
+    return row_max(x, n);
+  }
+  __m256 m = _mm256_loadu_ps(x);
+  int i = 8;
+  for (; i + 8 <= n; i += 8) {
+    m = _mm256_max_ps(m, _mm256_loadu_ps(x + i));
+  }
+  __m128 h = _mm_max_ps(_mm256_castps256_ps128(m),
+      _mm256_extractf128_ps(m, 1));
+  h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_max_ss(h, _mm_shuffle_ps(h, h, 1));
+  float result = _mm_cvtss_f32(h);
+  for (; i < n; ++i) {
+    result = std::max(result, x[i]);
+  }
+  return result;
+}
+
+__attribute__((target("avx2,fma")))
+float exp_shift_sum_avx2(const float* x, const float shift, const int n,
+    float* y) {
+  const __m256 vshift = _mm256_set1_ps(shift);
+  __m256 sum = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 e = exp256(_mm256_sub_ps(_mm256_loadu_ps(x + i), vshift));
+    _mm256_storeu_ps(y + i, e);
+    sum = _mm256_add_ps(sum, e);
+  }
+  __m128 h = _mm_add_ps(_mm256_castps256_ps128(sum),
+      _mm256_extractf128_ps(sum, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+  return _mm_cvtss_f32(h) + exp_shift_sum(x + i, shift, n - i, y + i);
+}
+
+__attribute__((target("avx2,fma")))
+void exp_shift_rows_avx2(const float* x, const float* shift, const int n,
+    float* y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, exp256(_mm256_sub_ps(_mm256_loadu_ps(x + i),
+        _mm256_loadu_ps(shift + i))));
+  }
+  exp_shift_rows(x + i, shift + i, n - i, y + i);
+}
+
+#endif  // CAFFE_SOFTMAX_X86
+
+template <typename Dtype>
+struct SoftmaxKernels {
+  static Dtype max(const Dtype* x, const int n) {
+    return row_max(x, n);
+  }
+  static Dtype exp_sum(const Dtype* x, const Dtype shift, const int n,
+      Dtype* y) {
+    return exp_shift_sum(x, shift, n, y);
+  }
+  static void exp_rows(const Dtype* x, const Dtype* shift, const int n,
+      Dtype* y) {
+    exp_shift_rows(x, shift, n, y);
+  }
+};
+
+#ifdef CAFFE_SOFTMAX_X86
+template <>
+struct SoftmaxKernels<float> {
+  static float max(const float* x, const int n) {
+    return cpu_has_avx2() ? row_max_avx2(x, n) : row_max(x, n);
+  }
+  static float exp_sum(const float* x, const float shift, const int n,
+      float* y) {
+    return cpu_has_avx2() ? exp_shift_sum_avx2(x, shift, n, y) :
+        exp_shift_sum(x, shift, n, y);
+  }
+  static void exp_rows(const float* x, const float* shift, const int n,
+      float* y) {
+    if (cpu_has_avx2()) {
+      exp_shift_rows_avx2(x, shift, n, y);
+    } else {
+      exp_shift_rows(x, shift, n, y);
+    }
+  }
+};
+#endif  // CAFFE_SOFTMAX_X86
+
+}  // namespace
+
+template <typename Dtype>
+void softmax_cpu(const Dtype* data_in, const int channels,
+    const int inner_num, Dtype* data_out, Dtype* scale) {
+  typedef SoftmaxKernels<Dtype> Kernels;
+  if (inner_num == 1) {
+    // One contiguous row, e.g. the scores of a classifier.
+    const Dtype max = Kernels::max(data_in, channels);
+    const Dtype inv_sum =
+        Dtype(1) / Kernels::exp_sum(data_in, max, channels, data_out);
+    for (int c = 0; c < channels; ++c) {
+      data_out[c] *= inv_sum;
+    }
+    return;
+  }
+  // Rows of inner_num positions, one per channel, reduced row by row.
+  std::copy(data_in, data_in + inner_num, scale);
+  for (int c = 1; c < channels; ++c) {
+    const Dtype* in = data_in + c * inner_num;
+    for (int k = 0; k < inner_num; ++k) {
+      scale[k] = std::max(scale[k], in[k]);
+    }
+  }
+  for (int c = 0; c < channels; ++c) {
+    Kernels::exp_rows(data_in + c * inner_num, scale, inner_num,
+        data_out + c * inner_num);
+  }
+  std::copy(data_out, data_out + inner_num, scale);
+  for (int c = 1; c < channels; ++c) {
+    const Dtype* out = data_out + c * inner_num;
+    for (int k = 0; k < inner_num; ++k) {
+      scale[k] += out[k];
+    }
+  }
+  for (int k = 0; k < inner_num; ++k) {
+    scale[k] = Dtype(1) / scale[k];
+  }
+  for (int c = 0; c < channels; ++c) {
+    Dtype* out = data_out + c * inner_num;
+    for (int k = 0; k < inner_num; ++k) {
+      out[k] *= scale[k];
+    }
+  }
+}
+
+template <typename Dtype>
+void softmax_backward_cpu(const Dtype* top_data, const Dtype* top_diff,
+    const int channels, const int inner_num, Dtype* bottom_diff,
+    Dtype* scale) {
+  if (inner_num == 1) {
+    const Dtype dot = caffe_cpu_dot(channels, top_diff, top_data);
+    for (int c = 0; c < channels; ++c) {
+      bottom_diff[c] = (top_diff[c] - dot) * top_data[c];
+    }
+    return;
+  }
+  std::fill(scale, scale + inner_num, Dtype(0));
+  for (int c = 0; c < channels; ++c) {
+    const int offset = c * inner_num;
+    for (int k = 0; k < inner_num; ++k) {
+      scale[k] += top_diff[offset + k] * top_data[offset + k];
+    }
+  }
+  for (int c = 0; c < channels; ++c) {
+    const int offset = c * inner_num;
+    for (int k = 0; k < inner_num; ++k) {
+      bottom_diff[offset + k] =
+          (top_diff[offset + k] - scale[k]) * top_data[offset + k];
+    }
+  }
+}
+
+template void softmax_cpu<float>(const float* data_in, const int channels,
+    const int inner_num, float* data_out, float* scale);
+template void softmax_cpu<double>(const double* data_in, const int channels,
+    const int inner_num, double* data_out, double* scale);
+template void softmax_backward_cpu<float>(const float* top_data,
+    const float* top_diff, const int channels, const int inner_num,
+    float* bottom_diff, float* scale);
+template void softmax_backward_cpu<double>(const double* top_data,
+    const double* top_diff, const int channels, const int inner_num,
+    double* bottom_diff, double* scale);
+
+}  // namespace caffe
@@ -0,0 +1,404 @@
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/solver_update.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_SOLVER_UPDATE_X86
+#include <immintrin.h>
+#endif
+
+namespace caffe {
+
+namespace {
+
+bool fused_enabled = true;
+
+// How caffe_axpy and caffe_cpu_axpby round y = alpha * x + beta * y, as
+// found by RoundingOf: the product alpha * x is either added to beta * y by a
+// fused multiply-add or rounded first, and a beta of 0 either clears y or
+// multiplies it (which keeps the sign of zeros, and NaNs).
+struct Rounding {
+  bool supported;
+  bool fma;
+  bool zero_clears;
+};
+
+// Keeps the compiler from contracting a product and a sum into a fused
+// multiply-add, which would round differently from the BLAS. For scalars;
+// vectors use opaque256.
+template <typename T>
+inline T opaque(T x) {
+#ifdef CAFFE_SOLVER_UPDATE_X86
+  __asm__("" : "+x"(x));
+#endif
+  return x;
+}
+
+template <typename Dtype, bool kFMA>
+struct ScalarOps {
+  static Dtype mul_add(const Dtype a, const Dtype b, const Dtype c) {
+    return kFMA ? std::fma(a, b, c) : opaque(a * b) + c;
+  }
+};
+
+// The values of beta * y in y = alpha * x + beta * y after caffe_cpu_axpby.
+// The product is rounded before it is added, as the BLAS does.
+template <typename Dtype>
+Dtype scale(const Dtype beta, const Dtype y, const bool zero_clears) {
+  return beta == Dtype(0) && zero_clears ? Dtype(0) : opaque(beta * y);
+}
+
+template <typename Dtype>
+Rounding RoundingOf() {
+  const int n = 67;
+  vector<Dtype> x(n), y(n), axpy(n), axpby(n), axpby_zero(n);
+  for (int i = 0; i < n; ++i) {
+    x[i] = Dtype(1) + Dtype(i) / 7;
+    y[i] = -Dtype(1) - Dtype(i) / 11;
+  }
+  const Dtype alpha = Dtype(1) / 3;
+  const Dtype beta = Dtype(9) / 10;
+  axpy = y;
+  caffe_axpy(n, alpha, &x[0], &axpy[0]);
+  axpby = y;
+  caffe_cpu_axpby(n, alpha, &x[0], beta, &axpby[0]);
+  // 0 * y[i] is -0, which keeps the sign of beta * y[i] in the sum.
+  axpby_zero = y;
+  caffe_cpu_axpby(n, Dtype(0), &y[0], Dtype(0), &axpby_zero[0]);
+  Rounding rounding;
+  rounding.zero_clears = !std::signbit(axpby_zero[0]);
+  rounding.supported = false;
+  for (int fma = 0; fma < 2 && !rounding.supported; ++fma) {
+    rounding.fma = fma;
+    rounding.supported = true;
+    for (int i = 0; i < n; ++i) {
+      const Dtype expected_axpy = fma ? std::fma(alpha, x[i], y[i]) :
+          opaque(alpha * x[i]) + y[i];
+      const Dtype scaled = scale(beta, y[i], rounding.zero_clears);
+      const Dtype expected_axpby = fma ? std::fma(alpha, x[i], scaled) :
+          opaque(alpha * x[i]) + scaled;
+      const Dtype expected_zero = Dtype(0) * y[i] +
+          scale(Dtype(0), y[i], rounding.zero_clears);
+      if (axpy[i] != expected_axpy || axpby[i] != expected_axpby ||
+          std::signbit(axpby_zero[i]) != std::signbit(expected_zero)) {
+        rounding.supported = false;
+      }
+    }
+  }
+  LOG_IF(INFO, !rounding.supported) << "The BLAS rounds in an unexpected way; "
+      << "fused solver updates are disabled";
+  return rounding;
+}
+
+template <typename Dtype>
+const Rounding& rounding() {
+  static const Rounding rounding = RoundingOf<Dtype>();
+  return rounding;
+}
+
+template <typename Dtype, typename Ops>
+inline Dtype decayed(const Dtype g, const Dtype w, const Dtype decay,
+    const Regularization regularization) {
+  switch (regularization) {
+  case REGULARIZATION_L2:
+    return Ops::mul_add(decay, w, g);
+  case REGULARIZATION_L1:
+    return Ops::mul_add(decay, Dtype(caffe_sign(w)), g);
+  default:
+    return g;
+  }
+}
+
+template <typename Dtype, bool kFMA>
+void sgd_scalar(const int n, const Dtype rate, const Dtype momentum,
+    const Dtype decay, const Regularization regularization,
+    const bool zero_clears, const bool update_data, Dtype* data,
+    Dtype* diff, Dtype* history) {
+  typedef ScalarOps<Dtype, kFMA> Ops;
+  for (int i = 0; i < n; ++i) {
+    const Dtype g = decayed<Dtype, Ops>(diff[i], data[i], decay,
+        regularization);
+    const Dtype h = Ops::mul_add(rate, g,
+        scale(momentum, history[i], zero_clears));
+    history[i] = h;
+    diff[i] = h;
+    if (update_data) {
+      data[i] -= h;
+    }
+  }
+}
+
+template <typename Dtype, bool kFMA>
+void nesterov_scalar(const int n, const Dtype rate, const Dtype momentum,
+    const Dtype decay, const Regularization regularization,
+    const bool zero_clears, const bool update_data, Dtype* data,
+    Dtype* diff, Dtype* history) {
+  typedef ScalarOps<Dtype, kFMA> Ops;
+  const Dtype step = Dtype(1) + momentum;
+  for (int i = 0; i < n; ++i) {
+    const Dtype g = decayed<Dtype, Ops>(diff[i], data[i], decay,
+        regularization);
+    const Dtype h_old = history[i];
+    const Dtype h = Ops::mul_add(rate, g, scale(momentum, h_old, zero_clears));
+    // Step back by the previous momentum, then over by the new one.
+    const Dtype u = Ops::mul_add(step, h, scale(-momentum, h_old,
+        zero_clears));
+    history[i] = h;
+    diff[i] = u;
+    if (update_data) {
+      data[i] -= u;
+    }
+  }
+}
+
+template <typename Dtype, bool kFMA>
+void adagrad_scalar(const int n, const Dtype rate, const Dtype delta,
+    const Dtype decay, const Regularization regularization,
+    const bool zero_clears, const bool update_data, Dtype* data,
+    Dtype* diff, Dtype* history) {
+  typedef ScalarOps<Dtype, kFMA> Ops;
+  for (int i = 0; i < n; ++i) {
+    const Dtype g = decayed<Dtype, Ops>(diff[i], data[i], decay,
+        regularization);
+    // caffe_powx rather than std::pow or std::sqrt, which may round
+    // differently.
+    Dtype g2, root;
+    caffe_powx(1, &g, Dtype(2), &g2);
+    const Dtype h = g2 + history[i];
+    caffe_powx(1, &h, Dtype(0.5), &root);
+    const Dtype u = Ops::mul_add(rate, g / (root + delta),
+        scale(Dtype(0), g, zero_clears));
+    history[i] = h;
+    diff[i] = u;
+    if (update_data) {
+      data[i] -= u;
+    }
+  }
+}
+
+#ifdef CAFFE_SOLVER_UPDATE_X86
+
+bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("fma");
+  return has_avx2;
+}
+
+// opaque for a vector of eight floats, which needs AVX enabled to be held in
+// a register at all.
+__attribute__((target("avx2,fma")))
+inline __m256 opaque256(__m256 x) {
+  __asm__("" : "+x"(x));
+  return x;
+}
+
+template <bool kFMA>
+struct Avx2Ops {
+  __attribute__((target("avx2,fma")))
+  static inline __m256 mul_add(const __m256 a, const __m256 b,
+      const __m256 c) {
+    return kFMA ? _mm256_fmadd_ps(a, b, c) :
+        _mm256_add_ps(opaque256(_mm256_mul_ps(a, b)), c);
+  }
+  // (0 < w) - (w < 0), as caffe_sign.
+  __attribute__((target("avx2,fma")))
+  static inline __m256 sign(const __m256 w) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    return _mm256_sub_ps(
+        _mm256_and_ps(_mm256_cmp_ps(zero, w, _CMP_LT_OQ), one),
+        _mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_LT_OQ), one));
+  }
+  __attribute__((target("avx2,fma")))
+  static inline __m256 decayed(const __m256 g, const __m256 w,
+      const __m256 decay, const Regularization regularization) {
+    switch (regularization) {
+    case REGULARIZATION_L2:
+      return mul_add(decay, w, g);
+    case REGULARIZATION_L1:
+      return mul_add(decay, sign(w), g);
+    default:
+      return g;
+    }
+  }
+  __attribute__((target("avx2,fma")))
+  static inline __m256 scale(const float beta, const __m256 y,
+      const bool zero_clears) {
+    return beta == 0.f && zero_clears ? _mm256_setzero_ps() :
+        opaque256(_mm256_mul_ps(_mm256_set1_ps(beta), y));
+  }
+};
+
+template <bool kFMA>
+__attribute__((target("avx2,fma")))
+void sgd_avx2(const int n, const float rate, const float momentum,
+    const float decay, const Regularization regularization,
+    const bool zero_clears, const bool update_data, float* data,
+    float* diff, float* history) {
+  typedef Avx2Ops<kFMA> Ops;
+  const __m256 vrate = _mm256_set1_ps(rate);
+  const __m256 vdecay = _mm256_set1_ps(decay);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 w = _mm256_loadu_ps(data + i);
+    const __m256 g = Ops::decayed(_mm256_loadu_ps(diff + i), w, vdecay,
+        regularization);
+    const __m256 h = Ops::mul_add(vrate, g,
+        Ops::scale(momentum, _mm256_loadu_ps(history + i), zero_clears));
+    _mm256_storeu_ps(history + i, h);
+    _mm256_storeu_ps(diff + i, h);
+    if (update_data) {
+      _mm256_storeu_ps(data + i, _mm256_sub_ps(w, h));
+    }
+  }
+  sgd_scalar<float, kFMA>(n - i, rate, momentum, decay, regularization,
+      zero_clears, update_data, data + i, diff + i, history + i);
+}
+
+template <bool kFMA>
+__attribute__((target("avx2,fma")))
+void nesterov_avx2(const int n, const float rate, const float momentum,
+    const float decay, const Regularization regularization,
+    const bool zero_clears, const bool update_data, float* data,
+    float* diff, float* history) {
+  typedef Avx2Ops<kFMA> Ops;
+  const __m256 vrate = _mm256_set1_ps(rate);
+  const __m256 vdecay = _mm256_set1_ps(decay);
+  const __m256 vstep = _mm256_set1_ps(1.f + momentum);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 w = _mm256_loadu_ps(data + i);
+    const __m256 g = Ops::decayed(_mm256_loadu_ps(diff + i), w, vdecay,
+        regularization);
+    const __m256 h_old = _mm256_loadu_ps(history + i);
+    const __m256 h = Ops::mul_add(vrate, g,
+        Ops::scale(momentum, h_old, zero_clears));
+    const __m256 u = Ops::mul_add(vstep, h,
+        Ops::scale(-momentum, h_old, zero_clears));
+    _mm256_storeu_ps(history + i, h);
+    _mm256_storeu_ps(diff + i, u);
+    if (update_data) {
+      _mm256_storeu_ps(data + i, _mm256_sub_ps(w, u));
+    }
+  }
+  nesterov_scalar<float, kFMA>(n - i, rate, momentum, decay, regularization,
+      zero_clears, update_data, data + i, diff + i, history + i);
+}
+
+#endif  // CAFFE_SOLVER_UPDATE_X86
+
+template <typename Dtype>
+struct UpdateKernels {
+  typedef void (*Kernel)(const int n, const Dtype rate, const Dtype momentum,
+      const Dtype decay, const Regularization regularization,
+      const bool zero_clears, const bool update_data, Dtype* data,
+      Dtype* diff, Dtype* history);
+
+  static Kernel sgd() {
+    return rounding<Dtype>().fma ? sgd_scalar<Dtype, true> :
+        sgd_scalar<Dtype, false>;
+  }
+  static Kernel nesterov() {
+    return rounding<Dtype>().fma ? nesterov_scalar<Dtype, true> :
+        nesterov_scalar<Dtype, false>;
+  }
+};
+
+#ifdef CAFFE_SOLVER_UPDATE_X86
+template <>
+struct UpdateKernels<float> {
+  typedef void (*Kernel)(const int n, const float rate, const float momentum,
+      const float decay, const Regularization regularization,
+      const bool zero_clears, const bool update_data, float* data,
+      float* diff, float* history);
+
+  static Kernel sgd() {
+    const bool fma = rounding<float>().fma;
+    if (cpu_has_avx2()) {
+      return fma ? sgd_avx2<true> : sgd_avx2<false>;
+    }
+    return fma ? sgd_scalar<float, true> : sgd_scalar<float, false>;
+  }
+  static Kernel nesterov() {
+    const bool fma = rounding<float>().fma;
+    if (cpu_has_avx2()) {
+      return fma ? nesterov_avx2<true> : nesterov_avx2<false>;
+    }
+    return fma ? nesterov_scalar<float, true> : nesterov_scalar<float, false>;
+  }
+};
+#endif  // CAFFE_SOLVER_UPDATE_X86
+
+}  // namespace
+
+template <typename Dtype>
+bool fused_update() {
+  return fused_enabled && rounding<Dtype>().supported;
+}
+
+void set_fused_update(const bool enabled) {
+  fused_enabled = enabled;
+}
+
+template <typename Dtype>
+void sgd_update_cpu(const int n, const Dtype rate, const Dtype momentum,
+    const Dtype decay, const Regularization regularization, Dtype* data,
+    Dtype* diff, Dtype* history, const bool update_data) {
+  UpdateKernels<Dtype>::sgd()(n, rate, momentum, decay, regularization,
+      rounding<Dtype>().zero_clears, update_data, data, diff, history);
+}
+
+template <typename Dtype>
+void nesterov_update_cpu(const int n, const Dtype rate, const Dtype momentum,
+    const Dtype decay, const Regularization regularization, Dtype* data,
+    Dtype* diff, Dtype* history, const bool update_data) {
+  UpdateKernels<Dtype>::nesterov()(n, rate, momentum, decay, regularization,
+      rounding<Dtype>().zero_clears, update_data, data, diff, history);
+}
+
+template <typename Dtype>
+void adagrad_update_cpu(const int n, const Dtype rate, const Dtype delta,
+    const Dtype decay, const Regularization regularization, Dtype* data,
+    Dtype* diff, Dtype* history, const bool update_data) {
+  const Rounding& r = rounding<Dtype>();
+  if (r.fma) {
+    adagrad_scalar<Dtype, true>(n, rate, delta, decay, regularization,
+        r.zero_clears, update_data, data, diff, history);
+  } else {
+    adagrad_scalar<Dtype, false>(n, rate, delta, decay, regularization,
+        r.zero_clears, update_data, data, diff, history);
+  }
+}
+
+template bool fused_update<float>();
+template bool fused_update<double>();
+template void sgd_update_cpu<float>(const int n, const float rate,
+    const float momentum, const float decay,
+    const Regularization regularization, float* data, float* diff,
+    float* history, const bool update_data);
+template void sgd_update_cpu<double>(const int n, const double rate,
+    const double momentum, const double decay,
+    const Regularization regularization, double* data, double* diff,
+    double* history, const bool update_data);
+template void nesterov_update_cpu<float>(const int n, const float rate,
+    const float momentum, const float decay,
+    const Regularization regularization, float* data, float* diff,
+    float* history, const bool update_data);
+template void nesterov_update_cpu<double>(const int n, const double rate,
+    const double momentum, const double decay,
+    const Regularization regularization, double* data, double* diff,
+    double* history, const bool update_data);
+template void adagrad_update_cpu<float>(const int n, const float rate,
+    const float delta, const float decay,
+    const Regularization regularization, float* data, float* diff,
+    float* history, const bool update_data);
+template void adagrad_update_cpu<double>(const int n, const double rate,
+    const double delta, const double decay,
+    const Regularization regularization, double* data, double* diff,
+    double* history, const bool update_data);
+
+}  // namespace caffe
@@ -0,0 +1,205 @@
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+namespace {
+
+// Index of the queue owned by the current thread: 1 .. num_threads - 1 for
+// pool workers, 0 (shared by all of them, and only ever submitted to) for
+// any other thread.
+thread_local int worker_index = 0;
+
+// Parses a sysfs cpu list such as "0-3,8-11".
+vector<int> ParseCpuList(const string& list) {
+  vector<int> cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == string::npos) {
+      end = list.size();
+    }
+    const string range = list.substr(pos, end - pos);
+    const size_t dash = range.find('-');
+    const int first = boost::lexical_cast<int>(range.substr(0, dash));
+    const int last = dash == string::npos ? first :
+        boost::lexical_cast<int>(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+    pos = end + 1;
+  }
+  return cpus;
+}
+
+void PinCurrentThread(const int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  LOG_IF(WARNING, error) << "Cannot pin a worker thread to core " << cpu;
+#else
+  LOG(WARNING) << "Thread pinning is only supported on Linux.";
+#endif
+}
+
+}  // namespace
+
+vector<vector<int> > ThreadPool::NumaTopology() {
+  vector<vector<int> > nodes;
+  for (int node = 0; ; ++node) {
+    std::ifstream file(("/sys/devices/system/node/node" +
+        boost::lexical_cast<string>(node) + "/cpulist").c_str());
+    string list;
+    if (!std::getline(file, list)) {
+      break;
+    }
+    nodes.push_back(ParseCpuList(list));
+  }
+  if (nodes.empty()) {
+    const int cpus =
+        std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+    nodes.resize(1);
+    for (int cpu = 0; cpu < cpus; ++cpu) {
+      nodes[0].push_back(cpu);
+    }
+  }
+  return nodes;
+}
+
+ThreadPool::ThreadPool(const int num_threads, const bool pin_threads,
+    const vector<int>& numa_nodes)
+    : queues_(num_threads), steal_order_(num_threads), node_(num_threads, 0),
+      queued_(0), stop_(false) {
+  CHECK_GT(num_threads, 0);
+  for (int i = 0; i < num_threads; ++i) {
+    queues_[i].reset(new Queue());
+  }
+  // Place thread i on core cpus[i].
+  vector<int> cpus(num_threads, -1);
+  if (pin_threads) {
+    const vector<vector<int> > topology = NumaTopology();
+    vector<int> nodes = numa_nodes;
+    for (int node = 0; nodes.empty() && node < topology.size(); ++node) {
+      nodes.push_back(node);
+    }
+    const int group_size = (num_threads - 1) / nodes.size() + 1;
+    for (int i = 0; i < num_threads; ++i) {
+      const int node = nodes[i / group_size];
+      CHECK(node >= 0 && node < topology.size() && !topology[node].empty())
+          << "No cores on NUMA node " << node;
+      node_[i] = node;
+      cpus[i] = topology[node][(i % group_size) % topology[node].size()];
+    }
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    for (int j = 1; j < num_threads; ++j) {
+      const int other = (i + j) % num_threads;
+      if (node_[other] == node_[i]) {
+        steal_order_[i].push_back(other);
+      }
+    }
+    for (int j = 1; j < num_threads; ++j) {
+      const int other = (i + j) % num_threads;
+      if (node_[other] != node_[i]) {
+        steal_order_[i].push_back(other);
+      }
+    }
+  }
+  for (int i = 1; i < num_threads; ++i) {
+    threads_.push_back(shared_ptr<boost::thread>(new boost::thread(
+        boost::bind(&ThreadPool::WorkerEntry, this, i, cpus[i]))));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (int i = 0; i < threads_.size(); ++i) {
+    threads_[i]->join();
+  }
+}
+
+void ThreadPool::Submit(const boost::function<void()>& task) {
+  Queue* queue = queues_[worker_index].get();
+  {
+    boost::mutex::scoped_lock lock(queue->mutex);
+    queue->tasks.push_back(task);
+  }
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ++queued_;
+  }
+  wake_.notify_one();
+}
+
+bool ThreadPool::RunOne() {
+  boost::function<void()> task;
+  const vector<int>& steal_order = steal_order_[worker_index];
+  bool found = Pop(worker_index, true, &task);
+  for (int i = 0; !found && i < steal_order.size(); ++i) {
+    found = Pop(steal_order[i], false, &task);
+  }
+  if (!found) {
+    return false;
+  }
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    --queued_;
+  }
+  task();
+  return true;
+}
+
+bool ThreadPool::Pop(const int index, const bool back,
+    boost::function<void()>* task) {
+  Queue* queue = queues_[index].get();
+  boost::mutex::scoped_lock lock(queue->mutex);
+  if (queue->tasks.empty()) {
+    return false;
+  }
+  if (back) {
+    *task = queue->tasks.back();
+    queue->tasks.pop_back();
+  } else {
+    *task = queue->tasks.front();
+    queue->tasks.pop_front();
+  }
+  return true;
+}
+
+void ThreadPool::WorkerEntry(const int index, const int cpu) {
+  worker_index = index;
+  if (cpu >= 0) {
+    PinCurrentThread(cpu);
+  }
+  while (true) {
+    if (RunOne()) {
+      continue;
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queued_ == 0 && !stop_) {
+      wake_.wait(lock);
+    }
+    if (stop_) {
+      return;
+    }
+  }
+}
+
+}  // namespace caffe
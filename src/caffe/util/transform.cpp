@@ -0,0 +1,218 @@
+#include "caffe/common.hpp"
+#include "caffe/util/transform.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_TRANSFORM_X86
+#include <immintrin.h>
+#endif
+
+namespace caffe {
+
+namespace {
+
+bool simd_enabled = true;
+
+// Scalar kernel, for any element type.
+template <typename T, typename Dtype>
+void transform_row_scalar(const T* x, const int n, const Dtype* mean_row,
+    const Dtype mean_value, const Dtype scale, const bool mirror, Dtype* y) {
+  Dtype* out = mirror ? y + n - 1 : y;
+  const int step = mirror ? -1 : 1;
+  if (mean_row) {
+    for (int i = 0; i < n; ++i) {
+      out[i * step] = (static_cast<Dtype>(x[i]) - mean_row[i]) * scale;
+    }
+  } else {
+    for (int i = 0; i < n; ++i) {
+      out[i * step] = (static_cast<Dtype>(x[i]) - mean_value) * scale;
+    }
+  }
+}
+
+#ifdef CAFFE_TRANSFORM_X86
+
+bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+
+// Converts 8 pixels at a time; the mirrored row is reversed in registers and
+// stored from the end of y. The arithmetic is that of the scalar kernel, so
+// the results are identical.
+template <bool kMirror, bool kMeanRow>
+__attribute__((target("avx2")))
+void transform_row_avx2(const uint8_t* x, const int n, const float* mean_row,
+    const float mean_value, const float scale, float* y) {
+  const __m256 vscale = _mm256_set1_ps(scale);
+  const __m256 vmean = _mm256_set1_ps(mean_value);
+  const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(x + i))));
+    v = _mm256_sub_ps(v, kMeanRow ? _mm256_loadu_ps(mean_row + i) : vmean);
+    v = _mm256_mul_ps(v, vscale);
+    if (kMirror) {
+      _mm256_storeu_ps(y + n - i - 8, _mm256_permutevar8x32_ps(v, reverse));
+    } else {
+      _mm256_storeu_ps(y + i, v);
+    }
+  }
+  // The remaining n - i values go to the first n - i outputs if mirrored.
+  transform_row_scalar(x + i, n - i, kMeanRow ? mean_row + i : NULL,
+      mean_value, scale, kMirror, kMirror ? y : y + i);
+}
+
+bool cpu_has_ssse3() {
+  static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+  return has_ssse3;
+}
+
+// Splits 16 pixels of 3 channels at a time: each channel gathers its bytes
+// from the three 16 byte blocks with one shuffle per block.
+__attribute__((target("ssse3")))
+void deinterleave3_ssse3(const uint8_t* x, const int n, uint8_t* y) {
+  const __m128i masks[3][3] = {
+    { _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1),
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1,
+          -1),
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10,
+          13) },
+    { _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1),
+      _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1,
+          -1),
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11,
+          14) },
+    { _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1),
+      _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1,
+          -1),
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12,
+          15) }
+  };
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i* in = reinterpret_cast<const __m128i*>(x + 3 * i);
+    const __m128i a0 = _mm_loadu_si128(in);
+    const __m128i a1 = _mm_loadu_si128(in + 1);
+    const __m128i a2 = _mm_loadu_si128(in + 2);
+    for (int c = 0; c < 3; ++c) {
+      const __m128i v = _mm_or_si128(_mm_or_si128(
+          _mm_shuffle_epi8(a0, masks[c][0]), _mm_shuffle_epi8(a1, masks[c][1])),
+          _mm_shuffle_epi8(a2, masks[c][2]));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(y + c * n + i), v);
+    }
+  }
+  for (; i < n; ++i) {
+    for (int c = 0; c < 3; ++c) {
+      y[c * n + i] = x[i * 3 + c];
+    }
+  }
+}
+
+#endif  // CAFFE_TRANSFORM_X86
+
+template <typename Dtype>
+struct TransformKernels {
+  static void row(const uint8_t* x, const int n, const Dtype* mean_row,
+      const Dtype mean_value, const Dtype scale, const bool mirror, Dtype* y) {
+    transform_row_scalar(x, n, mean_row, mean_value, scale, mirror, y);
+  }
+};
+
+#ifdef CAFFE_TRANSFORM_X86
+template <>
+struct TransformKernels<float> {
+  static void row(const uint8_t* x, const int n, const float* mean_row,
+      const float mean_value, const float scale, const bool mirror, float* y) {
+    if (!simd_enabled || !cpu_has_avx2()) {
+      transform_row_scalar(x, n, mean_row, mean_value, scale, mirror, y);
+    } else if (mirror) {
+      if (mean_row) {
+        transform_row_avx2<true, true>(x, n, mean_row, mean_value, scale, y);
+      } else {
+        transform_row_avx2<true, false>(x, n, mean_row, mean_value, scale, y);
+      }
+    } else {
+      if (mean_row) {
+        transform_row_avx2<false, true>(x, n, mean_row, mean_value, scale, y);
+      } else {
+        transform_row_avx2<false, false>(x, n, mean_row, mean_value, scale,
+            y);
+      }
+    }
+  }
+};
+#endif  // CAFFE_TRANSFORM_X86
+
+template <int C>
+void deinterleave(const uint8_t* x, const int n, uint8_t* y) {
+  for (int i = 0; i < n; ++i) {
+    for (int c = 0; c < C; ++c) {
+      y[c * n + i] = x[i * C + c];
+    }
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+void transform_row(const uint8_t* x, const int n, const Dtype* mean_row,
+    const Dtype mean_value, const Dtype scale, const bool mirror, Dtype* y) {
+  TransformKernels<Dtype>::row(x, n, mean_row, mean_value, scale, mirror, y);
+}
+
+template <typename Dtype>
+void transform_row(const float* x, const int n, const Dtype* mean_row,
+    const Dtype mean_value, const Dtype scale, const bool mirror, Dtype* y) {
+  transform_row_scalar(x, n, mean_row, mean_value, scale, mirror, y);
+}
+
+void deinterleave_row(const uint8_t* x, const int n, const int channels,
+    uint8_t* y) {
+  switch (channels) {
+  case 1:
+    deinterleave<1>(x, n, y);
+    break;
+  case 3:
+#ifdef CAFFE_TRANSFORM_X86
+    if (simd_enabled && cpu_has_ssse3()) {
+      deinterleave3_ssse3(x, n, y);
+      break;
+    }
+#endif
+    deinterleave<3>(x, n, y);
+    break;
+  default:
+    for (int i = 0; i < n; ++i) {
+      for (int c = 0; c < channels; ++c) {
+        y[c * n + i] = x[i * channels + c];
+      }
+    }
+  }
+}
+
+void set_transform_simd(const bool enabled) {
+  simd_enabled = enabled;
+}
+
+bool transform_simd() {
+  return simd_enabled;
+}
+
+template void transform_row<float>(const uint8_t* x, const int n,
+    const float* mean_row, const float mean_value, const float scale,
+    const bool mirror, float* y);
+template void transform_row<double>(const uint8_t* x, const int n,
+    const double* mean_row, const double mean_value, const double scale,
+    const bool mirror, double* y);
+template void transform_row<float>(const float* x, const int n,
+    const float* mean_row, const float mean_value, const float scale,
+    const bool mirror, float* y);
+template void transform_row<double>(const float* x, const int n,
+    const double* mean_row, const double mean_value, const double scale,
+    const bool mirror, double* y);
+
+}  // namespace caffe
@@ -0,0 +1,100 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+#include "caffe/util/worker_group.hpp"
+
+namespace caffe {
+
+class WorkerGroup::Sync {
+ public:
+  Sync() : generation(0), running(0), stop(false) {}
+
+  boost::mutex mutex;
+  // Signalled when a run starts, and when the group is destroyed.
+  boost::condition_variable start;
+  // Signalled when the last worker is done with a run.
+  boost::condition_variable done;
+  // Counts the runs, so that a worker takes part in each one exactly once.
+  int generation;
+  // The workers still busy with the current run.
+  int running;
+  bool stop;
+};
+
+WorkerGroup::WorkerGroup(const int num_threads)
+    : sync_(new Sync()), num_items_(0) {
+  CHECK_GT(num_threads, 0);
+  for (int i = 1; i < num_threads; ++i) {
+    threads_.push_back(shared_ptr<boost::thread>(new boost::thread(
+        boost::bind(&WorkerGroup::WorkerEntry, this, i))));
+  }
+}
+
+WorkerGroup::~WorkerGroup() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex);
+    sync_->stop = true;
+  }
+  sync_->start.notify_all();
+  for (int i = 0; i < threads_.size(); ++i) {
+    threads_[i]->join();
+  }
+}
+
+void WorkerGroup::Run(const int num_items,
+    const boost::function<void(int, int)>& job) {
+  if (threads_.empty()) {
+    for (int i = 0; i < num_items; ++i) {
+      job(0, i);
+    }
+    return;
+  }
+  // The caller may be an interruptible thread, but the workers have to be
+  // waited for: they write to memory owned by the caller.
+  boost::this_thread::disable_interruption no_interruption;
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex);
+    job_ = job;
+    num_items_ = num_items;
+    sync_->running = threads_.size();
+    ++sync_->generation;
+  }
+  sync_->start.notify_all();
+  RunItems(0);
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  while (sync_->running > 0) {
+    sync_->done.wait(lock);
+  }
+  job_.clear();
+}
+
+void WorkerGroup::WorkerEntry(const int thread) {
+  int generation = 0;
+  while (true) {
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex);
+      while (!sync_->stop && sync_->generation == generation) {
+        sync_->start.wait(lock);
+      }
+      if (sync_->stop) {
+        return;
+      }
+      generation = sync_->generation;
+    }
+    RunItems(thread);
+    boost::mutex::scoped_lock lock(sync_->mutex);
+    if (--sync_->running == 0) {
+      sync_->done.notify_one();
+    }
+  }
+}
+
+void WorkerGroup::RunItems(const int thread) {
+  for (int i = thread; i < num_items_; i += num_threads()) {
+    job_(thread, i);
+  }
+}
+
+}  // namespace caffe
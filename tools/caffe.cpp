@@ -1,13 +1,25 @@
 
 #include <glog/logging.h>
+#include <signal.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
 #include <map>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/lexical_cast.hpp"
+#include "boost/thread.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/allreduce.hpp"
+#include "caffe/util/host_allocator.hpp"
+#include "caffe/util/parallel.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
@@ -27,10 +39,39 @@ DEFINE_string(model, "",
 DEFINE_string(snapshot, "",
     "Optional; the snapshot solver state to resume training.");
 DEFINE_string(weights, "",
-    "Optional; the pretrained weights to initialize finetuning. "
+    "Optional; the pretrained weights to initialize finetuning, as a "
+    ".caffemodel or mapped weights (see convert_weights). "
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(threads, 0,
+    "Optional; the number of CPU threads. Default: one per core.");
+DEFINE_bool(pin_threads, false,
+    "Optional; bind each CPU thread to one core.");
+DEFINE_string(numa_nodes, "",
+    "Optional; comma-separated NUMA nodes to spread the pinned CPU threads "
+    "over. Implies --pin_threads. Default: all nodes.");
+DEFINE_bool(host_memory_pool, true,
+    "Optional; keep freed host memory for reuse by later blobs.");
+DEFINE_string(huge_pages, "none",
+    "Optional; back large blobs with huge pages: 'none', 'transparent' or "
+    "'explicit' (reserved hugetlbfs pages).");
+DEFINE_int32(memory_numa_node, -1,
+    "Optional; the NUMA node to place large blobs on. Default: the node of "
+    "the thread first writing them.");
+DEFINE_int32(workers, 1,
+    "Optional; the number of processes of data-parallel training on this "
+    "host, which average their gradients through shared memory. Each loads "
+    "its shard of every TRAIN batch, batch_size / workers images, so the "
+    "batch size and learning rate mean what they do on one process. Only "
+    "the Data and ImageData layers shard their data; TRAIN nets with other "
+    "data layers are refused.");
+DEFINE_string(hosts, "",
+    "Optional; comma-separated host:port of every process of data-parallel "
+    "training over TCP, in rank order. Start one process per entry. The "
+    "data is sharded as with --workers.");
+DEFINE_int32(rank, 0,
+    "Optional; with --hosts, the rank of this process.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -78,6 +119,116 @@ int device_query() {
 }
 RegisterBrewFunction(device_query);
 
+// Apply the CPU threading flags.
+void SetThreading() {
+  vector<int> numa_nodes;
+  if (FLAGS_numa_nodes.size()) {
+    std::vector<std::string> nodes;
+    boost::split(nodes, FLAGS_numa_nodes, boost::is_any_of(","));
+    for (int i = 0; i < nodes.size(); ++i) {
+      numa_nodes.push_back(boost::lexical_cast<int>(nodes[i]));
+    }
+  }
+  Caffe::set_num_threads(FLAGS_threads);
+  Caffe::set_thread_affinity(FLAGS_pin_threads || numa_nodes.size(),
+      numa_nodes);
+  LOG(INFO) << "Use " << caffe::parallel_num_threads() << " CPU threads"
+      << (FLAGS_pin_threads || numa_nodes.size() ? ", pinned." : ".");
+}
+
+// Apply the host memory flags.
+void SetHostMemory() {
+  caffe::HostAllocator& allocator = Caffe::host_allocator();
+  allocator.set_pooling(FLAGS_host_memory_pool);
+  if (FLAGS_huge_pages == "none") {
+    allocator.set_huge_pages(caffe::HostAllocator::HUGE_PAGES_NONE);
+  } else if (FLAGS_huge_pages == "transparent") {
+    allocator.set_huge_pages(caffe::HostAllocator::HUGE_PAGES_TRANSPARENT);
+  } else if (FLAGS_huge_pages == "explicit") {
+    allocator.set_huge_pages(caffe::HostAllocator::HUGE_PAGES_EXPLICIT);
+  } else {
+    LOG(FATAL) << "Unknown huge pages mode: " << FLAGS_huge_pages;
+  }
+  allocator.set_numa_node(FLAGS_memory_numa_node);
+}
+
+// Log the host memory statistics.
+void LogHostMemory() {
+  const caffe::HostAllocator::Stats stats = Caffe::host_allocator().stats();
+  LOG(INFO) << "Host memory: " << stats.live_bytes << " bytes live, "
+      << stats.peak_bytes << " peak, " << stats.cached_bytes << " pooled; "
+      << stats.pool_hits << " pool hits, " << stats.pool_misses << " misses.";
+}
+
+// Start the workers of data-parallel training, if any, and return the
+// transport of this one: with --workers, the calling process forks the
+// others, which share memory with it; with --hosts, the process of each rank
+// was started separately. Returns NULL for training on a single worker.
+shared_ptr<caffe::Transport> StartWorkers(vector<pid_t>* worker_pids) {
+  if (FLAGS_hosts.size()) {
+    CHECK_EQ(FLAGS_workers, 1) << "Give --workers or --hosts, not both.";
+    std::vector<std::string> hosts;
+    boost::split(hosts, FLAGS_hosts, boost::is_any_of(","));
+    const int size = hosts.size();
+    CHECK_GE(FLAGS_rank, 0);
+    CHECK_LT(FLAGS_rank, size) << "--rank must index --hosts.";
+    if (size == 1) {
+      return shared_ptr<caffe::Transport>();
+    }
+    const std::string& host = hosts[FLAGS_rank];
+    const int port = boost::lexical_cast<int>(
+        host.substr(host.rfind(':') + 1));
+    caffe::TcpTransport* tcp = new caffe::TcpTransport(FLAGS_rank, size, port);
+    shared_ptr<caffe::Transport> transport(tcp);
+    tcp->Connect(hosts[(FLAGS_rank + 1) % size]);
+    return transport;
+  }
+  if (FLAGS_workers <= 1) {
+    return shared_ptr<caffe::Transport>();
+  }
+  // Before any thread is started, which the children would not inherit.
+  void* region = caffe::ShmTransport::CreateRegion(
+      caffe::ShmTransport::RegionBytes(FLAGS_workers,
+      caffe::ShmTransport::kDefaultCapacity));
+  int rank = 0;
+  for (int r = 1; r < FLAGS_workers; ++r) {
+    const pid_t pid = fork();
+    CHECK_GE(pid, 0) << "Cannot fork worker " << r;
+    if (pid == 0) {
+      rank = r;
+      worker_pids->clear();
+#ifdef __linux__
+      // Do not wait forever for a parent that failed.
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+      break;
+    }
+    worker_pids->push_back(pid);
+  }
+  // Split the cores between the workers.
+  if (FLAGS_threads == 0) {
+    FLAGS_threads = std::max(1,
+        static_cast<int>(boost::thread::hardware_concurrency()) /
+        FLAGS_workers);
+  }
+  return shared_ptr<caffe::Transport>(
+      new caffe::ShmTransport(region, rank, FLAGS_workers));
+}
+
+// Wait for the forked workers, and return whether they all succeeded.
+bool WaitForWorkers(const vector<pid_t>& worker_pids) {
+  bool success = true;
+  for (int i = 0; i < worker_pids.size(); ++i) {
+    int status = 0;
+    CHECK_EQ(waitpid(worker_pids[i], &status, 0), worker_pids[i]);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      LOG(ERROR) << "Worker " << i + 1 << " failed.";
+      success = false;
+    }
+  }
+  return success;
+}
+
 // Load the weights from the specified caffemodel(s) into the train and
 // test nets.
 void CopyLayers(caffe::Solver<float>* solver, const std::string& model_list) {
@@ -118,10 +269,31 @@ int train() {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
   }
+  vector<pid_t> worker_pids;
+  shared_ptr<caffe::Transport> transport = StartWorkers(&worker_pids);
+  if (transport) {
+    Caffe::set_solver_count(transport->size());
+    Caffe::set_solver_rank(transport->rank());
+    // The workers shuffle their data alike, so that the Data and ImageData
+    // layers read disjoint shares of it.
+    int seed = solver_param.random_seed();
+    if (seed < 0) {
+      seed = caffe::caffe_rng_rand() & 0x7fffffff;
+    }
+    caffe::ring_broadcast(transport.get(), &seed, sizeof(seed));
+    solver_param.set_random_seed(seed);
+  }
+  SetThreading();
+  SetHostMemory();
 
   LOG(INFO) << "Starting Optimization";
   shared_ptr<caffe::Solver<float> >
     solver(caffe::GetSolver<float>(solver_param));
+  if (transport) {
+    solver->set_transport(transport);
+    // But draw different dropout masks and the like.
+    Caffe::set_random_seed(solver_param.random_seed() + transport->rank());
+  }
 
   if (FLAGS_snapshot.size()) {
     LOG(INFO) << "Resuming from " << FLAGS_snapshot;
@@ -133,7 +305,8 @@ int train() {
     solver->Solve();
   }
   LOG(INFO) << "Optimization Done.";
-  return 0;
+  LogHostMemory();
+  return WaitForWorkers(worker_pids) ? 0 : 1;
 }
 RegisterBrewFunction(train);
 
@@ -152,6 +325,8 @@ int test() {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
   }
+  SetThreading();
+  SetHostMemory();
   // Instantiate the caffe net.
   Net<float> caffe_net(FLAGS_model, caffe::TEST);
   caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
@@ -198,6 +373,7 @@ int test() {
     }
     LOG(INFO) << output_name << " = " << mean_score << loss_msg_stream.str();
   }
+  LogHostMemory();
 
   return 0;
 }
@@ -217,6 +393,8 @@ int time() {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
   }
+  SetThreading();
+  SetHostMemory();
   // Instantiate the caffe net.
   Net<float> caffe_net(FLAGS_model, caffe::TRAIN);
 
@@ -290,6 +468,7 @@ int time() {
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
   LOG(INFO) << "*** Benchmark ends ***";
+  LogHostMemory();
   return 0;
 }
 RegisterBrewFunction(time);
@@ -0,0 +1,93 @@
+// Times ConvolutionLayer::Backward_cpu across thread counts to measure how
+// the sharded weight-gradient reduction scales, and checks that the weight
+// gradient is reproducible at every thread count. Usage:
+//    conv_scaling_benchmark [--threads=1,2,4,8] [--num=64] [--channels=64]
+//        [--height=56] [--width=56] [--num_output=64] [--kernel_size=3]
+//        [--iterations=10]
+#include <glog/logging.h>
+
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "boost/lexical_cast.hpp"
+#include "caffe/caffe.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/vision_layers.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Timer;
+using caffe::vector;
+
+DEFINE_string(threads, "1,2,4,8",
+    "Comma-separated thread counts to time.");
+DEFINE_int32(num, 64, "Batch size.");
+DEFINE_int32(channels, 64, "Input channels.");
+DEFINE_int32(height, 56, "Input height.");
+DEFINE_int32(width, 56, "Input width.");
+DEFINE_int32(num_output, 64, "Output channels.");
+DEFINE_int32(kernel_size, 3, "Square kernel size; padding keeps the size.");
+DEFINE_int32(iterations, 10, "Backward passes per thread count.");
+
+int main(int argc, char** argv) {
+  // Print output to stderr (while still logging).
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Times convolution backward across thread counts.");
+  caffe::GlobalInit(&argc, &argv);
+  Caffe::set_mode(Caffe::CPU);
+
+  caffe::LayerParameter layer_param;
+  caffe::ConvolutionParameter* conv_param =
+      layer_param.mutable_convolution_param();
+  conv_param->set_num_output(FLAGS_num_output);
+  conv_param->set_kernel_size(FLAGS_kernel_size);
+  conv_param->set_pad(FLAGS_kernel_size / 2);
+  conv_param->mutable_weight_filler()->set_type("gaussian");
+  conv_param->mutable_bias_filler()->set_type("gaussian");
+  caffe::ConvolutionLayer<float> layer(layer_param);
+
+  Blob<float> bottom(FLAGS_num, FLAGS_channels, FLAGS_height, FLAGS_width);
+  Blob<float> top;
+  caffe::FillerParameter filler_param;
+  caffe::GaussianFiller<float> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<float>*> bottom_vec(1, &bottom);
+  vector<Blob<float>*> top_vec(1, &top);
+  layer.SetUp(bottom_vec, top_vec);
+  layer.Forward(bottom_vec, top_vec);
+  filler.Fill(&top);
+  caffe::caffe_copy(top.count(), top.cpu_data(), top.mutable_cpu_diff());
+  const vector<bool> propagate_down(1, true);
+  const Blob<float>& weights = *layer.blobs()[0];
+
+  vector<std::string> counts;
+  boost::split(counts, FLAGS_threads, boost::is_any_of(","));
+  double base_ms = 0;
+  for (int t = 0; t < counts.size(); ++t) {
+    Caffe::set_num_threads(boost::lexical_cast<int>(counts[t]));
+    // Reshape picks up the new shard count.
+    layer.Reshape(bottom_vec, top_vec);
+    layer.Backward(top_vec, propagate_down, bottom_vec);
+    vector<float> first_diff(weights.cpu_diff(),
+        weights.cpu_diff() + weights.count());
+    bool reproducible = true;
+    Timer timer;
+    timer.Start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+      layer.Backward(top_vec, propagate_down, bottom_vec);
+    }
+    const double ms = timer.MilliSeconds() / FLAGS_iterations;
+    for (int i = 0; i < weights.count(); ++i) {
+      reproducible &= first_diff[i] == weights.cpu_diff()[i];
+    }
+    if (t == 0) {
+      base_ms = ms;
+    }
+    LOG(INFO) << "threads: " << caffe::parallel_num_threads()
+        << "\tbackward: " << ms << " ms"
+        << "\tspeedup: " << base_ms / ms
+        << "\treproducible: " << (reproducible ? "yes" : "NO");
+  }
+  return 0;
+}
@@ -8,6 +8,9 @@
 // should be a list of files as well as their labels, in the format as
 //   subfolder1/file1.JPEG 7
 //   ....
+//
+// The images are read, resized and encoded on --threads threads; the db is
+// the same as with a single one.
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
@@ -15,14 +18,20 @@
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/worker_group.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 using std::pair;
@@ -32,8 +41,10 @@ DEFINE_bool(gray, false,
     "When this option is on, treat images as grayscale ones");
 DEFINE_bool(shuffle, false,
     "Randomly shuffle the order of images and their labels");
+DEFINE_int32(seed, -1,
+    "Optional: the random seed of the shuffle, for a reproducible order");
 DEFINE_string(backend, "lmdb",
-        "The backend {lmdb, leveldb} for storing the result");
+        "The backend {lmdb, leveldb, records} for storing the result");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
 DEFINE_bool(check_size, false,
@@ -42,6 +53,85 @@ DEFINE_bool(encoded, false,
     "When this option is on, the encoded image will be save in datum");
 DEFINE_string(encode_type, "",
     "Optional: What type should we encode the image as ('png','jpg',...).");
+DEFINE_int32(threads, 0,
+    "The number of threads reading and encoding images; 0 for one per core");
+DEFINE_int32(commit_size, 1000,
+    "The number of images written to the db in each transaction");
+
+// The images are read by a group of worker threads, chunk after chunk, while
+// the main thread writes the previous chunks to the db in order, so that the
+// db is the same whatever the number of threads.
+struct Chunk {
+  int begin;
+  int end;
+  // For each line of the chunk, whether the image could be read, and its
+  // serialized datum and sizes. The lines are read on different threads, so
+  // status is not a vector<bool>, whose elements share words.
+  vector<char> status;
+  vector<string> values;
+  vector<int> data_sizes;
+  vector<int> datum_sizes;
+};
+
+const int kNumChunks = 3;
+// The lines read per chunk, per thread.
+const int kChunkLines = 64;
+
+void ReadLine(const vector<std::pair<std::string, int> >& lines,
+    const string& root_folder, Chunk* chunk, const int thread,
+    const int item) {
+  const int line_id = chunk->begin + item;
+  std::string enc = FLAGS_encode_type;
+  if (FLAGS_encoded && !enc.size()) {
+    // Guess the encoding type from the file name
+    string fn = lines[line_id].first;
+    size_t p = fn.rfind('.');
+    if ( p == fn.npos )
+      LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
+    enc = fn.substr(p);
+    std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+  }
+  Datum datum;
+  chunk->status[item] = ReadImageToDatum(root_folder + lines[line_id].first,
+      lines[line_id].second, std::max<int>(0, FLAGS_resize_height),
+      std::max<int>(0, FLAGS_resize_width), !FLAGS_gray, enc, &datum);
+  if (chunk->status[item]) {
+    chunk->data_sizes[item] = datum.data().size();
+    chunk->datum_sizes[item] =
+        datum.channels() * datum.height() * datum.width();
+    CHECK(datum.SerializeToString(&chunk->values[item]));
+  }
+}
+
+// Fills the chunks handed over by free_chunks in order of the lines, and
+// passes them to full_chunks, then passes -1 at the end.
+void ReadChunks(const vector<std::pair<std::string, int> >& lines,
+    const string& root_folder, const int num_threads, vector<Chunk>* chunks,
+    BlockingQueue<int>* free_chunks, BlockingQueue<int>* full_chunks) {
+  WorkerGroup workers(num_threads);
+  const int chunk_lines = num_threads * kChunkLines;
+  for (int begin = 0; begin < lines.size(); begin += chunk_lines) {
+    Chunk* chunk = &(*chunks)[free_chunks->pop()];
+    chunk->begin = begin;
+    chunk->end = std::min<int>(begin + chunk_lines, lines.size());
+    const int num_items = chunk->end - chunk->begin;
+    chunk->status.resize(num_items);
+    chunk->values.resize(num_items);
+    chunk->data_sizes.resize(num_items);
+    chunk->datum_sizes.resize(num_items);
+    workers.Run(num_items, boost::bind(&ReadLine, boost::cref(lines),
+        boost::cref(root_folder), chunk, _1, _2));
+    full_chunks->push(chunk - &(*chunks)[0]);
+  }
+  full_chunks->push(-1);
+}
+
+void LogProgress(const int count, const boost::posix_time::ptime& start) {
+  const double seconds = (boost::posix_time::microsec_clock::local_time() -
+      start).total_microseconds() / 1e6;
+  LOG(ERROR) << "Processed " << count << " files ("
+      << count / std::max(seconds, 1e-6) << " files/s).";
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -63,10 +153,7 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  const bool is_color = !FLAGS_gray;
   const bool check_size = FLAGS_check_size;
-  const bool encoded = FLAGS_encoded;
-  const string encode_type = FLAGS_encode_type;
 
   std::ifstream infile(argv[2]);
   std::vector<std::pair<std::string, int> > lines;
@@ -78,15 +165,21 @@ int main(int argc, char** argv) {
   if (FLAGS_shuffle) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
+    if (FLAGS_seed >= 0) {
+      Caffe::set_random_seed(FLAGS_seed);
+    }
     shuffle(lines.begin(), lines.end());
   }
   LOG(INFO) << "A total of " << lines.size() << " images.";
 
-  if (encode_type.size() && !encoded)
+  if (FLAGS_encode_type.size() && !FLAGS_encoded)
     LOG(INFO) << "encode_type specified, assuming encoded=true.";
 
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
+  const int num_threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max<int>(1, boost::thread::hardware_concurrency());
+  const int commit_size = FLAGS_commit_size;
+  CHECK_GT(commit_size, 0);
+  LOG(INFO) << "Reading images on " << num_threads << " threads.";
 
   // Create new DB
   scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
@@ -95,59 +188,58 @@ int main(int argc, char** argv) {
 
   // Storing to db
   std::string root_folder(argv[1]);
-  Datum datum;
+  vector<Chunk> chunks(kNumChunks);
+  BlockingQueue<int> free_chunks, full_chunks;
+  for (int i = 0; i < kNumChunks; ++i) {
+    free_chunks.push(i);
+  }
+  boost::thread reader(boost::bind(&ReadChunks, boost::cref(lines),
+      boost::cref(root_folder), num_threads, &chunks, &free_chunks,
+      &full_chunks));
+  const boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::local_time();
   int count = 0;
   const int kMaxKeyLength = 256;
   char key_cstr[kMaxKeyLength];
   int data_size = 0;
   bool data_size_initialized = false;
 
-  for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    bool status;
-    std::string enc = encode_type;
-    if (encoded && !enc.size()) {
-      // Guess the encoding type from the file name
-      string fn = lines[line_id].first;
-      size_t p = fn.rfind('.');
-      if ( p == fn.npos )
-        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
-      enc = fn.substr(p);
-      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
-    }
-    status = ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color,
-        enc, &datum);
-    if (status == false) continue;
-    if (check_size) {
-      if (!data_size_initialized) {
-        data_size = datum.channels() * datum.height() * datum.width();
-        data_size_initialized = true;
-      } else {
-        const std::string& data = datum.data();
-        CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-            << data.size();
+  for (int chunk_id = full_chunks.pop(); chunk_id >= 0;
+       chunk_id = full_chunks.pop()) {
+    Chunk& chunk = chunks[chunk_id];
+    for (int line_id = chunk.begin; line_id < chunk.end; ++line_id) {
+      const int item = line_id - chunk.begin;
+      if (!chunk.status[item]) continue;
+      if (check_size) {
+        if (!data_size_initialized) {
+          data_size = chunk.datum_sizes[item];
+          data_size_initialized = true;
+        } else {
+          CHECK_EQ(chunk.data_sizes[item], data_size)
+              << "Incorrect data field size " << chunk.data_sizes[item];
+        }
+      }
+      // sequential
+      int length = snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
+          lines[line_id].first.c_str());
+
+      // Put in db
+      txn->Put(string(key_cstr, length), chunk.values[item]);
+
+      if (++count % commit_size == 0) {
+        // Commit db
+        txn->Commit();
+        txn.reset(db->NewTransaction());
+        LogProgress(count, start);
       }
     }
-    // sequential
-    int length = snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
-        lines[line_id].first.c_str());
-
-    // Put in db
-    string out;
-    CHECK(datum.SerializeToString(&out));
-    txn->Put(string(key_cstr, length), out);
-
-    if (++count % 1000 == 0) {
-      // Commit db
-      txn->Commit();
-      txn.reset(db->NewTransaction());
-      LOG(ERROR) << "Processed " << count << " files.";
-    }
+    free_chunks.push(chunk_id);
   }
+  reader.join();
   // write the last batch
-  if (count % 1000 != 0) {
+  if (count % commit_size != 0) {
     txn->Commit();
-    LOG(ERROR) << "Processed " << count << " files.";
+    LogProgress(count, start);
   }
   return 0;
-}
\ No newline at end of file
+}
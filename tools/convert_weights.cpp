@@ -0,0 +1,36 @@
+// This is a script to convert trained weights between a .caffemodel and the
+// mapped weights format (see caffe/util/mapped_weights.hpp), in whichever
+// direction the input calls for.
+// Usage:
+//    convert_weights weights_file_in weights_file_out
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mapped_weights.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: "
+        << "convert_weights weights_file_in weights_file_out";
+    return 1;
+  }
+
+  const string input_filename(argv[1]);
+  NetParameter net_param;
+  if (MappedWeights::IsMappedWeights(input_filename)) {
+    MappedWeights(input_filename).ToProto(&net_param);
+    WriteProtoToBinaryFile(net_param, argv[2]);
+    LOG(ERROR) << "Wrote NetParameter binary proto to " << argv[2];
+  } else {
+    ReadNetParamsFromBinaryFileOrDie(input_filename, &net_param);
+    MappedWeights::Write(net_param, argv[2]);
+    LOG(ERROR) << "Wrote mapped weights to " << argv[2];
+  }
+  return 0;
+}
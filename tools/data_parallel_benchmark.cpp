@@ -0,0 +1,133 @@
+// Times data-parallel training of a synthetic MLP on 1, 2, 4... forked
+// workers averaging their gradients through shared memory, and the ring
+// allreduce alone on the same number of parameters. Each worker trains on
+// its own batches, so the images per second should grow with the workers as
+// long as there are cores for them. Usage:
+//    data_parallel_benchmark [--max_workers=4] [--iterations=20]
+//        [--batch_size=64]
+#include <glog/logging.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "boost/thread.hpp"
+#include "google/protobuf/text_format.h"
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/allreduce.hpp"
+
+using caffe::Caffe;
+using caffe::shared_ptr;
+using caffe::Timer;
+using caffe::vector;
+
+DEFINE_int32(max_workers, 4, "Time 1, 2, 4... workers up to this many.");
+DEFINE_int32(iterations, 20, "Training iterations timed per configuration.");
+DEFINE_int32(batch_size, 64, "The batch size of each worker.");
+
+// 784 inputs, two hidden layers of 1024 and 10 outputs: about 1.9M
+// parameters, so that the allreduce is not negligible next to the compute.
+const char* kSolver =
+    "base_lr: 0.01 lr_policy: 'fixed' momentum: 0.9 weight_decay: 0.0005 "
+    "max_iter: 1000000 snapshot_after_train: false solver_mode: CPU "
+    "net_param { "
+    "  state { phase: TRAIN } "
+    "  layer { name: 'data' type: 'DummyData' top: 'data' top: 'label' "
+    "    dummy_data_param { "
+    "      shape { dim: 64 dim: 784 } shape { dim: 64 } "
+    "      data_filler { type: 'gaussian' } "
+    "      data_filler { type: 'constant' value: 3 } } } "
+    "  layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+    "    inner_product_param { num_output: 1024 "
+    "      weight_filler { type: 'xavier' } } } "
+    "  layer { name: 'relu1' type: 'ReLU' bottom: 'ip1' top: 'ip1' } "
+    "  layer { name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+    "    inner_product_param { num_output: 1024 "
+    "      weight_filler { type: 'xavier' } } } "
+    "  layer { name: 'relu2' type: 'ReLU' bottom: 'ip2' top: 'ip2' } "
+    "  layer { name: 'ip3' type: 'InnerProduct' bottom: 'ip2' top: 'ip3' "
+    "    inner_product_param { num_output: 10 "
+    "      weight_filler { type: 'xavier' } } } "
+    "  layer { name: 'loss' type: 'SoftmaxWithLoss' bottom: 'ip3' "
+    "    bottom: 'label' top: 'loss' } "
+    "} ";
+
+// Runs one worker; rank 0 reports the times.
+void RunWorker(void* region, const int rank, const int size) {
+  Caffe::set_num_threads(std::max(1,
+      static_cast<int>(boost::thread::hardware_concurrency()) / size));
+  caffe::SolverParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(kSolver, &param));
+  caffe::DummyDataParameter* data_param = param.mutable_net_param()
+      ->mutable_layer(0)->mutable_dummy_data_param();
+  data_param->mutable_shape(0)->set_dim(0, FLAGS_batch_size);
+  data_param->mutable_shape(1)->set_dim(0, FLAGS_batch_size);
+  shared_ptr<caffe::Solver<float> > solver(caffe::GetSolver<float>(param));
+  shared_ptr<caffe::Transport> transport(
+      new caffe::ShmTransport(region, rank, size));
+  solver->set_transport(transport);
+  solver->Step(2);
+
+  Timer timer;
+  timer.Start();
+  solver->Step(FLAGS_iterations);
+  const double train_ms = timer.MilliSeconds();
+
+  int count = 0;
+  const vector<shared_ptr<caffe::Blob<float> > >& params =
+      solver->net()->params();
+  for (int i = 0; i < params.size(); ++i) {
+    count += params[i]->count();
+  }
+  vector<float> diffs(count, 1);
+  caffe::ring_allreduce(transport.get(), &diffs[0], count);
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    caffe::ring_allreduce(transport.get(), &diffs[0], count);
+  }
+  const double allreduce_ms = timer.MilliSeconds() / FLAGS_iterations;
+
+  if (rank == 0) {
+    LOG(INFO) << size << " worker(s):\t"
+        << size * FLAGS_batch_size * FLAGS_iterations / (train_ms / 1000)
+        << " images/s\t" << train_ms / FLAGS_iterations
+        << " ms/iteration\tallreduce of " << count << " floats: "
+        << allreduce_ms << " ms";
+  }
+}
+
+int main(int argc, char** argv) {
+  // Print output to stderr (while still logging).
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Times data-parallel training on forked workers.");
+  caffe::GlobalInit(&argc, &argv);
+  Caffe::set_mode(Caffe::CPU);
+
+  for (int size = 1; size <= FLAGS_max_workers; size *= 2) {
+    void* region = caffe::ShmTransport::CreateRegion(
+        caffe::ShmTransport::RegionBytes(size,
+        caffe::ShmTransport::kDefaultCapacity));
+    // The workers are all forked, rank 0 included, so that none inherits
+    // the thread pool of a previous configuration without its threads.
+    vector<pid_t> pids;
+    for (int rank = 0; rank < size; ++rank) {
+      const pid_t pid = fork();
+      CHECK_GE(pid, 0) << "Cannot fork worker " << rank;
+      if (pid == 0) {
+        RunWorker(region, rank, size);
+        _exit(0);
+      }
+      pids.push_back(pid);
+    }
+    for (int i = 0; i < pids.size(); ++i) {
+      int status = 0;
+      CHECK_EQ(waitpid(pids[i], &status, 0), pids[i]);
+      CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+          << "Worker " << i << " failed";
+    }
+  }
+  return 0;
+}
@@ -1,27 +1,191 @@
-
+#include <stdint.h>
 #include <stdio.h>  // for snprintf
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/bind.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/thread.hpp"
+#include "gflags/gflags.h"
 #include "google/protobuf/text_format.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/worker_group.hpp"
 #include "caffe/vision_layers.hpp"
 
 using caffe::Blob;
+using caffe::BlockingQueue;
 using caffe::Caffe;
 using caffe::Datum;
 using caffe::Net;
+using caffe::WorkerGroup;
 using boost::shared_ptr;
 using std::string;
+using std::vector;
 namespace db = caffe::db;
 
+DEFINE_int32(threads, 0,
+    "The number of threads serializing features; 0 for one per core");
+DEFINE_int32(commit_size, 10000,
+    "The features written to each db in each transaction");
+
+// The features of the mini-batches go down a pipeline: the main thread runs
+// the forward passes and copies the feature blobs out of the net, a group of
+// worker threads serializes them to datums, and a writer thread puts them in
+// the dbs in order. The forward pass of the next mini-batches overlaps the
+// serialization and writing of the previous ones.
+template <typename Dtype>
+struct FeatureBatch {
+  // For each feature blob, its values for the mini-batch, and the serialized
+  // datum of each item.
+  vector<shared_ptr<Blob<Dtype> > > features;
+  vector<vector<string> > values;
+};
+
+const int kNumBatches = 3;
+
+// With db_type matrix, each feature blob is written to a file of raw floats
+// instead of a db of datums:
+//   uint64 rows (the items), uint64 columns (the values of each item),
+//   then the values, row after row, in the byte order of the host.
+class MatrixWriter {
+ public:
+  explicit MatrixWriter(const string& filename)
+      : filename_(filename), rows_(0), columns_(0) {
+    file_ = fopen(filename.c_str(), "wb");
+    CHECK(file_) << "Cannot create " << filename;
+    WriteHeader();
+  }
+  ~MatrixWriter() {
+    CHECK_EQ(fseek(file_, 0, SEEK_SET), 0);
+    WriteHeader();
+    CHECK_EQ(fclose(file_), 0) << "Cannot write " << filename_;
+  }
+  template <typename Dtype>
+  void Append(const Blob<Dtype>& feature) {
+    const uint64_t columns = feature.count() / feature.num();
+    CHECK(!rows_ || columns == columns_) << "The feature in " << filename_
+        << " changed size from " << columns_ << " to " << columns;
+    columns_ = columns;
+    rows_ += feature.num();
+    values_.assign(feature.cpu_data(), feature.cpu_data() + feature.count());
+    CHECK_EQ(fwrite(values_.data(), sizeof(float), values_.size(), file_),
+        values_.size()) << "Cannot write " << filename_;
+  }
+  uint64_t rows() const { return rows_; }
+
+ private:
+  void WriteHeader() {
+    const uint64_t header[2] = { rows_, columns_ };
+    CHECK_EQ(fwrite(header, sizeof(header), 1, file_), 1)
+        << "Cannot write " << filename_;
+  }
+
+  const string filename_;
+  FILE* file_;
+  uint64_t rows_;
+  uint64_t columns_;
+  vector<float> values_;
+};
+
+template <typename Dtype>
+void SerializeItem(const Blob<Dtype>* feature, vector<string>* values,
+    vector<Datum>* datums, const int thread, const int item) {
+  Datum& datum = (*datums)[thread];
+  datum.set_height(feature->height());
+  datum.set_width(feature->width());
+  datum.set_channels(feature->channels());
+  datum.clear_data();
+  const int dim_features = feature->count() / feature->num();
+  datum.mutable_float_data()->Resize(dim_features, 0);
+  const Dtype* feature_data = feature->cpu_data() + feature->offset(item);
+  std::copy(feature_data, feature_data + dim_features,
+      datum.mutable_float_data()->mutable_data());
+  CHECK(datum.SerializeToString(&(*values)[item]));
+}
+
+// Serializes the batches handed over by forwarded, unless they are written
+// as matrices, and passes them to serialized, then passes -1 at the end.
+template <typename Dtype>
+void SerializeBatches(const int num_threads, const bool matrix,
+    vector<FeatureBatch<Dtype> >* batches, BlockingQueue<int>* forwarded,
+    BlockingQueue<int>* serialized) {
+  WorkerGroup workers(num_threads);
+  vector<Datum> datums(workers.num_threads());
+  for (int batch_id = forwarded->pop(); batch_id >= 0;
+       batch_id = forwarded->pop()) {
+    FeatureBatch<Dtype>& batch = (*batches)[batch_id];
+    if (!matrix) {
+      batch.values.resize(batch.features.size());
+      for (int i = 0; i < batch.features.size(); ++i) {
+        const Blob<Dtype>* feature = batch.features[i].get();
+        batch.values[i].resize(feature->num());
+        workers.Run(feature->num(), boost::bind(&SerializeItem<Dtype>,
+            feature, &batch.values[i], &datums, _1, _2));
+      }
+    }
+    serialized->push(batch_id);
+  }
+  serialized->push(-1);
+}
+
+// Writes the batches handed over by serialized, in order, and hands them
+// back to free_batches.
+template <typename Dtype>
+void WriteBatches(const vector<string>& blob_names,
+    const vector<shared_ptr<db::DB> >& feature_dbs,
+    const vector<shared_ptr<MatrixWriter> >& matrices,
+    vector<FeatureBatch<Dtype> >* batches, BlockingQueue<int>* serialized,
+    BlockingQueue<int>* free_batches) {
+  const int kMaxKeyStrLength = 100;
+  char key_str[kMaxKeyStrLength];
+  vector<shared_ptr<db::Transaction> > txns;
+  for (int i = 0; i < feature_dbs.size(); ++i) {
+    txns.push_back(shared_ptr<db::Transaction>(
+        feature_dbs[i]->NewTransaction()));
+  }
+  vector<int> image_indices(blob_names.size(), 0);
+  for (int batch_id = serialized->pop(); batch_id >= 0;
+       batch_id = serialized->pop()) {
+    FeatureBatch<Dtype>& batch = (*batches)[batch_id];
+    for (int i = 0; i < blob_names.size(); ++i) {
+      if (matrices.size()) {
+        matrices[i]->Append(*batch.features[i]);
+        continue;
+      }
+      for (int n = 0; n < batch.values[i].size(); ++n) {
+        int length = snprintf(key_str, kMaxKeyStrLength, "%d",
+            image_indices[i]);
+        txns[i]->Put(std::string(key_str, length), batch.values[i][n]);
+        if (++image_indices[i] % FLAGS_commit_size == 0) {
+          txns[i]->Commit();
+          txns[i].reset(feature_dbs[i]->NewTransaction());
+          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
+              " query images for feature blob " << blob_names[i];
+        }
+      }
+    }
+    free_batches->push(batch_id);
+  }
+  // write the last batch
+  for (int i = 0; i < feature_dbs.size(); ++i) {
+    if (image_indices[i] % FLAGS_commit_size != 0) {
+      txns[i]->Commit();
+    }
+    LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
+        " query images for feature blob " << blob_names[i];
+  }
+}
+
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv);
 
@@ -33,19 +197,30 @@ int main(int argc, char** argv) {
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
   const int num_required_args = 7;
   if (argc < num_required_args) {
     LOG(ERROR)<<
     "This program takes in a trained network and an input data layer, and then"
     " extract features of the input data produced by the net.\n"
-    "Usage: extract_features  pretrained_net_param"
+    "Usage: extract_features [FLAGS] pretrained_net_param"
     "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
     "  save_feature_dataset_name1[,name2,...]  num_mini_batches  db_type"
     "  [CPU/GPU] [DEVICE_ID=0]\n"
     "Note: you can extract multiple features in one pass by specifying"
     " multiple feature blob names and dataset names seperated by ','."
     " The names cannot contain white space characters and the number of blobs"
-    " and datasets must be equal.";
+    " and datasets must be equal.\n"
+    "db_type is leveldb, lmdb or records, for a db of a datum per image, or"
+    " matrix, for a file of raw floats: uint64 rows, uint64 columns, then a"
+    " row of features per image.\n"
+    "Flags: --threads (serializing the features, 0 for one per core),"
+    " --commit_size (features per db transaction).";
     return 1;
   }
   int arg_pos = num_required_args;
@@ -121,67 +296,82 @@ int feature_extraction_pipeline(int argc, char** argv) {
 
   int num_mini_batches = atoi(argv[++arg_pos]);
 
+  // The same db_type for every dataset.
+  const std::string db_type(argv[++arg_pos]);
+  const bool matrix = db_type == "matrix";
   std::vector<shared_ptr<db::DB> > feature_dbs;
-  std::vector<shared_ptr<db::Transaction> > txns;
+  std::vector<shared_ptr<MatrixWriter> > matrices;
   for (size_t i = 0; i < num_features; ++i) {
     LOG(INFO)<< "Opening dataset " << dataset_names[i];
-    shared_ptr<db::DB> db(db::GetDB(argv[++arg_pos]));
-    db->Open(dataset_names.at(i), db::NEW);
-    feature_dbs.push_back(db);
-    shared_ptr<db::Transaction> txn(db->NewTransaction());
-    txns.push_back(txn);
+    if (matrix) {
+      matrices.push_back(shared_ptr<MatrixWriter>(
+          new MatrixWriter(dataset_names[i])));
+    } else {
+      shared_ptr<db::DB> db(db::GetDB(db_type));
+      db->Open(dataset_names.at(i), db::NEW);
+      feature_dbs.push_back(db);
+    }
   }
+  CHECK_GT(FLAGS_commit_size, 0);
+  const int num_threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max<int>(1, boost::thread::hardware_concurrency());
 
   LOG(ERROR)<< "Extacting Features";
 
-  Datum datum;
-  const int kMaxKeyStrLength = 100;
-  char key_str[kMaxKeyStrLength];
-  std::vector<Blob<float>*> input_vec;
-  std::vector<int> image_indices(num_features, 0);
+  vector<FeatureBatch<Dtype> > batches(kNumBatches);
+  BlockingQueue<int> free_batches, forwarded, serialized;
+  for (int i = 0; i < kNumBatches; ++i) {
+    for (size_t j = 0; j < num_features; ++j) {
+      batches[i].features.push_back(
+          shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    }
+    free_batches.push(i);
+  }
+  boost::thread serializer(boost::bind(&SerializeBatches<Dtype>, num_threads,
+      matrix, &batches, &forwarded, &serialized));
+  boost::thread writer(boost::bind(&WriteBatches<Dtype>,
+      boost::cref(blob_names), boost::cref(feature_dbs),
+      boost::cref(matrices), &batches, &serialized, &free_batches));
+
+  const boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::local_time();
+  double forward_seconds = 0;
+  int num_images = 0;
+  std::vector<Blob<Dtype>*> input_vec;
   for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
+    const boost::posix_time::ptime forward_start =
+        boost::posix_time::microsec_clock::local_time();
     feature_extraction_net->Forward(input_vec);
+    forward_seconds += (boost::posix_time::microsec_clock::local_time() -
+        forward_start).total_microseconds() / 1e6;
+    FeatureBatch<Dtype>& batch = batches[free_batches.pop()];
     for (int i = 0; i < num_features; ++i) {
       const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
           ->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      const Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        datum.set_height(feature_blob->height());
-        datum.set_width(feature_blob->width());
-        datum.set_channels(feature_blob->channels());
-        datum.clear_data();
-        datum.clear_float_data();
-        feature_blob_data = feature_blob->cpu_data() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          datum.add_float_data(feature_blob_data[d]);
-        }
-        int length = snprintf(key_str, kMaxKeyStrLength, "%d",
-            image_indices[i]);
-        string out;
-        CHECK(datum.SerializeToString(&out));
-        txns.at(i)->Put(std::string(key_str, length), out);
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          txns.at(i)->Commit();
-          txns.at(i).reset(feature_dbs.at(i)->NewTransaction());
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
-    }  // for (int i = 0; i < num_features; ++i)
-  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
-  // write the last batch
-  for (int i = 0; i < num_features; ++i) {
-    if (image_indices[i] % 1000 != 0) {
-      txns.at(i)->Commit();
+      batch.features[i]->ReshapeLike(*feature_blob);
+      caffe::caffe_copy(feature_blob->count(), feature_blob->cpu_data(),
+          batch.features[i]->mutable_cpu_data());
     }
-    LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-        " query images for feature blob " << blob_names[i];
+    num_images += batch.features[0]->num();
+    forwarded.push(&batch - &batches[0]);
+  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
+  forwarded.push(-1);
+  serializer.join();
+  writer.join();
+  for (int i = 0; i < feature_dbs.size(); ++i) {
     feature_dbs.at(i)->Close();
   }
+  for (int i = 0; i < matrices.size(); ++i) {
+    LOG(ERROR)<< "Extracted features of " << matrices[i]->rows() <<
+        " query images for feature blob " << blob_names[i];
+  }
+  matrices.clear();
+  const double seconds = (boost::posix_time::microsec_clock::local_time() -
+      start).total_microseconds() / 1e6;
+  LOG(ERROR)<< "Extracted the features of " << num_images << " images in "
+      << seconds << " s (" << num_images / std::max(seconds, 1e-6)
+      << " images/s); the forward passes took " << forward_seconds << " s ("
+      << num_images / std::max(forward_seconds, 1e-6) << " images/s)";
 
   LOG(ERROR)<< "Successfully extracted the features!";
   return 0;
@@ -0,0 +1,137 @@
+// Serves nets to clients on a local socket, batching their concurrent
+// requests (see caffe/util/inference_server.hpp), until interrupted. With
+// --load_clients, it instead serves each model to that many clients of its
+// own sending requests of random values as fast as they are answered, and
+// reports the latency and the throughput. Usage:
+//    inference_server --models=name:deploy.prototxt[:weights][,...]
+//        [--socket=/tmp/caffe_inference.sock] [--replicas=1]
+//        [--max_batch_size=32] [--max_delay_us=1000]
+//        [--threads_per_replica=0]
+//        [--load_clients=0] [--load_requests=200]
+#include <glog/logging.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "boost/thread.hpp"
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/inference_server.hpp"
+
+using caffe::Caffe;
+using caffe::InferenceClient;
+using caffe::InferenceServer;
+using caffe::shared_ptr;
+using caffe::Timer;
+using caffe::vector;
+
+DEFINE_string(models, "", "The models to serve, comma-separated, each as "
+    "name:model.prototxt or name:model.prototxt:weights.");
+DEFINE_string(socket, "/tmp/caffe_inference.sock",
+    "The Unix domain socket to listen on.");
+DEFINE_int32(replicas, 1, "The nets running the batches of each model.");
+DEFINE_int32(max_batch_size, 32, "The most requests run in one batch.");
+DEFINE_int32(max_delay_us, 1000, "How long the first request of a batch "
+    "waits for others, in microseconds.");
+DEFINE_int32(threads_per_replica, 0, "The threads of the pool running the "
+    "layers, per replica; the replicas share the pool. 0 for one pool thread "
+    "per core.");
+DEFINE_int32(load_clients, 0, "If positive, load the server with this many "
+    "clients per model instead of serving until interrupted.");
+DEFINE_int32(load_requests, 200, "The requests each load client sends.");
+
+// Sends the requests of one load client, and records how long each took.
+void RunClient(const std::string& model, const int input_count,
+    vector<double>* latencies_ms) {
+  InferenceClient client(FLAGS_socket);
+  vector<float> input(input_count);
+  caffe::caffe_rng_gaussian<float>(input_count, 0, 1, input.data());
+  vector<float> output;
+  std::string error;
+  Timer timer;
+  for (int i = 0; i < FLAGS_load_requests; ++i) {
+    timer.Start();
+    CHECK(client.Infer(model, input, &output, &error)) << error;
+    latencies_ms->push_back(timer.MicroSeconds() / 1000);
+  }
+}
+
+void Load(const InferenceServer& server, const std::string& model) {
+  const int input_count = server.input_count(model);
+  const InferenceServer::Stats before = server.stats(model);
+  vector<vector<double> > latencies(FLAGS_load_clients);
+  Timer timer;
+  timer.Start();
+  boost::thread_group clients;
+  for (int i = 0; i < FLAGS_load_clients; ++i) {
+    clients.create_thread(boost::bind(&RunClient, model, input_count,
+        &latencies[i]));
+  }
+  clients.join_all();
+  const double seconds = timer.Seconds();
+  vector<double> all;
+  for (int i = 0; i < latencies.size(); ++i) {
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+  }
+  std::sort(all.begin(), all.end());
+  const InferenceServer::Stats after = server.stats(model);
+  LOG(INFO) << model << ": " << FLAGS_load_clients << " clients, "
+      << all.size() / seconds << " requests/s\tlatency p50 "
+      << all[all.size() / 2] << " ms\tp99 "
+      << all[std::min(all.size() - 1, all.size() * 99 / 100)]
+      << " ms\tmean batch size "
+      << static_cast<double>(after.requests - before.requests) /
+         (after.batches - before.batches);
+}
+
+int main(int argc, char** argv) {
+  // Print output to stderr (while still logging).
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Serves nets on a local socket, batching the "
+      "requests of its clients.");
+  caffe::GlobalInit(&argc, &argv);
+  Caffe::set_mode(Caffe::CPU);
+  CHECK(FLAGS_models.size()) << "Give the models to serve with --models.";
+
+  // Every thread started from here on leaves the signals to sigwait.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  CHECK_EQ(pthread_sigmask(SIG_BLOCK, &signals, NULL), 0);
+
+  InferenceServer::Options options;
+  options.replicas = FLAGS_replicas;
+  options.max_batch_size = FLAGS_max_batch_size;
+  options.max_delay_us = FLAGS_max_delay_us;
+  options.threads_per_replica = FLAGS_threads_per_replica;
+  InferenceServer server(options);
+  vector<std::string> models;
+  boost::split(models, FLAGS_models, boost::is_any_of(","));
+  vector<std::string> names;
+  for (int i = 0; i < models.size(); ++i) {
+    vector<std::string> fields;
+    boost::split(fields, models[i], boost::is_any_of(":"));
+    CHECK(fields.size() == 2 || fields.size() == 3)
+        << "Expected name:model.prototxt[:weights], got " << models[i];
+    server.AddModel(fields[0], fields[1], fields.size() == 3 ? fields[2] : "");
+    names.push_back(fields[0]);
+  }
+  server.Listen(FLAGS_socket);
+
+  if (FLAGS_load_clients > 0) {
+    for (int i = 0; i < names.size(); ++i) {
+      Load(server, names[i]);
+    }
+  } else {
+    int signal = 0;
+    sigwait(&signals, &signal);
+    LOG(INFO) << "Stopping on signal " << signal;
+  }
+  server.Stop();
+  return 0;
+}
@@ -0,0 +1,96 @@
+// Times PoolingLayer::Forward_cpu on the pooling layers of CaffeNet with and
+// without the stride 2 fast path, in both phases, and checks that the two
+// agree. Usage:
+//    pooling_benchmark [--num=10] [--iterations=20] [--threads=0]
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/pooling.hpp"
+#include "caffe/vision_layers.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Timer;
+using caffe::vector;
+
+DEFINE_int32(num, 10, "Batch size.");
+DEFINE_int32(iterations, 20, "Forward passes per configuration.");
+DEFINE_int32(threads, 0, "CPU threads; 0 for one per core.");
+
+struct PoolShape {
+  const char* name;
+  int channels;
+  int size;
+};
+
+// Times one pooling configuration; returns the milliseconds per Forward.
+double TimeForward(caffe::PoolingLayer<float>* layer,
+    const vector<Blob<float>*>& bottom, const vector<Blob<float>*>& top) {
+  layer->Forward(bottom, top);
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    layer->Forward(bottom, top);
+  }
+  return timer.MilliSeconds() / FLAGS_iterations;
+}
+
+int main(int argc, char** argv) {
+  // Print output to stderr (while still logging).
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Times the pooling fast path on CaffeNet shapes.");
+  caffe::GlobalInit(&argc, &argv);
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_num_threads(FLAGS_threads);
+
+  // pool1, pool2 and pool5 of CaffeNet: 3x3 max pooling with stride 2.
+  const PoolShape shapes[] = {
+    { "pool1", 96, 55 }, { "pool2", 256, 27 }, { "pool5", 256, 13 }
+  };
+  const caffe::Phase phases[] = { caffe::TRAIN, caffe::TEST };
+  for (int s = 0; s < 3; ++s) {
+    Blob<float> bottom(FLAGS_num, shapes[s].channels, shapes[s].size,
+        shapes[s].size);
+    caffe::FillerParameter filler_param;
+    caffe::GaussianFiller<float> filler(filler_param);
+    filler.Fill(&bottom);
+    Blob<float> generic_top;
+    Blob<float> fast_top;
+    vector<Blob<float>*> bottom_vec(1, &bottom);
+    vector<Blob<float>*> generic_vec(1, &generic_top);
+    vector<Blob<float>*> fast_vec(1, &fast_top);
+    for (int p = 0; p < 2; ++p) {
+      caffe::LayerParameter layer_param;
+      layer_param.set_phase(phases[p]);
+      caffe::PoolingParameter* pooling_param =
+          layer_param.mutable_pooling_param();
+      pooling_param->set_pool(caffe::PoolingParameter_PoolMethod_MAX);
+      pooling_param->set_kernel_size(3);
+      pooling_param->set_stride(2);
+      caffe::PoolingLayer<float> layer(layer_param);
+      layer.SetUp(bottom_vec, generic_vec);
+      fast_top.ReshapeLike(generic_top);
+      caffe::set_pool_fast_path(false);
+      const double generic_ms = TimeForward(&layer, bottom_vec, generic_vec);
+      caffe::set_pool_fast_path(true);
+      const double fast_ms = TimeForward(&layer, bottom_vec, fast_vec);
+      float max_diff = 0;
+      for (int i = 0; i < fast_top.count(); ++i) {
+        max_diff = std::max(max_diff,
+            std::fabs(fast_top.cpu_data()[i] - generic_top.cpu_data()[i]));
+      }
+      LOG(INFO) << shapes[s].name << " " << FLAGS_num << "x"
+          << shapes[s].channels << "x" << shapes[s].size << "x"
+          << shapes[s].size << (p == 0 ? " TRAIN" : " TEST ")
+          << "\tgeneric: " << generic_ms << " ms"
+          << "\tfast: " << fast_ms << " ms"
+          << "\tspeedup: " << generic_ms / fast_ms
+          << "\tmax diff: " << max_diff;
+    }
+  }
+  return 0;
+}
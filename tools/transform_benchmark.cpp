@@ -0,0 +1,85 @@
+// Times DataTransformer on 227x227x3 random crops, with mirroring and mean
+// subtraction, of 256x256 images stored as a Datum and as a cv::Mat, with
+// and without the vectorized row kernels. Usage:
+//    transform_benchmark [--iterations=2000] [--mean_file=]
+#include <glog/logging.h>
+#include <opencv2/core/core.hpp>
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/transform.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Datum;
+using caffe::Timer;
+
+DEFINE_int32(iterations, 2000, "Images transformed per configuration.");
+DEFINE_string(mean_file, "",
+    "A 3x256x256 mean image to subtract instead of the mean values.");
+
+const int kSize = 256;
+const int kCropSize = 227;
+const int kChannels = 3;
+
+// Returns the images transformed per second.
+template <typename Image>
+double TimeTransform(caffe::DataTransformer<float>* transformer,
+    const Image& image, Blob<float>* blob) {
+  transformer->Transform(image, blob);
+  Timer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    transformer->Transform(image, blob);
+  }
+  return FLAGS_iterations / (timer.MilliSeconds() / 1000);
+}
+
+int main(int argc, char** argv) {
+  // Print output to stderr (while still logging).
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Times DataTransformer on ImageNet sized crops.");
+  caffe::GlobalInit(&argc, &argv);
+  Caffe::set_mode(Caffe::CPU);
+
+  Datum datum;
+  datum.set_channels(kChannels);
+  datum.set_height(kSize);
+  datum.set_width(kSize);
+  cv::Mat cv_img(kSize, kSize, CV_8UC3);
+  for (int c = 0; c < kChannels; ++c) {
+    for (int h = 0; h < kSize; ++h) {
+      for (int w = 0; w < kSize; ++w) {
+        const uint8_t pixel = caffe::caffe_rng_rand() % 256;
+        datum.mutable_data()->push_back(static_cast<char>(pixel));
+        cv_img.at<cv::Vec3b>(h, w)[c] = pixel;
+      }
+    }
+  }
+
+  caffe::TransformationParameter transform_param;
+  transform_param.set_crop_size(kCropSize);
+  transform_param.set_mirror(true);
+  if (FLAGS_mean_file.empty()) {
+    transform_param.add_mean_value(104);
+    transform_param.add_mean_value(117);
+    transform_param.add_mean_value(123);
+  } else {
+    transform_param.set_mean_file(FLAGS_mean_file);
+  }
+  caffe::DataTransformer<float> transformer(transform_param, caffe::TRAIN);
+  transformer.InitRand();
+  Blob<float> blob(1, kChannels, kCropSize, kCropSize);
+
+  for (int simd = 0; simd < 2; ++simd) {
+    caffe::set_transform_simd(simd);
+    const double datum_rate = TimeTransform(&transformer, datum, &blob);
+    const double mat_rate = TimeTransform(&transformer, cv_img, &blob);
+    LOG(INFO) << (simd ? "vectorized" : "scalar    ")
+        << "\tDatum: " << datum_rate << " images/s"
+        << "\tcv::Mat: " << mat_rate << " images/s";
+  }
+  return 0;
+}
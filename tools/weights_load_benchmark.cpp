@@ -0,0 +1,133 @@
+// Times loading trained weights into a net from a .caffemodel and from the
+// same weights converted to the mapped format, each in a fresh process, and
+// the peak memory each load adds. Without --model and --weights, a net of
+// --layers 4096x4096 inner products is generated, with its weights written
+// to both formats under --dir. Usage:
+//    weights_load_benchmark [--model=deploy.prototxt --weights=x.caffemodel]
+//        [--layers=4] [--dir=/tmp]
+#include <glog/logging.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "boost/lexical_cast.hpp"
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mapped_weights.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::Caffe;
+using caffe::Net;
+using caffe::Timer;
+using caffe::vector;
+
+DEFINE_string(model, "", "The model definition, in TEST phase.");
+DEFINE_string(weights, "", "The .caffemodel of the model.");
+DEFINE_int32(layers, 4, "The inner products of the generated net.");
+DEFINE_string(dir, "/tmp", "Where to write the weights of the generated net.");
+
+const int kWidth = 4096;
+
+caffe::NetParameter GeneratedNet() {
+  caffe::NetParameter param;
+  param.set_name("weights_load_benchmark");
+  param.add_input("data");
+  caffe::BlobShape* shape = param.add_input_shape();
+  shape->add_dim(1);
+  shape->add_dim(kWidth);
+  param.mutable_state()->set_phase(caffe::TEST);
+  std::string bottom = "data";
+  for (int i = 0; i < FLAGS_layers; ++i) {
+    caffe::LayerParameter* layer = param.add_layer();
+    layer->set_name("ip" + boost::lexical_cast<std::string>(i));
+    layer->set_type("InnerProduct");
+    layer->add_bottom(bottom);
+    layer->add_top(layer->name());
+    caffe::InnerProductParameter* ip = layer->mutable_inner_product_param();
+    ip->set_num_output(kWidth);
+    ip->mutable_weight_filler()->set_type("gaussian");
+    ip->mutable_bias_filler()->set_type("gaussian");
+    bottom = layer->name();
+  }
+  return param;
+}
+
+// The peak resident memory of this process, in MB.
+double MaxResidentMB() {
+  struct rusage usage;
+  CHECK_EQ(getrusage(RUSAGE_SELF, &usage), 0);
+  return usage.ru_maxrss / 1024.;
+}
+
+// Loads weights into a net of param in a child process, so that neither the
+// page tables nor the allocator of a previous load help it.
+void TimeLoad(const caffe::NetParameter& param, const std::string& weights,
+    const std::string& format) {
+  const pid_t pid = fork();
+  CHECK_GE(pid, 0) << "Cannot fork";
+  if (pid) {
+    int status = 0;
+    CHECK_EQ(waitpid(pid, &status, 0), pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0) << format
+        << " load failed";
+    return;
+  }
+  Net<float> net(param);
+  const double base_mb = MaxResidentMB();
+  Timer timer;
+  timer.Start();
+  net.CopyTrainedLayersFrom(weights);
+  const double load_ms = timer.MilliSeconds();
+  const double load_mb = MaxResidentMB() - base_mb;
+  // Mapped pages are only read when first used.
+  timer.Start();
+  float sum = 0;
+  for (int i = 0; i < net.params().size(); ++i) {
+    sum += net.params()[i]->asum_data();
+  }
+  const double read_ms = timer.MilliSeconds();
+  LOG(INFO) << format << ":\tload " << load_ms << " ms\tfirst read "
+      << read_ms << " ms\tpeak memory added by the load " << load_mb
+      << " MB\t(checksum " << sum << ")";
+  _exit(0);
+}
+
+int main(int argc, char** argv) {
+  // Print output to stderr (while still logging).
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Times loading .caffemodel and mapped weights.");
+  caffe::GlobalInit(&argc, &argv);
+  Caffe::set_mode(Caffe::CPU);
+
+  caffe::NetParameter param;
+  std::string caffemodel = FLAGS_weights;
+  if (FLAGS_model.size()) {
+    CHECK(FLAGS_weights.size()) << "Give the weights of --model.";
+    caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+    param.mutable_state()->set_phase(caffe::TEST);
+  } else {
+    param = GeneratedNet();
+    caffemodel = FLAGS_dir + "/weights_load_benchmark.caffemodel";
+    caffe::NetParameter trained;
+    Net<float>(param).ToProto(&trained);
+    caffe::WriteProtoToBinaryFile(trained, caffemodel);
+  }
+  const std::string mapped = FLAGS_dir + "/weights_load_benchmark.caffeweights";
+  {
+    caffe::NetParameter trained;
+    caffe::ReadNetParamsFromBinaryFileOrDie(caffemodel, &trained);
+    caffe::MappedWeights::Write(trained, mapped);
+  }
+
+  TimeLoad(param, caffemodel, ".caffemodel");
+  TimeLoad(param, mapped, "mapped     ");
+  if (FLAGS_model.empty()) {
+    unlink(caffemodel.c_str());
+  }
+  unlink(mapped.c_str());
+  return 0;
+}